@@ -0,0 +1,769 @@
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pre_computed.hpp"
+#include "dct.hpp"
+#include "huffman.hpp"
+#include "bit_writer.hpp"
+#include "shared.hpp"
+#include "rle.hpp"
+#include "plane.hpp"
+#include "color.hpp"
+#include "thread_pool.hpp"
+#include "jpeg.hpp"
+#include "jpeg_encoder.hpp"
+#include "jpeg_decoder.hpp"
+#include "rans.hpp"
+#include "row_reader.hpp"
+#include "metrics.hpp"
+
+//
+// Micro-benchmarks of the stages of the JPEG pipeline.
+//
+// Every benchmark makes one pass of a stage over a whole image - the luma blocks
+// of its padded Y plane, or all of its pixels for colour conversion and whole
+// encodes - on a single thread. Passes are warmed up, then timed a number of
+// times, and reported as time per 8x8 block (median, mean, standard deviation
+// and minimum over the repetitions) and throughput of the stage's input, in MB/s
+// of 8-bit samples.
+//
+// Images are synthetic (a smooth one, like a photo, and one of uniform noise, the
+// worst case for entropy coding) plus any image files given. Results print as a
+// table, or as JSON lines (one object per result) to track regressions.
+//
+
+#define BENCH_QUALITY 75
+
+struct BenchArgs {
+    std::vector<std::string> imagePaths;
+    int width = 1024;
+    int height = 1024;
+    int warmup = 2;
+    int reps = 10;
+    // only run benchmarks whose "stage/variant" name contains this
+    std::string filter;
+    bool json = false;
+};
+
+//
+// An image, along with the inputs of every stage, prepared once up front
+//
+struct BenchImage {
+    std::string name;
+    cv::Mat bgr;
+    int blocksWide, blocksHigh;
+
+    // Y, Cr, Cb planes (padded to whole blocks)
+    Plane<uchar> planes[3];
+
+    // per luma block (64 values each, row-major): level-shifted samples, their
+    // float and islow DCTs, and quantised coefficients in zig-zag order
+    std::vector<float> samples;
+    std::vector<int32_t> intSamples;
+    std::vector<float> coefs;
+    std::vector<int32_t> intCoefs;
+    std::vector<int16_t> zigZag;
+    std::vector<int> lasts;
+
+    // the quantised blocks' run/size symbols, as HuffmanEncoder::encode takes them,
+    // and tagged with their contexts (as luma blocks), as Rans::encode takes them
+    std::vector<int> symbols;
+    std::vector<uint16_t> ransSymbols;
+
+    // the Y plane reconstructed from the quantised coefficients
+    Plane<uchar> reconstruction;
+
+    int numBlocks() const {
+        return blocksWide * blocksHigh;
+    }
+};
+
+//
+// One benchmark: a pass over an image, returning a checksum so that its work
+// cannot be optimised away
+//
+struct Benchmark {
+    std::string stage;
+    std::string variant;
+    // number of blocks and bytes of input a pass processes
+    double blocks;
+    double bytes;
+    std::function<uint64_t()> pass;
+};
+
+struct BenchResult {
+    std::string image;
+    std::string stage;
+    std::string variant;
+    double blocks;
+    double medianNs, meanNs, stddevNs, minNs;
+    double mbPerSecond;
+};
+
+// checksums land here, so no pass is dead code
+static volatile uint64_t checksumSink;
+
+std::string usage() {
+    std::ostringstream oss;
+    oss << "Usage: jpeg_bench [image_file_path ...] [--size=WxH] [--warmup=N] [--reps=N] [--filter=NAME] [--json]" << "\n\n";
+    oss << "Note - --size sets the size of the synthetic images (default 1024x1024)" << "\n";
+    oss << "     - --warmup/--reps set the untimed and timed passes of each benchmark (default 2/10)" << "\n";
+    oss << "     - --filter runs only benchmarks whose stage/variant name contains NAME (e.g. dct/)" << "\n";
+    oss << "     - --json prints one JSON object per result, instead of a table" << "\n";
+    return oss.str();
+}
+
+BenchArgs parseBenchArgs(int argc, char* argv[]) {
+    BenchArgs args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--size=", 0) == 0) {
+            if (!parseImageSize(arg.substr(7), args.width, args.height)) {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg.rfind("--warmup=", 0) == 0) {
+            args.warmup = std::stoi(arg.substr(9));
+            if (args.warmup < 0) {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg.rfind("--reps=", 0) == 0) {
+            args.reps = std::stoi(arg.substr(7));
+            if (args.reps < 1) {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg.rfind("--filter=", 0) == 0) {
+            args.filter = arg.substr(9);
+        } else if (arg == "--json") {
+            args.json = true;
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cout << usage();
+            std::exit(1);
+        } else {
+            args.imagePaths.push_back(arg);
+        }
+    }
+    return args;
+}
+
+//
+// Synthetic BGR images: smooth gradients and blobs with a little noise, or
+// uniform noise
+//
+cv::Mat syntheticImage(int width, int height, bool noise) {
+    cv::Mat image(height, width, CV_8UC3);
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> full(0, 255), small(-4, 4);
+    for (int y = 0; y < height; y++) {
+        uchar *row = image.ptr<uchar>(y);
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) {
+                int v;
+                if (noise) {
+                    v = full(rng);
+                } else {
+                    double fx = static_cast<double>(x) / width, fy = static_cast<double>(y) / height;
+                    v = static_cast<int>(128 + 60 * std::sin(6.0 * fx + 2.0 * c) * std::cos(4.0 * fy - c)
+                                         + 40 * (fx - fy)) + small(rng);
+                }
+                row[x * 3 + c] = static_cast<uchar>(MathUtils::clamp(v, 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+//
+// Collects run/size symbols into a vector, as the old symbolize-then-code
+// pipeline did
+//
+struct SymbolCollector {
+    std::vector<int> &symbols;
+
+    inline void put(const void*, int symbol, int, int) {
+        symbols.push_back(symbol);
+    }
+};
+
+//
+// Counts symbols, i.e. does the least a sink can
+//
+struct SymbolTally {
+    uint64_t count;
+
+    inline void put(const void*, int symbol, int, int) {
+        count += symbol + 1;
+    }
+};
+
+//
+// Writes Huffman codes and magnitude bits, as the encoder does
+//
+struct CodeWriter {
+    BitWriter &writer;
+
+    inline void put(const HuffmanTable *table, int symbol, int coef, int size) {
+        writer.writeBits((static_cast<uint32_t>(table->codes[symbol]) << size) | Rle::magnitudeBits(coef, size),
+                         table->lengths[symbol] + size);
+    }
+};
+
+//
+// Collects run/size symbols tagged with their rANS contexts, as the encoder does
+// for luma blocks
+//
+struct ContextCollector {
+    std::vector<uint16_t> &symbols;
+    int k;
+
+    inline void put(const void *table, int symbol, int, int) {
+        int context;
+        if (table) {
+            context = Rans::acContext(0, k);
+            k += symbol == Rle::SYMBOL_EOB ? BLOCK_SIZE*BLOCK_SIZE : (symbol >> 4) + 1;
+        } else {
+            context = Rans::dcContext(0);
+            k = 1;
+        }
+        symbols.push_back(static_cast<uint16_t>((context << 8) | symbol));
+    }
+};
+
+//
+// Prepares the inputs of every stage for the given image
+//
+void prepareImage(BenchImage &image, JpegElements &jpegElements, ThreadPool &pool) {
+    int paddedWidth = (image.bgr.cols + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    int paddedHeight = (image.bgr.rows + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    Color::bgrToYcbcrPlanes(image.bgr, image.planes, paddedWidth, paddedHeight, pool);
+    image.blocksWide = paddedWidth / BLOCK_SIZE;
+    image.blocksHigh = paddedHeight / BLOCK_SIZE;
+
+    int n = image.numBlocks();
+    image.samples.resize(n * 64);
+    image.intSamples.resize(n * 64);
+    image.coefs.resize(n * 64);
+    image.intCoefs.resize(n * 64);
+    image.zigZag.resize(n * 64);
+    image.lasts.resize(n);
+
+    const QuantTable &table = jpegElements.getQualityTables(BENCH_QUALITY)[0];
+    for (int by = 0; by < image.blocksHigh; by++) {
+        for (int bx = 0; bx < image.blocksWide; bx++) {
+            int b = by * image.blocksWide + bx;
+            for (int r = 0; r < BLOCK_SIZE; r++) {
+                const uchar *row = image.planes[0].row(by * BLOCK_SIZE + r) + bx * BLOCK_SIZE;
+                for (int c = 0; c < BLOCK_SIZE; c++) {
+                    image.samples[b * 64 + r * BLOCK_SIZE + c] = row[c] - 128.0f;
+                    image.intSamples[b * 64 + r * BLOCK_SIZE + c] = row[c] - 128;
+                }
+            }
+            Dct::forwardDct(&image.samples[b * 64], &image.coefs[b * 64], jpegElements);
+            Dct::forwardDctIslow(&image.intSamples[b * 64], &image.intCoefs[b * 64]);
+            image.lasts[b] = quantiseZigZag(&image.coefs[b * 64], table, jpegElements.zig_zag_order,
+                                            &image.zigZag[b * 64]);
+        }
+    }
+
+    image.reconstruction.create(paddedWidth, paddedHeight);
+    int32_t multipliers[64];
+    uint16_t values[64];
+    for (int k = 0; k < 64; k++) {
+        values[jpegElements.zig_zag_order[k]] = table.values[k];
+    }
+    jpegElements.computeIdctMultipliers(DCT_FLOAT, values, multipliers);
+    BlockScratch scratch;
+    for (int by = 0; by < image.blocksHigh; by++) {
+        for (int bx = 0; bx < image.blocksWide; bx++) {
+            jpegBlockInverse(&image.zigZag[(by * image.blocksWide + bx) * 64], multipliers,
+                             image.reconstruction.row(by * BLOCK_SIZE) + bx * BLOCK_SIZE,
+                             image.reconstruction.stride, DCT_FLOAT, jpegElements, scratch);
+        }
+    }
+
+    SymbolCollector collector{image.symbols};
+    int prevDc = 0;
+    for (int b = 0; b < n; b++) {
+        Rle::runSizeEncode(&image.zigZag[b * 64], image.lasts[b], prevDc, collector,
+                           static_cast<const void*>(nullptr), static_cast<const void*>(nullptr));
+    }
+
+    // (the collector tells AC symbols by their non-null table)
+    ContextCollector contextCollector{image.ransSymbols, 0};
+    prevDc = 0;
+    for (int b = 0; b < n; b++) {
+        Rle::runSizeEncode(&image.zigZag[b * 64], image.lasts[b], prevDc, contextCollector,
+                           static_cast<const void*>(nullptr), static_cast<const void*>(&contextCollector));
+    }
+}
+
+//
+// Adds the benchmarks of every stage (and its variants) for the given image
+//
+void addBenchmarks(std::vector<Benchmark> &benchmarks, BenchImage &image, JpegElements &jpegElements,
+                   ThreadPool &pool, HuffmanTable *dcTables, HuffmanTable *acTables) {
+    BenchImage *img = &image;
+    JpegElements *elements = &jpegElements;
+    ThreadPool *threads = &pool;
+    double blocks = image.numBlocks();
+    double pixelBlocks = static_cast<double>(image.bgr.total()) / 64;
+    double pixelBytes = static_cast<double>(image.bgr.total()) * 3;
+    const QuantTable *table = &jpegElements.getQualityTables(BENCH_QUALITY)[0];
+
+    // colour conversion
+    benchmarks.push_back({"color", "bgrToYcbcr", pixelBlocks, pixelBytes, [=]() {
+        cv::Mat ycbcr = bgrToYcbcr(img->bgr);
+        return static_cast<uint64_t>(ycbcr.ptr<uchar>(0)[0]);
+    }});
+    for (int level = CpuUtils::SIMD_SCALAR; level <= CpuUtils::SIMD_AVX2; level++) {
+        CpuUtils::SimdLevel simd = static_cast<CpuUtils::SimdLevel>(level);
+        if (simd == CpuUtils::SIMD_SSE2 || simd > CpuUtils::detectSimdLevel()) {
+            continue; // colour kernels below AVX2 are scalar
+        }
+        benchmarks.push_back({"color", "planes-" + CpuUtils::simdLevelName(simd), pixelBlocks, pixelBytes, [=]() {
+            CpuUtils::SimdLevel previous = CpuUtils::getSimdLevel();
+            CpuUtils::setSimdLevel(simd);
+            Plane<uchar> planes[3];
+            Color::bgrToYcbcrPlanes(img->bgr, planes, img->planes[0].width, img->planes[0].height, *threads);
+            CpuUtils::setSimdLevel(previous);
+            return static_cast<uint64_t>(planes[0].row(0)[0]);
+        }});
+    }
+
+    // forward DCT
+    benchmarks.push_back({"dct", "dctBlock", blocks, blocks * 64, [=]() {
+        cv::Mat in(BLOCK_SIZE, BLOCK_SIZE, CV_32F), out(BLOCK_SIZE, BLOCK_SIZE, CV_32F);
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            for (int r = 0; r < BLOCK_SIZE; r++) {
+                std::copy(&img->samples[b * 64 + r * BLOCK_SIZE], &img->samples[b * 64 + (r + 1) * BLOCK_SIZE],
+                          in.ptr<float>(r));
+            }
+            dctBlock(out, in, *elements);
+            sum += static_cast<uint64_t>(out.ptr<float>(0)[0]);
+        }
+        return sum;
+    }});
+    struct FloatKernel {
+        const char *name;
+        CpuUtils::SimdLevel level;
+        Dct::DctKernel forward, inverse;
+    };
+    std::vector<FloatKernel> kernels = {
+        {"float-scalar", CpuUtils::SIMD_SCALAR, Dct::forwardDctScalar, Dct::inverseDctScalar},
+#if defined(__x86_64__)
+        {"float-sse2", CpuUtils::SIMD_SSE2, Dct::forwardDctSse2, Dct::inverseDctSse2},
+        {"float-avx2", CpuUtils::SIMD_AVX2, Dct::forwardDctAvx2, Dct::inverseDctAvx2},
+#endif
+    };
+    for (const FloatKernel &kernel : kernels) {
+        if (kernel.level > CpuUtils::detectSimdLevel()) {
+            continue;
+        }
+        Dct::DctKernel forward = kernel.forward;
+        benchmarks.push_back({"dct", kernel.name, blocks, blocks * 64, [=]() {
+            alignas(PLANE_ALIGNMENT) float out[64];
+            uint64_t sum = 0;
+            for (int b = 0; b < img->numBlocks(); b++) {
+                forward(&img->samples[b * 64], out, *elements);
+                sum += static_cast<uint64_t>(out[0]);
+            }
+            return sum;
+        }});
+    }
+    benchmarks.push_back({"dct", "islow", blocks, blocks * 64, [=]() {
+        int32_t out[64];
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            Dct::forwardDctIslow(&img->intSamples[b * 64], out);
+            sum += out[0];
+        }
+        return sum;
+    }});
+    benchmarks.push_back({"dct", "ifast", blocks, blocks * 64, [=]() {
+        int32_t out[64];
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            Dct::forwardDctIfast(&img->intSamples[b * 64], out);
+            sum += out[0];
+        }
+        return sum;
+    }});
+
+    // inverse DCT
+    benchmarks.push_back({"idct", "inverseDctBlock", blocks, blocks * 64, [=]() {
+        cv::Mat in(BLOCK_SIZE, BLOCK_SIZE, CV_32F), out(BLOCK_SIZE, BLOCK_SIZE, CV_32F);
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            for (int r = 0; r < BLOCK_SIZE; r++) {
+                std::copy(&img->coefs[b * 64 + r * BLOCK_SIZE], &img->coefs[b * 64 + (r + 1) * BLOCK_SIZE],
+                          in.ptr<float>(r));
+            }
+            inverseDctBlock(out, in, *elements);
+            sum += static_cast<uint64_t>(out.ptr<float>(0)[0]);
+        }
+        return sum;
+    }});
+    for (const FloatKernel &kernel : kernels) {
+        if (kernel.level > CpuUtils::detectSimdLevel()) {
+            continue;
+        }
+        Dct::DctKernel inverse = kernel.inverse;
+        benchmarks.push_back({"idct", kernel.name, blocks, blocks * 64, [=]() {
+            alignas(PLANE_ALIGNMENT) float out[64];
+            uint64_t sum = 0;
+            for (int b = 0; b < img->numBlocks(); b++) {
+                inverse(&img->coefs[b * 64], out, *elements);
+                sum += static_cast<uint64_t>(out[0]);
+            }
+            return sum;
+        }});
+    }
+    benchmarks.push_back({"idct", "islow", blocks, blocks * 64, [=]() {
+        const int32_t *multipliers = elements->getIntIdctMultipliers(DCT_ISLOW);
+        int32_t in[64], out[64];
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            for (int k = 0; k < 64; k++) {
+                in[elements->zig_zag_order[k]] = img->zigZag[b * 64 + k];
+            }
+            Dct::inverseDctIslow(in, out, multipliers);
+            sum += out[0];
+        }
+        return sum;
+    }});
+
+    // quantisation (and zig-zag reordering, which the fused kernels fold in)
+    benchmarks.push_back({"quantise", "quantiseBlock", blocks, blocks * 64, [=]() {
+        float out[64];
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            quantiseBlock(out, &img->coefs[b * 64], &elements->QUANTISATION_MATRIX[3][0][0]);
+            sum += static_cast<uint64_t>(out[0]);
+        }
+        return sum;
+    }});
+    benchmarks.push_back({"quantise", "quantiseZigZag", blocks, blocks * 64, [=]() {
+        int16_t out[64];
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            sum += quantiseZigZag(&img->coefs[b * 64], *table, elements->zig_zag_order, out);
+        }
+        return sum;
+    }});
+    benchmarks.push_back({"quantise", "quantiseZigZagInt", blocks, blocks * 64, [=]() {
+        int16_t out[64];
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            sum += quantiseZigZagInt(&img->intCoefs[b * 64], *table, DCT_ISLOW, elements->zig_zag_order, out);
+        }
+        return sum;
+    }});
+    // as rate control quantises its cached (zig-zag ordered) coefficients - the
+    // order of the input does not change the work
+    benchmarks.push_back({"quantise", "quantiseReordered", blocks, blocks * 64, [=]() {
+        int16_t out[64];
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            sum += quantiseReordered(&img->coefs[b * 64], *table, out);
+        }
+        return sum;
+    }});
+    benchmarks.push_back({"quantise", "quantiseReorderedInt", blocks, blocks * 64, [=]() {
+        int16_t out[64];
+        uint64_t sum = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            sum += quantiseReorderedInt(&img->intCoefs[b * 64], *table, DCT_ISLOW, out);
+        }
+        return sum;
+    }});
+
+    // run/size symbolization, and Huffman coding
+    benchmarks.push_back({"rle", "runSizeEncode", blocks, blocks * 64, [=]() {
+        SymbolTally tally{0};
+        int prevDc = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            Rle::runSizeEncode(&img->zigZag[b * 64], img->lasts[b], prevDc, tally,
+                               static_cast<const void*>(nullptr), static_cast<const void*>(nullptr));
+        }
+        return tally.count;
+    }});
+    benchmarks.push_back({"huffman", "HuffmanEncoder::encode", blocks, static_cast<double>(image.symbols.size()), [=]() {
+        HuffmanEncoder encoder;
+        std::vector<uchar> coded = encoder.encode(img->symbols, false);
+        return static_cast<uint64_t>(coded.size());
+    }});
+    benchmarks.push_back({"huffman", "standard", blocks, blocks * 64, [=]() {
+        BitWriter writer;
+        CodeWriter sink{writer};
+        int prevDc = 0;
+        for (int b = 0; b < img->numBlocks(); b++) {
+            Rle::runSizeEncode(&img->zigZag[b * 64], img->lasts[b], prevDc, sink, &dcTables[0], &acTables[0]);
+        }
+        writer.alignToByte();
+        return static_cast<uint64_t>(writer.size());
+    }});
+
+    // rANS coding of the same symbols (as the luma blocks of a rANS file), without
+    // their magnitude bits: coding with per-image tables, and decoding, which
+    // follows each block's zig-zag position to pick the next symbol's context
+    {
+        std::vector<uint32_t> counts(RANS_CONTEXTS * RANS_SYMBOLS);
+        for (uint16_t symbol : image.ransSymbols) {
+            counts[symbol]++;
+        }
+        std::shared_ptr<std::vector<Rans::EncodeTable>> encodeTables(new std::vector<Rans::EncodeTable>(RANS_CONTEXTS));
+        std::shared_ptr<std::vector<Rans::DecodeTable>> decodeTables(new std::vector<Rans::DecodeTable>(RANS_CONTEXTS));
+        for (int context = 0; context < RANS_CONTEXTS; context++) {
+            Rans::FrequencyTable freqTable;
+            freqTable.build(&counts[context * RANS_SYMBOLS]);
+            (*encodeTables)[context].build(freqTable);
+            (*decodeTables)[context].build(freqTable);
+        }
+        std::shared_ptr<std::vector<uchar>> stream(new std::vector<uchar>());
+        Rans::encode(image.ransSymbols.data(), image.ransSymbols.size(), encodeTables->data(), *stream);
+
+        benchmarks.push_back({"rans", "encode", blocks, blocks * 64, [=]() {
+            std::vector<uchar> coded;
+            Rans::encode(img->ransSymbols.data(), img->ransSymbols.size(), encodeTables->data(), coded);
+            return static_cast<uint64_t>(coded.size());
+        }});
+        benchmarks.push_back({"rans", "decode", blocks, blocks * 64, [=]() {
+            const Rans::DecodeTable *tables = decodeTables->data();
+            Rans::Decoder decoder;
+            decoder.init(stream->data(), stream->size());
+            uint64_t sum = 0;
+            for (int b = 0; b < img->numBlocks(); b++) {
+                sum += decoder.decode(tables[Rans::dcContext(0)]);
+                // as JpegDecoder, band by band
+                int k = 1;
+                for (int band = 0; band < RANS_AC_BANDS; band++) {
+                    const Rans::DecodeTable &table = tables[Rans::acContext(0, k)];
+                    for (; k <= Rans::AC_BAND_ENDS[band]; k++) {
+                        int symbol = decoder.decode(table);
+                        if (symbol == Rle::SYMBOL_EOB) {
+                            k = BLOCK_SIZE*BLOCK_SIZE;
+                            break;
+                        }
+                        k += symbol >> 4;
+                        sum += symbol;
+                    }
+                }
+            }
+            return sum;
+        }});
+    }
+
+    // whole pipeline: per block, then per image
+    benchmarks.push_back({"block", "float", blocks, blocks * 64, [=]() {
+        BlockScratch scratch;
+        int16_t out[64];
+        uint64_t sum = 0;
+        for (int by = 0; by < img->blocksHigh; by++) {
+            for (int bx = 0; bx < img->blocksWide; bx++) {
+                const uchar *block = img->planes[0].row(by * BLOCK_SIZE) + bx * BLOCK_SIZE;
+                sum += jpegBlockForward(block, img->planes[0].stride, out, *table, DCT_FLOAT, *elements, scratch);
+            }
+        }
+        return sum;
+    }});
+    benchmarks.push_back({"block", "islow", blocks, blocks * 64, [=]() {
+        BlockScratch scratch;
+        int16_t out[64];
+        uint64_t sum = 0;
+        for (int by = 0; by < img->blocksHigh; by++) {
+            for (int bx = 0; bx < img->blocksWide; bx++) {
+                const uchar *block = img->planes[0].row(by * BLOCK_SIZE) + bx * BLOCK_SIZE;
+                sum += jpegBlockForward(block, img->planes[0].stride, out, *table, DCT_ISLOW, *elements, scratch);
+            }
+        }
+        return sum;
+    }});
+    // quality metrics of the luma plane, and of whole encodes
+    for (int level = CpuUtils::SIMD_SCALAR; level <= CpuUtils::SIMD_AVX2; level++) {
+        CpuUtils::SimdLevel simd = static_cast<CpuUtils::SimdLevel>(level);
+        if (simd == CpuUtils::SIMD_SSE2 || simd > CpuUtils::detectSimdLevel()) {
+            continue; // metrics kernels below AVX2 are scalar
+        }
+        benchmarks.push_back({"metrics", "mse-" + CpuUtils::simdLevelName(simd), blocks, blocks * 64, [=]() {
+            CpuUtils::SimdLevel previous = CpuUtils::getSimdLevel();
+            CpuUtils::setSimdLevel(simd);
+            const Plane<uchar> &a = img->planes[0], &b = img->reconstruction;
+            double mse = Metrics::meanSquaredError(a.row(0), a.stride, b.row(0), b.stride, a.width, a.height, *threads);
+            CpuUtils::setSimdLevel(previous);
+            return static_cast<uint64_t>(mse * 1000);
+        }});
+        benchmarks.push_back({"metrics", "ssim-" + CpuUtils::simdLevelName(simd), blocks, blocks * 64, [=]() {
+            CpuUtils::SimdLevel previous = CpuUtils::getSimdLevel();
+            CpuUtils::setSimdLevel(simd);
+            const Plane<uchar> &a = img->planes[0], &b = img->reconstruction;
+            double ssim = Metrics::ssim(a.row(0), a.stride, b.row(0), b.stride, a.width, a.height, *threads);
+            CpuUtils::setSimdLevel(previous);
+            return static_cast<uint64_t>(ssim * 1e6);
+        }});
+    }
+    {
+        EncoderOptions options;
+        options.quality = BENCH_QUALITY;
+        options.subsampling = SUBSAMPLING_420;
+        std::shared_ptr<JpegEncoder> encoder(new JpegEncoder(options));
+        std::ostringstream out;
+        size_t bytes = encoder->encode(img->bgr, out);
+        benchmarks.push_back({"metrics", "measure-420", pixelBlocks, pixelBytes, [=]() {
+            return static_cast<uint64_t>(encoder->measure(img->bgr, false, bytes).psnr * 1000);
+        }});
+    }
+
+    for (Subsampling subsampling : {SUBSAMPLING_444, SUBSAMPLING_420}) {
+        EncoderOptions options;
+        options.quality = BENCH_QUALITY;
+        options.subsampling = subsampling;
+        std::shared_ptr<JpegEncoder> encoder(new JpegEncoder(options));
+        benchmarks.push_back({"encode", Sampling::subsamplingName(subsampling), pixelBlocks, pixelBytes, [=]() {
+            std::ostringstream out;
+            return static_cast<uint64_t>(encoder->encode(img->bgr, out));
+        }});
+    }
+
+    // entropy coders, on whole 4:2:0 encodes and decodes: optimized Huffman tables
+    // against rANS
+    for (EntropyCoder entropy : {ENTROPY_HUFFMAN, ENTROPY_RANS}) {
+        EncoderOptions options;
+        options.quality = BENCH_QUALITY;
+        options.subsampling = SUBSAMPLING_420;
+        options.huffman = HUFFMAN_OPTIMIZED;
+        options.entropy = entropy;
+        std::string name = entropy == ENTROPY_RANS ? "rans-420" : "optimized-420";
+        std::shared_ptr<JpegEncoder> encoder(new JpegEncoder(options));
+        benchmarks.push_back({"encode", name, pixelBlocks, pixelBytes, [=]() {
+            std::ostringstream out;
+            return static_cast<uint64_t>(encoder->encode(img->bgr, out));
+        }});
+
+        std::ostringstream out;
+        encoder->encode(img->bgr, out);
+        std::shared_ptr<std::string> file(new std::string(out.str()));
+        std::shared_ptr<JpegDecoder> decoder(new JpegDecoder(DecoderOptions()));
+        benchmarks.push_back({"decode", name, pixelBlocks, pixelBytes, [=]() {
+            cv::Mat decoded;
+            decoder->decode(reinterpret_cast<const uchar*>(file->data()), file->size(), decoded);
+            return static_cast<uint64_t>(decoded.total());
+        }});
+    }
+}
+
+//
+// Runs the given benchmark: `warmup` untimed passes, then `reps` timed ones
+//
+BenchResult runBenchmark(const Benchmark &benchmark, const std::string &imageName, int warmup, int reps) {
+    uint64_t checksum = 0;
+    for (int i = 0; i < warmup; i++) {
+        checksum += benchmark.pass();
+    }
+
+    std::vector<double> nsPerBlock;
+    for (int i = 0; i < reps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        checksum += benchmark.pass();
+        auto end = std::chrono::steady_clock::now();
+        nsPerBlock.push_back(std::chrono::duration<double, std::nano>(end - start).count() / benchmark.blocks);
+    }
+    checksumSink = checksum;
+
+    BenchResult result;
+    result.image = imageName;
+    result.stage = benchmark.stage;
+    result.variant = benchmark.variant;
+    result.blocks = benchmark.blocks;
+
+    std::sort(nsPerBlock.begin(), nsPerBlock.end());
+    size_t mid = nsPerBlock.size() / 2;
+    result.medianNs = nsPerBlock.size() % 2 ? nsPerBlock[mid] : (nsPerBlock[mid - 1] + nsPerBlock[mid]) / 2;
+    result.minNs = nsPerBlock.front();
+    double sum = 0, sumSquares = 0;
+    for (double ns : nsPerBlock) {
+        sum += ns;
+        sumSquares += ns * ns;
+    }
+    result.meanNs = sum / reps;
+    result.stddevNs = std::sqrt(std::max(0.0, sumSquares / reps - result.meanNs * result.meanNs));
+
+    double seconds = result.medianNs * benchmark.blocks / 1e9;
+    result.mbPerSecond = benchmark.bytes / 1e6 / seconds;
+    return result;
+}
+
+void printResult(const BenchResult &result, bool json) {
+    if (json) {
+        std::cout << std::fixed << std::setprecision(3)
+                  << "{\"image\":\"" << result.image << "\",\"stage\":\"" << result.stage
+                  << "\",\"variant\":\"" << result.variant << "\",\"blocks\":" << static_cast<long>(result.blocks)
+                  << ",\"median_ns_per_block\":" << result.medianNs << ",\"mean_ns_per_block\":" << result.meanNs
+                  << ",\"stddev_ns_per_block\":" << result.stddevNs << ",\"min_ns_per_block\":" << result.minNs
+                  << ",\"mb_per_s\":" << result.mbPerSecond << "}" << "\n";
+        return;
+    }
+    std::cout << std::fixed << std::setprecision(2) << std::left
+              << std::setw(10) << result.stage << std::setw(24) << result.variant << std::right
+              << std::setw(12) << result.medianNs << " ns/block"
+              << std::setw(8) << (result.meanNs > 0 ? 100 * result.stddevNs / result.meanNs : 0) << "% sd"
+              << std::setw(12) << result.minNs << " min"
+              << std::setw(12) << result.mbPerSecond << " MB/s" << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    BenchArgs args = parseBenchArgs(argc, argv);
+    JpegElements jpegElements;
+    ThreadPool pool(1);
+    HuffmanTable dcTables[2], acTables[2];
+    dcTables[0].build(jpegElements.STD_DC_LUMINANCE_BITS, jpegElements.STD_DC_LUMINANCE_VALS);
+    acTables[0].build(jpegElements.STD_AC_LUMINANCE_BITS, jpegElements.STD_AC_LUMINANCE_VALS);
+
+    std::vector<BenchImage> images(2 + args.imagePaths.size());
+    images[0].name = "synthetic-smooth";
+    images[0].bgr = syntheticImage(args.width, args.height, false);
+    images[1].name = "synthetic-noise";
+    images[1].bgr = syntheticImage(args.width, args.height, true);
+    for (size_t i = 0; i < args.imagePaths.size(); i++) {
+        images[2 + i].name = args.imagePaths[i];
+        images[2 + i].bgr = CvImageUtils::loadImage(args.imagePaths[i]);
+        if (images[2 + i].bgr.empty()) {
+            return 1;
+        }
+    }
+
+    if (!args.json) {
+        std::cout << "simd: " << CpuUtils::simdLevelName(CpuUtils::detectSimdLevel())
+                  << ", warmup: " << args.warmup << ", reps: " << args.reps << "\n";
+    }
+    for (BenchImage &image : images) {
+        prepareImage(image, jpegElements, pool);
+        std::vector<Benchmark> benchmarks;
+        addBenchmarks(benchmarks, image, jpegElements, pool, dcTables, acTables);
+
+        if (!args.json) {
+            std::cout << "\n" << image.name << " (" << image.bgr.cols << "x" << image.bgr.rows << ", "
+                      << image.numBlocks() << " luma blocks)" << "\n";
+        }
+        for (const Benchmark &benchmark : benchmarks) {
+            if ((benchmark.stage + "/" + benchmark.variant).find(args.filter) == std::string::npos) {
+                continue;
+            }
+            printResult(runBenchmark(benchmark, image.name, args.warmup, args.reps), args.json);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "batch.hpp"
+#include "image_input.hpp"
+#include "profile.hpp"
+#include "thread_pool.hpp"
+
+namespace Batch {
+
+    //
+    // Returns true if the given path has the extension of an image format that
+    // ImageInput::load reads
+    //
+    static bool hasImageExtension(const std::string &path) {
+        static const char *extensions[] = {
+            "jpg", "jpeg", "png", "bmp", "ppm", "pgm", "pnm", "tif", "tiff", "webp", "raw", "bgr"
+        };
+        size_t dot = path.rfind('.');
+        if (dot == std::string::npos) {
+            return false;
+        }
+        std::string ext = path.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        for (const char *e : extensions) {
+            if (ext == e) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool isDirectory(const std::string &path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    //
+    // Collects the image files of the given source: either a directory (its files
+    // with image extensions, sorted by name) or a list file (one path per line,
+    // ignoring blank lines and lines starting with '#').
+    // Returns false if the source cannot be read.
+    //
+    bool collectInputs(const std::string &source, std::vector<std::string> &paths) {
+        if (isDirectory(source)) {
+            DIR *dir = opendir(source.c_str());
+            if (!dir) {
+                return false;
+            }
+            std::vector<std::string> names;
+            while (struct dirent *entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name[0] != '.' && hasImageExtension(name)) {
+                    names.push_back(name);
+                }
+            }
+            closedir(dir);
+
+            std::sort(names.begin(), names.end());
+            for (const std::string &name : names) {
+                std::string path = source + "/" + name;
+                if (!isDirectory(path)) {
+                    paths.push_back(path);
+                }
+            }
+            return true;
+        }
+
+        std::ifstream list(source);
+        if (!list) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() && line[0] != '#') {
+                paths.push_back(line);
+            }
+        }
+        return true;
+    }
+
+    //
+    // Returns the output path of the given input in `outDir`, i.e. the input's
+    // file name with the given extension
+    //
+    std::string outputPath(const std::string &inputPath, const std::string &outDir,
+                           const std::string &extension) {
+        size_t slash = inputPath.rfind('/');
+        std::string name = slash == std::string::npos ? inputPath : inputPath.substr(slash + 1);
+        size_t dot = name.rfind('.');
+        if (dot != std::string::npos && dot > 0) {
+            name = name.substr(0, dot);
+        }
+        return outDir + "/" + name + extension;
+    }
+
+    //
+    // Returns the mean of each metric over the measured images
+    //
+    QualityMetrics Summary::meanMetrics() const {
+        QualityMetrics mean;
+        for (const ImageMetrics &image : imageMetrics) {
+            mean.psnrR += image.metrics.psnrR;
+            mean.psnrG += image.metrics.psnrG;
+            mean.psnrB += image.metrics.psnrB;
+            mean.psnr += image.metrics.psnr;
+            mean.ssim += image.metrics.ssim;
+            mean.bitsPerPixel += image.metrics.bitsPerPixel;
+        }
+        if (!imageMetrics.empty()) {
+            double n = static_cast<double>(imageMetrics.size());
+            mean.psnrR /= n;
+            mean.psnrG /= n;
+            mean.psnrB /= n;
+            mean.psnr /= n;
+            mean.ssim /= n;
+            mean.bitsPerPixel /= n;
+        }
+        return mean;
+    }
+
+    //
+    // Encoders of the workers: each file borrows one for its duration, so there
+    // are never more encoders than workers
+    //
+    class EncoderPool {
+    private:
+        EncoderOptions options;
+        std::vector<std::unique_ptr<JpegEncoder>> encoders;
+        std::vector<JpegEncoder*> idle;
+        std::mutex mutex;
+
+    public:
+        explicit EncoderPool(const EncoderOptions &options) : options(options) {}
+
+        JpegEncoder *acquire() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (idle.empty()) {
+                encoders.emplace_back(new JpegEncoder(options));
+                return encoders.back().get();
+            }
+            JpegEncoder *encoder = idle.back();
+            idle.pop_back();
+            return encoder;
+        }
+
+        void release(JpegEncoder *encoder) {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(encoder);
+        }
+    };
+
+    //
+    // Encodes every image of `source` (see collectInputs) into `outDir` (created if
+    // missing) on `numWorkers` workers (0: one per hardware thread), and fills in
+    // the summary. If `rawFormat` has a size, inputs are raw pixels of that format.
+    // If `measure`, the quality of each image is measured by its worker (see
+    // JpegEncoder::measure).
+    //
+    // Files that fail are reported and counted, and the rest still encoded.
+    // Returns false if the batch cannot run at all: the source or output directory
+    // are unusable, or two inputs would share an output file.
+    //
+    bool encodeAll(const std::string &source, const std::string &outDir, const EncoderOptions &options,
+                   const PixelFormat &rawFormat, int numWorkers, bool measure, Summary &summary) {
+        std::vector<std::string> inputs;
+        if (!collectInputs(source, inputs)) {
+            std::cout << "Could not read batch source: " << source << "\n";
+            return false;
+        }
+        if (mkdir(outDir.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::cout << "Could not create output directory: " << outDir << "\n";
+            return false;
+        }
+
+        std::vector<std::string> outputs;
+        std::set<std::string> seen;
+        for (const std::string &input : inputs) {
+            outputs.push_back(outputPath(input, outDir, options.entropy == ENTROPY_RANS ? ".rans" : ".jpg"));
+            if (!seen.insert(outputs.back()).second) {
+                std::cout << "Inputs share an output file: " << outputs.back() << "\n";
+                return false;
+            }
+        }
+
+        // file-level parallelism only (see batch.hpp)
+        EncoderOptions encoderOptions = options;
+        encoderOptions.threads = 1;
+        EncoderPool encoders(encoderOptions);
+        ThreadPool pool(numWorkers);
+
+        std::vector<double> inputBytes(inputs.size(), 0), outputBytes(inputs.size(), 0);
+        std::vector<QualityMetrics> metrics(inputs.size());
+        std::vector<RateResult> rates(inputs.size());
+        std::vector<char> ok(inputs.size(), 0);
+        std::mutex logMutex;
+
+        auto start = std::chrono::steady_clock::now();
+        pool.parallelFor(static_cast<int>(inputs.size()), [&](int i) {
+            InputImage input;
+            {
+                Profile::ScopedTimer timer(Profile::STAGE_READ);
+                input = ImageInput::load(inputs[i], rawFormat);
+                uint64_t pixelBytes = input.pixels.total() * input.pixels.elemSize();
+                timer.setCounts(0, pixelBytes, pixelBytes);
+            }
+            if (input.empty()) {
+                return;
+            }
+
+            std::ofstream outFile(outputs[i], std::ios::binary);
+            if (!outFile) {
+                std::lock_guard<std::mutex> lock(logMutex);
+                std::cout << "Could not open output file: " << outputs[i] << "\n";
+                return;
+            }
+
+            JpegEncoder *encoder = encoders.acquire();
+            size_t bytes = encoder->encode(input.pixels, outFile, input.rgb);
+            if (bytes == 0) {
+                std::string error = encoder->error();
+                encoders.release(encoder);
+                outFile.close();
+                std::remove(outputs[i].c_str());
+                std::lock_guard<std::mutex> lock(logMutex);
+                std::cout << "Could not encode " << inputs[i] << ": " << error << "\n";
+                return;
+            }
+            if (measure) {
+                metrics[i] = encoder->measure(input.pixels, input.rgb, bytes);
+            }
+            rates[i] = encoder->rateResult();
+            encoders.release(encoder);
+            {
+                Profile::ScopedTimer timer(Profile::STAGE_WRITE);
+                timer.setCounts(0, bytes, bytes);
+                outFile.close();
+            }
+            if (!outFile) {
+                std::lock_guard<std::mutex> lock(logMutex);
+                std::cout << "Could not write output file: " << outputs[i] << "\n";
+                return;
+            }
+
+            inputBytes[i] = static_cast<double>(input.pixels.total()) * input.pixels.elemSize();
+            outputBytes[i] = static_cast<double>(bytes);
+            ok[i] = 1;
+        });
+        auto end = std::chrono::steady_clock::now();
+
+        summary = Summary();
+        summary.seconds = std::chrono::duration<double>(end - start).count();
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (ok[i]) {
+                summary.images++;
+                summary.inputBytes += inputBytes[i];
+                summary.outputBytes += outputBytes[i];
+                summary.qualitySum += rates[i].quality;
+                summary.targetsMissed += !rates[i].met;
+                if (measure) {
+                    ImageMetrics image;
+                    image.outputPath = outputs[i];
+                    image.metrics = metrics[i];
+                    summary.imageMetrics.push_back(image);
+                }
+            } else {
+                summary.failed++;
+            }
+        }
+        return true;
+    }
+}
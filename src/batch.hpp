@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "jpeg_encoder.hpp"
+#include "metrics.hpp"
+
+//
+// Headless batch encoding: many images, encoded concurrently at the file level,
+// without any GUI.
+//
+// Each worker of a pool takes the next file from a shared queue, and encodes it
+// with its own JpegEncoder (reused across files, so same-sized images do not
+// allocate). Blocks within a file are transformed on a single thread - with many
+// files, file-level parallelism keeps every worker busy without any
+// synchronisation inside an image.
+//
+namespace Batch {
+
+    //
+    // Quality of an encoded image
+    //
+    struct ImageMetrics {
+        std::string outputPath;
+        QualityMetrics metrics;
+    };
+
+    //
+    // Totals of a batch run
+    //
+    struct Summary {
+        int images = 0;
+        int failed = 0;
+        double inputBytes = 0;   // decoded (BGR) bytes of the encoded images
+        double outputBytes = 0;  // JPEG bytes written
+        double seconds = 0;      // wall time, including reading and writing files
+
+        // with a target size or PSNR, the sum of the chosen qualities, and the
+        // number of images no quality met the target of
+        double qualitySum = 0;
+        int targetsMissed = 0;
+
+        // quality of every encoded image, in input order, if measured
+        std::vector<ImageMetrics> imageMetrics;
+
+        //
+        // Returns the mean of each metric over the measured images
+        //
+        QualityMetrics meanMetrics() const;
+    };
+
+    //
+    // Collects the image files of the given source: either a directory (its files
+    // with image extensions, sorted by name) or a list file (one path per line,
+    // ignoring blank lines and lines starting with '#').
+    // Returns false if the source cannot be read.
+    //
+    bool collectInputs(const std::string &source, std::vector<std::string> &paths);
+
+    //
+    // Returns the output path of the given input in `outDir`, i.e. the input's
+    // file name with the given extension
+    //
+    std::string outputPath(const std::string &inputPath, const std::string &outDir,
+                           const std::string &extension = ".jpg");
+
+    //
+    // Encodes every image of `source` (see collectInputs) into `outDir` (created if
+    // missing) on `numWorkers` workers (0: one per hardware thread), and fills in
+    // the summary. If `rawFormat` has a size, inputs are raw pixels of that format.
+    // If `measure`, the quality of each image is measured by its worker (see
+    // JpegEncoder::measure).
+    //
+    // Files that fail are reported and counted, and the rest still encoded.
+    // Returns false if the batch cannot run at all: the source or output directory
+    // are unusable, or two inputs would share an output file.
+    //
+    bool encodeAll(const std::string &source, const std::string &outDir, const EncoderOptions &options,
+                   const PixelFormat &rawFormat, int numWorkers, bool measure, Summary &summary);
+}
@@ -0,0 +1,86 @@
+#include "bit_reader.hpp"
+
+BitReader::BitReader(const uchar *data, size_t size, size_t pos, bool stuffedBytes)
+    : data(data), size(size), pos(pos), stuffedBytes(stuffedBytes), bitBuffer(0), bitCount(0), markerCode(0) {}
+
+//
+// Tops up the bit buffer to at least 57 bits
+//
+void BitReader::fill() {
+    if (!stuffedBytes && size - pos >= 8) {
+        // as many whole bytes as fit, from a single big-endian 64-bit load
+        uint64_t word = 0;
+        for (int i = 0; i < 8; i++) {
+            word = (word << 8) | data[pos + i];
+        }
+        int bytes = (64 - bitCount) / 8;
+        bitBuffer |= (word >> bitCount) & (~0ull << (64 - bitCount - 8 * bytes));
+        bitCount += 8 * bytes;
+        pos += bytes;
+        return;
+    }
+    while (bitCount <= 56) {
+        uint64_t byte = 0;
+        if (markerCode == 0 && pos >= size) {
+            markerCode = -1;
+        } else if (markerCode == 0) {
+            byte = data[pos];
+            if (byte != 0xFF || !stuffedBytes) {
+                pos++;
+            } else if (pos + 1 < size && data[pos + 1] == 0x00) {
+                pos += 2;
+            } else {
+                // a marker, possibly preceded by fill bytes (0xFF)
+                size_t p = pos + 1;
+                while (p < size && data[p] == 0xFF) {
+                    p++;
+                }
+                markerCode = p < size ? data[p] : -1;
+                byte = 0;
+            }
+        }
+        bitBuffer |= byte << (56 - bitCount);
+        bitCount += 8;
+    }
+}
+
+//
+// Consumes an RSTn marker (JPEG F.1.2.3), discarding the remaining bits of the
+// current byte. Returns false if the next marker is not the given restart marker.
+//
+bool BitReader::readRestartMarker(int n) {
+    bitBuffer = 0;
+    bitCount = 0;
+    if (markerCode == 0) {
+        fill(); // reaches the marker, unless there is more data before it
+    }
+    if (markerCode != 0xD0 + n) {
+        return false;
+    }
+
+    // skip the marker (and any fill bytes before it)
+    while (pos < size && data[pos] == 0xFF) {
+        pos++;
+    }
+    pos++;
+
+    bitBuffer = 0;
+    bitCount = 0;
+    markerCode = 0;
+    return true;
+}
+
+//
+// Code of the marker reached so far (0 if none, -1 at the end of the data)
+//
+int BitReader::marker() const {
+    return markerCode;
+}
+
+//
+// Position in the data just past the entropy-coded bytes read, i.e. at the
+// marker reached (or the end of the data)
+//
+size_t BitReader::position() const {
+    return pos;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <opencv2/opencv.hpp>
+
+//
+// Reader of the entropy-coded data of a JPEG scan, most significant bit first.
+//
+// Removes the zero bytes stuffed after 0xFF, and stops at the first marker: from
+// then on (or past the end of the data) it reads zero bits, and `marker` gives
+// the marker's code (-1 for the end of the data).
+//
+// Bits are held left-aligned in a 64-bit buffer, refilled a byte at a time only
+// when fewer bits remain than are asked for.
+//
+// Unstuffed bit streams (of the internal rANS format, see Rans) are read with
+// `stuffedBytes` false: every byte is data, up to the end.
+//
+class BitReader {
+private:
+    const uchar *data;
+    size_t size;
+    size_t pos;
+    bool stuffedBytes;
+
+    uint64_t bitBuffer;
+    int bitCount;
+
+    // code of the marker reached (0 if none, -1 at the end of the data)
+    int markerCode;
+
+    //
+    // Tops up the bit buffer to at least 57 bits
+    //
+    void fill();
+
+public:
+    BitReader(const uchar *data, size_t size, size_t pos, bool stuffedBytes = true);
+
+    //
+    // Returns the next `n` bits (n <= 32) without consuming them
+    //
+    inline uint32_t peekBits(int n) {
+        if (bitCount < n) {
+            fill();
+        }
+        return static_cast<uint32_t>(bitBuffer >> (64 - n));
+    }
+
+    //
+    // Consumes `n` bits, which must have been peeked
+    //
+    inline void skipBits(int n) {
+        bitBuffer <<= n;
+        bitCount -= n;
+    }
+
+    //
+    // Reads the next `n` bits (1 <= n <= 32)
+    //
+    inline uint32_t readBits(int n) {
+        uint32_t bits = peekBits(n);
+        skipBits(n);
+        return bits;
+    }
+
+    //
+    // Consumes an RSTn marker (JPEG F.1.2.3), discarding the remaining bits of the
+    // current byte. Returns false if the next marker is not the given restart marker.
+    //
+    bool readRestartMarker(int n);
+
+    //
+    // Code of the marker reached so far (0 if none, -1 at the end of the data)
+    //
+    int marker() const;
+
+    //
+    // Position in the data just past the entropy-coded bytes read, i.e. at the
+    // marker reached (or the end of the data)
+    //
+    size_t position() const;
+};
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cstring>
+
+#include "bit_writer.hpp"
+
+// pending output size at which it is handed to the stream
+#define BIT_WRITER_CHUNK_SIZE (64 * 1024)
+
+BitWriter::BitWriter(std::ostream *out, bool stuffBytes)
+    : out(out), stuffBytes(stuffBytes), buffer(BIT_WRITER_CHUNK_SIZE), pos(0),
+      accumulator(0), freeBits(64), bytesFlushed(0) {}
+
+//
+// Makes room for at least `n` more bytes in the buffer, handing pending output
+// to the stream (or growing the buffer, without a stream)
+//
+void BitWriter::reserve(size_t n) {
+    if (pos + n <= buffer.size()) {
+        return;
+    }
+    if (out) {
+        flush();
+    }
+    if (pos + n > buffer.size()) {
+        buffer.resize(std::max(2 * buffer.size(), pos + n));
+    }
+}
+
+//
+// Writes out the full accumulator
+//
+void BitWriter::writeAccumulator(uint64_t word) {
+    reserve(16);
+    uchar *dst = buffer.data() + pos;
+
+    // a byte of 0xFF is a zero byte of the complement
+    uint64_t inverted = ~word;
+    bool hasFF = ((inverted - 0x0101010101010101ull) & ~inverted & 0x8080808080808080ull) != 0;
+    if (!hasFF || !stuffBytes) {
+        uint64_t bigEndian = __builtin_bswap64(word);
+        memcpy(dst, &bigEndian, 8);
+        pos += 8;
+        return;
+    }
+
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        uchar byte = static_cast<uchar>(word >> shift);
+        *dst++ = byte;
+        if (byte == 0xFF) {
+            *dst++ = 0x00;
+        }
+    }
+    pos = dst - buffer.data();
+}
+
+//
+// Writes out any partial entropy-coded byte, padded with 1 bits (JPEG F.1.2.3)
+//
+void BitWriter::alignToByte() {
+    int pendingBits = 64 - freeBits;
+    if (pendingBits % 8) {
+        writeBits(0x7F, 8 - pendingBits % 8);
+        pendingBits = 64 - freeBits;
+    }
+
+    // write out the whole bytes left in the accumulator (a full one already was)
+    reserve(16);
+    for (int shift = pendingBits - 8; shift >= 0; shift -= 8) {
+        uchar byte = static_cast<uchar>(accumulator >> shift);
+        buffer[pos++] = byte;
+        if (byte == 0xFF && stuffBytes) {
+            buffer[pos++] = 0x00;
+        }
+    }
+    accumulator = 0;
+    freeBits = 64;
+}
+
+//
+// Writes a raw byte / big-endian 16-bit word (outside entropy-coded data)
+//
+void BitWriter::writeByte(uchar byte) {
+    reserve(1);
+    buffer[pos++] = byte;
+}
+
+void BitWriter::writeWord(uint16_t word) {
+    writeByte(static_cast<uchar>(word >> 8));
+    writeByte(static_cast<uchar>(word & 0xFF));
+}
+
+//
+// Appends the given bytes as they are. Any partial entropy-coded byte must have
+// been written out (see alignToByte).
+//
+void BitWriter::writeBytes(const uchar *bytes, size_t n) {
+    if (out && n >= buffer.size()) {
+        flush();
+        out->write(reinterpret_cast<const char*>(bytes), n);
+        bytesFlushed += n;
+        return;
+    }
+    reserve(n);
+    memcpy(buffer.data() + pos, bytes, n);
+    pos += n;
+}
+
+//
+// Writes a marker (0xFF followed by the given code), first padding any partial
+// entropy-coded byte
+//
+void BitWriter::writeMarker(uchar code) {
+    alignToByte();
+    writeByte(0xFF);
+    writeByte(code);
+}
+
+//
+// Hands all pending output to the stream (if any)
+//
+void BitWriter::flush() {
+    if (!out || pos == 0) {
+        return;
+    }
+    out->write(reinterpret_cast<const char*>(buffer.data()), pos);
+    bytesFlushed += pos;
+    pos = 0;
+}
+
+//
+// Total number of bytes written so far (excluding bits still in the accumulator)
+//
+size_t BitWriter::size() const {
+    return bytesFlushed + pos;
+}
+
+//
+// Output held in memory (`size` bytes when there is no stream)
+//
+const uchar *BitWriter::data() const {
+    return buffer.data();
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+//
+// Buffered writer of a JPEG byte stream: marker segments (raw bytes) and
+// entropy-coded data (bit strings, most significant bit first).
+//
+// Bits are collected in a 64-bit accumulator, and written out a whole word at a
+// time. Entropy-coded bytes of 0xFF are followed by a stuffed 0x00 (unless
+// stuffing is turned off), so they cannot be mistaken for markers; words without
+// any 0xFF byte (nearly all of them) are stored with a single 8-byte write.
+//
+// Output is collected in a memory buffer, and handed to the given stream (if any)
+// in large chunks, so memory use stays constant; without a stream, the whole
+// output stays in memory (see `data`).
+//
+class BitWriter {
+private:
+    std::ostream *out;
+    bool stuffBytes;
+
+    // output buffer, of which the first `pos` bytes are pending output
+    std::vector<uchar> buffer;
+    size_t pos;
+
+    // bits not yet written out, right-aligned, and the number of unused bits
+    uint64_t accumulator;
+    int freeBits;
+
+    // bytes handed to the stream so far
+    size_t bytesFlushed;
+
+    //
+    // Writes out the full accumulator
+    //
+    void writeAccumulator(uint64_t word);
+
+    //
+    // Makes room for at least `n` more bytes in the buffer, handing pending output
+    // to the stream (or growing the buffer, without a stream)
+    //
+    void reserve(size_t n);
+
+public:
+    //
+    // Writes to the given stream, or to memory if it is null. `stuffBytes` turns
+    // JPEG byte stuffing of entropy-coded data on or off.
+    //
+    explicit BitWriter(std::ostream *out = nullptr, bool stuffBytes = true);
+
+    //
+    // Writes the low `length` bits of `bits` (length <= 32) as entropy-coded data
+    //
+    inline void writeBits(uint32_t bits, int length) {
+        uint64_t value = bits & ((1ull << length) - 1);
+        if (length < freeBits) {
+            accumulator = (accumulator << length) | value;
+            freeBits -= length;
+            return;
+        }
+
+        // fill the accumulator, write it out, and keep the bits that did not fit
+        int spill = length - freeBits;
+        accumulator = (accumulator << freeBits) | (value >> spill);
+        writeAccumulator(accumulator);
+        accumulator = value;
+        freeBits = 64 - spill;
+    }
+
+    //
+    // Writes out any partial entropy-coded byte, padded with 1 bits (JPEG F.1.2.3)
+    //
+    void alignToByte();
+
+    //
+    // Writes a raw byte / big-endian 16-bit word (outside entropy-coded data)
+    //
+    void writeByte(uchar byte);
+    void writeWord(uint16_t word);
+
+    //
+    // Appends the given bytes as they are, e.g. entropy-coded data (already
+    // stuffed) of another writer. Any partial entropy-coded byte must have been
+    // written out.
+    //
+    void writeBytes(const uchar *bytes, size_t n);
+
+    //
+    // Writes a marker (0xFF followed by the given code), first padding any partial
+    // entropy-coded byte
+    //
+    void writeMarker(uchar code);
+
+    //
+    // Hands all pending output to the stream (if any)
+    //
+    void flush();
+
+    //
+    // Total number of bytes written so far (excluding bits still in the accumulator)
+    //
+    size_t size() const;
+
+    //
+    // Output held in memory (`size` bytes when there is no stream)
+    //
+    const uchar *data() const;
+};
@@ -0,0 +1,54 @@
+#include <algorithm>
+
+#include "coef_frame.hpp"
+
+const int CoefFrame::COMPONENT_PLANES[NUM_COMPONENTS] = {0, 2, 1};
+
+//
+// Number of quantisation and Huffman table ids used by the components
+//
+int CoefFrame::numTableIds() const {
+    return numComponents > 1 ? 2 : 1;
+}
+
+//
+// Number of blocks in the coefficient planes
+//
+uint64_t CoefFrame::numBlocks() const {
+    uint64_t blocks = 0;
+    for (int channel = 0; channel < numComponents; channel++) {
+        blocks += static_cast<uint64_t>(coefPlanes[channel].blocksWide) * coefPlanes[channel].blocksHigh;
+    }
+    return blocks;
+}
+
+//
+// Number of MCUs in the coefficient planes
+//
+int CoefFrame::numMcus() const {
+    return (coefPlanes[0].blocksWide / components[0].h) * (coefPlanes[0].blocksHigh / components[0].v);
+}
+
+//
+// Writes the DQT segments of the quantisation tables in use (one, if the
+// components share a table)
+//
+void CoefFrame::writeQuantTables(BitWriter &writer) const {
+    for (int id = 0; id < std::min(numQuantTables, numTableIds()); id++) {
+        Jfif::writeDqt(writer, id, quantTables[id]->values);
+    }
+}
+
+//
+// Gives the DC predictions of the components at the start of the given MCU row of
+// the coefficient planes: the DC of each component's last block in the MCU row
+// above (0 at the top), so that rows can be coded independently
+//
+void CoefFrame::dcPredictions(int mcuRow, int *prevDc) const {
+    int mcusWide = coefPlanes[0].blocksWide / components[0].h;
+    for (int i = 0; i < numComponents; i++) {
+        const JfifComponent &component = components[i];
+        prevDc[i] = mcuRow == 0 ? 0 : coefPlanes[COMPONENT_PLANES[i]].block(mcusWide * component.h - 1,
+                                                                             mcuRow * component.v - 1)[0];
+    }
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pre_computed.hpp"
+#include "plane.hpp"
+#include "huffman.hpp"
+#include "bit_writer.hpp"
+#include "jfif.hpp"
+#include "rle.hpp"
+
+#define NUM_COMPONENTS 3
+
+//
+// An image as its entropy coders see it: its dimensions, frame components and
+// quantisation tables, and its quantised coefficient planes. JpegEncoder fills it
+// in, and codes it as a baseline scan; ProgressiveWriter and RansWriter code it
+// as the scans of a progression, or rANS coded.
+//
+// Blocks are symbolized (see rle.hpp) into symbol sinks, as (table, symbol,
+// coefficient, size) tuples, which one sink writes out and another counts. Sinks
+// are also told where each restart interval ends.
+//
+struct CoefFrame {
+    // plane (Y, Cr, Cb order) of each component (Y, Cb, Cr order)
+    static const int COMPONENT_PLANES[NUM_COMPONENTS];
+
+    // dimensions of the image
+    int width = 0;
+    int height = 0;
+
+    // frame components, in file order (Y, Cb, Cr)
+    JfifComponent components[NUM_COMPONENTS];
+    int numComponents = 0;
+
+    // quantised coefficients of each plane (Y, Cr, Cb order), and the index of each
+    // block's last nonzero AC coefficient
+    CoefPlane coefPlanes[NUM_COMPONENTS];
+    Plane<uchar> blockEnds[NUM_COMPONENTS];
+
+    // quantisation tables (see pre_computed.hpp), indexed by table id
+    // (0: luma, 1: chroma - unless a single table is shared by all components)
+    const QuantTable *quantTables[2];
+    int numQuantTables = 0;
+
+    // MCUs per restart interval of baseline scans - 0 for none
+    int restartInterval = 0;
+
+    //
+    // Number of quantisation and Huffman table ids used by the components
+    //
+    int numTableIds() const;
+
+    //
+    // Number of blocks in the coefficient planes
+    //
+    uint64_t numBlocks() const;
+
+    //
+    // Number of MCUs in the coefficient planes
+    //
+    int numMcus() const;
+
+    //
+    // Writes the DQT segments of the quantisation tables in use
+    //
+    void writeQuantTables(BitWriter &writer) const;
+
+    //
+    // Gives the DC predictions of the components at the start of the given MCU row
+    // of the coefficient planes
+    //
+    void dcPredictions(int mcuRow, int *prevDc) const;
+
+    //
+    // Codes all blocks of the coefficient planes into the given symbol sink, in
+    // scan order, continuing from the given DC predictions. The planes start at
+    // MCU `mcuOffset` of the image (see below).
+    //
+    template <typename Sink, typename Table>
+    void codeScan(Sink &sink, Table *dcTables, Table *acTables, int *prevDc, int mcuOffset = 0) const;
+
+    //
+    // Codes the blocks of MCUs [firstMcu, endMcu) of the coefficient planes into
+    // the given symbol sink, as codeScan
+    //
+    template <typename Sink, typename Table>
+    void codeMcus(Sink &sink, Table *dcTables, Table *acTables, int *prevDc, int firstMcu, int endMcu,
+                  int mcuOffset) const;
+};
+
+//
+// Writes the Huffman code of each coefficient's magnitude category (the symbol),
+// then the coefficient's low `size` bits (one's complement if negative), as a
+// single bit string of at most 16 + 11 bits
+//
+struct SymbolWriter {
+    BitWriter &writer;
+
+    inline void put(const HuffmanTable *table, int symbol, int coef, int size) {
+        writer.writeBits((static_cast<uint32_t>(table->codes[symbol]) << size) | Rle::magnitudeBits(coef, size),
+                         table->lengths[symbol] + size);
+    }
+
+    // uncoded bits (of progressive refinement scans)
+    inline void putBits(uint32_t bits, int length) {
+        writer.writeBits(bits, length);
+    }
+
+    inline void restart(int interval) {
+        Jfif::writeRst(writer, interval);
+    }
+};
+
+//
+// Symbol frequencies of a Huffman table
+//
+struct SymbolCounts {
+    uint32_t freqs[HUFFMAN_SYMBOLS];
+};
+
+//
+// Counts the occurrences of each symbol, i.e. its "tables" are symbol counts
+//
+struct SymbolCounter {
+    inline void put(SymbolCounts *counts, int symbol, int, int) {
+        counts->freqs[symbol]++;
+    }
+
+    inline void putBits(uint32_t, int) {}
+
+    inline void restart(int) {}
+};
+
+//
+// Codes all blocks of the coefficient planes into the given sink, in the order of
+// a single interleaved scan, i.e. MCU by MCU. Tables are indexed by table id.
+// `prevDc` holds the DC predictions of the components, carried over between calls
+// when the planes hold consecutive strips of an image, the first of which is MCU
+// `mcuOffset` of the image. With restart intervals, the sink is told of each
+// interval ending, and predictions start again from 0.
+//
+template <typename Sink, typename Table>
+void CoefFrame::codeScan(Sink &sink, Table *dcTables, Table *acTables, int *prevDc, int mcuOffset) const {
+    codeMcus(sink, dcTables, acTables, prevDc, 0, numMcus(), mcuOffset);
+}
+
+//
+// Codes the blocks of MCUs [firstMcu, endMcu) of the coefficient planes into the
+// given sink, as codeScan
+//
+template <typename Sink, typename Table>
+void CoefFrame::codeMcus(Sink &sink, Table *dcTables, Table *acTables, int *prevDc, int firstMcu, int endMcu,
+                         int mcuOffset) const {
+    int mcusWide = coefPlanes[0].blocksWide / components[0].h;
+    int interval = restartInterval;
+
+    for (int mcu = firstMcu; mcu < endMcu; mcu++) {
+        int index = mcuOffset + mcu;
+        if (interval > 0 && index > 0 && index % interval == 0) {
+            sink.restart(index / interval - 1);
+            for (int i = 0; i < numComponents; i++) {
+                prevDc[i] = 0;
+            }
+        }
+
+        int mx = mcu % mcusWide, my = mcu / mcusWide;
+        for (int i = 0; i < numComponents; i++) {
+            const JfifComponent &component = components[i];
+            const CoefPlane &coefPlane = coefPlanes[COMPONENT_PLANES[i]];
+            const Plane<uchar> &ends = blockEnds[COMPONENT_PLANES[i]];
+            for (int by = 0; by < component.v; by++) {
+                for (int bx = 0; bx < component.h; bx++) {
+                    int x = mx * component.h + bx, y = my * component.v + by;
+                    Rle::runSizeEncode(coefPlane.block(x, y), ends.row(y)[x], prevDc[i], sink,
+                                       &dcTables[component.dcTable], &acTables[component.acTable]);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,288 @@
+#include <cstring>
+#include <utility>
+
+#include "color.hpp"
+#include "shared.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Color {
+
+    //
+    // Forward (BGR -> YCrCb) coefficients, 15 fractional bits
+    //
+    static const int FWD_BITS = 15;
+    static const int FWD_Y_R = 9798, FWD_Y_G = 19235, FWD_Y_B = 3736;
+    static const int FWD_CB_R = -5529, FWD_CB_G = -10855, FWD_CB_B = 16384;
+    static const int FWD_CR_R = 16384, FWD_CR_G = -13720, FWD_CR_B = -2664;
+    static const int FWD_ROUND = 1 << (FWD_BITS - 1);
+    static const int FWD_CHROMA_OFFSET = 128 << FWD_BITS;
+
+    //
+    // Inverse (YCrCb -> BGR) coefficients, 14 fractional bits
+    //
+    static const int INV_BITS = 14;
+    static const int INV_ONE = 1 << INV_BITS;
+    static const int INV_R_CR = 22970;
+    static const int INV_G_CB = -5638, INV_G_CR = -11700;
+    static const int INV_B_CB = 29032;
+    static const int INV_ROUND = 1 << (INV_BITS - 1);
+
+    //
+    // Forward row kernels read pixels in BGR order, or in RGB order if `rgb`
+    //
+    template <bool rgb>
+    static void bgrRowToYcbcrScalar(const uchar *bgr, int width, uchar *y, uchar *cr, uchar *cb) {
+        int b, g, r;
+        for (int i = 0; i < width; i++) {
+            b = bgr[3*i + (rgb ? 2 : 0)];
+            g = bgr[3*i + 1];
+            r = bgr[3*i + (rgb ? 0 : 2)];
+            y[i] = (FWD_Y_R*r + FWD_Y_G*g + FWD_Y_B*b + FWD_ROUND) >> FWD_BITS;
+            // pure blue (red) gives a Cb (Cr) of 256: saturate, as the AVX2 kernel's packs do
+            cb[i] = MathUtils::clamp((FWD_CB_R*r + FWD_CB_G*g + FWD_CB_B*b + FWD_ROUND + FWD_CHROMA_OFFSET) >> FWD_BITS, 0, 255);
+            cr[i] = MathUtils::clamp((FWD_CR_R*r + FWD_CR_G*g + FWD_CR_B*b + FWD_ROUND + FWD_CHROMA_OFFSET) >> FWD_BITS, 0, 255);
+        }
+    }
+
+    static void ycbcrRowToBgrScalar(const uchar *y, const uchar *cr, const uchar *cb, int width, uchar *bgr) {
+        int yy, crr, cbb;
+        for (int i = 0; i < width; i++) {
+            yy = y[i] * INV_ONE + INV_ROUND;
+            crr = cr[i] - 128;
+            cbb = cb[i] - 128;
+            bgr[3*i] = MathUtils::clamp((yy + INV_B_CB*cbb) >> INV_BITS, 0, 255);
+            bgr[3*i + 1] = MathUtils::clamp((yy + INV_G_CB*cbb + INV_G_CR*crr) >> INV_BITS, 0, 255);
+            bgr[3*i + 2] = MathUtils::clamp((yy + INV_R_CR*crr) >> INV_BITS, 0, 255);
+        }
+    }
+
+#if defined(__x86_64__)
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+    //
+    // Broadcasts a pair of 16-bit coefficients, for _mm256_madd_epi16
+    //
+    static inline AVX2_TARGET __m256i coefPair(int first, int second) {
+        return _mm256_set1_epi32((int) ((uint32_t) (uint16_t) first | ((uint32_t) (uint16_t) second << 16)));
+    }
+
+    //
+    // Computes one output channel of 16 pixels from interleaved 16-bit input pairs,
+    // i.e. (p.first * c.first + p.second * c.second + q.first * d.first + ...) >> bits,
+    // then packs it to bytes
+    //
+    static inline AVX2_TARGET __m128i combineAvx2(__m256i pLo, __m256i pHi, __m256i pCoefs,
+                                                  __m256i qLo, __m256i qHi, __m256i qCoefs,
+                                                  __m256i offset, int bits) {
+        __m256i lo = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(pLo, pCoefs), _mm256_madd_epi16(qLo, qCoefs)), offset);
+        __m256i hi = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(pHi, pCoefs), _mm256_madd_epi16(qHi, qCoefs)), offset);
+        lo = _mm256_srai_epi32(lo, bits);
+        hi = _mm256_srai_epi32(hi, bits);
+
+        // unpack/pack both work per 128-bit lane, so packing lo with hi restores pixel order
+        __m256i words = _mm256_packs_epi32(lo, hi);
+        __m256i bytes = _mm256_packus_epi16(words, words);
+        bytes = _mm256_permute4x64_epi64(bytes, _MM_SHUFFLE(3, 1, 2, 0));
+        return _mm256_castsi256_si128(bytes);
+    }
+
+    template <bool rgb>
+    static AVX2_TARGET void bgrRowToYcbcrAvx2(const uchar *bgr, int width, uchar *y, uchar *cr, uchar *cb) {
+        // byte shuffles, de-interleaving the B, G and R bytes of each 16-byte third of 16 pixels
+        const __m128i bFromA = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m128i bFromB = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+        const __m128i bFromC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+        const __m128i gFromA = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m128i gFromB = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+        const __m128i gFromC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+        const __m128i rFromA = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m128i rFromB = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+        const __m128i rFromC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+        const __m256i one = _mm256_set1_epi16(1);
+        const __m256i yRg = coefPair(FWD_Y_R, FWD_Y_G), yB = coefPair(FWD_Y_B, FWD_ROUND);
+        const __m256i cbRg = coefPair(FWD_CB_R, FWD_CB_G), cbB = coefPair(FWD_CB_B, FWD_ROUND);
+        const __m256i crRg = coefPair(FWD_CR_R, FWD_CR_G), crB = coefPair(FWD_CR_B, FWD_ROUND);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i chromaOffset = _mm256_set1_epi32(FWD_CHROMA_OFFSET);
+
+        int i = 0;
+        for (; i + 16 <= width; i += 16) {
+            const uchar *p = bgr + 3*i;
+            __m128i a = _mm_loadu_si128((const __m128i*) p);
+            __m128i b = _mm_loadu_si128((const __m128i*) (p + 16));
+            __m128i c = _mm_loadu_si128((const __m128i*) (p + 32));
+
+            __m128i b8 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, bFromA), _mm_shuffle_epi8(b, bFromB)), _mm_shuffle_epi8(c, bFromC));
+            __m128i g8 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, gFromA), _mm_shuffle_epi8(b, gFromB)), _mm_shuffle_epi8(c, gFromC));
+            __m128i r8 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, rFromA), _mm_shuffle_epi8(b, rFromB)), _mm_shuffle_epi8(c, rFromC));
+            if (rgb) {
+                std::swap(b8, r8);
+            }
+
+            __m256i b16 = _mm256_cvtepu8_epi16(b8);
+            __m256i g16 = _mm256_cvtepu8_epi16(g8);
+            __m256i r16 = _mm256_cvtepu8_epi16(r8);
+
+            // (r, g) and (b, 1) pairs
+            __m256i rgLo = _mm256_unpacklo_epi16(r16, g16), rgHi = _mm256_unpackhi_epi16(r16, g16);
+            __m256i b1Lo = _mm256_unpacklo_epi16(b16, one), b1Hi = _mm256_unpackhi_epi16(b16, one);
+
+            _mm_storeu_si128((__m128i*) (y + i), combineAvx2(rgLo, rgHi, yRg, b1Lo, b1Hi, yB, zero, FWD_BITS));
+            _mm_storeu_si128((__m128i*) (cb + i), combineAvx2(rgLo, rgHi, cbRg, b1Lo, b1Hi, cbB, chromaOffset, FWD_BITS));
+            _mm_storeu_si128((__m128i*) (cr + i), combineAvx2(rgLo, rgHi, crRg, b1Lo, b1Hi, crB, chromaOffset, FWD_BITS));
+        }
+
+        bgrRowToYcbcrScalar<rgb>(bgr + 3*i, width - i, y + i, cr + i, cb + i);
+    }
+
+    static AVX2_TARGET void ycbcrRowToBgrAvx2(const uchar *y, const uchar *cr, const uchar *cb, int width, uchar *bgr) {
+        // byte shuffles, interleaving B, G and R bytes into each 16-byte third of 16 pixels
+        const __m128i aFromB = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+        const __m128i aFromG = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+        const __m128i aFromR = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+        const __m128i bFromB = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+        const __m128i bFromG = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+        const __m128i bFromR = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+        const __m128i cFromB = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+        const __m128i cFromG = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+        const __m128i cFromR = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+        const __m256i one = _mm256_set1_epi16(1);
+        const __m256i centre = _mm256_set1_epi16(128);
+        const __m256i rYcr = coefPair(INV_ONE, INV_R_CR);
+        const __m256i gYcb = coefPair(INV_ONE, INV_G_CB), gCr1 = coefPair(INV_G_CR, INV_ROUND);
+        const __m256i bYcb = coefPair(INV_ONE, INV_B_CB);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i round = _mm256_set1_epi32(INV_ROUND);
+
+        int i = 0;
+        for (; i + 16 <= width; i += 16) {
+            __m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (y + i)));
+            __m256i cr16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (cr + i))), centre);
+            __m256i cb16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (cb + i))), centre);
+
+            // (y, cr), (y, cb) and (cr, 1) pairs
+            __m256i ycrLo = _mm256_unpacklo_epi16(y16, cr16), ycrHi = _mm256_unpackhi_epi16(y16, cr16);
+            __m256i ycbLo = _mm256_unpacklo_epi16(y16, cb16), ycbHi = _mm256_unpackhi_epi16(y16, cb16);
+            __m256i cr1Lo = _mm256_unpacklo_epi16(cr16, one), cr1Hi = _mm256_unpackhi_epi16(cr16, one);
+
+            __m128i r8 = combineAvx2(ycrLo, ycrHi, rYcr, zero, zero, zero, round, INV_BITS);
+            __m128i g8 = combineAvx2(ycbLo, ycbHi, gYcb, cr1Lo, cr1Hi, gCr1, zero, INV_BITS);
+            __m128i b8 = combineAvx2(ycbLo, ycbHi, bYcb, zero, zero, zero, round, INV_BITS);
+
+            uchar *p = bgr + 3*i;
+            _mm_storeu_si128((__m128i*) p, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b8, aFromB), _mm_shuffle_epi8(g8, aFromG)), _mm_shuffle_epi8(r8, aFromR)));
+            _mm_storeu_si128((__m128i*) (p + 16), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b8, bFromB), _mm_shuffle_epi8(g8, bFromG)), _mm_shuffle_epi8(r8, bFromR)));
+            _mm_storeu_si128((__m128i*) (p + 32), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b8, cFromB), _mm_shuffle_epi8(g8, cFromG)), _mm_shuffle_epi8(r8, cFromR)));
+        }
+
+        ycbcrRowToBgrScalar(y + i, cr + i, cb + i, width - i, bgr + 3*i);
+    }
+
+#undef AVX2_TARGET
+
+#endif
+
+    //
+    // Converts a row of `width` interleaved BGR pixels into Y, Cr and Cb rows
+    //
+    void bgrRowToYcbcr(const uchar *bgr, int width, uchar *y, uchar *cr, uchar *cb) {
+#if defined(__x86_64__)
+        if (CpuUtils::getSimdLevel() >= CpuUtils::SIMD_AVX2) {
+            bgrRowToYcbcrAvx2<false>(bgr, width, y, cr, cb);
+            return;
+        }
+#endif
+        bgrRowToYcbcrScalar<false>(bgr, width, y, cr, cb);
+    }
+
+    //
+    // Converts a row of `width` interleaved RGB pixels into Y, Cr and Cb rows
+    //
+    void rgbRowToYcbcr(const uchar *rgb, int width, uchar *y, uchar *cr, uchar *cb) {
+#if defined(__x86_64__)
+        if (CpuUtils::getSimdLevel() >= CpuUtils::SIMD_AVX2) {
+            bgrRowToYcbcrAvx2<true>(rgb, width, y, cr, cb);
+            return;
+        }
+#endif
+        bgrRowToYcbcrScalar<true>(rgb, width, y, cr, cb);
+    }
+
+    //
+    // Converts `width` pixels of Y, Cr and Cb rows into a row of interleaved BGR pixels
+    //
+    void ycbcrRowToBgr(const uchar *y, const uchar *cr, const uchar *cb, int width, uchar *bgr) {
+#if defined(__x86_64__)
+        if (CpuUtils::getSimdLevel() >= CpuUtils::SIMD_AVX2) {
+            ycbcrRowToBgrAvx2(y, cr, cb, width, bgr);
+            return;
+        }
+#endif
+        ycbcrRowToBgrScalar(y, cr, cb, width, bgr);
+    }
+
+    //
+    // Converts the given BGR (or, if `rgb`, RGB) image into Y, Cr and Cb planes of
+    // the given (padded) dimensions in a single pass, replicating the right/bottom
+    // edge pixels into the padding. Creates the planes.
+    //
+    void bgrToYcbcrPlanes(const cv::Mat &bgrImage, Plane<uchar> *planes,
+                          int paddedWidth, int paddedHeight, ThreadPool &pool, bool rgb) {
+        for (int channel = 0; channel < 3; channel++) {
+            planes[channel].create(paddedWidth, paddedHeight);
+        }
+
+        int width = bgrImage.cols, height = bgrImage.rows;
+        pool.parallelFor(paddedHeight, [&](int r) {
+            // rows past the bottom edge replicate the last row
+            const uchar *src = bgrImage.ptr<uchar>(std::min(r, height - 1));
+            uchar *y = planes[0].row(r), *cr = planes[1].row(r), *cb = planes[2].row(r);
+            if (rgb) {
+                rgbRowToYcbcr(src, width, y, cr, cb);
+            } else {
+                bgrRowToYcbcr(src, width, y, cr, cb);
+            }
+            for (int c = width; c < paddedWidth; c++) {
+                y[c] = y[width - 1];
+                cr[c] = cr[width - 1];
+                cb[c] = cb[width - 1];
+            }
+        });
+    }
+
+    //
+    // Copies the given grayscale image into a Y plane of the given (padded)
+    // dimensions, replicating the right/bottom edge pixels into the padding.
+    // Creates the plane.
+    //
+    void grayToPlane(const cv::Mat &grayImage, Plane<uchar> &plane,
+                     int paddedWidth, int paddedHeight, ThreadPool &pool) {
+        plane.create(paddedWidth, paddedHeight);
+
+        int width = grayImage.cols, height = grayImage.rows;
+        pool.parallelFor(paddedHeight, [&](int r) {
+            const uchar *src = grayImage.ptr<uchar>(std::min(r, height - 1));
+            uchar *y = plane.row(r);
+            memcpy(y, src, width);
+            memset(y + width, src[width - 1], paddedWidth - width);
+        });
+    }
+
+    //
+    // Converts the top-left `width` x `height` pixels of the given Y, Cr and Cb planes
+    // into a BGR image in a single pass (i.e. dropping any padding)
+    //
+    cv::Mat ycbcrPlanesToBgr(const Plane<uchar> *planes, int width, int height, ThreadPool &pool) {
+        cv::Mat bgrImage(height, width, CV_8UC3);
+        pool.parallelFor(height, [&](int r) {
+            ycbcrRowToBgr(planes[0].row(r), planes[1].row(r), planes[2].row(r), width, bgrImage.ptr<uchar>(r));
+        });
+        return bgrImage;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include "plane.hpp"
+#include "thread_pool.hpp"
+
+//
+// Fixed-point colour conversion between interleaved BGR images and planar
+// Y, Cr, Cb channels (in that order, as used throughout the pipeline).
+//
+// Coefficients are the JFIF (BT.601 full range) ones, in fixed point:
+//      - forward: 15 fractional bits
+//      - inverse: 14 fractional bits
+// so every coefficient fits a signed 16-bit multiply-add. The AVX2 row kernels
+// compute exactly the same integer formulas as the scalar ones, so output does not
+// depend on the SIMD level. (Kernels below AVX2 are scalar: de-interleaving 3-byte
+// pixels needs the byte shuffles that come with it.)
+//
+namespace Color {
+
+    //
+    // Converts a row of `width` interleaved BGR pixels into Y, Cr and Cb rows
+    //
+    void bgrRowToYcbcr(const uchar *bgr, int width, uchar *y, uchar *cr, uchar *cb);
+
+    //
+    // Converts a row of `width` interleaved RGB pixels into Y, Cr and Cb rows
+    //
+    void rgbRowToYcbcr(const uchar *rgb, int width, uchar *y, uchar *cr, uchar *cb);
+
+    //
+    // Converts `width` pixels of Y, Cr and Cb rows into a row of interleaved BGR pixels
+    //
+    void ycbcrRowToBgr(const uchar *y, const uchar *cr, const uchar *cb, int width, uchar *bgr);
+
+    //
+    // Converts the given BGR (or, if `rgb`, RGB) image into Y, Cr and Cb planes of
+    // the given (padded) dimensions in a single pass, replicating the right/bottom
+    // edge pixels into the padding. Creates the planes.
+    //
+    void bgrToYcbcrPlanes(const cv::Mat &bgrImage, Plane<uchar> *planes,
+                          int paddedWidth, int paddedHeight, ThreadPool &pool, bool rgb = false);
+
+    //
+    // Copies the given grayscale image into a Y plane of the given (padded)
+    // dimensions, replicating the right/bottom edge pixels into the padding.
+    // Creates the plane.
+    //
+    void grayToPlane(const cv::Mat &grayImage, Plane<uchar> &plane,
+                     int paddedWidth, int paddedHeight, ThreadPool &pool);
+
+    //
+    // Converts the top-left `width` x `height` pixels of the given Y, Cr and Cb planes
+    // into a BGR image in a single pass (i.e. dropping any padding)
+    //
+    cv::Mat ycbcrPlanesToBgr(const Plane<uchar> *planes, int width, int height, ThreadPool &pool);
+}
@@ -0,0 +1,192 @@
+#include "dct.hpp"
+
+namespace Dct {
+
+    //
+    // AAN multiplier constants
+    //
+    static const float C_0_382683433 = 0.382683433f; // cos(6pi/16)
+    static const float C_0_541196100 = 0.541196100f; // sqrt(2) * cos(6pi/16)
+    static const float C_0_707106781 = 0.707106781f; // cos(4pi/16)
+    static const float C_1_306562965 = 1.306562965f; // sqrt(2) * cos(2pi/16)
+    static const float C_1_082392200 = 1.082392200f; // 2 * (cos(2pi/16) - cos(6pi/16))
+    static const float C_1_414213562 = 1.414213562f; // sqrt(2)
+    static const float C_1_847759065 = 1.847759065f; // 2 * cos(2pi/16)
+    static const float C_2_613125930 = 2.613125930f; // 2 * (cos(2pi/16) + cos(6pi/16))
+
+    //
+    // Scaled 1D forward DCT of 8 elements, `stride` apart, in place
+    //
+    static inline void forwardDct1d(float *d, int stride) {
+        float tmp0 = d[0*stride] + d[7*stride];
+        float tmp7 = d[0*stride] - d[7*stride];
+        float tmp1 = d[1*stride] + d[6*stride];
+        float tmp6 = d[1*stride] - d[6*stride];
+        float tmp2 = d[2*stride] + d[5*stride];
+        float tmp5 = d[2*stride] - d[5*stride];
+        float tmp3 = d[3*stride] + d[4*stride];
+        float tmp4 = d[3*stride] - d[4*stride];
+
+        // even part
+        float tmp10 = tmp0 + tmp3;
+        float tmp13 = tmp0 - tmp3;
+        float tmp11 = tmp1 + tmp2;
+        float tmp12 = tmp1 - tmp2;
+
+        d[0*stride] = tmp10 + tmp11;
+        d[4*stride] = tmp10 - tmp11;
+
+        float z1 = (tmp12 + tmp13) * C_0_707106781;
+        d[2*stride] = tmp13 + z1;
+        d[6*stride] = tmp13 - z1;
+
+        // odd part
+        tmp10 = tmp4 + tmp5;
+        tmp11 = tmp5 + tmp6;
+        tmp12 = tmp6 + tmp7;
+
+        float z5 = (tmp10 - tmp12) * C_0_382683433;
+        float z2 = C_0_541196100 * tmp10 + z5;
+        float z4 = C_1_306562965 * tmp12 + z5;
+        float z3 = tmp11 * C_0_707106781;
+
+        float z11 = tmp7 + z3;
+        float z13 = tmp7 - z3;
+
+        d[5*stride] = z13 + z2;
+        d[3*stride] = z13 - z2;
+        d[1*stride] = z11 + z4;
+        d[7*stride] = z11 - z4;
+    }
+
+    //
+    // Scaled 1D inverse DCT of 8 elements, `stride` apart, in place
+    //
+    static inline void inverseDct1d(float *d, int stride) {
+        // even part
+        float tmp0 = d[0*stride];
+        float tmp1 = d[2*stride];
+        float tmp2 = d[4*stride];
+        float tmp3 = d[6*stride];
+
+        float tmp10 = tmp0 + tmp2;
+        float tmp11 = tmp0 - tmp2;
+        float tmp13 = tmp1 + tmp3;
+        float tmp12 = (tmp1 - tmp3) * C_1_414213562 - tmp13;
+
+        tmp0 = tmp10 + tmp13;
+        tmp3 = tmp10 - tmp13;
+        tmp1 = tmp11 + tmp12;
+        tmp2 = tmp11 - tmp12;
+
+        // odd part
+        float tmp4 = d[1*stride];
+        float tmp5 = d[3*stride];
+        float tmp6 = d[5*stride];
+        float tmp7 = d[7*stride];
+
+        float z13 = tmp6 + tmp5;
+        float z10 = tmp6 - tmp5;
+        float z11 = tmp4 + tmp7;
+        float z12 = tmp4 - tmp7;
+
+        tmp7 = z11 + z13;
+        tmp11 = (z11 - z13) * C_1_414213562;
+
+        float z5 = (z10 + z12) * C_1_847759065;
+        tmp10 = C_1_082392200 * z12 - z5;
+        tmp12 = z5 - C_2_613125930 * z10;
+
+        tmp6 = tmp12 - tmp7;
+        tmp5 = tmp11 - tmp6;
+        tmp4 = tmp10 + tmp5;
+
+        d[0*stride] = tmp0 + tmp7;
+        d[7*stride] = tmp0 - tmp7;
+        d[1*stride] = tmp1 + tmp6;
+        d[6*stride] = tmp1 - tmp6;
+        d[2*stride] = tmp2 + tmp5;
+        d[5*stride] = tmp2 - tmp5;
+        d[4*stride] = tmp3 + tmp4;
+        d[3*stride] = tmp3 - tmp4;
+    }
+
+    //
+    // Scalar forward DCT kernel
+    //
+    void forwardDctScalar(const float *in, float *out, const JpegElements &jpegElements) {
+        float ws[BLOCK_SIZE*BLOCK_SIZE];
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            ws[i] = in[i];
+        }
+
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            forwardDct1d(ws + r*BLOCK_SIZE, 1);
+        }
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            forwardDct1d(ws + c, BLOCK_SIZE);
+        }
+
+        const float *scales = &jpegElements.aan_fdct_scales[0][0];
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            out[i] = ws[i] * scales[i];
+        }
+    }
+
+    //
+    // Scalar inverse DCT kernel
+    //
+    void inverseDctScalar(const float *in, float *out, const JpegElements &jpegElements) {
+        float ws[BLOCK_SIZE*BLOCK_SIZE];
+        const float *scales = &jpegElements.aan_idct_scales[0][0];
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            ws[i] = in[i] * scales[i];
+        }
+
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            inverseDct1d(ws + c, BLOCK_SIZE);
+        }
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            inverseDct1d(ws + r*BLOCK_SIZE, 1);
+        }
+
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            out[i] = ws[i];
+        }
+    }
+
+    //
+    // Dispatch to the kernels of the process-wide SIMD level (see CpuUtils)
+    //
+    void forwardDct(const float *in, float *out, const JpegElements &jpegElements) {
+        switch (CpuUtils::getSimdLevel()) {
+#if defined(__x86_64__)
+            case CpuUtils::SIMD_AVX2:
+                forwardDctAvx2(in, out, jpegElements);
+                break;
+            case CpuUtils::SIMD_SSE2:
+                forwardDctSse2(in, out, jpegElements);
+                break;
+#endif
+            default:
+                forwardDctScalar(in, out, jpegElements);
+                break;
+        }
+    }
+
+    void inverseDct(const float *in, float *out, const JpegElements &jpegElements) {
+        switch (CpuUtils::getSimdLevel()) {
+#if defined(__x86_64__)
+            case CpuUtils::SIMD_AVX2:
+                inverseDctAvx2(in, out, jpegElements);
+                break;
+            case CpuUtils::SIMD_SSE2:
+                inverseDctSse2(in, out, jpegElements);
+                break;
+#endif
+            default:
+                inverseDctScalar(in, out, jpegElements);
+                break;
+        }
+    }
+}
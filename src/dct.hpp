@@ -0,0 +1,69 @@
+#pragma once
+
+#include "pre_computed.hpp"
+#include "shared.hpp"
+
+//
+// Fast separable 8x8 DCT/IDCT, using the AAN (Arai-Agui-Nakajima) factorisation.
+//
+// Each 2D transform is done as a 1D transform of every row, followed by a 1D
+// transform of every column. Each 1D transform takes 5 multiplies and 29 adds,
+// (vs. 64 multiply-adds of the direct form), with the remaining per-coefficient
+// scaling folded into a single pass over the block using the AAN scale factors in
+// `JpegElements`.
+//
+// Both transforms compute exactly the same (orthonormal) DCT as the direct form, i.e.
+//      F(u,v) = 1/4 C(u) C(v) sum_{i,j} f(i,j) cos((2i+1)u pi/16) cos((2j+1)v pi/16)
+// For 8-bit input, outputs agree with the direct O(N^4) form to within 1e-3 (absolute),
+// the difference being float rounding only.
+//
+// Scalar, SSE2 and AVX2 kernels are provided. The SIMD kernels hold the whole block
+// in registers, doing the 1D transforms across row vectors with two in-register
+// transposes. `forwardDct`/`inverseDct` dispatch to the kernels of the process-wide
+// SIMD level (CpuUtils::getSimdLevel), which defaults to the best the host supports.
+//
+namespace Dct {
+
+    typedef void (*DctKernel)(const float *in, float *out, const JpegElements &jpegElements);
+
+    //
+    // Forward DCT of the given 8x8 row-major block, using the active kernel.
+    // `in` and `out` may point to the same block.
+    //
+    void forwardDct(const float *in, float *out, const JpegElements &jpegElements);
+
+    //
+    // Inverse DCT of the given 8x8 row-major block of DCT coefficients, using the
+    // active kernel. `in` and `out` may point to the same block.
+    //
+    void inverseDct(const float *in, float *out, const JpegElements &jpegElements);
+
+    //
+    // Individual kernels. The SSE2/AVX2 ones are only defined on x86-64 builds.
+    //
+    void forwardDctScalar(const float *in, float *out, const JpegElements &jpegElements);
+    void inverseDctScalar(const float *in, float *out, const JpegElements &jpegElements);
+    void forwardDctSse2(const float *in, float *out, const JpegElements &jpegElements);
+    void inverseDctSse2(const float *in, float *out, const JpegElements &jpegElements);
+    void forwardDctAvx2(const float *in, float *out, const JpegElements &jpegElements);
+    void inverseDctAvx2(const float *in, float *out, const JpegElements &jpegElements);
+
+    //
+    // Fixed-point (integer) forward DCTs, bit-exact on every platform (see dct_int.cpp).
+    // Input is 8x8 level-shifted samples (i.e. sample - 128), and outputs are scaled up:
+    //      - islow: by 8
+    //      - ifast: by 8 * s[u] * s[v] (the AAN scale factors)
+    // Both scalings are folded into the quantisation divisors in `JpegElements`.
+    //
+    void forwardDctIslow(const int32_t *in, int32_t *out);
+    void forwardDctIfast(const int32_t *in, int32_t *out);
+
+    //
+    // Fixed-point (integer) inverse DCTs, bit-exact on every platform.
+    // Each coefficient is first multiplied by the corresponding entry of `multipliers`,
+    // i.e. the dequantisation table, pre-scaled by the AAN scale factors for ifast
+    // (see `JpegElements::ifast_idct_multipliers`).
+    //
+    void inverseDctIslow(const int32_t *in, int32_t *out, const int32_t *multipliers);
+    void inverseDctIfast(const int32_t *in, int32_t *out, const int32_t *multipliers);
+}
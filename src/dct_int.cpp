@@ -0,0 +1,309 @@
+#include "dct.hpp"
+
+//
+// Fixed-point DCT/IDCT kernels, after the "islow" (Loeffler-Ligtenberg-Moschytz,
+// 13-bit constants) and "ifast" (AAN, 8-bit constants) integer transforms of the
+// IJG JPEG library. Only integer adds, multiplies and arithmetic right shifts are
+// used, so output is bit-identical regardless of compiler, ISA or float settings.
+//
+namespace Dct {
+
+    //
+    // Right shift by `n` with rounding
+    //
+    static inline int32_t descale(int32_t x, int n) {
+        return (x + (1 << (n - 1))) >> n;
+    }
+
+    ////////////////////////////////////////
+    // islow
+    ////////////////////////////////////////
+
+    static const int ISLOW_CONST_BITS = 13;
+    static const int ISLOW_PASS1_BITS = 2;
+
+    static const int32_t FIX_0_298631336 = 2446;
+    static const int32_t FIX_0_390180644 = 3196;
+    static const int32_t FIX_0_541196100 = 4433;
+    static const int32_t FIX_0_765366865 = 6270;
+    static const int32_t FIX_0_899976223 = 7373;
+    static const int32_t FIX_1_175875602 = 9633;
+    static const int32_t FIX_1_501321110 = 12299;
+    static const int32_t FIX_1_847759065 = 15137;
+    static const int32_t FIX_1_961570560 = 16069;
+    static const int32_t FIX_2_053119869 = 16819;
+    static const int32_t FIX_2_562915447 = 20995;
+    static const int32_t FIX_3_072711026 = 25172;
+
+    //
+    // islow 1D forward DCT of 8 elements, `stride` apart, in place.
+    // The first pass scales up by 2^PASS1_BITS, the second pass removes it again.
+    //
+    static inline void forwardDctIslow1d(int32_t *d, int stride, bool firstPass) {
+        int32_t tmp0 = d[0*stride] + d[7*stride];
+        int32_t tmp7 = d[0*stride] - d[7*stride];
+        int32_t tmp1 = d[1*stride] + d[6*stride];
+        int32_t tmp6 = d[1*stride] - d[6*stride];
+        int32_t tmp2 = d[2*stride] + d[5*stride];
+        int32_t tmp5 = d[2*stride] - d[5*stride];
+        int32_t tmp3 = d[3*stride] + d[4*stride];
+        int32_t tmp4 = d[3*stride] - d[4*stride];
+
+        int shift = firstPass ? ISLOW_CONST_BITS - ISLOW_PASS1_BITS : ISLOW_CONST_BITS + ISLOW_PASS1_BITS;
+
+        // even part
+        int32_t tmp10 = tmp0 + tmp3;
+        int32_t tmp13 = tmp0 - tmp3;
+        int32_t tmp11 = tmp1 + tmp2;
+        int32_t tmp12 = tmp1 - tmp2;
+
+        if (firstPass) {
+            d[0*stride] = (tmp10 + tmp11) * (1 << ISLOW_PASS1_BITS);
+            d[4*stride] = (tmp10 - tmp11) * (1 << ISLOW_PASS1_BITS);
+        } else {
+            d[0*stride] = descale(tmp10 + tmp11, ISLOW_PASS1_BITS);
+            d[4*stride] = descale(tmp10 - tmp11, ISLOW_PASS1_BITS);
+        }
+
+        int32_t z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        d[2*stride] = descale(z1 + tmp13 * FIX_0_765366865, shift);
+        d[6*stride] = descale(z1 - tmp12 * FIX_1_847759065, shift);
+
+        // odd part
+        z1 = tmp4 + tmp7;
+        int32_t z2 = tmp5 + tmp6;
+        int32_t z3 = tmp4 + tmp6;
+        int32_t z4 = tmp5 + tmp7;
+        int32_t z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+
+        d[7*stride] = descale(tmp4 + z1 + z3, shift);
+        d[5*stride] = descale(tmp5 + z2 + z4, shift);
+        d[3*stride] = descale(tmp6 + z2 + z3, shift);
+        d[1*stride] = descale(tmp7 + z1 + z4, shift);
+    }
+
+    //
+    // islow 1D inverse DCT of 8 elements, `stride` apart, in place.
+    // `shift` is the descale applied to the outputs.
+    //
+    static inline void inverseDctIslow1d(int32_t *d, int stride, int shift) {
+        // even part
+        int32_t z2 = d[2*stride];
+        int32_t z3 = d[6*stride];
+        int32_t z1 = (z2 + z3) * FIX_0_541196100;
+        int32_t tmp2 = z1 - z3 * FIX_1_847759065;
+        int32_t tmp3 = z1 + z2 * FIX_0_765366865;
+
+        z2 = d[0*stride];
+        z3 = d[4*stride];
+        int32_t tmp0 = (z2 + z3) * (1 << ISLOW_CONST_BITS);
+        int32_t tmp1 = (z2 - z3) * (1 << ISLOW_CONST_BITS);
+
+        int32_t tmp10 = tmp0 + tmp3;
+        int32_t tmp13 = tmp0 - tmp3;
+        int32_t tmp11 = tmp1 + tmp2;
+        int32_t tmp12 = tmp1 - tmp2;
+
+        // odd part
+        tmp0 = d[7*stride];
+        tmp1 = d[5*stride];
+        tmp2 = d[3*stride];
+        tmp3 = d[1*stride];
+
+        z1 = tmp0 + tmp3;
+        z2 = tmp1 + tmp2;
+        z3 = tmp0 + tmp2;
+        int32_t z4 = tmp1 + tmp3;
+        int32_t z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp0 *= FIX_0_298631336;
+        tmp1 *= FIX_2_053119869;
+        tmp2 *= FIX_3_072711026;
+        tmp3 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+
+        tmp0 += z1 + z3;
+        tmp1 += z2 + z4;
+        tmp2 += z2 + z3;
+        tmp3 += z1 + z4;
+
+        d[0*stride] = descale(tmp10 + tmp3, shift);
+        d[7*stride] = descale(tmp10 - tmp3, shift);
+        d[1*stride] = descale(tmp11 + tmp2, shift);
+        d[6*stride] = descale(tmp11 - tmp2, shift);
+        d[2*stride] = descale(tmp12 + tmp1, shift);
+        d[5*stride] = descale(tmp12 - tmp1, shift);
+        d[3*stride] = descale(tmp13 + tmp0, shift);
+        d[4*stride] = descale(tmp13 - tmp0, shift);
+    }
+
+    void forwardDctIslow(const int32_t *in, int32_t *out) {
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            out[i] = in[i];
+        }
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            forwardDctIslow1d(out + r*BLOCK_SIZE, 1, true);
+        }
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            forwardDctIslow1d(out + c, BLOCK_SIZE, false);
+        }
+    }
+
+    void inverseDctIslow(const int32_t *in, int32_t *out, const int32_t *multipliers) {
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            out[i] = in[i] * multipliers[i];
+        }
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            inverseDctIslow1d(out + c, BLOCK_SIZE, ISLOW_CONST_BITS - ISLOW_PASS1_BITS);
+        }
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            inverseDctIslow1d(out + r*BLOCK_SIZE, 1, ISLOW_CONST_BITS + ISLOW_PASS1_BITS + 3);
+        }
+    }
+
+    ////////////////////////////////////////
+    // ifast
+    ////////////////////////////////////////
+
+    static const int IFAST_CONST_BITS = 8;
+    static const int IFAST_PASS1_BITS = 2;
+
+    static const int32_t FIX_0_382683433_8 = 98;
+    static const int32_t FIX_0_541196100_8 = 139;
+    static const int32_t FIX_0_707106781_8 = 181;
+    static const int32_t FIX_1_306562965_8 = 334;
+    static const int32_t FIX_1_082392200_8 = 277;
+    static const int32_t FIX_1_414213562_8 = 362;
+    static const int32_t FIX_1_847759065_8 = 473;
+    static const int32_t FIX_2_613125930_8 = 669;
+
+    //
+    // Multiply by an 8-bit fixed-point constant, truncating (as ifast does)
+    //
+    static inline int32_t multiplyIfast(int32_t x, int32_t c) {
+        return (x * c) >> IFAST_CONST_BITS;
+    }
+
+    //
+    // ifast 1D forward DCT of 8 elements, `stride` apart, in place
+    //
+    static inline void forwardDctIfast1d(int32_t *d, int stride) {
+        int32_t tmp0 = d[0*stride] + d[7*stride];
+        int32_t tmp7 = d[0*stride] - d[7*stride];
+        int32_t tmp1 = d[1*stride] + d[6*stride];
+        int32_t tmp6 = d[1*stride] - d[6*stride];
+        int32_t tmp2 = d[2*stride] + d[5*stride];
+        int32_t tmp5 = d[2*stride] - d[5*stride];
+        int32_t tmp3 = d[3*stride] + d[4*stride];
+        int32_t tmp4 = d[3*stride] - d[4*stride];
+
+        // even part
+        int32_t tmp10 = tmp0 + tmp3;
+        int32_t tmp13 = tmp0 - tmp3;
+        int32_t tmp11 = tmp1 + tmp2;
+        int32_t tmp12 = tmp1 - tmp2;
+
+        d[0*stride] = tmp10 + tmp11;
+        d[4*stride] = tmp10 - tmp11;
+
+        int32_t z1 = multiplyIfast(tmp12 + tmp13, FIX_0_707106781_8);
+        d[2*stride] = tmp13 + z1;
+        d[6*stride] = tmp13 - z1;
+
+        // odd part
+        tmp10 = tmp4 + tmp5;
+        tmp11 = tmp5 + tmp6;
+        tmp12 = tmp6 + tmp7;
+
+        int32_t z5 = multiplyIfast(tmp10 - tmp12, FIX_0_382683433_8);
+        int32_t z2 = multiplyIfast(tmp10, FIX_0_541196100_8) + z5;
+        int32_t z4 = multiplyIfast(tmp12, FIX_1_306562965_8) + z5;
+        int32_t z3 = multiplyIfast(tmp11, FIX_0_707106781_8);
+
+        int32_t z11 = tmp7 + z3;
+        int32_t z13 = tmp7 - z3;
+
+        d[5*stride] = z13 + z2;
+        d[3*stride] = z13 - z2;
+        d[1*stride] = z11 + z4;
+        d[7*stride] = z11 - z4;
+    }
+
+    //
+    // ifast 1D inverse DCT of 8 elements, `stride` apart, in place.
+    // `shift` is the descale applied to the outputs (0 for none).
+    //
+    static inline void inverseDctIfast1d(int32_t *d, int stride, int shift) {
+        // even part
+        int32_t tmp10 = d[0*stride] + d[4*stride];
+        int32_t tmp11 = d[0*stride] - d[4*stride];
+        int32_t tmp13 = d[2*stride] + d[6*stride];
+        int32_t tmp12 = multiplyIfast(d[2*stride] - d[6*stride], FIX_1_414213562_8) - tmp13;
+
+        int32_t tmp0 = tmp10 + tmp13;
+        int32_t tmp3 = tmp10 - tmp13;
+        int32_t tmp1 = tmp11 + tmp12;
+        int32_t tmp2 = tmp11 - tmp12;
+
+        // odd part
+        int32_t z13 = d[5*stride] + d[3*stride];
+        int32_t z10 = d[5*stride] - d[3*stride];
+        int32_t z11 = d[1*stride] + d[7*stride];
+        int32_t z12 = d[1*stride] - d[7*stride];
+
+        int32_t tmp7 = z11 + z13;
+        tmp11 = multiplyIfast(z11 - z13, FIX_1_414213562_8);
+
+        int32_t z5 = multiplyIfast(z10 + z12, FIX_1_847759065_8);
+        tmp10 = multiplyIfast(z12, FIX_1_082392200_8) - z5;
+        tmp12 = z5 - multiplyIfast(z10, FIX_2_613125930_8);
+
+        int32_t tmp6 = tmp12 - tmp7;
+        int32_t tmp5 = tmp11 - tmp6;
+        int32_t tmp4 = tmp10 + tmp5;
+
+        int32_t res[BLOCK_SIZE] = {
+            tmp0 + tmp7, tmp1 + tmp6, tmp2 + tmp5, tmp3 - tmp4,
+            tmp3 + tmp4, tmp2 - tmp5, tmp1 - tmp6, tmp0 - tmp7
+        };
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            d[k*stride] = shift ? descale(res[k], shift) : res[k];
+        }
+    }
+
+    void forwardDctIfast(const int32_t *in, int32_t *out) {
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            out[i] = in[i];
+        }
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            forwardDctIfast1d(out + r*BLOCK_SIZE, 1);
+        }
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            forwardDctIfast1d(out + c, BLOCK_SIZE);
+        }
+    }
+
+    void inverseDctIfast(const int32_t *in, int32_t *out, const int32_t *multipliers) {
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            out[i] = in[i] * multipliers[i];
+        }
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            inverseDctIfast1d(out + c, BLOCK_SIZE, 0);
+        }
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            inverseDctIfast1d(out + r*BLOCK_SIZE, 1, IFAST_PASS1_BITS + 3);
+        }
+    }
+}
@@ -0,0 +1,323 @@
+#include "dct.hpp"
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+//
+// SSE2 and AVX2 kernels of the AAN DCT/IDCT (see dct.hpp and dct.cpp).
+//
+// Blocks are held as 8 row vectors (two __m128 halves per row for SSE2, one __m256
+// per row for AVX2). A 1D transform applied across the 8 row vectors transforms
+// every column at once; transposing the block in registers then lets the same
+// code transform every row.
+//
+// The AVX2 kernels are compiled for AVX2 via target attributes, so the rest of the
+// binary stays baseline x86-64, and they are only ever called once CPUID says so.
+//
+namespace Dct {
+
+    ////////////////////////////////////////
+    // SSE2
+    ////////////////////////////////////////
+
+    static inline void forwardDct1dSse2(__m128 *d) {
+        __m128 tmp0 = _mm_add_ps(d[0], d[7]);
+        __m128 tmp7 = _mm_sub_ps(d[0], d[7]);
+        __m128 tmp1 = _mm_add_ps(d[1], d[6]);
+        __m128 tmp6 = _mm_sub_ps(d[1], d[6]);
+        __m128 tmp2 = _mm_add_ps(d[2], d[5]);
+        __m128 tmp5 = _mm_sub_ps(d[2], d[5]);
+        __m128 tmp3 = _mm_add_ps(d[3], d[4]);
+        __m128 tmp4 = _mm_sub_ps(d[3], d[4]);
+
+        // even part
+        __m128 tmp10 = _mm_add_ps(tmp0, tmp3);
+        __m128 tmp13 = _mm_sub_ps(tmp0, tmp3);
+        __m128 tmp11 = _mm_add_ps(tmp1, tmp2);
+        __m128 tmp12 = _mm_sub_ps(tmp1, tmp2);
+
+        d[0] = _mm_add_ps(tmp10, tmp11);
+        d[4] = _mm_sub_ps(tmp10, tmp11);
+
+        __m128 z1 = _mm_mul_ps(_mm_add_ps(tmp12, tmp13), _mm_set1_ps(0.707106781f));
+        d[2] = _mm_add_ps(tmp13, z1);
+        d[6] = _mm_sub_ps(tmp13, z1);
+
+        // odd part
+        tmp10 = _mm_add_ps(tmp4, tmp5);
+        tmp11 = _mm_add_ps(tmp5, tmp6);
+        tmp12 = _mm_add_ps(tmp6, tmp7);
+
+        __m128 z5 = _mm_mul_ps(_mm_sub_ps(tmp10, tmp12), _mm_set1_ps(0.382683433f));
+        __m128 z2 = _mm_add_ps(_mm_mul_ps(tmp10, _mm_set1_ps(0.541196100f)), z5);
+        __m128 z4 = _mm_add_ps(_mm_mul_ps(tmp12, _mm_set1_ps(1.306562965f)), z5);
+        __m128 z3 = _mm_mul_ps(tmp11, _mm_set1_ps(0.707106781f));
+
+        __m128 z11 = _mm_add_ps(tmp7, z3);
+        __m128 z13 = _mm_sub_ps(tmp7, z3);
+
+        d[5] = _mm_add_ps(z13, z2);
+        d[3] = _mm_sub_ps(z13, z2);
+        d[1] = _mm_add_ps(z11, z4);
+        d[7] = _mm_sub_ps(z11, z4);
+    }
+
+    static inline void inverseDct1dSse2(__m128 *d) {
+        // even part
+        __m128 tmp10 = _mm_add_ps(d[0], d[4]);
+        __m128 tmp11 = _mm_sub_ps(d[0], d[4]);
+        __m128 tmp13 = _mm_add_ps(d[2], d[6]);
+        __m128 tmp12 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(d[2], d[6]), _mm_set1_ps(1.414213562f)), tmp13);
+
+        __m128 tmp0 = _mm_add_ps(tmp10, tmp13);
+        __m128 tmp3 = _mm_sub_ps(tmp10, tmp13);
+        __m128 tmp1 = _mm_add_ps(tmp11, tmp12);
+        __m128 tmp2 = _mm_sub_ps(tmp11, tmp12);
+
+        // odd part
+        __m128 z13 = _mm_add_ps(d[5], d[3]);
+        __m128 z10 = _mm_sub_ps(d[5], d[3]);
+        __m128 z11 = _mm_add_ps(d[1], d[7]);
+        __m128 z12 = _mm_sub_ps(d[1], d[7]);
+
+        __m128 tmp7 = _mm_add_ps(z11, z13);
+        tmp11 = _mm_mul_ps(_mm_sub_ps(z11, z13), _mm_set1_ps(1.414213562f));
+
+        __m128 z5 = _mm_mul_ps(_mm_add_ps(z10, z12), _mm_set1_ps(1.847759065f));
+        tmp10 = _mm_sub_ps(_mm_mul_ps(z12, _mm_set1_ps(1.082392200f)), z5);
+        tmp12 = _mm_sub_ps(z5, _mm_mul_ps(z10, _mm_set1_ps(2.613125930f)));
+
+        __m128 tmp6 = _mm_sub_ps(tmp12, tmp7);
+        __m128 tmp5 = _mm_sub_ps(tmp11, tmp6);
+        __m128 tmp4 = _mm_add_ps(tmp10, tmp5);
+
+        d[0] = _mm_add_ps(tmp0, tmp7);
+        d[7] = _mm_sub_ps(tmp0, tmp7);
+        d[1] = _mm_add_ps(tmp1, tmp6);
+        d[6] = _mm_sub_ps(tmp1, tmp6);
+        d[2] = _mm_add_ps(tmp2, tmp5);
+        d[5] = _mm_sub_ps(tmp2, tmp5);
+        d[4] = _mm_add_ps(tmp3, tmp4);
+        d[3] = _mm_sub_ps(tmp3, tmp4);
+    }
+
+    //
+    // Transposes the 8x8 block held as left (columns 0-3) and right (columns 4-7)
+    // row halves, by transposing each 4x4 quadrant and swapping the off-diagonal ones
+    //
+    static inline void transposeSse2(__m128 *left, __m128 *right) {
+        _MM_TRANSPOSE4_PS(left[0], left[1], left[2], left[3]);
+        _MM_TRANSPOSE4_PS(right[0], right[1], right[2], right[3]);
+        _MM_TRANSPOSE4_PS(left[4], left[5], left[6], left[7]);
+        _MM_TRANSPOSE4_PS(right[4], right[5], right[6], right[7]);
+        for (int i = 0; i < 4; i++) {
+            __m128 t = right[i];
+            right[i] = left[4 + i];
+            left[4 + i] = t;
+        }
+    }
+
+    void forwardDctSse2(const float *in, float *out, const JpegElements &jpegElements) {
+        __m128 left[BLOCK_SIZE], right[BLOCK_SIZE];
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            left[r] = _mm_loadu_ps(in + r*BLOCK_SIZE);
+            right[r] = _mm_loadu_ps(in + r*BLOCK_SIZE + 4);
+        }
+
+        // rows, then columns
+        transposeSse2(left, right);
+        forwardDct1dSse2(left);
+        forwardDct1dSse2(right);
+        transposeSse2(left, right);
+        forwardDct1dSse2(left);
+        forwardDct1dSse2(right);
+
+        const float *scales = &jpegElements.aan_fdct_scales[0][0];
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            _mm_storeu_ps(out + r*BLOCK_SIZE, _mm_mul_ps(left[r], _mm_loadu_ps(scales + r*BLOCK_SIZE)));
+            _mm_storeu_ps(out + r*BLOCK_SIZE + 4, _mm_mul_ps(right[r], _mm_loadu_ps(scales + r*BLOCK_SIZE + 4)));
+        }
+    }
+
+    void inverseDctSse2(const float *in, float *out, const JpegElements &jpegElements) {
+        const float *scales = &jpegElements.aan_idct_scales[0][0];
+        __m128 left[BLOCK_SIZE], right[BLOCK_SIZE];
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            left[r] = _mm_mul_ps(_mm_loadu_ps(in + r*BLOCK_SIZE), _mm_loadu_ps(scales + r*BLOCK_SIZE));
+            right[r] = _mm_mul_ps(_mm_loadu_ps(in + r*BLOCK_SIZE + 4), _mm_loadu_ps(scales + r*BLOCK_SIZE + 4));
+        }
+
+        // columns, then rows
+        inverseDct1dSse2(left);
+        inverseDct1dSse2(right);
+        transposeSse2(left, right);
+        inverseDct1dSse2(left);
+        inverseDct1dSse2(right);
+        transposeSse2(left, right);
+
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            _mm_storeu_ps(out + r*BLOCK_SIZE, left[r]);
+            _mm_storeu_ps(out + r*BLOCK_SIZE + 4, right[r]);
+        }
+    }
+
+    ////////////////////////////////////////
+    // AVX2
+    ////////////////////////////////////////
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+    static inline AVX2_TARGET void forwardDct1dAvx2(__m256 *d) {
+        __m256 tmp0 = _mm256_add_ps(d[0], d[7]);
+        __m256 tmp7 = _mm256_sub_ps(d[0], d[7]);
+        __m256 tmp1 = _mm256_add_ps(d[1], d[6]);
+        __m256 tmp6 = _mm256_sub_ps(d[1], d[6]);
+        __m256 tmp2 = _mm256_add_ps(d[2], d[5]);
+        __m256 tmp5 = _mm256_sub_ps(d[2], d[5]);
+        __m256 tmp3 = _mm256_add_ps(d[3], d[4]);
+        __m256 tmp4 = _mm256_sub_ps(d[3], d[4]);
+
+        // even part
+        __m256 tmp10 = _mm256_add_ps(tmp0, tmp3);
+        __m256 tmp13 = _mm256_sub_ps(tmp0, tmp3);
+        __m256 tmp11 = _mm256_add_ps(tmp1, tmp2);
+        __m256 tmp12 = _mm256_sub_ps(tmp1, tmp2);
+
+        d[0] = _mm256_add_ps(tmp10, tmp11);
+        d[4] = _mm256_sub_ps(tmp10, tmp11);
+
+        __m256 z1 = _mm256_mul_ps(_mm256_add_ps(tmp12, tmp13), _mm256_set1_ps(0.707106781f));
+        d[2] = _mm256_add_ps(tmp13, z1);
+        d[6] = _mm256_sub_ps(tmp13, z1);
+
+        // odd part
+        tmp10 = _mm256_add_ps(tmp4, tmp5);
+        tmp11 = _mm256_add_ps(tmp5, tmp6);
+        tmp12 = _mm256_add_ps(tmp6, tmp7);
+
+        __m256 z5 = _mm256_mul_ps(_mm256_sub_ps(tmp10, tmp12), _mm256_set1_ps(0.382683433f));
+        __m256 z2 = _mm256_add_ps(_mm256_mul_ps(tmp10, _mm256_set1_ps(0.541196100f)), z5);
+        __m256 z4 = _mm256_add_ps(_mm256_mul_ps(tmp12, _mm256_set1_ps(1.306562965f)), z5);
+        __m256 z3 = _mm256_mul_ps(tmp11, _mm256_set1_ps(0.707106781f));
+
+        __m256 z11 = _mm256_add_ps(tmp7, z3);
+        __m256 z13 = _mm256_sub_ps(tmp7, z3);
+
+        d[5] = _mm256_add_ps(z13, z2);
+        d[3] = _mm256_sub_ps(z13, z2);
+        d[1] = _mm256_add_ps(z11, z4);
+        d[7] = _mm256_sub_ps(z11, z4);
+    }
+
+    static inline AVX2_TARGET void inverseDct1dAvx2(__m256 *d) {
+        // even part
+        __m256 tmp10 = _mm256_add_ps(d[0], d[4]);
+        __m256 tmp11 = _mm256_sub_ps(d[0], d[4]);
+        __m256 tmp13 = _mm256_add_ps(d[2], d[6]);
+        __m256 tmp12 = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(d[2], d[6]), _mm256_set1_ps(1.414213562f)), tmp13);
+
+        __m256 tmp0 = _mm256_add_ps(tmp10, tmp13);
+        __m256 tmp3 = _mm256_sub_ps(tmp10, tmp13);
+        __m256 tmp1 = _mm256_add_ps(tmp11, tmp12);
+        __m256 tmp2 = _mm256_sub_ps(tmp11, tmp12);
+
+        // odd part
+        __m256 z13 = _mm256_add_ps(d[5], d[3]);
+        __m256 z10 = _mm256_sub_ps(d[5], d[3]);
+        __m256 z11 = _mm256_add_ps(d[1], d[7]);
+        __m256 z12 = _mm256_sub_ps(d[1], d[7]);
+
+        __m256 tmp7 = _mm256_add_ps(z11, z13);
+        tmp11 = _mm256_mul_ps(_mm256_sub_ps(z11, z13), _mm256_set1_ps(1.414213562f));
+
+        __m256 z5 = _mm256_mul_ps(_mm256_add_ps(z10, z12), _mm256_set1_ps(1.847759065f));
+        tmp10 = _mm256_sub_ps(_mm256_mul_ps(z12, _mm256_set1_ps(1.082392200f)), z5);
+        tmp12 = _mm256_sub_ps(z5, _mm256_mul_ps(z10, _mm256_set1_ps(2.613125930f)));
+
+        __m256 tmp6 = _mm256_sub_ps(tmp12, tmp7);
+        __m256 tmp5 = _mm256_sub_ps(tmp11, tmp6);
+        __m256 tmp4 = _mm256_add_ps(tmp10, tmp5);
+
+        d[0] = _mm256_add_ps(tmp0, tmp7);
+        d[7] = _mm256_sub_ps(tmp0, tmp7);
+        d[1] = _mm256_add_ps(tmp1, tmp6);
+        d[6] = _mm256_sub_ps(tmp1, tmp6);
+        d[2] = _mm256_add_ps(tmp2, tmp5);
+        d[5] = _mm256_sub_ps(tmp2, tmp5);
+        d[4] = _mm256_add_ps(tmp3, tmp4);
+        d[3] = _mm256_sub_ps(tmp3, tmp4);
+    }
+
+    //
+    // Transposes the 8x8 block held as 8 row vectors
+    //
+    static inline AVX2_TARGET void transposeAvx2(__m256 *r) {
+        __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+        __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+        __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+        __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+        __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+        __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+        __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+        __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+        __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+        r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+        r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+        r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+        r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+        r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+        r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+        r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+        r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    }
+
+    AVX2_TARGET void forwardDctAvx2(const float *in, float *out, const JpegElements &jpegElements) {
+        __m256 rows[BLOCK_SIZE];
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            rows[r] = _mm256_loadu_ps(in + r*BLOCK_SIZE);
+        }
+
+        // rows, then columns
+        transposeAvx2(rows);
+        forwardDct1dAvx2(rows);
+        transposeAvx2(rows);
+        forwardDct1dAvx2(rows);
+
+        const float *scales = &jpegElements.aan_fdct_scales[0][0];
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            _mm256_storeu_ps(out + r*BLOCK_SIZE, _mm256_mul_ps(rows[r], _mm256_loadu_ps(scales + r*BLOCK_SIZE)));
+        }
+    }
+
+    AVX2_TARGET void inverseDctAvx2(const float *in, float *out, const JpegElements &jpegElements) {
+        const float *scales = &jpegElements.aan_idct_scales[0][0];
+        __m256 rows[BLOCK_SIZE];
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            rows[r] = _mm256_mul_ps(_mm256_loadu_ps(in + r*BLOCK_SIZE), _mm256_loadu_ps(scales + r*BLOCK_SIZE));
+        }
+
+        // columns, then rows
+        inverseDct1dAvx2(rows);
+        transposeAvx2(rows);
+        inverseDct1dAvx2(rows);
+        transposeAvx2(rows);
+
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            _mm256_storeu_ps(out + r*BLOCK_SIZE, rows[r]);
+        }
+    }
+
+#undef AVX2_TARGET
+}
+
+#endif
@@ -1,11 +1,67 @@
+#include <algorithm>
+#include <cstring>
 #include <map>
-#include <queue>
 #include <opencv2/opencv.hpp>
 #include "huffman.hpp"
 #include "shared.hpp"
-#include "rle.hpp"
+#include "bit_writer.hpp"
 
-HuffmanNode::HuffmanNode(int val, int freq) { // leaf
+//
+// Sets the table from DHT fields, and derives the code of each symbol
+//
+// Codes are canonical: consecutive within each length, and each length's first
+// code is one past the previous length's last, shifted left by one.
+//
+void HuffmanTable::build(const uchar *bits, const uchar *vals) {
+    numVals = 0;
+    for (int l = 0; l < 16; l++) {
+        this->bits[l] = bits[l];
+        numVals += bits[l];
+    }
+    memcpy(this->vals, vals, numVals);
+    memset(lengths, 0, sizeof(lengths));
+    memset(codes, 0, sizeof(codes));
+
+    int k = 0;
+    uint16_t code = 0;
+    for (int l = 1; l <= 16; l++) {
+        for (int i = 0; i < bits[l - 1]; i++, k++) {
+            codes[vals[k]] = code++;
+            lengths[vals[k]] = l;
+        }
+        code <<= 1;
+    }
+}
+
+//
+// Builds the decoding tables of the given table
+//
+void HuffmanDecodeTable::build(const HuffmanTable &table) {
+    memcpy(vals, table.vals, table.numVals);
+    memset(lookahead, 0, sizeof(lookahead));
+
+    int k = 0;
+    int32_t code = 0;
+    for (int l = 1; l <= 16; l++) {
+        int n = table.bits[l - 1];
+        valOffset[l] = k - code;
+        maxCode[l] = n ? code + n - 1 : -1;
+
+        for (int i = 0; i < n; i++, k++, code++) {
+            if (l > HUFFMAN_LOOKAHEAD_BITS) {
+                continue;
+            }
+            // every bit pattern starting with this code decodes to its symbol
+            int shift = HUFFMAN_LOOKAHEAD_BITS - l;
+            for (int pad = 0; pad < (1 << shift); pad++) {
+                lookahead[(code << shift) | pad] = static_cast<uint16_t>((l << 8) | table.vals[k]);
+            }
+        }
+        code <<= 1;
+    }
+}
+
+HuffmanNode::HuffmanNode(int val, uint64_t freq) { // leaf
     this->val = val;
     this->freq = freq;
     this->left = nullptr;
@@ -13,7 +69,7 @@ HuffmanNode::HuffmanNode(int val, int freq) { // leaf
 }
 
 HuffmanNode::HuffmanNode(HuffmanNode *left, HuffmanNode *right) { // non-leaf
-    this->val = 0;
+    this->val = -1;
     this->freq = 0;
     if (left) {
         this->freq += left->freq;
@@ -26,96 +82,190 @@ HuffmanNode::HuffmanNode(HuffmanNode *left, HuffmanNode *right) { // non-leaf
 }
 
 //
-// Builds up encoding tree from given byte array. Expects `data` to be rle-encoding,
-// see rle.hpp.
+// Heap order: lowest frequency on top, and among equal frequencies the node
+// latest in the arena, so that the reserved symbol gets the longest code
 //
-void HuffmanEncoder::buildEncodingTree(std::vector<int> rle_data) {
-    // build up frequency map
-    std::map<int, int> freqCount;
-    int n = rle_data.size();
-    int f, el;
-    for (int i = 0; i < n; i+=2) {
-        f = rle_data[i], el = rle_data[i+1];
-        freqCount[el] += f;
-    }
+static bool heapOrder(const HuffmanNode *a, const HuffmanNode *b) {
+    return a->freq > b->freq || (a->freq == b->freq && a < b);
+}
 
-    // build up min heap
-    std::priority_queue<std::pair<int, HuffmanNode*>> pq;
-    for (auto p : freqCount) {
-        el = p.first, f = p.second;
-        HuffmanNode *node = new HuffmanNode(el, f);
-        pq.push(std::make_pair(f*-1, node));
+//
+// Builds up encoding tree from the given frequency of each symbol. Returns the
+// root (null if no symbol occurs).
+//
+// Leaves are nodes[symbol], with the reserved symbol (frequency 1) last.
+//
+HuffmanNode *HuffmanEncoder::buildEncodingTree(const uint32_t *freqs) {
+    // build up min heap of leaves
+    int heapSize = 0;
+    for (int el = 0; el <= HUFFMAN_SYMBOLS; el++) {
+        uint64_t f = el < HUFFMAN_SYMBOLS ? freqs[el] : 1;
+        if (f == 0) {
+            continue;
+        }
+        nodes[el] = HuffmanNode(el, f);
+        heap[heapSize++] = &nodes[el];
+    }
+    if (heapSize == 1) {
+        return nullptr;
     }
+    std::make_heap(heap, heap + heapSize, heapOrder);
 
-    // build up huffman tree from min heap
-    std::pair<int, HuffmanNode*> e1, e2;
+    // build up huffman tree, repeatedly merging the two lowest frequency subtrees
+    int nextNode = HUFFMAN_SYMBOLS + 1;
     HuffmanNode *left, *right;
-    while (pq.size() > 1) {
-        e1 = pq.top(); pq.pop(); 
-        e2 = pq.top(); pq.pop();
-        left = e1.second;
-        right = e2.second;
-        HuffmanNode *node = new HuffmanNode(left, right);
-        pq.push(std::make_pair(node->freq, node));
-    }
-    this->root = pq.top().second;
+    while (heapSize > 1) {
+        std::pop_heap(heap, heap + heapSize--, heapOrder);
+        left = heap[heapSize];
+        std::pop_heap(heap, heap + heapSize--, heapOrder);
+        right = heap[heapSize];
+
+        nodes[nextNode] = HuffmanNode(left, right);
+        heap[heapSize++] = &nodes[nextNode++];
+        std::push_heap(heap, heap + heapSize, heapOrder);
+    }
+    return heap[0];
+}
+
+//
+// Traverses huffman encoding tree to record the code length (depth) of each leaf
+//
+void HuffmanEncoder::findCodeLengths(const HuffmanNode *node, int depth, int *codeLengths) {
+    if (!node->left && !node->right) {
+        codeLengths[node->val] = depth;
+        return;
+    }
+    findCodeLengths(node->left, depth + 1, codeLengths);
+    findCodeLengths(node->right, depth + 1, codeLengths);
 }
 
 //
-// Traverses huffman encoding tree to populate the encodings map with encodings of each leaf
+// Builds the optimal table of the given frequency of each symbol (JPEG Annex K.2)
+// into `table`. Symbols that do not occur get no code.
 //
-void HuffmanEncoder::buildEncodingsMap(HuffmanNode *root, std::string code) {
+void HuffmanEncoder::buildTable(const uint32_t *freqs, HuffmanTable &table) {
+    uchar dhtBits[HUFFMAN_MAX_CODE_LENGTH] = {0};
+    uchar vals[HUFFMAN_SYMBOLS];
+
+    int codeLengths[HUFFMAN_SYMBOLS + 1] = {0};
+    HuffmanNode *root = buildEncodingTree(freqs);
     if (!root) {
+        table.build(dhtBits, vals);
         return;
     }
+    findCodeLengths(root, 0, codeLengths);
 
-    if (!root->left && !root->right) {
-        this->encodings[root->val] = code;
+    // number of codes of each length (up to one per symbol before limiting)
+    int bits[HUFFMAN_SYMBOLS + 2] = {0};
+    int maxLength = 0;
+    for (int el = 0; el <= HUFFMAN_SYMBOLS; el++) {
+        if (codeLengths[el]) {
+            bits[codeLengths[el]]++;
+            maxLength = std::max(maxLength, codeLengths[el]);
+        }
     }
 
-    buildEncodingsMap(root->left, code + "0");
-    buildEncodingsMap(root->right, code + "1");
+    // limit code lengths (K.3, figure K.3): codes longer than the limit come in
+    // pairs; move each pair up to a length one shorter, taking the place of a
+    // shorter code, which is lengthened by one to pair with the other
+    for (int i = maxLength; i > HUFFMAN_MAX_CODE_LENGTH; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) {
+                j--;
+            }
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+
+    // drop the reserved symbol's code, i.e. the last of the longest length
+    int longest = HUFFMAN_MAX_CODE_LENGTH;
+    while (bits[longest] == 0) {
+        longest--;
+    }
+    bits[longest]--;
+
+    // symbols in order of (unlimited) code length, then value (K.4). The reserved
+    // symbol would sort last, so is left out.
+    int n = 0;
+    for (int length = 1; length <= maxLength; length++) {
+        for (int el = 0; el < HUFFMAN_SYMBOLS; el++) {
+            if (codeLengths[el] == length) {
+                vals[n++] = el;
+            }
+        }
+    }
+    for (int l = 1; l <= HUFFMAN_MAX_CODE_LENGTH; l++) {
+        dhtBits[l - 1] = bits[l];
+    }
+    table.build(dhtBits, vals);
 }
 
 //
-// Huffman encodes given byte array
+// Huffman encodes given byte array (symbols 0-255), packing the codes into bytes
+// (most significant bit first, the last byte padded with 1 bits)
 //
-std::vector<uchar> HuffmanEncoder::encode(std::vector<int> data, bool debug) {
-    // rle encode the data
-    std::vector<int> rle_data = Rle::rleEncode(data);
-
-    // calculate encodings
-    buildEncodingTree(rle_data);
-    buildEncodingsMap(this->root, "");
+std::vector<uchar> HuffmanEncoder::encode(const std::vector<int> &data, bool debug) {
+    for (int symbol : data) {
+        if (symbol < 0 || symbol >= HUFFMAN_SYMBOLS) {
+            std::cout << "HuffmanEncoder::encode(): symbol out of range: " << symbol << "\n";
+            return std::vector<uchar>();
+        }
+    }
 
-    // convert byte array to its encoded binary string
-    std::string binary_string;
-    for (int byte : data) {
-        binary_string += this->encodings[byte];
+    // count symbol frequencies
+    uint32_t freqs[HUFFMAN_SYMBOLS] = {0};
+    for (int symbol : data) {
+        freqs[symbol]++;
     }
 
-    // convert new binary string into byte array
-    std::vector<uchar> byte_array;
-    std::string byte_string;
-    int val;
-    for (size_t i = 0; i < binary_string.size(); i += 8) {
-        byte_string = binary_string.substr(i, 8);
-        val = std::stoi(byte_string, nullptr, 2);
-        byte_array.push_back(val);
+    // calculate encodings
+    buildTable(freqs, table);
+
+    // pack the codes of the data, a table lookup per symbol
+    BitWriter writer(nullptr, false);
+    for (int symbol : data) {
+        writer.writeBits(table.codes[symbol], table.lengths[symbol]);
     }
+    writer.alignToByte();
+    std::vector<uchar> byte_array(writer.data(), writer.data() + writer.size());
 
     if (debug) {
         std::cout << std::endl << "Data" << std::endl;
         PrintUtils::printVector(data);
         std::cout << std::endl << "Encodings map" << std::endl;
-        PrintUtils::printMap(encodings);
-        std::cout << std::endl << "Full binary string: (" << binary_string.size() << ")" << std::endl;
-        std::cout << binary_string << std::endl;
+        PrintUtils::printMap(getEncodings());
+        std::cout << std::endl << "Encoded bytes: (" << byte_array.size() << ")" << std::endl;
+        PrintUtils::printVector(byte_array);
     }
 
     return byte_array;
 }
 
+//
+// Returns the table of the last `encode` (e.g. to write as a DHT segment)
+//
+const HuffmanTable& HuffmanEncoder::getTable() const {
+    return table;
+}
+
+//
+// Returns the code of each symbol as a binary string (for debugging)
+//
 std::map<int, std::string> HuffmanEncoder::getEncodings() {
-    return this->encodings;
+    std::map<int, std::string> encodings;
+    for (int symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+        if (table.lengths[symbol] == 0) {
+            continue;
+        }
+        std::string code;
+        for (int b = table.lengths[symbol] - 1; b >= 0; b--) {
+            code += ((table.codes[symbol] >> b) & 1) ? '1' : '0';
+        }
+        encodings[symbol] = code;
+    }
+    return encodings;
 }
\ No newline at end of file
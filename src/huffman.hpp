@@ -1,49 +1,137 @@
 #pragma once
 #include <map>
-#include <queue>
+#include <cstdint>
 #include <opencv2/opencv.hpp>
 
+//
+// A JPEG Huffman table, as given in a DHT segment (the number of codes of each
+// length 1-16, and the symbols in order of increasing code length), along with the
+// code of each symbol derived from it (JPEG Annex C).
+//
+struct HuffmanTable {
+    // number of codes of each length 1-16
+    uchar bits[16];
+
+    // symbols, in order of increasing code length
+    uchar vals[256];
+    int numVals;
+
+    // code and code length of each symbol (length 0 if the symbol has no code)
+    uint16_t codes[256];
+    uchar lengths[256];
+
+    //
+    // Sets the table from DHT fields, and derives the code of each symbol
+    //
+    void build(const uchar *bits, const uchar *vals);
+};
+
+// number of bits the decoder looks ahead to decode most symbols with one lookup
+#define HUFFMAN_LOOKAHEAD_BITS 9
+
+//
+// Decoding tables of a JPEG Huffman table (JPEG F.2.2.3).
+//
+// Codes of up to HUFFMAN_LOOKAHEAD_BITS bits (nearly all symbols in practice) are
+// decoded by a single lookup of the next HUFFMAN_LOOKAHEAD_BITS bits of input.
+// Longer codes fall back to comparing against the largest code of each length.
+//
+struct HuffmanDecodeTable {
+    // (code length << 8) | symbol of each lookahead bit pattern, or 0 if the
+    // pattern is the prefix of a longer code
+    uint16_t lookahead[1 << HUFFMAN_LOOKAHEAD_BITS];
+
+    // largest code of each length 1-16 (-1 if none)
+    int32_t maxCode[17];
+
+    // index of the first symbol of each length in `vals`, minus the length's first code
+    int32_t valOffset[17];
+
+    uchar vals[256];
+
+    //
+    // Builds the decoding tables of the given table
+    //
+    void build(const HuffmanTable &table);
+};
+
 //
 // Huffman encoding tree node
 //
 class HuffmanNode {
 public:
     int val;
-    int freq;
+    uint64_t freq;
     HuffmanNode *left;
     HuffmanNode *right;
 
+    HuffmanNode() = default;
+
     // leaf constructor
-    HuffmanNode(int val, int freq);
+    HuffmanNode(int val, uint64_t freq);
 
     // non-leaf constructor
     HuffmanNode(HuffmanNode *left, HuffmanNode *right);
 };
 
+// number of distinct symbols (bytes) HuffmanEncoder codes
+#define HUFFMAN_SYMBOLS 256
+
+// longest code length JPEG allows
+#define HUFFMAN_MAX_CODE_LENGTH 16
+
+//
+// Builder of optimal JPEG Huffman tables from symbol frequencies, and encoder of
+// byte arrays with them.
+//
+// Tables are built as in JPEG Annex K.2: code lengths from a Huffman tree, limited
+// to 16 bits (K.3), then canonical codes assigned in order of length (K.4, Annex C).
+// A reserved symbol with the lowest frequency keeps the all-ones code unused, as
+// JPEG requires. Tree nodes live in a fixed arena inside the encoder, so building a
+// table does not allocate.
+//
 class HuffmanEncoder {
 private:
-    // encoding tree
-    HuffmanNode *root; 
+    // node arena: leaves (symbols plus the reserved one), then internal nodes
+    HuffmanNode nodes[2 * (HUFFMAN_SYMBOLS + 1)];
 
-    // encodings map, i.e. mapping of the form: byte -> binary string
-    std::map<int, std::string> encodings;
+    // min-heap of the current subtrees (by frequency)
+    HuffmanNode *heap[HUFFMAN_SYMBOLS + 1];
+
+    // current table
+    HuffmanTable table;
 
     //
-    // Builds up encoding tree from given byte array. Expects `data` to be rle-encoding,
-    // see rle.hpp.
+    // Builds up encoding tree from the given frequency of each symbol. Returns the
+    // root (null if no symbol occurs).
     //
-    void buildEncodingTree(std::vector<int> data);
+    HuffmanNode *buildEncodingTree(const uint32_t *freqs);
 
     //
-    // Traverses huffman encoding tree to populate the encodings map
+    // Traverses huffman encoding tree to record the code length (depth) of each leaf
     //
-    void buildEncodingsMap(HuffmanNode *root, std::string code);
+    void findCodeLengths(const HuffmanNode *node, int depth, int *codeLengths);
 
 public:
     //
-    // Huffman encodes given byte array
+    // Builds the optimal table of the given frequency of each symbol (JPEG Annex K.2)
+    // into `table`. Symbols that do not occur get no code.
     //
-    std::vector<uchar> encode(std::vector<int> data, bool debug);
+    void buildTable(const uint32_t *freqs, HuffmanTable &table);
 
+    //
+    // Huffman encodes given byte array (symbols 0-255), packing the codes into bytes
+    // (most significant bit first, the last byte padded with 1 bits)
+    //
+    std::vector<uchar> encode(const std::vector<int> &data, bool debug);
+
+    //
+    // Returns the table of the last `encode` (e.g. to write as a DHT segment)
+    //
+    const HuffmanTable& getTable() const;
+
+    //
+    // Returns the code of each symbol as a binary string (for debugging)
+    //
     std::map<int, std::string> getEncodings();
 };
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image_input.hpp"
+#include "shared.hpp"
+
+MappedFile::MappedFile() : mapping(nullptr), mappedSize(0) {}
+
+MappedFile::~MappedFile() {
+    if (mapping) {
+        munmap(const_cast<uchar*>(mapping), mappedSize);
+    }
+}
+
+//
+// Maps the given file, hinting the kernel that it will be read sequentially.
+// Returns false if the file cannot be opened or mapped (e.g. it is empty).
+//
+bool MappedFile::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    mapping = static_cast<const uchar*>(p);
+    mappedSize = st.st_size;
+    return true;
+}
+
+const uchar *MappedFile::data() const {
+    return mapping;
+}
+
+size_t MappedFile::size() const {
+    return mappedSize;
+}
+
+namespace ImageInput {
+
+    //
+    // Wraps the pixels of the given mapping, from `offset`, as an image of the
+    // given format. Returns an empty image if the file is too short.
+    //
+    static InputImage wrapMapping(const std::shared_ptr<MappedFile> &file, size_t offset,
+                                  const PixelFormat &format, const std::string &path) {
+        InputImage image;
+        size_t bytes = format.rowBytes() * format.height;
+        if (file->size() < offset || file->size() - offset < bytes) {
+            std::cerr << "Image file is truncated: " << path << std::endl;
+            return image;
+        }
+
+        // cv::Mat wants mutable data, but only ever reads input pixels
+        uchar *pixels = const_cast<uchar*>(file->data() + offset);
+        image.pixels = cv::Mat(format.height, format.width, format.channels == 1 ? CV_8UC1 : CV_8UC3,
+                               pixels, format.rowBytes());
+        image.rgb = format.rgb;
+        image.mapping = file;
+        return image;
+    }
+
+    //
+    // Loads the image of the given file. If `rawFormat` has a size, the file holds
+    // raw pixels of that format; otherwise a PPM/PGM is mapped, and other formats
+    // are decoded. Prints an error and returns an empty image on failure.
+    //
+    InputImage load(const std::string &path, const PixelFormat &rawFormat) {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+        bool mapped = file->open(path);
+
+        if (rawFormat.width > 0) {
+            if (!mapped) {
+                std::cerr << "Could not open or find the image: " << path << std::endl;
+                return InputImage();
+            }
+            return wrapMapping(file, 0, rawFormat, path);
+        }
+
+        PixelFormat format;
+        size_t offset;
+        if (mapped && Pnm::parseHeader(file->data(), file->size(), format, offset)) {
+            return wrapMapping(file, offset, format, path);
+        }
+
+        InputImage image;
+        image.pixels = CvImageUtils::loadImage(path);
+        return image;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "row_reader.hpp"
+
+//
+// A read-only memory mapping of a whole file, unmapped on destruction
+//
+class MappedFile {
+private:
+    const uchar *mapping;
+    size_t mappedSize;
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    //
+    // Maps the given file, hinting the kernel that it will be read sequentially.
+    // Returns false if the file cannot be opened or mapped (e.g. it is empty).
+    //
+    bool open(const std::string &path);
+
+    const uchar *data() const;
+    size_t size() const;
+};
+
+//
+// An image to encode: rows of 8-bit pixels (BGR - or RGB, if `rgb` - or gray),
+// either decoded into memory, or pointing straight into a mapping of an
+// uncompressed file, which the image keeps alive
+//
+struct InputImage {
+    cv::Mat pixels;
+    bool rgb = false;
+    std::shared_ptr<MappedFile> mapping;
+
+    bool empty() const {
+        return pixels.empty();
+    }
+};
+
+//
+// Loading of images to encode.
+//
+// Uncompressed images (binary PPM/PGM, and raw BGR frames) are memory-mapped
+// rather than read: their pixel rows are used in place, so no parse, allocation or
+// copy happens before compression, and pages are only faulted in (with sequential
+// read-ahead) as colour conversion reaches them. Anything else is decoded with
+// cv::imread, as CvImageUtils::loadImage does.
+//
+namespace ImageInput {
+
+    //
+    // Loads the image of the given file. If `rawFormat` has a size, the file holds
+    // raw pixels of that format; otherwise a PPM/PGM is mapped, and other formats
+    // are decoded. Prints an error and returns an empty image on failure.
+    //
+    InputImage load(const std::string &path, const PixelFormat &rawFormat = PixelFormat());
+}
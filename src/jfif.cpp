@@ -0,0 +1,129 @@
+#include "jfif.hpp"
+
+namespace Jfif {
+
+    //
+    // SOI and EOI markers
+    //
+    void writeSoi(BitWriter &writer) {
+        writer.writeMarker(MARKER_SOI);
+    }
+
+    void writeEoi(BitWriter &writer) {
+        writer.writeMarker(MARKER_EOI);
+    }
+
+    //
+    // APP0 segment identifying the file as JFIF (version 1.01, square pixels)
+    //
+    void writeApp0(BitWriter &writer) {
+        const uchar identifier[5] = {'J', 'F', 'I', 'F', '\0'};
+
+        writer.writeMarker(MARKER_APP0);
+        writer.writeWord(16);
+        for (uchar c : identifier) {
+            writer.writeByte(c);
+        }
+        writer.writeByte(1); // version
+        writer.writeByte(1);
+        writer.writeByte(0); // units: none, i.e. density is the aspect ratio
+        writer.writeWord(1); // x/y density
+        writer.writeWord(1);
+        writer.writeByte(0); // no thumbnail
+        writer.writeByte(0);
+    }
+
+    //
+    // DQT segment defining the given 8-bit quantisation table, in zig-zag order
+    //
+    void writeDqt(BitWriter &writer, int tableId, const uint16_t *zigZagTable) {
+        writer.writeMarker(MARKER_DQT);
+        writer.writeWord(2 + 1 + 64);
+        writer.writeByte(tableId); // 8-bit precision
+        for (int k = 0; k < 64; k++) {
+            writer.writeByte(static_cast<uchar>(zigZagTable[k]));
+        }
+    }
+
+    //
+    // SOFn segment of a frame of the given dimensions and components
+    //
+    static void writeSof(BitWriter &writer, uchar marker, int width, int height, const JfifComponent *components,
+                         int numComponents) {
+        writer.writeMarker(marker);
+        writer.writeWord(8 + 3 * numComponents);
+        writer.writeByte(8); // sample precision
+        writer.writeWord(height);
+        writer.writeWord(width);
+        writer.writeByte(numComponents);
+        for (int i = 0; i < numComponents; i++) {
+            writer.writeByte(components[i].id);
+            writer.writeByte((components[i].h << 4) | components[i].v);
+            writer.writeByte(components[i].quantTable);
+        }
+    }
+
+    //
+    // SOF0 (baseline) / SOF2 (progressive) segment of a frame of the given
+    // dimensions and components
+    //
+    void writeSof0(BitWriter &writer, int width, int height, const JfifComponent *components, int numComponents) {
+        writeSof(writer, MARKER_SOF0, width, height, components, numComponents);
+    }
+
+    void writeSof2(BitWriter &writer, int width, int height, const JfifComponent *components, int numComponents) {
+        writeSof(writer, MARKER_SOF2, width, height, components, numComponents);
+    }
+
+    //
+    // DHT segment defining the given table. `tableClass` is 0 for DC, 1 for AC.
+    //
+    void writeDht(BitWriter &writer, int tableClass, int tableId, const HuffmanTable &table) {
+        writer.writeMarker(MARKER_DHT);
+        writer.writeWord(2 + 1 + 16 + table.numVals);
+        writer.writeByte((tableClass << 4) | tableId);
+        for (int l = 0; l < 16; l++) {
+            writer.writeByte(table.bits[l]);
+        }
+        for (int i = 0; i < table.numVals; i++) {
+            writer.writeByte(table.vals[i]);
+        }
+    }
+
+    //
+    // DRI segment setting the restart interval (in MCUs) of the following scans
+    //
+    void writeDri(BitWriter &writer, int restartInterval) {
+        writer.writeMarker(MARKER_DRI);
+        writer.writeWord(4);
+        writer.writeWord(restartInterval);
+    }
+
+    //
+    // RSTn marker ending restart interval `interval` (0-based) of a scan, numbered
+    // modulo 8 (JPEG B.2.1). BitWriter::writeMarker pads the interval's last
+    // byte with 1 bits first.
+    //
+    void writeRst(BitWriter &writer, int interval) {
+        writer.writeMarker(MARKER_RST0 + (interval & 7));
+    }
+
+    //
+    // SOS segment of a scan of the given components: a sequential scan of all
+    // coefficients, or a progressive scan of zig-zag positions [ss, se] at
+    // successive approximation bit positions `ah` (previous) and `al` (current)
+    //
+    void writeSos(BitWriter &writer, const JfifComponent *components, int numComponents,
+                  int ss, int se, int ah, int al) {
+        writer.writeMarker(MARKER_SOS);
+        writer.writeWord(6 + 2 * numComponents);
+        writer.writeByte(numComponents);
+        for (int i = 0; i < numComponents; i++) {
+            writer.writeByte(components[i].id);
+            writer.writeByte((components[i].dcTable << 4) | components[i].acTable);
+        }
+        writer.writeByte(ss);             // spectral selection start
+        writer.writeByte(se);             // spectral selection end
+        writer.writeByte((ah << 4) | al); // successive approximation
+    }
+}
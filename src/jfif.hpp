@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+
+#include "bit_writer.hpp"
+#include "huffman.hpp"
+
+// largest restart interval (MCUs) a DRI segment holds
+#define MAX_RESTART_INTERVAL 65535
+
+// largest image width or height a SOF segment holds
+#define MAX_IMAGE_DIMENSION 65535
+
+//
+// JPEG marker codes (the byte following 0xFF)
+//
+enum JpegMarker {
+    MARKER_SOF0 = 0xC0, // start of frame (baseline DCT)
+    MARKER_SOF1 = 0xC1, // start of frame (extended sequential DCT)
+    MARKER_SOF2 = 0xC2, // start of frame (progressive DCT)
+    MARKER_SOF15 = 0xCF,// last start of frame (SOF4, 8 and 12 are other markers)
+    MARKER_DHT = 0xC4,  // define Huffman table(s)
+    MARKER_JPG = 0xC8,  // reserved
+    MARKER_DAC = 0xCC,  // define arithmetic coding conditioning(s)
+    MARKER_RST0 = 0xD0, // restart interval termination (RST0-7)
+    MARKER_RST7 = 0xD7,
+    MARKER_SOI = 0xD8,  // start of image
+    MARKER_EOI = 0xD9,  // end of image
+    MARKER_SOS = 0xDA,  // start of scan
+    MARKER_DQT = 0xDB,  // define quantisation table(s)
+    MARKER_DRI = 0xDD,  // define restart interval
+    MARKER_APP0 = 0xE0  // application segment 0 (JFIF)
+};
+
+//
+// A colour component of a frame, with the tables it is coded with
+//
+struct JfifComponent {
+    int id;
+    int h, v;       // sampling factors
+    int quantTable;
+    int dcTable;
+    int acTable;
+};
+
+//
+// Writers of the marker segments of a JFIF file (JPEG Annex B, JFIF 1.02)
+//
+namespace Jfif {
+
+    //
+    // SOI and EOI markers
+    //
+    void writeSoi(BitWriter &writer);
+    void writeEoi(BitWriter &writer);
+
+    //
+    // APP0 segment identifying the file as JFIF (version 1.01, square pixels)
+    //
+    void writeApp0(BitWriter &writer);
+
+    //
+    // DQT segment defining the given 8-bit quantisation table, in zig-zag order
+    //
+    void writeDqt(BitWriter &writer, int tableId, const uint16_t *zigZagTable);
+
+    //
+    // SOF0 (baseline) / SOF2 (progressive) segment of a frame of the given
+    // dimensions and components
+    //
+    void writeSof0(BitWriter &writer, int width, int height, const JfifComponent *components, int numComponents);
+    void writeSof2(BitWriter &writer, int width, int height, const JfifComponent *components, int numComponents);
+
+    //
+    // DHT segment defining the given table. `tableClass` is 0 for DC, 1 for AC.
+    //
+    void writeDht(BitWriter &writer, int tableClass, int tableId, const HuffmanTable &table);
+
+    //
+    // DRI segment setting the restart interval (in MCUs) of the following scans
+    //
+    void writeDri(BitWriter &writer, int restartInterval);
+
+    //
+    // RSTn marker ending restart interval `interval` (0-based) of a scan, numbered
+    // modulo 8 (JPEG B.2.1). BitWriter::writeMarker pads the interval's last
+    // byte with 1 bits first.
+    //
+    void writeRst(BitWriter &writer, int interval);
+
+    //
+    // SOS segment of a scan of the given components: a sequential scan of all
+    // coefficients, or a progressive scan of zig-zag positions [ss, se] at
+    // successive approximation bit positions `ah` (previous) and `al` (current)
+    //
+    void writeSos(BitWriter &writer, const JfifComponent *components, int numComponents,
+                  int ss = 0, int se = 63, int ah = 0, int al = 0);
+}
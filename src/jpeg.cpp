@@ -1,12 +1,30 @@
 #include <opencv2/opencv.hpp>
+#include <algorithm>
 #include <iostream>
 #include <typeinfo>
 #include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 
 #include "pre_computed.hpp"
+#include "dct.hpp"
 #include "huffman.hpp"
 #include "shared.hpp"
 #include "rle.hpp"
+#include "thread_pool.hpp"
+#include "plane.hpp"
+#include "color.hpp"
+#include "sampling.hpp"
+#include "jpeg.hpp"
+#include "jpeg_encoder.hpp"
+#include "jpeg_decoder.hpp"
+#include "batch.hpp"
+#include "metrics.hpp"
+#include "row_reader.hpp"
+#include "image_input.hpp"
+#include "profile.hpp"
 
 //
 // Pads given image to ensure its dimensions are a multiple of 'blockSize'
@@ -82,170 +100,480 @@ cv::Mat ycbcrToBgr(cv::Mat ycbcrImage) {
 }
 
 //
-// Performs DCT step on the given 8x8 block
+// Copies the given 8x8 CV_32F block into a flat, row-major array
 //
-void dctBlock(cv::Mat dctBlock, cv::Mat block, JpegElements &jpegElements) {
-    float temp;
-    int N = block.rows;
-    int u,v,i,j;
-    for (u = 0; u < N; u++) {
-        for (v = 0; v < N; v++) {
-            temp = 0.0;
-            for (i = 0; i < N; i++) {
-                for (j = 0; j < N; j++) {
-                    temp += jpegElements.dct_cosines[i][u] * 
-                            jpegElements.dct_cosines[j][v] * 
-                            block.at<float>(i, j);
-                }
-            }
-            temp *= (0.25) * jpegElements.dct_coefs[u][v];
-            dctBlock.at<float>(u, v) = temp;
+static void blockToArray(float *arr, cv::Mat block) {
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        const float *row = block.ptr<float>(r);
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            arr[r*BLOCK_SIZE + c] = row[c];
+        }
+    }
+}
+
+//
+// Copies the given flat, row-major array into an 8x8 CV_32F block
+//
+static void arrayToBlock(cv::Mat block, const float *arr) {
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        float *row = block.ptr<float>(r);
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            row[c] = arr[r*BLOCK_SIZE + c];
         }
     }
 }
 
 //
-// Performs the inverse DCT step on the given 8x8 block
+// Performs DCT step on the given 8x8 block (see dct.hpp)
+//
+void dctBlock(cv::Mat dctBlock, cv::Mat block, JpegElements &jpegElements) {
+    float arr[BLOCK_SIZE*BLOCK_SIZE];
+    blockToArray(arr, block);
+    Dct::forwardDct(arr, arr, jpegElements);
+    arrayToBlock(dctBlock, arr);
+}
+
+//
+// Performs the inverse DCT step on the given 8x8 block (see dct.hpp)
 //
 void inverseDctBlock(cv::Mat invBlock, cv::Mat dctBlock, JpegElements &jpegElements) {
-    float temp;
-    int N = dctBlock.rows;
-    int i,j,u,v;
-    for (i = 0; i < N; i++) {
-        for (j = 0; j < N; j++) {
-            temp = 0.0;
-            for (u = 0; u < N; u++) {
-                for (v = 0; v < N; v++) {
-                    temp += jpegElements.dct_coefs[u][v] *
-                            jpegElements.dct_cosines[i][u] * 
-                            jpegElements.dct_cosines[j][v] * 
-                            dctBlock.at<float>(u, v);
-                            
-                }
-            }
-            temp *= (0.25);
-            invBlock.at<float>(i, j) = temp;
+    float arr[BLOCK_SIZE*BLOCK_SIZE];
+    blockToArray(arr, dctBlock);
+    Dct::inverseDct(arr, arr, jpegElements);
+    arrayToBlock(invBlock, arr);
+}
+
+//
+// Performs quantisation step on the given flat 8x8 block, with the given
+// (flat) quantisation matrix
+//
+void quantiseBlock(float *quantBlock, const float *dctBlock, const float *quantisationMatrix) {
+    for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+        quantBlock[i] = round(dctBlock[i] / quantisationMatrix[i]);
+    }
+}
+
+//
+// Performs quantisation step on the given 8x8 block of integer DCT coefficients.
+// `divisors` have the integer DCT's output scaling folded in (see pre_computed.hpp).
+// Rounds half away from zero, like quantiseBlock.
+//
+void quantiseBlockInt(int32_t *quantBlock, const int32_t *dctBlock, const int32_t *divisors) {
+    int32_t coef, divisor;
+    for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+        coef = dctBlock[i];
+        divisor = divisors[i];
+        if (coef < 0) {
+            quantBlock[i] = -((divisor / 2 - coef) / divisor);
+        } else {
+            quantBlock[i] = (coef + divisor / 2) / divisor;
         }
     }
 }
 
 //
-// Performs quantisation step on the given 8x8 block
+// Rounds half away from zero, like round(), but inline. The fraction x - trunc(x)
+// is exact, so ties are decided exactly (unlike trunc(x +- 0.5)).
 //
-void quantiseBlock(cv::Mat quantBlock, cv::Mat dctBlock, int i, JpegElements &jpegElements) {
-    cv::Mat quantisationMatrix = jpegElements.getQuantisationMatrix(i);
-    for (int r = 0; r < BLOCK_SIZE; r++) {
-        for (int c = 0; c < BLOCK_SIZE; c++) {
-            float currIntensity = dctBlock.at<float>(r, c);
-            quantBlock.at<float>(r, c) = round(currIntensity / quantisationMatrix.at<float>(r, c));
+static inline int roundHalfAway(float x) {
+    int t = static_cast<int>(x);
+    float fraction = x - t;
+    return t + (fraction >= 0.5f) - (fraction <= -0.5f);
+}
+
+//
+// Fused quantisation and zig-zag reordering: quantises the given flat 8x8 block of
+// float DCT coefficients by multiplying with the table's reciprocals, rounding half
+// away from zero, and writes the results in zig-zag order to `zigZagOut`.
+//
+// AC coefficients are clamped to the +-1023 that baseline JPEG can code.
+// Returns the (zig-zag) index of the last nonzero AC coefficient, or 0 if there is none.
+//
+int quantiseZigZag(const float *dctBlock, const QuantTable &table, const int *zigZagOrder, int16_t *zigZagOut) {
+    zigZagOut[0] = static_cast<int16_t>(roundHalfAway(dctBlock[0] * table.reciprocals[0]));
+
+    int last = 0;
+    for (int k = 1; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        int q = MathUtils::clamp(roundHalfAway(dctBlock[zigZagOrder[k]] * table.reciprocals[k]), -1023, 1023);
+        zigZagOut[k] = static_cast<int16_t>(q);
+        last = q ? k : last;
+    }
+    return last;
+}
+
+//
+// Fused quantisation and zig-zag reordering of the given flat 8x8 block of integer
+// DCT coefficients, as quantiseZigZag. Multiplies by the table's fixed point
+// reciprocals for the given DCT method, which gives exactly the quotients of
+// quantiseBlockInt (see JpegElements::buildQuantTable).
+//
+int quantiseZigZagInt(const int32_t *dctBlock, const QuantTable &table, DctMethod dctMethod,
+                      const int *zigZagOrder, int16_t *zigZagOut) {
+    const uint32_t *reciprocals = table.intReciprocals[dctMethod - 1];
+    const int32_t *biases = table.intBiases[dctMethod - 1];
+
+    int last = 0;
+    for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        int32_t coef = dctBlock[zigZagOrder[k]];
+        uint32_t n = static_cast<uint32_t>((coef < 0 ? -coef : coef) + biases[k]);
+        int q = static_cast<int>((static_cast<uint64_t>(n) * reciprocals[k]) >> 31);
+        q = coef < 0 ? -q : q;
+        if (k > 0) {
+            q = MathUtils::clamp(q, -1023, 1023);
+            last = q ? k : last;
         }
+        zigZagOut[k] = static_cast<int16_t>(q);
     }
+    return last;
 }
 
 //
-// Convert 8x8 block into zig-zag ordered 64-d array
+// Index of the last nonzero AC coefficient of the given block in zig-zag order
+// (0 if there is none)
 //
-std::vector<int> blockToZigZag(cv::Mat block, JpegElements &jpegElements) {
-    std::vector<int> res;
+static inline int lastNonzero(const int16_t *zigZag) {
+    int last = 0;
+    for (int k = 1; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        last = zigZag[k] ? k : last;
+    }
+    return last;
+}
 
-    if (jpegElements.zig_zag_indices.size() != BLOCK_SIZE*BLOCK_SIZE) {
-        std::cout << "Fatal: incorrect block size" << "\n";
-        return res;
+//
+// Quantisation of the given flat 8x8 block of float DCT coefficients that are
+// already in zig-zag order, as quantiseZigZag (with identical results). Without
+// the gather (and with an inline clamp), the loop vectorises.
+//
+int quantiseReordered(const float *zigZagBlock, const QuantTable &table, int16_t *zigZagOut) {
+    for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        int q = roundHalfAway(zigZagBlock[k] * table.reciprocals[k]);
+        zigZagOut[k] = static_cast<int16_t>(std::min(std::max(q, -1023), 1023));
     }
-    
-    int r, c;
-    int val = 0;
-    std::pair<int, int> pos;
+    zigZagOut[0] = static_cast<int16_t>(roundHalfAway(zigZagBlock[0] * table.reciprocals[0]));
+    return lastNonzero(zigZagOut);
+}
 
-    for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
-        pos = jpegElements.zig_zag_indices[i];
-        r = pos.first; c = pos.second;
-        val = static_cast<int>(block.at<float>(r, c));
-        res.push_back(val);
+//
+// Quantisation of the given flat 8x8 block of integer DCT coefficients that are
+// already in zig-zag order, as quantiseZigZagInt (with identical results)
+//
+int quantiseReorderedInt(const int32_t *zigZagBlock, const QuantTable &table, DctMethod dctMethod,
+                         int16_t *zigZagOut) {
+    const uint32_t *reciprocals = table.intReciprocals[dctMethod - 1];
+    const int32_t *biases = table.intBiases[dctMethod - 1];
+
+    int dc = 0;
+    for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        int32_t coef = zigZagBlock[k];
+        uint32_t n = static_cast<uint32_t>((coef < 0 ? -coef : coef) + biases[k]);
+        int q = static_cast<int>((static_cast<uint64_t>(n) * reciprocals[k]) >> 31);
+        q = coef < 0 ? -q : q;
+        dc = k == 0 ? q : dc;
+        zigZagOut[k] = static_cast<int16_t>(std::min(std::max(q, -1023), 1023));
     }
+    zigZagOut[0] = static_cast<int16_t>(dc);
+    return lastNonzero(zigZagOut);
+}
 
-    return res;
+//
+// Rounds (half to even, like cv::Mat::convertTo) and saturates to a byte
+//
+static inline uchar saturateToByte(float v) {
+    return static_cast<uchar>(MathUtils::clamp(static_cast<int>(lrintf(v)), 0, 255));
 }
 
 //
-// For given block, apply jpeg, then reverse steps to produce compressed block
+// For given block, apply jpeg using the given integer DCT method, then reverse steps
+// to produce compressed block. Integer arithmetic only, so output is bit-exact.
 //
-cv::Mat jpegBlockForwardReverse(cv::Mat block, int quantMatrixIndex, JpegElements &jpegElements, bool debug) {
+void jpegBlockForwardReverseInt(const uchar *block, int blockStride, uchar *outBlock, int outStride,
+                                int quantMatrixIndex, DctMethod dctMethod, JpegElements &jpegElements,
+                                BlockScratch &scratch, bool debug) {
+    int32_t *samples = scratch.intSamples;
+    int32_t *coefs = scratch.intCoefs;
+    int32_t *quantBlock = scratch.intQuant;
+
+    // pre-process (level shift, keeping integer DCT inputs in their expected range)
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            samples[r*BLOCK_SIZE + c] = block[r*blockStride + c] - 128;
+        }
+    }
+
+    // dct, then undo the level shift (a flat block of 128 has DC 1024, scaled up by 8)
+    if (dctMethod == DCT_ISLOW) {
+        Dct::forwardDctIslow(samples, coefs);
+    } else {
+        Dct::forwardDctIfast(samples, coefs);
+    }
+    coefs[0] += 1024 * 8;
+
+    // quantise block
+    quantiseBlockInt(quantBlock, coefs, jpegElements.getIntQuantDivisors(dctMethod, quantMatrixIndex));
+
+    // inverse dct (re-using the samples buffer)
+    const int32_t *multipliers = jpegElements.getIntIdctMultipliers(dctMethod);
+    if (dctMethod == DCT_ISLOW) {
+        Dct::inverseDctIslow(quantBlock, samples, multipliers);
+    } else {
+        Dct::inverseDctIfast(quantBlock, samples, multipliers);
+    }
+
+    // convert back to uchar
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            outBlock[r*outStride + c] = MathUtils::clamp(samples[r*BLOCK_SIZE + c], 0, 255);
+        }
+    }
+
+    if (debug) {
+        std::cout << "Init" << "\n" << cv::Mat(BLOCK_SIZE, BLOCK_SIZE, CV_8UC1, (void*) block, blockStride) << "\n" << "\n";
+        std::cout << "Quantised" << "\n" << cv::Mat(BLOCK_SIZE, BLOCK_SIZE, CV_32S, quantBlock) << "\n" << "\n";
+        std::cout << "Converted back" << "\n" << cv::Mat(BLOCK_SIZE, BLOCK_SIZE, CV_8UC1, outBlock, outStride) << "\n" << "\n";
+    }
+}
+
+//
+// For given block, apply jpeg, then reverse steps to produce compressed block.
+// Reads the 8x8 block at `block` and writes the compressed block to `outBlock`
+// (row strides given in bytes), using only the given scratch space.
+//
+void jpegBlockForwardReverse(const uchar *block, int blockStride, uchar *outBlock, int outStride,
+                             int quantMatrixIndex, DctMethod dctMethod, JpegElements &jpegElements,
+                             BlockScratch &scratch, bool debug) {
+    if (dctMethod != DCT_FLOAT) {
+        jpegBlockForwardReverseInt(block, blockStride, outBlock, outStride, quantMatrixIndex,
+                                   dctMethod, jpegElements, scratch, debug);
+        return;
+    }
+
     // pre-process
-    cv::Mat floatBlock;
-    block.convertTo(floatBlock, CV_32F);
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            scratch.samples[r*BLOCK_SIZE + c] = block[r*blockStride + c];
+        }
+    }
 
     // dct
-    cv::Mat dctResultBlock(8, 8, CV_32F);
-    dctBlock(dctResultBlock, floatBlock, jpegElements);
-    
+    Dct::forwardDct(scratch.samples, scratch.coefs, jpegElements);
+
     // quantise block
-    cv::Mat quantBlock(8, 8, CV_32F);
-    quantiseBlock(quantBlock, dctResultBlock, quantMatrixIndex, jpegElements);
-    
-    // inverse dct
-    cv::Mat invDctBlock(8, 8, CV_32F);
-    inverseDctBlock(invDctBlock, quantBlock, jpegElements);
-    
+    quantiseBlock(scratch.quant, scratch.coefs, &jpegElements.QUANTISATION_MATRIX[quantMatrixIndex][0][0]);
+
+    // inverse dct (re-using the samples buffer)
+    Dct::inverseDct(scratch.quant, scratch.samples, jpegElements);
+
     // convert back to uchar
-    cv::Mat finalBlock;
-    invDctBlock.convertTo(finalBlock, CV_8UC1);
-    
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            outBlock[r*outStride + c] = saturateToByte(scratch.samples[r*BLOCK_SIZE + c]);
+        }
+    }
+
     if (debug) {
-        std::cout << "Init" << "\n" << block << "\n" << "\n";
-        std::cout << "DCT'd" << "\n" << dctResultBlock << "\n" << "\n";
-        std::cout << "Quantised" << "\n" << quantBlock << "\n" << "\n";
-        std::cout << "Converted back" << "\n" << finalBlock << "\n" << "\n";
+        std::cout << "Init" << "\n" << cv::Mat(BLOCK_SIZE, BLOCK_SIZE, CV_8UC1, (void*) block, blockStride) << "\n" << "\n";
+        std::cout << "DCT'd" << "\n" << cv::Mat(BLOCK_SIZE, BLOCK_SIZE, CV_32F, scratch.coefs) << "\n" << "\n";
+        std::cout << "Quantised" << "\n" << cv::Mat(BLOCK_SIZE, BLOCK_SIZE, CV_32F, scratch.quant) << "\n" << "\n";
+        std::cout << "Converted back" << "\n" << cv::Mat(BLOCK_SIZE, BLOCK_SIZE, CV_8UC1, outBlock, outStride) << "\n" << "\n";
     }
+}
 
-    return finalBlock;
+//
+// Applies the level shift and the forward DCT of the given method to the given
+// block, writing its (unquantised) coefficients to `coefs` for the float DCT, or
+// to `intCoefs` for the integer DCTs
+//
+void jpegBlockDct(const uchar *block, int blockStride, float *coefs, int32_t *intCoefs,
+                  DctMethod dctMethod, JpegElements &jpegElements, BlockScratch &scratch) {
+    if (dctMethod == DCT_FLOAT) {
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            for (int c = 0; c < BLOCK_SIZE; c++) {
+                scratch.samples[r*BLOCK_SIZE + c] = block[r*blockStride + c] - 128.0f;
+            }
+        }
+        Dct::forwardDct(scratch.samples, coefs, jpegElements);
+        return;
+    }
+
+    int32_t *samples = scratch.intSamples;
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            samples[r*BLOCK_SIZE + c] = block[r*blockStride + c] - 128;
+        }
+    }
+    if (dctMethod == DCT_ISLOW) {
+        Dct::forwardDctIslow(samples, intCoefs);
+    } else {
+        Dct::forwardDctIfast(samples, intCoefs);
+    }
+}
+
+//
+// Applies the forward JPEG steps (level shift, DCT, quantisation) to the given
+// block, writing its quantised coefficients in zig-zag order to `zigZagOut`.
+//
+// AC coefficients are clamped to the +-1023 that baseline JPEG can code.
+// Returns the (zig-zag) index of the last nonzero AC coefficient, or 0 if there is none.
+//
+int jpegBlockForward(const uchar *block, int blockStride, int16_t *zigZagOut,
+                     const QuantTable &quantTable, DctMethod dctMethod, JpegElements &jpegElements,
+                     BlockScratch &scratch) {
+    jpegBlockDct(block, blockStride, scratch.coefs, scratch.intCoefs, dctMethod, jpegElements, scratch);
+    if (dctMethod == DCT_FLOAT) {
+        return quantiseZigZag(scratch.coefs, quantTable, jpegElements.zig_zag_order, zigZagOut);
+    }
+    return quantiseZigZagInt(scratch.intCoefs, quantTable, dctMethod, jpegElements.zig_zag_order, zigZagOut);
+}
+
+//
+// Applies the inverse JPEG steps (dequantisation, inverse DCT, level shift) to the
+// given block of quantised coefficients in zig-zag order, writing the 8x8 block of
+// samples to `outBlock`. `multipliers` dequantise for the given DCT method (see
+// JpegElements::computeIdctMultipliers).
+//
+void jpegBlockInverse(const int16_t *zigZag, const int32_t *multipliers, uchar *outBlock, int outStride,
+                      DctMethod dctMethod, JpegElements &jpegElements, BlockScratch &scratch) {
+    const int *order = jpegElements.zig_zag_order;
+
+    if (dctMethod == DCT_FLOAT) {
+        for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+            scratch.coefs[order[k]] = static_cast<float>(zigZag[k] * multipliers[order[k]]);
+        }
+        Dct::inverseDct(scratch.coefs, scratch.samples, jpegElements);
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            for (int c = 0; c < BLOCK_SIZE; c++) {
+                outBlock[r*outStride + c] = saturateToByte(scratch.samples[r*BLOCK_SIZE + c] + 128.0f);
+            }
+        }
+        return;
+    }
+
+    int32_t *samples = scratch.intSamples;
+    for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        scratch.intCoefs[order[k]] = zigZag[k];
+    }
+    if (dctMethod == DCT_ISLOW) {
+        Dct::inverseDctIslow(scratch.intCoefs, samples, multipliers);
+    } else {
+        Dct::inverseDctIfast(scratch.intCoefs, samples, multipliers);
+    }
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            outBlock[r*outStride + c] = MathUtils::clamp(samples[r*BLOCK_SIZE + c] + 128, 0, 255);
+        }
+    }
 }
 
 //
 // Apply jpeg to image, then reverse it and re-construct compressed form.
+// Unless `metrics` is off, reports the quality and size of the file the same
+// settings encode (see JpegEncoder::measure), as `jpegEncode` does: the displayed
+// reconstruction skips dequantisation, so is not what that file decodes to.
 //
-int jpegForwardReverse(std::string imageFilePath, int quantMatrixIndex) {
-    JpegElements jpegElements = JpegElements();
+int jpegForwardReverse(std::string imageFilePath, int quantMatrixIndex, DctMethod dctMethod,
+                       Subsampling subsampling, int numThreads, MetricsMode metrics) {
+    JpegElements jpegElements;
 
     // load image
-    cv::Mat image = CvImageUtils::loadImage(imageFilePath);
+    cv::Mat image;
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_READ);
+        image = CvImageUtils::loadImage(imageFilePath);
+        timer.setCounts(0, image.total() * image.elemSize(), image.total() * image.elemSize());
+    }
+    if (image.empty()) {
+        return 1;
+    }
     std::cout << "loaded image: " << imageFilePath << "\n";
 
     CvImageUtils::displayImage(image, "Before (" + imageFilePath + ")");
 
-    // pad to make dimensions multiple of BLOCK_SIZE
-    cv::Mat paddedImage = padForJpeg(image, 8);
-
-    // convert to Y, Cr, Cb format
-    cv::Mat ycbcrImage = bgrToYcbcr(paddedImage);
-
-    // split into channels
-    std::vector<cv::Mat> channels;
-    split(ycbcrImage, channels);
-    
-    int M = ycbcrImage.rows, N = ycbcrImage.cols, nChannels = 3;
-    cv::Mat currChannel, block, invDctBlock;
-
-    std::vector<cv::Mat> invChannels;
-
-    for (int channel = 0; channel < nChannels; channel++) {
-        currChannel = channels[channel];
-        cv::Mat invChannel = cv::Mat(M, N, CV_8UC1, cv::Scalar(0));
-        for (int r = 0; r < M; r+=8) {
-            for (int c = 0; c < N; c+=8) {
-                cv::Rect blockRect(c, r, 8, 8);
-                block = currChannel(blockRect).clone();
-                invDctBlock = jpegBlockForwardReverse(block, quantMatrixIndex, jpegElements, false);
-                invDctBlock.copyTo(invChannel(blockRect));
+    ThreadPool pool(numThreads);
+
+    // convert to Y, Cr, Cb channel planes, padded to make dimensions multiple of the MCU size
+    const int nChannels = 3;
+    int mcuWidth = Sampling::mcuWidth(subsampling), mcuHeight = Sampling::mcuHeight(subsampling);
+    int M = (image.rows + mcuHeight - 1) / mcuHeight * mcuHeight;
+    int N = (image.cols + mcuWidth - 1) / mcuWidth * mcuWidth;
+    Plane<uchar> planes[nChannels], invPlanes[nChannels];
+    uint64_t planeBytes = static_cast<uint64_t>(N) * M;
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_COLOR);
+        timer.setCounts(0, image.total() * image.elemSize(), planeBytes * nChannels);
+        Color::bgrToYcbcrPlanes(image, planes, N, M, pool);
+    }
+
+    // subsample chroma
+    int h = Sampling::lumaH(subsampling), v = Sampling::lumaV(subsampling);
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_SAMPLING);
+        timer.setCounts(0, 2 * planeBytes, 2 * planeBytes / (h * v));
+        for (int channel = 1; channel < nChannels; channel++) {
+            Plane<uchar> fullPlane = std::move(planes[channel]);
+            Sampling::downsample(fullPlane, planes[channel], h, v, pool);
+        }
+    }
+
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_TRANSFORM);
+
+        // block rows of each channel, laid out one channel after the other
+        int blockRowOffsets[nChannels + 1] = {0};
+        uint64_t blocks = 0;
+        for (int channel = 0; channel < nChannels; channel++) {
+            invPlanes[channel].create(planes[channel].width, planes[channel].height);
+            blockRowOffsets[channel + 1] = blockRowOffsets[channel] + planes[channel].height / BLOCK_SIZE;
+            blocks += static_cast<uint64_t>(planes[channel].width) * planes[channel].height / 64;
+        }
+        timer.setCounts(blocks, blocks * 64, blocks * 64);
+
+        // one task per block row of each channel. Tasks write disjoint block rows,
+        // so output is identical for any number of threads.
+        pool.parallelFor(blockRowOffsets[nChannels], [&](int task) {
+            int channel = 0;
+            while (task >= blockRowOffsets[channel + 1]) {
+                channel++;
+            }
+            int r = (task - blockRowOffsets[channel]) * BLOCK_SIZE;
+            const Plane<uchar> &plane = planes[channel];
+            Plane<uchar> &invPlane = invPlanes[channel];
+            BlockScratch scratch;
+            for (int c = 0; c < plane.width; c+=8) {
+                jpegBlockForwardReverse(plane.row(r) + c, plane.stride, invPlane.row(r) + c, invPlane.stride,
+                                        quantMatrixIndex, dctMethod, jpegElements, scratch, false);
             }
+        });
+    }
+
+    // upsample chroma back to full resolution
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_SAMPLING);
+        timer.setCounts(0, 2 * planeBytes / (h * v), 2 * planeBytes);
+        for (int channel = 1; channel < nChannels; channel++) {
+            Plane<uchar> subsampledPlane = std::move(invPlanes[channel]);
+            Sampling::upsample(subsampledPlane, invPlanes[channel], h, v, pool);
         }
-        invChannels.push_back(invChannel);
     }
 
     // reconstruct and display final image
-    cv::Mat reconstructedImage;
-    merge(invChannels, reconstructedImage);
-    cv::Mat finalImage = ycbcrToBgr(reconstructedImage);
+    cv::Mat finalImage;
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_COLOR);
+        timer.setCounts(0, planeBytes * nChannels, image.total() * image.elemSize());
+        finalImage = Color::ycbcrPlanesToBgr(invPlanes, image.cols, image.rows, pool);
+    }
+
+    if (metrics != METRICS_OFF) {
+        EncoderOptions options;
+        options.quantMatrixIndex = quantMatrixIndex;
+        options.dctMethod = dctMethod;
+        options.subsampling = subsampling;
+        options.threads = numThreads;
+        JpegEncoder encoder(options);
+        std::ostringstream jpeg;
+        size_t bytes = encoder.encode(image, jpeg);
+        Metrics::print(std::cout, encoder.measure(image, false, bytes), metrics == METRICS_JSON);
+    }
     CvImageUtils::displayImage(finalImage, "After (" + imageFilePath + ")");
 
     // cleanup
@@ -253,54 +581,222 @@ int jpegForwardReverse(std::string imageFilePath, int quantMatrixIndex) {
     return 0;
 }
 
-////////////////////////////////////////
-// Run
-////////////////////////////////////////
+//
+// Encode image as a baseline JPEG file, reporting compressed size and throughput.
+// Uncompressed inputs (PPM/PGM, or raw pixels of the given format) are memory-mapped,
+// so the encode time includes reading them. Unless `metrics` is off, reports the
+// quality of the encoded image (see JpegEncoder::measure).
+//
+int jpegEncode(std::string imageFilePath, std::string outFilePath, const EncoderOptions &options,
+               const PixelFormat &rawFormat, MetricsMode metrics) {
+    InputImage input;
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_READ);
+        input = ImageInput::load(imageFilePath, rawFormat);
+        uint64_t pixelBytes = input.pixels.total() * input.pixels.elemSize();
+        timer.setCounts(0, pixelBytes, pixelBytes);
+    }
+    if (input.empty()) {
+        return 1;
+    }
+    const cv::Mat &image = input.pixels;
+
+    std::ofstream outFile(outFilePath, std::ios::binary);
+    if (!outFile) {
+        std::cout << "Could not open output file: " << outFilePath << "\n";
+        return 1;
+    }
 
-struct CliArgs {
-    std::string imagePath;      
+    JpegEncoder encoder(options);
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes = encoder.encode(image, outFile, input.rgb);
+    auto end = std::chrono::steady_clock::now();
+    if (bytes == 0) {
+        std::cout << "Could not encode " << imageFilePath << ": " << encoder.error() << "\n";
+        outFile.close();
+        std::remove(outFilePath.c_str());
+        return 1;
+    }
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_WRITE);
+        timer.setCounts(0, bytes, bytes);
+        outFile.close();
+    }
+    if (!outFile) {
+        std::cout << "Could not write output file: " << outFilePath << "\n";
+        return 1;
+    }
 
-    // quantisation matrix to use - default 3 (best performing so far)
-    int qmi = 3;           
-};
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double inputBytes = static_cast<double>(image.total()) * image.elemSize();
+    std::cout << "wrote " << outFilePath << ": " << bytes << " bytes ("
+              << 8.0 * bytes / image.total() << " bits/pixel, "
+              << inputBytes / bytes << ":1, "
+              << (options.entropy == ENTROPY_RANS ? "rANS coded"
+                  : options.progressive ? "progressive, optimized Huffman tables"
+                  : options.huffman == HUFFMAN_OPTIMIZED ? "optimized Huffman tables" : "standard Huffman tables")
+              << ")" << "\n";
+    std::cout << "encoded in " << seconds * 1000 << " ms ("
+              << inputBytes / 1e6 / seconds << " MB/s)" << "\n";
+    if (options.targetBytes > 0 || options.targetPsnr > 0) {
+        const RateResult &rate = encoder.rateResult();
+        std::cout << "quality " << rate.quality << (rate.met ? "" : " (target not met)") << ": "
+                  << rate.candidates << " candidates estimated, " << rate.encodes << " encoded" << "\n";
+    }
 
-std::string usage() {
-    std::ostringstream oss;
-    oss << "Usage: myjpeg {image_file_path} [--qmi=N]" << "\n\n";
-    oss << "Note - valid N values: {0,1,2,3} (increasing orders of quantisation)" << "\n";
-    return oss.str();
+    if (metrics != METRICS_OFF) {
+        Metrics::print(std::cout, encoder.measure(image, input.rgb, bytes), metrics == METRICS_JSON, outFilePath);
+    }
+    return 0;
 }
 
-CliArgs parseCliArgs(int argc, char* argv[]) {
-    CliArgs args;
+//
+// Encode a PPM/PGM image (or raw BGR pixels of the given size) from a file or
+// stdin ("-") as a baseline JPEG, streaming it a strip at a time, to a file or
+// stdout ("-"). Reports go to stderr when the JPEG goes to stdout.
+//
+int jpegEncodeStream(std::string inFilePath, std::string outFilePath, const EncoderOptions &options,
+                     const PixelFormat &rawFormat) {
+    std::ostream &log = outFilePath == "-" ? std::cerr : std::cout;
+
+    std::ifstream inFile;
+    if (inFilePath != "-") {
+        inFile.open(inFilePath, std::ios::binary);
+        if (!inFile) {
+            log << "Could not open file: " << inFilePath << "\n";
+            return 1;
+        }
+    }
+    std::istream &in = inFilePath == "-" ? std::cin : inFile;
 
-    if (argc < 2) {
-        std::cout << usage();
-        std::exit(1);
+    PixelFormat format = rawFormat;
+    if (format.width == 0 && !Pnm::readHeader(in, format)) {
+        log << "Not a binary PPM/PGM image with 8-bit samples: " << inFilePath << "\n";
+        return 1;
     }
 
-    args.imagePath = argv[1];
-    for (int i = 2; i < argc; ++i) {
-        std::string arg = argv[i];
-        int qmi;
-        if (arg.rfind("--qmi=", 0) == 0) {
-            qmi = std::stoi(arg.substr(6));
-        } else {
-            std::cout << usage();
-            std::exit(1);
+    std::ofstream outFile;
+    if (outFilePath != "-") {
+        outFile.open(outFilePath, std::ios::binary);
+        if (!outFile) {
+            log << "Could not open output file: " << outFilePath << "\n";
+            return 1;
         }
-        if (qmi < 0 || qmi >= NUM_QUANT_MATRICES) {
-            std::cout << usage();
-            std::exit(1);
+    }
+    std::ostream &out = outFilePath == "-" ? std::cout : outFile;
+
+    JpegEncoder encoder(options);
+    RowReader reader(in, format);
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = encoder.encodeStream(reader, out, bytes);
+    auto end = std::chrono::steady_clock::now();
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_WRITE);
+        timer.setCounts(0, bytes, bytes);
+        out.flush();
+    }
+    if (!ok) {
+        log << "Could not encode " << inFilePath << ": " << encoder.error() << "\n";
+        if (outFilePath != "-") {
+            outFile.close();
+            std::remove(outFilePath.c_str());
         }
-        args.qmi = qmi;
+        return 1;
+    }
+    if (!out) {
+        log << "Could not write output file: " << outFilePath << "\n";
+        return 1;
     }
 
-    return args;
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double pixels = static_cast<double>(format.width) * format.height;
+    double inputBytes = pixels * format.channels;
+    log << "wrote " << outFilePath << ": " << bytes << " bytes ("
+        << 8.0 * bytes / pixels << " bits/pixel, " << inputBytes / bytes << ":1, streamed)" << "\n";
+    log << "encoded in " << seconds * 1000 << " ms (" << inputBytes / 1e6 / seconds << " MB/s)" << "\n";
+    return 0;
 }
 
-int main(int argc, char* argv[]) {
-    CliArgs args = parseCliArgs(argc, argv);
-    jpegForwardReverse(args.imagePath, args.qmi);
+//
+// Encode every image of a directory or list file into `outDir`, on a pool of
+// workers, without any GUI. Reports batch throughput and compression, and unless
+// `metrics` is off, mean quality (with JSON metrics, that of every image too).
+//
+int jpegEncodeBatch(std::string source, std::string outDir, const EncoderOptions &options,
+                    const PixelFormat &rawFormat, int numWorkers, MetricsMode metrics) {
+    Batch::Summary summary;
+    if (!Batch::encodeAll(source, outDir, options, rawFormat, numWorkers, metrics != METRICS_OFF, summary)) {
+        return 1;
+    }
+    if (metrics == METRICS_JSON) {
+        for (const Batch::ImageMetrics &image : summary.imageMetrics) {
+            Metrics::print(std::cout, image.metrics, true, image.outputPath);
+        }
+    }
+
+    std::cout << "encoded " << summary.images << " images into " << outDir;
+    if (summary.failed > 0) {
+        std::cout << " (" << summary.failed << " failed)";
+    }
+    std::cout << " on " << ThreadPool::resolveThreadCount(numWorkers) << " workers in "
+              << summary.seconds * 1000 << " ms" << "\n";
+    if (summary.images > 0) {
+        std::cout << "throughput: " << summary.images / summary.seconds << " images/s, "
+                  << summary.inputBytes / 1e6 / summary.seconds << " MB/s" << "\n";
+        std::cout << "compression: " << summary.outputBytes << " bytes ("
+                  << summary.inputBytes / summary.outputBytes << ":1)" << "\n";
+        if (options.targetBytes > 0 || options.targetPsnr > 0) {
+            std::cout << "rate control: mean quality " << summary.qualitySum / summary.images << ", "
+                      << summary.targetsMissed << " targets not met" << "\n";
+        }
+    }
+    if (metrics != METRICS_OFF && !summary.imageMetrics.empty()) {
+        Metrics::print(std::cout, summary.meanMetrics(), metrics == METRICS_JSON, "mean");
+    }
+    return summary.failed == 0 && summary.images > 0 ? 0 : 1;
+}
+
+//
+// Decode a JPEG file, then save the result (if an output path is given) or display it.
+// Reports decode throughput.
+//
+int jpegDecode(std::string jpegFilePath, std::string outFilePath, const DecoderOptions &options) {
+    std::vector<uchar> data;
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_READ);
+        std::ifstream inFile(jpegFilePath, std::ios::binary);
+        if (!inFile) {
+            std::cout << "Could not open file: " << jpegFilePath << "\n";
+            return 1;
+        }
+        data.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+        timer.setCounts(0, data.size(), data.size());
+    }
+
+    JpegDecoder decoder(options);
+    cv::Mat image;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = decoder.decode(data.data(), data.size(), image);
+    auto end = std::chrono::steady_clock::now();
+    if (!ok) {
+        std::cout << "Could not decode " << jpegFilePath << ": " << decoder.error() << "\n";
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double outputBytes = static_cast<double>(image.total()) * image.elemSize();
+    std::cout << "decoded " << jpegFilePath << ": " << image.cols << "x" << image.rows << ", "
+              << data.size() << " bytes" << "\n";
+    std::cout << "decoded in " << seconds * 1000 << " ms ("
+              << outputBytes / 1e6 / seconds << " MB/s)" << "\n";
+
+    if (!outFilePath.empty()) {
+        Profile::ScopedTimer timer(Profile::STAGE_WRITE);
+        timer.setCounts(0, outputBytes, outputBytes);
+        return CvImageUtils::saveImage(image, outFilePath) ? 0 : 1;
+    }
+    CvImageUtils::displayImage(image, "Decoded (" + jpegFilePath + ")");
+    cv::destroyAllWindows();
     return 0;
-}
\ No newline at end of file
+}
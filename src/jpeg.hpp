@@ -0,0 +1,138 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pre_computed.hpp"
+#include "plane.hpp"
+#include "sampling.hpp"
+#include "jpeg_encoder.hpp"
+#include "jpeg_decoder.hpp"
+#include "row_reader.hpp"
+#include "metrics.hpp"
+
+//
+// The per-block steps of the JPEG pipeline (see jpeg.cpp)
+//
+
+//
+// Per-thread scratch space of the block pipeline, so that blocks are processed
+// without any allocation
+//
+struct BlockScratch {
+    alignas(PLANE_ALIGNMENT) float samples[BLOCK_SIZE*BLOCK_SIZE];
+    alignas(PLANE_ALIGNMENT) float coefs[BLOCK_SIZE*BLOCK_SIZE];
+    alignas(PLANE_ALIGNMENT) float quant[BLOCK_SIZE*BLOCK_SIZE];
+    alignas(PLANE_ALIGNMENT) int32_t intSamples[BLOCK_SIZE*BLOCK_SIZE];
+    alignas(PLANE_ALIGNMENT) int32_t intCoefs[BLOCK_SIZE*BLOCK_SIZE];
+    alignas(PLANE_ALIGNMENT) int32_t intQuant[BLOCK_SIZE*BLOCK_SIZE];
+};
+
+//
+// Pads given image to ensure its dimensions are a multiple of 'blockSize'
+//
+cv::Mat padForJpeg(cv::Mat image, int blockSize);
+
+//
+// Convert image from [B,G,R] to [Y,Cb,Cr] format, and back
+//
+cv::Mat bgrToYcbcr(cv::Mat bgrImage);
+cv::Mat ycbcrToBgr(cv::Mat ycbcrImage);
+
+//
+// Performs the (inverse) DCT step on the given 8x8 block (see dct.hpp)
+//
+void dctBlock(cv::Mat dctBlock, cv::Mat block, JpegElements &jpegElements);
+void inverseDctBlock(cv::Mat invBlock, cv::Mat dctBlock, JpegElements &jpegElements);
+
+//
+// Performs quantisation step on the given (flat) 8x8 block
+//
+void quantiseBlock(float *quantBlock, const float *dctBlock, const float *quantisationMatrix);
+void quantiseBlockInt(int32_t *quantBlock, const int32_t *dctBlock, const int32_t *divisors);
+
+//
+// Performs quantisation of the given (flat) 8x8 block of float or integer DCT
+// coefficients and zig-zag reordering in one pass, writing int16 coefficients to
+// `zigZagOut`. Returns the index of the last nonzero AC coefficient (0 if none).
+//
+int quantiseZigZag(const float *dctBlock, const QuantTable &table, const int *zigZagOrder, int16_t *zigZagOut);
+int quantiseZigZagInt(const int32_t *dctBlock, const QuantTable &table, DctMethod dctMethod,
+                      const int *zigZagOrder, int16_t *zigZagOut);
+
+//
+// Quantises the given (flat) 8x8 block of float or integer DCT coefficients that
+// are already in zig-zag order, as quantiseZigZag(Int), but without the gather
+//
+int quantiseReordered(const float *zigZagBlock, const QuantTable &table, int16_t *zigZagOut);
+int quantiseReorderedInt(const int32_t *zigZagBlock, const QuantTable &table, DctMethod dctMethod,
+                         int16_t *zigZagOut);
+
+//
+// Applies the level shift and the forward DCT of the given method to the given
+// block, writing its (unquantised) coefficients to `coefs` for the float DCT, or
+// to `intCoefs` for the integer DCTs
+//
+void jpegBlockDct(const uchar *block, int blockStride, float *coefs, int32_t *intCoefs,
+                  DctMethod dctMethod, JpegElements &jpegElements, BlockScratch &scratch);
+
+//
+// Applies the forward JPEG steps (level shift, DCT, quantisation) to the given
+// block, writing its quantised coefficients in zig-zag order to `zigZagOut`.
+// Returns the index of the last nonzero AC coefficient (0 if none).
+//
+int jpegBlockForward(const uchar *block, int blockStride, int16_t *zigZagOut,
+                     const QuantTable &quantTable, DctMethod dctMethod, JpegElements &jpegElements,
+                     BlockScratch &scratch);
+
+//
+// Applies the inverse JPEG steps (dequantisation, inverse DCT, level shift) to the
+// given block of quantised coefficients in zig-zag order, writing the 8x8 block of
+// samples to `outBlock`
+//
+void jpegBlockInverse(const int16_t *zigZag, const int32_t *multipliers, uchar *outBlock, int outStride,
+                      DctMethod dctMethod, JpegElements &jpegElements, BlockScratch &scratch);
+
+//
+// For given block, apply jpeg, then reverse steps to produce compressed block
+//
+void jpegBlockForwardReverse(const uchar *block, int blockStride, uchar *outBlock, int outStride,
+                             int quantMatrixIndex, DctMethod dctMethod, JpegElements &jpegElements,
+                             BlockScratch &scratch, bool debug);
+
+//
+// Apply jpeg to image, then reverse it and re-construct compressed form, reporting
+// the quality of the file the same settings encode (unless `metrics` is off).
+//
+int jpegForwardReverse(std::string imageFilePath, int quantMatrixIndex, DctMethod dctMethod,
+                       Subsampling subsampling, int numThreads, MetricsMode metrics);
+
+//
+// Encode image as a baseline JPEG file, reporting compressed size and throughput.
+// Uncompressed inputs (PPM/PGM, or raw pixels of the given format) are memory-mapped.
+// Reports the quality of the written file, unless `metrics` is off.
+//
+int jpegEncode(std::string imageFilePath, std::string outFilePath, const EncoderOptions &options,
+               const PixelFormat &rawFormat, MetricsMode metrics);
+
+//
+// Encode a PPM/PGM image (or raw BGR pixels of the given size) from a file or
+// stdin ("-") as a baseline JPEG, streaming it a strip at a time, to a file or
+// stdout ("-")
+//
+int jpegEncodeStream(std::string inFilePath, std::string outFilePath, const EncoderOptions &options,
+                     const PixelFormat &rawFormat);
+
+//
+// Encode every image of a directory or list file into `outDir`, on a pool of
+// workers, without any GUI, reporting their quality unless `metrics` is off
+//
+int jpegEncodeBatch(std::string source, std::string outDir, const EncoderOptions &options,
+                    const PixelFormat &rawFormat, int numWorkers, MetricsMode metrics);
+
+//
+// Decode a JPEG file, then save the result (if an output path is given) or display it
+//
+int jpegDecode(std::string jpegFilePath, std::string outFilePath, const DecoderOptions &options);
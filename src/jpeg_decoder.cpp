@@ -0,0 +1,839 @@
+#include <algorithm>
+#include <cstring>
+
+#include "jpeg_decoder.hpp"
+#include "jpeg.hpp"
+#include "jfif.hpp"
+#include "color.hpp"
+#include "sampling.hpp"
+#include "rle.hpp"
+#include "profile.hpp"
+
+// plane (Y, Cr, Cb order) of each component (Y, Cb, Cr order)
+static const int COMPONENT_PLANES[3] = {0, 2, 1};
+
+static inline int readWord(const uchar *p) {
+    return (p[0] << 8) | p[1];
+}
+
+JpegDecoder::JpegDecoder(const DecoderOptions &options)
+    : options(options), pool(options.threads), restartInterval(0), width(0), height(0), numComponents(0),
+      progressive(false) {}
+
+//
+// Records the given error. Returns false.
+//
+bool JpegDecoder::fail(const std::string &message) {
+    errorMessage = message;
+    return false;
+}
+
+//
+// Description of the last decoding error
+//
+const std::string& JpegDecoder::error() const {
+    return errorMessage;
+}
+
+//
+// SOF0/SOF1/SOF2: frame dimensions and components. Sets up the coefficient planes.
+//
+bool JpegDecoder::parseSof(const uchar *segment, size_t size) {
+    if (numComponents) {
+        return fail("multiple frames");
+    }
+    if (size < 6) {
+        return fail("truncated SOF segment");
+    }
+    if (segment[0] != 8) {
+        return fail("unsupported sample precision: " + std::to_string(segment[0]));
+    }
+    height = readWord(segment + 1);
+    width = readWord(segment + 3);
+    int n = segment[5];
+    if (width == 0 || height == 0) {
+        return fail("unsupported image dimensions (DNL marker)");
+    }
+    if (n != 1 && n != 3) {
+        return fail("unsupported number of components: " + std::to_string(n));
+    }
+    if (size < 6 + 3 * (size_t) n) {
+        return fail("truncated SOF segment");
+    }
+
+    maxH = maxV = 1;
+    for (int i = 0; i < n; i++) {
+        DecoderComponent &component = components[i];
+        const uchar *p = segment + 6 + 3 * i;
+        component.id = p[0];
+        component.h = p[1] >> 4;
+        component.v = p[1] & 15;
+        component.quantTable = p[2];
+        if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quantTable >= MAX_TABLES) {
+            return fail("invalid SOF segment");
+        }
+        if (n == 1) {
+            // a single component's MCU is always one block
+            component.h = component.v = 1;
+        }
+        maxH = std::max(maxH, component.h);
+        maxV = std::max(maxV, component.v);
+    }
+    for (int i = 0; i < n; i++) {
+        int fh = maxH / components[i].h, fv = maxV / components[i].v;
+        if (fh * components[i].h != maxH || fv * components[i].v != maxV || fh > 2 || fv > 2) {
+            return fail("unsupported sampling factors");
+        }
+    }
+    numComponents = n;
+
+    mcusWide = (width + 8 * maxH - 1) / (8 * maxH);
+    mcusHigh = (height + 8 * maxV - 1) / (8 * maxV);
+    for (int i = 0; i < n; i++) {
+        DecoderComponent &component = components[i];
+        int componentWidth = (width * component.h + maxH - 1) / maxH;
+        int componentHeight = (height * component.v + maxV - 1) / maxV;
+        component.blocksWide = (componentWidth + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        component.blocksHigh = (componentHeight + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+        // blocks no scan codes (MCU padding) stay zero
+        CoefPlane &coefPlane = coefPlanes[i];
+        coefPlane.create(mcusWide * component.h, mcusHigh * component.v);
+        memset(coefPlane.coefs.data(), 0, sizeof(int16_t) * coefPlane.coefs.stride * coefPlane.coefs.height);
+    }
+    return true;
+}
+
+//
+// DHT: one or more Huffman tables
+//
+bool JpegDecoder::parseDht(const uchar *segment, size_t size) {
+    HuffmanTable table;
+    size_t pos = 0;
+    while (pos < size) {
+        if (size - pos < 17) {
+            return fail("truncated DHT segment");
+        }
+        int tableClass = segment[pos] >> 4, tableId = segment[pos] & 15;
+        if (tableClass > 1 || tableId >= MAX_TABLES) {
+            return fail("invalid DHT segment");
+        }
+        const uchar *bits = segment + pos + 1;
+
+        // the counts must fit the code space of each length
+        int numVals = 0, codes = 0;
+        for (int l = 1; l <= 16; l++) {
+            numVals += bits[l - 1];
+            codes = (codes << 1) + bits[l - 1];
+            if (codes > (1 << l)) {
+                return fail("invalid Huffman table");
+            }
+        }
+        if (numVals > 256 || size - pos - 17 < (size_t) numVals) {
+            return fail("invalid DHT segment");
+        }
+
+        table.build(bits, segment + pos + 17);
+        if (tableClass == 0) {
+            dcTables[tableId].build(table);
+            dcDefined[tableId] = true;
+        } else {
+            acTables[tableId].build(table);
+            acDefined[tableId] = true;
+        }
+        pos += 17 + numVals;
+    }
+    return true;
+}
+
+//
+// DQT: one or more quantisation tables (8 or 16-bit), stored in natural order
+//
+bool JpegDecoder::parseDqt(const uchar *segment, size_t size) {
+    size_t pos = 0;
+    while (pos < size) {
+        int precision = segment[pos] >> 4, tableId = segment[pos] & 15;
+        size_t tableSize = precision ? 128 : 64;
+        if (precision > 1 || tableId >= MAX_TABLES) {
+            return fail("invalid DQT segment");
+        }
+        if (size - pos - 1 < tableSize) {
+            return fail("truncated DQT segment");
+        }
+        const uchar *values = segment + pos + 1;
+        for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+            quantTables[tableId][jpegElements.zig_zag_order[k]] = precision ? readWord(values + 2 * k) : values[k];
+        }
+        quantDefined[tableId] = true;
+        pos += 1 + tableSize;
+    }
+    return true;
+}
+
+//
+// DRI: restart interval
+//
+bool JpegDecoder::parseDri(const uchar *segment, size_t size) {
+    if (size < 2) {
+        return fail("truncated DRI segment");
+    }
+    restartInterval = readWord(segment);
+    return true;
+}
+
+//
+// SOS: components of the scan, their tables, and the scan's band and bit positions
+//
+bool JpegDecoder::parseSos(const uchar *segment, size_t size) {
+    if (!numComponents) {
+        return fail("scan before frame header");
+    }
+    int n = size > 0 ? segment[0] : 0;
+    if (n < 1 || n > numComponents || size < 4 + 2 * (size_t) n) {
+        return fail("invalid SOS segment");
+    }
+
+    // band and bit positions: all of each coefficient, unless progressive (where
+    // DC and AC are sent apart, and AC a component at a time)
+    const uchar *p = segment + 1 + 2 * n;
+    scanSs = p[0];
+    scanSe = p[1];
+    scanAh = p[2] >> 4;
+    scanAl = p[2] & 15;
+    if (!progressive && (scanSs != 0 || scanSe != 63 || p[2] != 0)) {
+        return fail("invalid scan of a sequential frame");
+    }
+    if (progressive && (scanSs > scanSe || scanSe > 63 || scanAh > 13 || scanAl > 13
+                        || (scanSs == 0 && scanSe != 0) || (scanSs > 0 && n != 1))) {
+        return fail("invalid progressive scan");
+    }
+    bool needsDc = !progressive || (scanSs == 0 && scanAh == 0);
+    bool needsAc = !progressive || scanSs > 0;
+
+    int blocksPerMcu = 0;
+    for (int i = 0; i < n; i++) {
+        int id = segment[1 + 2 * i], tables = segment[2 + 2 * i];
+        int c = 0;
+        while (c < numComponents && components[c].id != id) {
+            c++;
+        }
+        if (c == numComponents) {
+            return fail("scan of unknown component");
+        }
+
+        DecoderComponent &component = components[c];
+        component.dcTable = tables >> 4;
+        component.acTable = tables & 15;
+        if (component.dcTable >= MAX_TABLES || component.acTable >= MAX_TABLES ||
+            (needsDc && !dcDefined[component.dcTable]) || (needsAc && !acDefined[component.acTable])) {
+            return fail("scan uses undefined Huffman table");
+        }
+        if (!quantDefined[component.quantTable]) {
+            return fail("scan uses undefined quantisation table");
+        }
+        jpegElements.computeIdctMultipliers(options.dctMethod, quantTables[component.quantTable], component.multipliers);
+        scanComponents[i] = c;
+        blocksPerMcu += component.h * component.v;
+    }
+    numScanComponents = n;
+    if (n > 1 && blocksPerMcu > 10) {
+        return fail("invalid SOS segment");
+    }
+    return true;
+}
+
+//
+// Decodes the next Huffman-coded symbol with the given table. Returns -1 on
+// invalid codes.
+//
+static inline int decodeSymbol(BitReader &reader, const HuffmanDecodeTable &table) {
+    uint32_t bits = reader.peekBits(16);
+    uint16_t entry = table.lookahead[bits >> (16 - HUFFMAN_LOOKAHEAD_BITS)];
+    if (entry) {
+        reader.skipBits(entry >> 8);
+        return entry & 0xFF;
+    }
+
+    // longer code: find its length, comparing against the largest code of each
+    int l = HUFFMAN_LOOKAHEAD_BITS + 1;
+    int32_t code = bits >> (16 - l);
+    while (code > table.maxCode[l]) {
+        if (++l > 16) {
+            return -1;
+        }
+        code = bits >> (16 - l);
+    }
+    reader.skipBits(l);
+    return table.vals[table.valOffset[l] + code];
+}
+
+//
+// Decodes the coefficients of a block, in zig-zag order (JPEG F.2.2)
+//
+bool JpegDecoder::decodeBlock(BitReader &reader, int16_t *zigZag, const DecoderComponent &component, int &dcPred) {
+    memset(zigZag, 0, sizeof(int16_t) * BLOCK_SIZE*BLOCK_SIZE);
+
+    int size = decodeSymbol(reader, dcTables[component.dcTable]);
+    if (size < 0 || size > 11) {
+        return false;
+    }
+    if (size) {
+        dcPred += Rle::extendMagnitude(reader.readBits(size), size);
+    }
+    zigZag[0] = static_cast<int16_t>(dcPred);
+
+    const HuffmanDecodeTable &acTable = acTables[component.acTable];
+    for (int k = 1; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        int symbol = decodeSymbol(reader, acTable);
+        if (symbol < 0) {
+            return false;
+        }
+        int run = symbol >> 4;
+        size = symbol & 15;
+        if (size) {
+            k += run;
+            if (k >= BLOCK_SIZE*BLOCK_SIZE) {
+                return false;
+            }
+            zigZag[k] = static_cast<int16_t>(Rle::extendMagnitude(reader.readBits(size), size));
+        } else if (symbol == Rle::SYMBOL_ZRL) {
+            k += 15;
+        } else {
+            break; // EOB
+        }
+    }
+    return true;
+}
+
+//
+// Decodes the current progressive scan's band or bit of the coefficients of a
+// block, adding them to the block (JPEG G.2, inverting Progressive's coding):
+//      - DC first: the DPCM difference of the DC, shifted left by `al`
+//      - DC refinement: bit `al` of the DC
+//      - AC first: run/size symbols of the band, shifted left by `al`, with runs
+//        of empty bands coded as EOB runs
+//      - AC refinement: bit `al` of the band's coefficients - new ones (+-1 << al)
+//        from 1-bit symbols, correction bits of ones already nonzero
+//
+bool JpegDecoder::decodeProgressiveBlock(BitReader &reader, int16_t *zigZag, const DecoderComponent &component,
+                                         int &dcPred, int &eobRun) {
+    if (scanSs == 0) {
+        if (scanAh > 0) {
+            zigZag[0] |= static_cast<int16_t>(reader.readBits(1) << scanAl);
+            return true;
+        }
+        int size = decodeSymbol(reader, dcTables[component.dcTable]);
+        if (size < 0 || size > 11) {
+            return false;
+        }
+        if (size) {
+            dcPred += Rle::extendMagnitude(reader.readBits(size), size);
+        }
+        zigZag[0] = static_cast<int16_t>(dcPred * (1 << scanAl));
+        return true;
+    }
+
+    const HuffmanDecodeTable &acTable = acTables[component.acTable];
+    if (scanAh == 0) {
+        if (eobRun > 0) {
+            eobRun--;
+            return true;
+        }
+        for (int k = scanSs; k <= scanSe; k++) {
+            int symbol = decodeSymbol(reader, acTable);
+            if (symbol < 0) {
+                return false;
+            }
+            int run = symbol >> 4, size = symbol & 15;
+            if (size) {
+                k += run;
+                if (k > scanSe) {
+                    return false;
+                }
+                zigZag[k] = static_cast<int16_t>(Rle::extendMagnitude(reader.readBits(size), size) * (1 << scanAl));
+            } else if (run == 15) {
+                k += 15; // ZRL
+            } else {
+                // EOBn: this block and the next 2^n - 1 + (n bits) are done
+                eobRun = (1 << run) - 1 + (run ? reader.readBits(run) : 0);
+                break;
+            }
+        }
+        return true;
+    }
+
+    // refinement: `run` counts the zero coefficients to skip before the new one,
+    // appending a correction bit to each nonzero one passed
+    int bit = 1 << scanAl;
+    int k = scanSs;
+    if (eobRun == 0) {
+        for (; k <= scanSe; k++) {
+            int symbol = decodeSymbol(reader, acTable);
+            if (symbol < 0) {
+                return false;
+            }
+            int run = symbol >> 4, size = symbol & 15, value = 0;
+            if (size) {
+                if (size != 1) {
+                    return false;
+                }
+                value = reader.readBits(1) ? bit : -bit;
+            } else if (run != 15) {
+                eobRun = (1 << run) + (run ? reader.readBits(run) : 0);
+                break; // the rest of the band is refined as part of the EOB run
+            }
+
+            for (; k <= scanSe; k++) {
+                int16_t &coef = zigZag[k];
+                if (coef != 0) {
+                    if (reader.readBits(1) && (coef & bit) == 0) {
+                        coef += coef >= 0 ? bit : -bit;
+                    }
+                } else if (--run < 0) {
+                    break;
+                }
+            }
+            if (value) {
+                if (k > scanSe) {
+                    return false;
+                }
+                zigZag[k] = static_cast<int16_t>(value);
+            }
+        }
+    }
+    if (eobRun > 0) {
+        for (; k <= scanSe; k++) {
+            int16_t &coef = zigZag[k];
+            if (coef != 0 && reader.readBits(1) && (coef & bit) == 0) {
+                coef += coef >= 0 ? bit : -bit;
+            }
+        }
+        eobRun--;
+    }
+    return true;
+}
+
+//
+// Decodes units [firstUnit, endUnit) of the current scan, from the given state.
+// Interleaved scans code MCU by MCU; a single-component scan codes that
+// component's blocks in raster order.
+//
+bool JpegDecoder::decodeUnits(BitReader &reader, ScanState &state, int firstUnit, int endUnit) {
+    auto decode = [&](int i, int16_t *block) {
+        const DecoderComponent &component = components[scanComponents[i]];
+        return progressive ? decodeProgressiveBlock(reader, block, component, state.dcPred[i], state.eobRun)
+                           : decodeBlock(reader, block, component, state.dcPred[i]);
+    };
+
+    bool interleaved = numScanComponents > 1;
+    int unitsWide = interleaved ? mcusWide : components[scanComponents[0]].blocksWide;
+    for (int unit = firstUnit; unit < endUnit; unit++) {
+        int ux = unit % unitsWide, uy = unit / unitsWide;
+        if (!interleaved) {
+            if (!decode(0, coefPlanes[scanComponents[0]].block(ux, uy))) {
+                return false;
+            }
+            continue;
+        }
+        for (int i = 0; i < numScanComponents; i++) {
+            const DecoderComponent &component = components[scanComponents[i]];
+            CoefPlane &coefPlane = coefPlanes[scanComponents[i]];
+            for (int by = 0; by < component.v; by++) {
+                for (int bx = 0; bx < component.h; bx++) {
+                    if (!decode(i, coefPlane.block(ux * component.h + bx, uy * component.v + by))) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//
+// Finds the restart intervals of the current scan, whose data starts at `pos`:
+// records the start of each (just past the RSTn marker ending the one before) in
+// `intervalStarts`, then the end of the data (at the first other marker).
+// Returns false unless there are `numIntervals` of them, with markers numbered
+// in order - leaving the error to a serial decode.
+//
+bool JpegDecoder::findIntervals(const uchar *data, size_t size, size_t pos, int numIntervals) {
+    intervalStarts.clear();
+    intervalStarts.push_back(pos);
+    size_t end = size;
+    while (pos < size) {
+        const uchar *ff = static_cast<const uchar*>(memchr(data + pos, 0xFF, size - pos));
+        if (!ff) {
+            break;
+        }
+        size_t p = ff - data + 1;
+        while (p < size && data[p] == 0xFF) {
+            p++; // fill bytes
+        }
+        int code = p < size ? data[p] : -1;
+        if (code == 0x00) {
+            pos = p + 1; // stuffed byte
+            continue;
+        }
+        if (code < MARKER_RST0 || code > MARKER_RST7) {
+            end = ff - data;
+            break;
+        }
+        if (code != MARKER_RST0 + static_cast<int>((intervalStarts.size() - 1) & 7)
+            || static_cast<int>(intervalStarts.size()) == numIntervals) {
+            return false;
+        }
+        pos = p + 1;
+        intervalStarts.push_back(pos);
+    }
+    intervalStarts.push_back(end);
+    return static_cast<int>(intervalStarts.size()) == numIntervals + 1;
+}
+
+//
+// Decodes the entropy-coded data of the current scan, which starts at `pos`.
+// Leaves `pos` at the marker ending the scan.
+//
+// Each restart interval starts from a fresh state. With several threads (and
+// intervals), the intervals are found first, and decoded in parallel, a few runs
+// of them per thread, each interval with its own bit reader. Otherwise they are
+// decoded in one go, reading each RSTn marker on the way.
+//
+bool JpegDecoder::decodeScan(const uchar *data, size_t size, size_t &pos) {
+    Profile::ScopedTimer timer(Profile::STAGE_ENTROPY);
+    size_t start = pos;
+    const DecoderComponent &first = components[scanComponents[0]];
+    int units = numScanComponents > 1 ? mcusWide * mcusHigh : first.blocksWide * first.blocksHigh;
+    int interval = restartInterval > 0 ? restartInterval : units;
+    int numIntervals = (units + interval - 1) / interval;
+
+    if (pool.size() > 1 && numIntervals > 1 && findIntervals(data, size, pos, numIntervals)) {
+        int numRuns = std::min(numIntervals, 4 * pool.size());
+        std::vector<char> decoded(numRuns);
+        pool.parallelFor(numRuns, [&](int run) {
+            int firstInterval = static_cast<int>(static_cast<int64_t>(numIntervals) * run / numRuns);
+            int endInterval = static_cast<int>(static_cast<int64_t>(numIntervals) * (run + 1) / numRuns);
+            bool ok = true;
+            for (int n = firstInterval; n < endInterval && ok; n++) {
+                BitReader reader(data, size, intervalStarts[n]);
+                ScanState state = {};
+                ok = decodeUnits(reader, state, n * interval, std::min((n + 1) * interval, units));
+            }
+            decoded[run] = ok;
+        });
+        for (char ok : decoded) {
+            if (!ok) {
+                return fail("corrupt entropy-coded data");
+            }
+        }
+        pos = intervalStarts[numIntervals];
+    } else {
+        BitReader reader(data, size, pos);
+        for (int n = 0; n < numIntervals; n++) {
+            if (n > 0 && !reader.readRestartMarker((n - 1) & 7)) {
+                return fail("missing restart marker");
+            }
+            ScanState state = {};
+            if (!decodeUnits(reader, state, n * interval, std::min((n + 1) * interval, units))) {
+                return fail("corrupt entropy-coded data");
+            }
+        }
+        pos = reader.position();
+    }
+
+    uint64_t blocks = 0;
+    for (int i = 0; i < numScanComponents; i++) {
+        const CoefPlane &coefPlane = coefPlanes[scanComponents[i]];
+        blocks += static_cast<uint64_t>(coefPlane.blocksWide) * coefPlane.blocksHigh;
+    }
+    timer.setCounts(blocks, pos - start, blocks * 64 * sizeof(int16_t));
+    return true;
+}
+
+//
+// Decodes the coefficients of a block of the given class (0: luma, 1: chroma) from
+// a file of the internal rANS format, in zig-zag order: as decodeBlock, but each
+// symbol is rANS decoded in its context (see Rans), and magnitude bits come from
+// their own stream
+//
+static inline bool decodeRansBlock(Rans::Decoder &decoder, BitReader &magnitudeBits,
+                                   const Rans::DecodeTable *tables, int16_t *zigZag, int blockClass, int &dcPred) {
+    memset(zigZag, 0, sizeof(int16_t) * BLOCK_SIZE*BLOCK_SIZE);
+
+    int size = decoder.decode(tables[Rans::dcContext(blockClass)]);
+    if (size > 11) {
+        return false;
+    }
+    if (size) {
+        dcPred += Rle::extendMagnitude(magnitudeBits.readBits(size), size);
+    }
+    zigZag[0] = static_cast<int16_t>(dcPred);
+
+    // AC symbols band by band, each band's with a fixed table: the next symbol's
+    // decoding then only waits on the (well predicted) loop branches, not on the
+    // symbol before it picking its context, so the lanes' decodes overlap
+    int k = 1;
+    for (int band = 0; band < RANS_AC_BANDS; band++) {
+        const Rans::DecodeTable &table = tables[Rans::acContext(blockClass, k)];
+        for (; k <= Rans::AC_BAND_ENDS[band]; k++) {
+            int symbol = decoder.decode(table);
+            int run = symbol >> 4;
+            size = symbol & 15;
+            if (size) {
+                k += run;
+                if (k >= BLOCK_SIZE*BLOCK_SIZE) {
+                    return false;
+                }
+                zigZag[k] = static_cast<int16_t>(Rle::extendMagnitude(magnitudeBits.readBits(size), size));
+            } else if (symbol == Rle::SYMBOL_ZRL) {
+                k += 15;
+            } else {
+                return true; // EOB
+            }
+        }
+    }
+    return true;
+}
+
+//
+// Decodes a file of the internal rANS format (see rans.hpp) into the coefficient
+// planes: parses its frame header segments and frequency tables, then decodes its
+// blocks MCU by MCU, from the rANS stream and the magnitude bit stream
+//
+bool JpegDecoder::decodeRans(const uchar *data, size_t size) {
+    size_t pos = RANS_MAGIC_SIZE;
+    if (size <= pos || data[pos] != RANS_VERSION) {
+        return fail("unsupported rANS format version");
+    }
+    pos++;
+
+    // quantisation tables, up to the frame header
+    while (!numComponents) {
+        if (size - pos < 4 || data[pos] != 0xFF || readWord(data + pos + 2) < 2
+            || size - pos - 2 < (size_t) readWord(data + pos + 2)) {
+            return fail("truncated segment");
+        }
+        int marker = data[pos + 1];
+        const uchar *segment = data + pos + 4;
+        size_t segmentSize = readWord(data + pos + 2) - 2;
+        pos += segmentSize + 4;
+        bool ok = marker == MARKER_DQT ? parseDqt(segment, segmentSize)
+                : marker == MARKER_SOF0 ? parseSof(segment, segmentSize)
+                : fail("invalid rANS file header");
+        if (!ok) {
+            return false;
+        }
+    }
+    for (int i = 0; i < numComponents; i++) {
+        DecoderComponent &component = components[i];
+        if (!quantDefined[component.quantTable]) {
+            return fail("frame uses undefined quantisation table");
+        }
+        jpegElements.computeIdctMultipliers(options.dctMethod, quantTables[component.quantTable], component.multipliers);
+    }
+
+    Profile::ScopedTimer timer(Profile::STAGE_ENTROPY);
+    size_t start = pos;
+    Rans::FrequencyTable freqTables[RANS_CONTEXTS];
+    if (!Rans::readTables(data, size, pos, freqTables) || size - pos < 8) {
+        return fail("truncated rANS tables");
+    }
+    size_t streamBytes = (static_cast<size_t>(readWord(data + pos)) << 16) | readWord(data + pos + 2);
+    size_t magnitudeBytes = (static_cast<size_t>(readWord(data + pos + 4)) << 16) | readWord(data + pos + 6);
+    pos += 8;
+    if (size - pos < streamBytes || size - pos - streamBytes < magnitudeBytes) {
+        return fail("truncated rANS data");
+    }
+    std::vector<Rans::DecodeTable> decodeTables(RANS_CONTEXTS);
+    for (int context = 0; context < RANS_CONTEXTS; context++) {
+        decodeTables[context].build(freqTables[context]);
+    }
+
+    Rans::Decoder decoder;
+    if (!decoder.init(data + pos, streamBytes)) {
+        return fail("truncated rANS data");
+    }
+    BitReader magnitudeBits(data, pos + streamBytes + magnitudeBytes, pos + streamBytes, false);
+    int dcPred[MAX_COMPONENTS] = {0};
+    for (int mcu = 0; mcu < mcusWide * mcusHigh; mcu++) {
+        int mx = mcu % mcusWide, my = mcu / mcusWide;
+        for (int i = 0; i < numComponents; i++) {
+            const DecoderComponent &component = components[i];
+            CoefPlane &coefPlane = coefPlanes[i];
+            for (int by = 0; by < component.v; by++) {
+                for (int bx = 0; bx < component.h; bx++) {
+                    if (!decodeRansBlock(decoder, magnitudeBits, decodeTables.data(),
+                                         coefPlane.block(mx * component.h + bx, my * component.v + by),
+                                         i == 0 ? 0 : 1, dcPred[i])) {
+                        return fail("corrupt rANS data");
+                    }
+                }
+            }
+        }
+    }
+
+    uint64_t blocks = 0;
+    for (int i = 0; i < numComponents; i++) {
+        blocks += static_cast<uint64_t>(coefPlanes[i].blocksWide) * coefPlanes[i].blocksHigh;
+    }
+    timer.setCounts(blocks, pos + streamBytes + magnitudeBytes - start, blocks * 64 * sizeof(int16_t));
+    return true;
+}
+
+//
+// Reconstructs the image from the coefficient planes
+//
+void JpegDecoder::reconstruct(cv::Mat &image) {
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_TRANSFORM);
+
+        // block rows of each component, laid out one component after the other
+        int blockRowOffsets[MAX_COMPONENTS + 1] = {0};
+        uint64_t blocks = 0;
+        for (int i = 0; i < numComponents; i++) {
+            samplePlanes[i].create(coefPlanes[i].blocksWide * BLOCK_SIZE, coefPlanes[i].blocksHigh * BLOCK_SIZE);
+            blockRowOffsets[i + 1] = blockRowOffsets[i] + coefPlanes[i].blocksHigh;
+            blocks += static_cast<uint64_t>(coefPlanes[i].blocksWide) * coefPlanes[i].blocksHigh;
+        }
+        timer.setCounts(blocks, blocks * 64 * sizeof(int16_t), blocks * 64);
+
+        // one task per block row of each component
+        pool.parallelFor(blockRowOffsets[numComponents], [&](int task) {
+            int i = 0;
+            while (task >= blockRowOffsets[i + 1]) {
+                i++;
+            }
+            int by = task - blockRowOffsets[i];
+            const CoefPlane &coefPlane = coefPlanes[i];
+            Plane<uchar> &plane = samplePlanes[i];
+            BlockScratch scratch;
+            for (int bx = 0; bx < coefPlane.blocksWide; bx++) {
+                jpegBlockInverse(coefPlane.block(bx, by), components[i].multipliers,
+                                 plane.row(by * BLOCK_SIZE) + bx * BLOCK_SIZE, plane.stride,
+                                 options.dctMethod, jpegElements, scratch);
+            }
+        });
+    }
+
+    if (numComponents == 1) {
+        image = cv::Mat(height, width, CV_8UC1);
+        for (int r = 0; r < height; r++) {
+            memcpy(image.ptr<uchar>(r), samplePlanes[0].row(r), width);
+        }
+        return;
+    }
+
+    // upsample chroma to full resolution
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_SAMPLING);
+        uint64_t bytesIn = 0, bytesOut = 0;
+        for (int i = 0; i < numComponents; i++) {
+            int h = maxH / components[i].h, v = maxV / components[i].v;
+            Plane<uchar> &fullPlane = fullPlanes[COMPONENT_PLANES[i]];
+            if (h == 1 && v == 1) {
+                std::swap(fullPlane, samplePlanes[i]);
+            } else {
+                Sampling::upsample(samplePlanes[i], fullPlane, h, v, pool);
+                bytesIn += static_cast<uint64_t>(samplePlanes[i].width) * samplePlanes[i].height;
+                bytesOut += static_cast<uint64_t>(fullPlane.width) * fullPlane.height;
+            }
+        }
+        timer.setCounts(0, bytesIn, bytesOut);
+    }
+
+    Profile::ScopedTimer timer(Profile::STAGE_COLOR);
+    image = Color::ycbcrPlanesToBgr(fullPlanes, width, height, pool);
+    timer.setCounts(0, static_cast<uint64_t>(width) * height * 3, image.total() * image.elemSize());
+}
+
+//
+// Decodes the given JPEG file contents into a BGR (or, for grayscale files,
+// single-channel) image. Returns false on invalid or unsupported input (see
+// `error`).
+//
+bool JpegDecoder::decode(const uchar *data, size_t size, cv::Mat &image) {
+    for (int i = 0; i < MAX_TABLES; i++) {
+        quantDefined[i] = dcDefined[i] = acDefined[i] = false;
+    }
+    restartInterval = 0;
+    numComponents = 0;
+    progressive = false;
+    errorMessage.clear();
+
+    if (size >= RANS_MAGIC_SIZE && memcmp(data, RANS_MAGIC, RANS_MAGIC_SIZE) == 0) {
+        if (!decodeRans(data, size)) {
+            return false;
+        }
+        reconstruct(image);
+        return true;
+    }
+    if (size < 2 || data[0] != 0xFF || data[1] != MARKER_SOI) {
+        return fail("not a JPEG file");
+    }
+
+    size_t pos = 2;
+    int numScans = 0;
+    while (true) {
+        // next marker (skipping anything else, and fill bytes)
+        while (pos < size && data[pos] != 0xFF) {
+            pos++;
+        }
+        while (pos < size && data[pos] == 0xFF) {
+            pos++;
+        }
+        if (pos >= size) {
+            break; // no EOI: decode what there is
+        }
+        int marker = data[pos++];
+        if (marker == MARKER_EOI) {
+            break;
+        }
+        if (marker == 0x00 || (marker >= MARKER_RST0 && marker <= MARKER_RST7)) {
+            continue; // stuffed byte or stray restart marker
+        }
+
+        if (size - pos < 2 || readWord(data + pos) < 2 || size - pos < (size_t) readWord(data + pos)) {
+            return fail("truncated segment");
+        }
+        const uchar *segment = data + pos + 2;
+        size_t segmentSize = readWord(data + pos) - 2;
+        pos += segmentSize + 2;
+
+        bool ok = true;
+        switch (marker) {
+            case MARKER_SOF0:
+            case MARKER_SOF1:
+            case MARKER_SOF2:
+                ok = parseSof(segment, segmentSize);
+                progressive = marker == MARKER_SOF2;
+                break;
+            case MARKER_DHT:
+                ok = parseDht(segment, segmentSize);
+                break;
+            case MARKER_DQT:
+                ok = parseDqt(segment, segmentSize);
+                break;
+            case MARKER_DRI:
+                ok = parseDri(segment, segmentSize);
+                break;
+            case MARKER_SOS:
+                ok = parseSos(segment, segmentSize) && decodeScan(data, size, pos);
+                numScans++;
+                break;
+            default:
+                // other frame types; anything else (APPn, COM, ...) is skipped
+                if (marker > MARKER_SOF2 && marker <= MARKER_SOF15 && marker != MARKER_JPG && marker != MARKER_DAC) {
+                    return fail("unsupported JPEG process (only baseline, extended sequential and progressive Huffman are supported)");
+                }
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    if (!numScans) {
+        return fail("no image data");
+    }
+    reconstruct(image);
+    return true;
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pre_computed.hpp"
+#include "plane.hpp"
+#include "thread_pool.hpp"
+#include "huffman.hpp"
+#include "bit_reader.hpp"
+#include "rans.hpp"
+
+#define MAX_COMPONENTS 4
+#define MAX_TABLES 4
+
+//
+// Settings of the decoder
+//
+struct DecoderOptions {
+    // inverse DCT implementation
+    DctMethod dctMethod = DCT_FLOAT;
+
+    // number of threads to reconstruct blocks (and decode restart intervals) with -
+    // 0 means one per hardware thread
+    int threads = 1;
+};
+
+//
+// A colour component of the frame being decoded
+//
+struct DecoderComponent {
+    int id;
+    int h, v;           // sampling factors
+    int quantTable;
+    int dcTable;        // tables of the current scan
+    int acTable;
+
+    // blocks covering the component's samples, i.e. its blocks in non-interleaved
+    // scans (interleaved scans code whole MCUs, which may add padding blocks)
+    int blocksWide;
+    int blocksHigh;
+
+    // inverse DCT multipliers, dequantising with the table in effect at the scan
+    int32_t multipliers[BLOCK_SIZE*BLOCK_SIZE];
+};
+
+//
+// Entropy decoding state of a scan, which starts afresh at each restart: the DC
+// predictions of its components (in scan order), and the blocks left of the
+// current EOB run (of progressive AC scans)
+//
+struct ScanState {
+    int dcPred[MAX_COMPONENTS];
+    int eobRun;
+};
+
+//
+// Baseline (and 8-bit extended sequential) and progressive Huffman JPEG decoder,
+// for grayscale and YCbCr images with any of the chroma subsamplings the encoder
+// produces.
+//
+// Decoding is in two stages, mirroring the encoder:
+//      - entropy decoding: markers are parsed, and each scan's coefficients are
+//        decoded (with table lookups, see HuffmanDecodeTable) into coefficient
+//        planes. The scans of progressive files add to the planes band by band
+//        and bit by bit (see Progressive), so the image is reconstructed once,
+//        after the last scan.
+//      - reconstruction: per-block dequantisation and inverse DCT, then chroma
+//        upsampling and colour conversion, in parallel over block rows
+//
+// Restart intervals are supported. With several threads, a scan's restart
+// intervals are decoded in parallel: its data is split at the RSTn markers, and
+// each interval decoded by its own bit reader, from a fresh state.
+//
+// Files of the internal rANS format (see Rans) are decoded too: their frame
+// header is parsed as a JFIF one, then their blocks are decoded in the order of
+// a baseline scan, from the interleaved rANS stream and the magnitude bit stream,
+// and reconstructed as above.
+//
+// Lossless, hierarchical and arithmetic-coded files are rejected.
+//
+class JpegDecoder {
+private:
+    DecoderOptions options;
+    JpegElements jpegElements;
+    ThreadPool pool;
+
+    // tables defined so far, indexed by table id. Quantisation tables in natural order.
+    uint16_t quantTables[MAX_TABLES][BLOCK_SIZE*BLOCK_SIZE];
+    bool quantDefined[MAX_TABLES];
+    HuffmanDecodeTable dcTables[MAX_TABLES];
+    HuffmanDecodeTable acTables[MAX_TABLES];
+    bool dcDefined[MAX_TABLES];
+    bool acDefined[MAX_TABLES];
+
+    // MCUs per restart interval (0 if none)
+    int restartInterval;
+
+    // frame
+    int width;
+    int height;
+    int numComponents;
+    DecoderComponent components[MAX_COMPONENTS];
+    int maxH, maxV;
+    int mcusWide, mcusHigh;
+
+    // whether the frame is progressive (SOF2)
+    bool progressive;
+
+    // components of the current scan, and its band of zig-zag positions and
+    // successive approximation bit positions
+    int scanComponents[MAX_COMPONENTS];
+    int numScanComponents;
+    int scanSs, scanSe;
+    int scanAh, scanAl;
+
+    // start of each restart interval of the current scan's data, then its end
+    // (see findIntervals)
+    std::vector<size_t> intervalStarts;
+
+    // coefficients and samples of each component, and full resolution planes in
+    // Y, Cr, Cb order
+    CoefPlane coefPlanes[MAX_COMPONENTS];
+    Plane<uchar> samplePlanes[MAX_COMPONENTS];
+    Plane<uchar> fullPlanes[3];
+
+    std::string errorMessage;
+
+    //
+    // Records the given error. Returns false.
+    //
+    bool fail(const std::string &message);
+
+    //
+    // Parsers of the marker segments (given without marker and length)
+    //
+    bool parseSof(const uchar *segment, size_t size);
+    bool parseDht(const uchar *segment, size_t size);
+    bool parseDqt(const uchar *segment, size_t size);
+    bool parseDri(const uchar *segment, size_t size);
+    bool parseSos(const uchar *segment, size_t size);
+
+    //
+    // Decodes the entropy-coded data of the current scan, which starts at `pos`.
+    // Leaves `pos` at the marker ending the scan.
+    //
+    bool decodeScan(const uchar *data, size_t size, size_t &pos);
+
+    //
+    // Finds the restart intervals of the current scan, whose data starts at
+    // `pos`. Returns false unless there are `numIntervals` of them.
+    //
+    bool findIntervals(const uchar *data, size_t size, size_t pos, int numIntervals);
+
+    //
+    // Decodes units [firstUnit, endUnit) of the current scan: MCUs of interleaved
+    // scans, blocks of single-component ones
+    //
+    bool decodeUnits(BitReader &reader, ScanState &state, int firstUnit, int endUnit);
+
+    //
+    // Decodes the coefficients of a block, in zig-zag order (JPEG F.2.2)
+    //
+    bool decodeBlock(BitReader &reader, int16_t *zigZag, const DecoderComponent &component, int &dcPred);
+
+    //
+    // Decodes the current progressive scan's band or bit of the coefficients of a
+    // block, adding them to the block (JPEG G.2)
+    //
+    bool decodeProgressiveBlock(BitReader &reader, int16_t *zigZag, const DecoderComponent &component,
+                                int &dcPred, int &eobRun);
+
+    //
+    // Decodes a file of the internal rANS format into the coefficient planes
+    //
+    bool decodeRans(const uchar *data, size_t size);
+
+    //
+    // Reconstructs the image from the coefficient planes
+    //
+    void reconstruct(cv::Mat &image);
+
+public:
+    explicit JpegDecoder(const DecoderOptions &options);
+
+    //
+    // Decodes the given JPEG (or rANS format) file contents into a BGR (or, for
+    // grayscale files, single-channel) image. Returns false on invalid or
+    // unsupported input (see `error`).
+    //
+    bool decode(const uchar *data, size_t size, cv::Mat &image);
+
+    //
+    // Description of the last decoding error
+    //
+    const std::string& error() const;
+};
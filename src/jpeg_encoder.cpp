@@ -0,0 +1,526 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "jpeg_encoder.hpp"
+#include "jpeg.hpp"
+#include "color.hpp"
+#include "shared.hpp"
+#include "profile.hpp"
+
+JpegEncoder::JpegEncoder(const EncoderOptions &options)
+    : options(options), pool(options.threads) {
+    // progressive scans and rANS files are coded without restart intervals
+    if (options.progressive || options.entropy == ENTROPY_RANS) {
+        this->options.restartInterval = 0;
+    }
+    frame.restartInterval = this->options.restartInterval;
+    chromaQuantTable = 0;
+    frame.quantTables[0] = frame.quantTables[1] = &jpegElements.quant_tables[options.quantMatrixIndex];
+    frame.numQuantTables = 1;
+    setComponents(NUM_COMPONENTS);
+    if (options.quality > 0) {
+        setQuality(options.quality);
+    }
+
+    // standard tables (replaced per image when optimizing)
+    dcTables[0].build(jpegElements.STD_DC_LUMINANCE_BITS, jpegElements.STD_DC_LUMINANCE_VALS);
+    dcTables[1].build(jpegElements.STD_DC_CHROMINANCE_BITS, jpegElements.STD_DC_CHROMINANCE_VALS);
+    acTables[0].build(jpegElements.STD_AC_LUMINANCE_BITS, jpegElements.STD_AC_LUMINANCE_VALS);
+    acTables[1].build(jpegElements.STD_AC_CHROMINANCE_BITS, jpegElements.STD_AC_CHROMINANCE_VALS);
+}
+
+//
+// Records the given error. Returns false.
+//
+bool JpegEncoder::fail(const std::string &message) {
+    errorMessage = message;
+    return false;
+}
+
+//
+// Description of the last encoding error
+//
+const std::string& JpegEncoder::error() const {
+    return errorMessage;
+}
+
+//
+// Checks that the SOF segment's 16-bit fields can hold the given image
+// dimensions (which would otherwise be written truncated)
+//
+bool JpegEncoder::checkDimensions(int width, int height) {
+    if (width > MAX_IMAGE_DIMENSION || height > MAX_IMAGE_DIMENSION) {
+        return fail("image dimensions " + std::to_string(width) + "x" + std::to_string(height)
+                    + " exceed the JPEG maximum of " + std::to_string(MAX_IMAGE_DIMENSION));
+    }
+    return true;
+}
+
+//
+// Quantises with the standard luma and chroma tables scaled to the given quality
+//
+void JpegEncoder::setQuality(int quality) {
+    const QuantTable *tables = jpegElements.getQualityTables(quality);
+    frame.quantTables[0] = &tables[0];
+    frame.quantTables[1] = &tables[1];
+    frame.numQuantTables = 2;
+    chromaQuantTable = 1;
+    setComponents(frame.numComponents);
+}
+
+//
+// Sets up the frame components for images of the given number of channels:
+// Y, Cb and Cr for colour images, a single (unsubsampled) Y for grayscale ones
+//
+void JpegEncoder::setComponents(int channels) {
+    JfifComponent *components = frame.components;
+    if (channels == 1) {
+        frame.numComponents = 1;
+        components[0] = {1, 1, 1, 0, 0, 0};
+        return;
+    }
+
+    int h = Sampling::lumaH(options.subsampling), v = Sampling::lumaV(options.subsampling);
+    frame.numComponents = NUM_COMPONENTS;
+    components[0] = {1, h, v, 0, 0, 0};                // Y
+    components[1] = {2, 1, 1, chromaQuantTable, 1, 1}; // Cb
+    components[2] = {3, 1, 1, chromaQuantTable, 1, 1}; // Cr
+}
+
+//
+// Converts the given BGR (RGB if `rgb`, or grayscale) image into sample planes of
+// the given padded dimensions, subsampling chroma
+//
+void JpegEncoder::convertPlanes(const cv::Mat &image, bool rgb, int paddedWidth, int paddedHeight) {
+    uint64_t planeBytes = static_cast<uint64_t>(paddedWidth) * paddedHeight;
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_COLOR);
+        timer.setCounts(0, image.total() * image.elemSize(), planeBytes * frame.numComponents);
+        if (frame.numComponents == 1) {
+            Color::grayToPlane(image, planes[0], paddedWidth, paddedHeight, pool);
+            return;
+        }
+
+        // Y goes straight to its plane, chroma via full-resolution planes
+        Color::bgrToYcbcrPlanes(image, fullPlanes, paddedWidth, paddedHeight, pool, rgb);
+        std::swap(planes[0], fullPlanes[0]);
+    }
+
+    Profile::ScopedTimer timer(Profile::STAGE_SAMPLING);
+    int h = frame.components[0].h, v = frame.components[0].v;
+    for (int channel = 1; channel < NUM_COMPONENTS; channel++) {
+        Sampling::downsample(fullPlanes[channel], planes[channel], h, v, pool);
+    }
+    timer.setCounts(0, 2 * planeBytes, 2 * planeBytes / (h * v));
+}
+
+//
+// Transforms the sample planes into quantised coefficient planes, in parallel
+// over block rows
+//
+void JpegEncoder::transformBlocks() {
+    Profile::ScopedTimer timer(Profile::STAGE_TRANSFORM);
+
+    // block rows of each channel, laid out one channel after the other
+    int blockRowOffsets[NUM_COMPONENTS + 1] = {0};
+    for (int channel = 0; channel < frame.numComponents; channel++) {
+        frame.coefPlanes[channel].create(planes[channel].width / BLOCK_SIZE, planes[channel].height / BLOCK_SIZE);
+        frame.blockEnds[channel].create(frame.coefPlanes[channel].blocksWide, frame.coefPlanes[channel].blocksHigh);
+        blockRowOffsets[channel + 1] = blockRowOffsets[channel] + frame.coefPlanes[channel].blocksHigh;
+    }
+
+    // one task per block row of each channel
+    pool.parallelFor(blockRowOffsets[frame.numComponents], [&](int task) {
+        int channel = 0;
+        while (task >= blockRowOffsets[channel + 1]) {
+            channel++;
+        }
+        int by = task - blockRowOffsets[channel];
+        const Plane<uchar> &plane = planes[channel];
+        CoefPlane &coefPlane = frame.coefPlanes[channel];
+        const QuantTable &quantTable = *frame.quantTables[channel == 0 ? 0 : 1];
+        uchar *ends = frame.blockEnds[channel].row(by);
+        BlockScratch scratch;
+        for (int bx = 0; bx < coefPlane.blocksWide; bx++) {
+            ends[bx] = jpegBlockForward(plane.row(by * BLOCK_SIZE) + bx * BLOCK_SIZE, plane.stride,
+                                        coefPlane.block(bx, by), quantTable, options.dctMethod,
+                                        jpegElements, scratch);
+        }
+    });
+    uint64_t blocks = frame.numBlocks();
+    timer.setCounts(blocks, blocks * 64, blocks * 64 * sizeof(int16_t));
+}
+
+//
+// Transforms the given image into quantised coefficient planes
+//
+void JpegEncoder::transform(const cv::Mat &image, bool rgb) {
+    // pad to make dimensions multiple of the MCU size
+    int mcuWidth = BLOCK_SIZE * frame.components[0].h, mcuHeight = BLOCK_SIZE * frame.components[0].v;
+    int M = (image.rows + mcuHeight - 1) / mcuHeight * mcuHeight;
+    int N = (image.cols + mcuWidth - 1) / mcuWidth * mcuWidth;
+    convertPlanes(image, rgb, N, M);
+    transformBlocks();
+}
+
+//
+// Writes everything up to (and including) the SOF segment: SOF2 for progressive
+// files, SOF0 otherwise
+//
+void JpegEncoder::writeFrameHeaders(BitWriter &writer, int width, int height) {
+    Jfif::writeSoi(writer);
+    Jfif::writeApp0(writer);
+    frame.writeQuantTables(writer);
+    if (options.progressive) {
+        Jfif::writeSof2(writer, width, height, frame.components, frame.numComponents);
+    } else {
+        Jfif::writeSof0(writer, width, height, frame.components, frame.numComponents);
+    }
+}
+
+//
+// Writes everything up to (and including) the SOS segment of a baseline file
+//
+void JpegEncoder::writeHeaders(BitWriter &writer, int width, int height) {
+    writeFrameHeaders(writer, width, height);
+    for (int id = 0; id < frame.numTableIds(); id++) {
+        Jfif::writeDht(writer, 0, id, dcTables[id]);
+        Jfif::writeDht(writer, 1, id, acTables[id]);
+    }
+    if (options.restartInterval > 0) {
+        Jfif::writeDri(writer, options.restartInterval);
+    }
+    Jfif::writeSos(writer, frame.components, frame.numComponents);
+}
+
+//
+// Counts the occurrences of each symbol, as SymbolCounter, the magnitude bits
+// that follow the symbols' codes, and the restart markers
+//
+struct SizeCounter {
+    uint64_t &magnitudeBits;
+    uint64_t &restarts;
+
+    inline void put(SymbolCounts *counts, int symbol, int, int size) {
+        counts->freqs[symbol]++;
+        magnitudeBits += size;
+    }
+
+    inline void restart(int) {
+        restarts++;
+    }
+};
+
+//
+// Symbol counts, magnitude bits and restart markers of (a range of MCU rows of)
+// a scan
+//
+struct ScanCounts {
+    SymbolCounts dc[2];
+    SymbolCounts ac[2];
+    uint64_t magnitudeBits;
+    uint64_t restarts;
+};
+
+//
+// Counts the symbols (and magnitude bits and restart markers) of the scan of the
+// coefficient planes, in parallel over ranges of MCU rows, each starting from the
+// DC predictions the rows above leave
+//
+void JpegEncoder::countSymbols(ScanCounts &counts) {
+    int mcusWide = frame.coefPlanes[0].blocksWide / frame.components[0].h;
+    int mcusHigh = frame.coefPlanes[0].blocksHigh / frame.components[0].v;
+    int numRanges = std::min(mcusHigh, 4 * pool.size());
+    std::vector<ScanCounts> rangeCounts(numRanges);
+
+    pool.parallelFor(numRanges, [&](int range) {
+        ScanCounts &c = rangeCounts[range];
+        memset(&c, 0, sizeof(c));
+        int first = static_cast<int>(static_cast<int64_t>(mcusHigh) * range / numRanges);
+        int end = static_cast<int>(static_cast<int64_t>(mcusHigh) * (range + 1) / numRanges);
+        int prevDc[NUM_COMPONENTS];
+        frame.dcPredictions(first, prevDc);
+        SizeCounter counter = {c.magnitudeBits, c.restarts};
+        frame.codeMcus(counter, c.dc, c.ac, prevDc, first * mcusWide, end * mcusWide, 0);
+    });
+
+    counts = rangeCounts[0];
+    for (int range = 1; range < numRanges; range++) {
+        for (int id = 0; id < 2; id++) {
+            for (int symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+                counts.dc[id].freqs[symbol] += rangeCounts[range].dc[id].freqs[symbol];
+                counts.ac[id].freqs[symbol] += rangeCounts[range].ac[id].freqs[symbol];
+            }
+        }
+        counts.magnitudeBits += rangeCounts[range].magnitudeBits;
+        counts.restarts += rangeCounts[range].restarts;
+    }
+}
+
+//
+// Builds optimal Huffman tables for the coefficient planes (JPEG Annex K.2), from
+// the symbol frequencies of a statistics pass over the scan
+//
+void JpegEncoder::optimizeTables() {
+    Profile::ScopedTimer timer(Profile::STAGE_STATISTICS);
+    uint64_t blocks = frame.numBlocks();
+    timer.setCounts(blocks, blocks * 64 * sizeof(int16_t), 0);
+
+    ScanCounts counts;
+    countSymbols(counts);
+    for (int id = 0; id < frame.numTableIds(); id++) {
+        huffmanEncoder.buildTable(counts.dc[id].freqs, dcTables[id]);
+        huffmanEncoder.buildTable(counts.ac[id].freqs, acTables[id]);
+    }
+}
+
+//
+// Entropy codes the coefficient planes as a single interleaved scan. Without
+// restart intervals (or threads to share them), the scan is coded in one go.
+// Otherwise the intervals are split into a few runs per thread, each coded into
+// a buffer of its own, starting with the RSTn marker ending the previous run
+// (intervals code independently of each other), and the buffers are appended in
+// order - giving the same bytes as coding in one go.
+//
+void JpegEncoder::encodeScan(BitWriter &writer) {
+    const HuffmanTable *dc = dcTables, *ac = acTables;
+    int interval = options.restartInterval;
+    int mcus = frame.numMcus();
+    int numIntervals = interval > 0 ? (mcus + interval - 1) / interval : 1;
+    int numRuns = pool.size() > 1 ? std::min(numIntervals, 4 * pool.size()) : 1;
+    if (numRuns == 1) {
+        SymbolWriter symbolWriter = {writer};
+        int prevDc[NUM_COMPONENTS] = {0};
+        frame.codeScan(symbolWriter, dc, ac, prevDc);
+        writer.alignToByte();
+        return;
+    }
+
+    std::vector<BitWriter> runWriters(numRuns);
+    pool.parallelFor(numRuns, [&](int run) {
+        int first = static_cast<int>(static_cast<int64_t>(numIntervals) * run / numRuns) * interval;
+        int end = std::min(static_cast<int>(static_cast<int64_t>(numIntervals) * (run + 1) / numRuns) * interval, mcus);
+        SymbolWriter symbolWriter = {runWriters[run]};
+        int prevDc[NUM_COMPONENTS] = {0};
+        frame.codeMcus(symbolWriter, dc, ac, prevDc, first, end, 0);
+        runWriters[run].alignToByte();
+    });
+    for (const BitWriter &runWriter : runWriters) {
+        writer.writeBytes(runWriter.data(), runWriter.size());
+    }
+}
+
+//
+// Writes the coefficient planes as a JFIF file, building optimized tables first if
+// enabled (always, for progressive files). Returns the number of bytes written.
+//
+size_t JpegEncoder::writeFile(std::ostream &out) {
+    if (options.entropy == ENTROPY_RANS) {
+        return ransWriter.write(out, frame);
+    }
+    if (options.progressive) {
+        progressiveWriter.optimizeTables(frame);
+    } else if (options.huffman == HUFFMAN_OPTIMIZED) {
+        optimizeTables();
+    }
+
+    Profile::ScopedTimer timer(Profile::STAGE_ENTROPY);
+    BitWriter writer(&out);
+    if (options.progressive) {
+        writeFrameHeaders(writer, frame.width, frame.height);
+        progressiveWriter.writeScans(writer, frame);
+    } else {
+        writeHeaders(writer, frame.width, frame.height);
+        encodeScan(writer);
+    }
+    Jfif::writeEoi(writer);
+    writer.flush();
+    uint64_t blocks = frame.numBlocks();
+    timer.setCounts(blocks, blocks * 64 * sizeof(int16_t), writer.size());
+    return writer.size();
+}
+
+//
+// Encodes the given BGR (RGB if `rgb`, or grayscale) image as a JFIF file into the
+// given stream. Returns the number of bytes written (0 if the image is too large).
+// With a target size or PSNR, searches the quality that meets it.
+//
+size_t JpegEncoder::encode(const cv::Mat &image, std::ostream &out, bool rgb) {
+    errorMessage.clear();
+    if (!checkDimensions(image.cols, image.rows)) {
+        return 0;
+    }
+    frame.width = image.cols;
+    frame.height = image.rows;
+    if (options.targetBytes > 0 || options.targetPsnr > 0) {
+        return rateControl.encode(*this, image, out, rgb);
+    }
+    setComponents(image.channels());
+    transform(image, rgb);
+    return writeFile(out);
+}
+
+//
+// Outcome of the last encode with a target size or PSNR
+//
+const RateResult &JpegEncoder::rateResult() const {
+    return rateControl.result();
+}
+
+//
+// Estimates the size of the file the coefficient planes code into: counts the
+// symbols of the scan (in parallel, see countSymbols), builds optimized
+// tables from the counts if enabled, and adds up code lengths and magnitude bits.
+// Headers are written out (to memory) with the tables in use; byte stuffing is
+// estimated as one byte in 256 of the scan. Progressive files are estimated as
+// baseline ones with optimized tables, which they come within a few percent of.
+//
+size_t JpegEncoder::estimateSize() {
+    Profile::ScopedTimer timer(Profile::STAGE_STATISTICS);
+    ScanCounts total;
+    countSymbols(total);
+
+    // each restart marker takes 2 bytes, after the interval's last byte is padded
+    // (by 4 bits, on average)
+    uint64_t bits = total.magnitudeBits + total.restarts * (16 + 4);
+    for (int id = 0; id < frame.numTableIds(); id++) {
+        if (options.huffman == HUFFMAN_OPTIMIZED || options.progressive) {
+            huffmanEncoder.buildTable(total.dc[id].freqs, dcTables[id]);
+            huffmanEncoder.buildTable(total.ac[id].freqs, acTables[id]);
+        }
+        for (int symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+            bits += static_cast<uint64_t>(total.dc[id].freqs[symbol]) * dcTables[id].lengths[symbol]
+                    + static_cast<uint64_t>(total.ac[id].freqs[symbol]) * acTables[id].lengths[symbol];
+        }
+    }
+
+    std::ostringstream headers;
+    BitWriter writer(&headers);
+    writeHeaders(writer, frame.width, frame.height);
+    writer.flush();
+
+    uint64_t scanBytes = (bits + 7) / 8;
+    uint64_t blocks = frame.numBlocks();
+    timer.setCounts(blocks, blocks * 64 * sizeof(int16_t), 0);
+    return writer.size() + scanBytes + scanBytes / 256 + 2;
+}
+
+//
+// Measures the quality of the last image encoded whole, the given `image` (RGB if
+// `rgb`), which compressed into `compressedBytes` bytes (see jpeg_encoder.hpp).
+// Blocks are reconstructed with the decoder's own steps (jpegBlockInverse, then
+// upsampling and colour conversion), in parallel over block rows.
+//
+QualityMetrics JpegEncoder::measure(const cv::Mat &image, bool rgb, size_t compressedBytes) {
+    // dequantisation multipliers of each table, from its natural order values
+    int32_t multipliers[2][BLOCK_SIZE*BLOCK_SIZE];
+    for (int t = 0; t < 2; t++) {
+        uint16_t values[BLOCK_SIZE*BLOCK_SIZE];
+        for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+            values[jpegElements.zig_zag_order[k]] = frame.quantTables[t]->values[k];
+        }
+        jpegElements.computeIdctMultipliers(options.dctMethod, values, multipliers[t]);
+    }
+
+    // block rows of each channel, laid out one channel after the other
+    int blockRowOffsets[NUM_COMPONENTS + 1] = {0};
+    for (int channel = 0; channel < frame.numComponents; channel++) {
+        reconstructedPlanes[channel].create(planes[channel].width, planes[channel].height);
+        blockRowOffsets[channel + 1] = blockRowOffsets[channel] + frame.coefPlanes[channel].blocksHigh;
+    }
+
+    pool.parallelFor(blockRowOffsets[frame.numComponents], [&](int task) {
+        int channel = 0;
+        while (task >= blockRowOffsets[channel + 1]) {
+            channel++;
+        }
+        int by = task - blockRowOffsets[channel];
+        const CoefPlane &coefPlane = frame.coefPlanes[channel];
+        Plane<uchar> &plane = reconstructedPlanes[channel];
+        BlockScratch scratch;
+        for (int bx = 0; bx < coefPlane.blocksWide; bx++) {
+            jpegBlockInverse(coefPlane.block(bx, by), multipliers[channel == 0 ? 0 : 1],
+                             plane.row(by * BLOCK_SIZE) + bx * BLOCK_SIZE, plane.stride,
+                             options.dctMethod, jpegElements, scratch);
+        }
+    });
+
+    // luma (and unsubsampled chroma) is already at full resolution
+    int h = frame.components[0].h, v = frame.components[0].v;
+    for (int channel = 0; channel < frame.numComponents; channel++) {
+        if (channel == 0 || (h == 1 && v == 1)) {
+            std::swap(reconstructedFullPlanes[channel], reconstructedPlanes[channel]);
+        } else {
+            Sampling::upsample(reconstructedPlanes[channel], reconstructedFullPlanes[channel], h, v, pool);
+        }
+    }
+
+    if (frame.numComponents == 1) {
+        Plane<uchar> &plane = reconstructedFullPlanes[0];
+        cv::Mat reconstruction(frame.height, frame.width, CV_8UC1, plane.row(0), plane.stride);
+        return Metrics::compare(image, false, reconstruction, compressedBytes, pool);
+    }
+    cv::Mat reconstruction = Color::ycbcrPlanesToBgr(reconstructedFullPlanes, frame.width, frame.height, pool);
+    return Metrics::compare(image, rgb, reconstruction, compressedBytes, pool);
+}
+
+//
+// Encodes the image read by the given reader as a JFIF file into the given
+// stream, one MCU row at a time (see jpeg_encoder.hpp). Gives the number of bytes
+// written. Returns false if the encoder uses optimized Huffman tables (or anything
+// else that needs the whole image), if the image is too large (before writing
+// anything), or if the input ends early.
+//
+bool JpegEncoder::encodeStream(RowReader &reader, std::ostream &out, size_t &bytes) {
+    const PixelFormat &format = reader.format();
+    errorMessage.clear();
+    if (options.huffman == HUFFMAN_OPTIMIZED || options.progressive || options.entropy == ENTROPY_RANS
+        || options.targetBytes > 0 || options.targetPsnr > 0) {
+        return fail("streaming needs standard Huffman tables, baseline scans and a fixed quality");
+    }
+    if (!checkDimensions(format.width, format.height)) {
+        return false;
+    }
+    setComponents(format.channels);
+
+    // a strip is one MCU row of the image, padded to a whole number of MCUs
+    int mcuWidth = BLOCK_SIZE * frame.components[0].h, mcuHeight = BLOCK_SIZE * frame.components[0].v;
+    int N = (format.width + mcuWidth - 1) / mcuWidth * mcuWidth;
+    cv::Mat strip(mcuHeight, format.width, format.channels == 1 ? CV_8UC1 : CV_8UC3);
+
+    BitWriter writer(&out);
+    writeHeaders(writer, format.width, format.height);
+
+    SymbolWriter symbolWriter = {writer};
+    const HuffmanTable *dc = dcTables, *ac = acTables;
+    int prevDc[NUM_COMPONENTS] = {0};
+    int mcuOffset = 0;
+    for (int y = 0; y < format.height; y += mcuHeight) {
+        int rows;
+        {
+            Profile::ScopedTimer timer(Profile::STAGE_READ);
+            rows = reader.read(strip.data, strip.step, mcuHeight);
+            timer.setCounts(0, rows > 0 ? rows * format.rowBytes() : 0, 0);
+        }
+        if (rows <= 0) {
+            return fail("input ended early");
+        }
+        // the last strip's missing rows replicate its bottom row
+        convertPlanes(strip.rowRange(0, rows), format.rgb, N, mcuHeight);
+        transformBlocks();
+
+        Profile::ScopedTimer timer(Profile::STAGE_ENTROPY);
+        size_t before = writer.size();
+        frame.codeScan(symbolWriter, dc, ac, prevDc, mcuOffset);
+        mcuOffset += N / mcuWidth;
+        uint64_t blocks = frame.numBlocks();
+        timer.setCounts(blocks, blocks * 64 * sizeof(int16_t), writer.size() - before);
+    }
+
+    writer.alignToByte();
+    Jfif::writeEoi(writer);
+    writer.flush();
+    bytes = writer.size();
+    return true;
+}
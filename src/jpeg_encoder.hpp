@@ -0,0 +1,264 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "pre_computed.hpp"
+#include "plane.hpp"
+#include "sampling.hpp"
+#include "thread_pool.hpp"
+#include "huffman.hpp"
+#include "bit_writer.hpp"
+#include "row_reader.hpp"
+#include "metrics.hpp"
+#include "coef_frame.hpp"
+#include "progressive_writer.hpp"
+#include "rans_writer.hpp"
+#include "rate_control.hpp"
+
+//
+// Huffman table modes:
+//      - standard: the example tables of JPEG Annex K.3, in a single pass
+//      - optimized: tables built per image from its symbol statistics (Annex K.2),
+//        which takes an extra statistics pass, but gives smaller files
+//
+enum HuffmanMode {
+    HUFFMAN_STANDARD = 0,
+    HUFFMAN_OPTIMIZED = 1
+};
+
+//
+// Entropy coders:
+//      - huffman: JPEG Huffman coding, writing JFIF files
+//      - rans: rANS coding of the same symbols, in contexts (see Rans), writing
+//        files of an internal format that only JpegDecoder reads
+//
+enum EntropyCoder {
+    ENTROPY_HUFFMAN = 0,
+    ENTROPY_RANS = 1
+};
+
+//
+// Settings of the encoder
+//
+struct EncoderOptions {
+    // quantisation matrix to use for all components (see pre_computed.hpp)
+    int quantMatrixIndex = 3;
+
+    // quality (MIN_QUALITY to MAX_QUALITY) to scale the standard luma and chroma
+    // quantisation tables to - 0 means quantMatrixIndex is used instead
+    int quality = 0;
+
+    // DCT implementation
+    DctMethod dctMethod = DCT_FLOAT;
+
+    // chroma subsampling mode
+    Subsampling subsampling = SUBSAMPLING_444;
+
+    // Huffman tables to code with
+    HuffmanMode huffman = HUFFMAN_STANDARD;
+
+    // write progressive JPEGs (see Progressive), whose scans are always coded
+    // with optimized tables - rather than baseline ones
+    bool progressive = false;
+
+    // entropy coder - rANS files are always baseline, without restart intervals
+    EntropyCoder entropy = ENTROPY_HUFFMAN;
+
+    // MCUs per restart interval of baseline files - 0 for none. Intervals are
+    // entropy coded independently, so in parallel.
+    int restartInterval = 0;
+
+    // number of threads to transform blocks (and code restart intervals) with -
+    // 0 means one per hardware thread
+    int threads = 1;
+
+    // rate control: the largest file size (bytes), or the lowest PSNR (dB, see
+    // QualityMetrics), to search the quality for instead of using `quality` -
+    // 0 for neither
+    size_t targetBytes = 0;
+    double targetPsnr = 0;
+};
+
+// symbol counts of a scan (see jpeg_encoder.cpp)
+struct ScanCounts;
+
+//
+// Baseline JPEG encoder, writing JFIF files of colour (Y, Cb, Cr) or grayscale
+// images.
+//
+// Encoding is in two stages:
+//      - transform: colour conversion, chroma subsampling, and per-block DCT and
+//        quantisation into the coefficient planes of a CoefFrame, in parallel over
+//        block rows
+//      - entropy coding: headers, then one interleaved scan of all components. With
+//        optimized Huffman tables, a statistics pass over the scan comes first.
+//        With restart intervals, each run of intervals is coded by its own thread
+//        into its own buffer (each interval starts afresh, after an RSTn marker),
+//        and the buffers are concatenated.
+// Progressive files and rANS coded files are written from the same coefficient
+// planes, by a ProgressiveWriter or a RansWriter. With a target size or PSNR, a
+// RateController searches the quality to encode at.
+//
+// Images are either encoded whole, or streamed: read, transformed and coded one
+// MCU row (a strip of 8 or 16 pixel rows) at a time, with the coded bytes written
+// out as they fill the bit writer's buffer. Streaming holds only a strip in
+// memory, so its footprint depends on the image's width, not its area.
+//
+// Planes are kept between calls, so encoding images of the same size does not
+// allocate.
+//
+class JpegEncoder {
+private:
+    EncoderOptions options;
+    JpegElements jpegElements;
+    ThreadPool pool;
+
+    // Y, Cr, Cb sample planes (with full-resolution chroma planes to subsample
+    // from)
+    Plane<uchar> fullPlanes[NUM_COMPONENTS];
+    Plane<uchar> planes[NUM_COMPONENTS];
+
+    // the image being encoded, as its entropy coders see it (after `encode`, the
+    // last image encoded whole)
+    CoefFrame frame;
+
+    // planes reconstructed from the coefficient planes, and their full-resolution
+    // versions (see measure)
+    Plane<uchar> reconstructedPlanes[NUM_COMPONENTS];
+    Plane<uchar> reconstructedFullPlanes[NUM_COMPONENTS];
+
+    // quantisation table id of the chroma components
+    int chromaQuantTable;
+
+    // Huffman tables, indexed by table id (0: luma, 1: chroma)
+    HuffmanTable dcTables[2];
+    HuffmanTable acTables[2];
+
+    // builder of optimized tables
+    HuffmanEncoder huffmanEncoder;
+
+    // writers of progressive and rANS coded files, and rate control
+    ProgressiveWriter progressiveWriter;
+    RansWriter ransWriter;
+    RateController rateControl;
+    friend class RateController;
+
+    std::string errorMessage;
+
+    //
+    // Records the given error. Returns false.
+    //
+    bool fail(const std::string &message);
+
+    //
+    // Checks that the SOF segment can hold the given image dimensions
+    //
+    bool checkDimensions(int width, int height);
+
+    //
+    // Sets up the frame components for images of the given number of channels
+    //
+    void setComponents(int channels);
+
+    //
+    // Converts the given image into sample planes of the given padded dimensions
+    //
+    void convertPlanes(const cv::Mat &image, bool rgb, int paddedWidth, int paddedHeight);
+
+    //
+    // Transforms the sample planes into quantised coefficient planes
+    //
+    void transformBlocks();
+
+    //
+    // Transforms the given image into quantised coefficient planes
+    //
+    void transform(const cv::Mat &image, bool rgb);
+
+    //
+    // Writes everything up to (and including) the SOF segment
+    //
+    void writeFrameHeaders(BitWriter &writer, int width, int height);
+
+    //
+    // Writes everything up to (and including) the SOS segment of a baseline file
+    //
+    void writeHeaders(BitWriter &writer, int width, int height);
+
+    //
+    // Counts the symbols of the scan of the coefficient planes, in parallel
+    //
+    void countSymbols(ScanCounts &counts);
+
+    //
+    // Builds optimal Huffman tables for the coefficient planes
+    //
+    void optimizeTables();
+
+    //
+    // Entropy codes the coefficient planes as a single interleaved scan, a run of
+    // restart intervals per thread
+    //
+    void encodeScan(BitWriter &writer);
+
+    //
+    // Writes the coefficient planes as a JFIF file (or, with the rANS coder, a
+    // file of the internal format), building optimized tables first if enabled.
+    // Returns the number of bytes written.
+    //
+    size_t writeFile(std::ostream &out);
+
+    //
+    // Quantises with the standard tables scaled to the given quality
+    //
+    void setQuality(int quality);
+
+    //
+    // Estimates the size of the file the coefficient planes code into, without
+    // coding them
+    //
+    size_t estimateSize();
+
+public:
+    explicit JpegEncoder(const EncoderOptions &options);
+
+    //
+    // Encodes the given BGR (RGB if `rgb`, or grayscale) image as a JFIF file into
+    // the given stream. Returns the number of bytes written, or 0 (writing
+    // nothing) if the image is larger than a JPEG can hold (see `error`). With a
+    // target size or PSNR, searches the quality that meets it (see `rateResult`).
+    //
+    size_t encode(const cv::Mat &image, std::ostream &out, bool rgb = false);
+
+    //
+    // Outcome of the last encode with a target size or PSNR
+    //
+    const RateResult &rateResult() const;
+
+    //
+    // Encodes the image read by the given reader as a JFIF file into the given
+    // stream, a strip at a time. Gives the number of bytes written. Returns false
+    // (see `error`) if the encoder uses optimized Huffman tables, progressive
+    // scans, the rANS coder or a target size or PSNR, which need the whole image,
+    // if the image is larger than a JPEG can hold (writing nothing), or if the
+    // input ends early.
+    //
+    bool encodeStream(RowReader &reader, std::ostream &out, size_t &bytes);
+
+    //
+    // Description of the last encoding error
+    //
+    const std::string& error() const;
+
+    //
+    // Measures the quality of the last image encoded whole (by `encode`): the
+    // given `image` (RGB if `rgb`), which compressed into `compressedBytes` bytes.
+    // Compares it with the image a decoder reconstructs (with the same DCT method
+    // and colour conversion), see Metrics. Reconstructs from the coefficient
+    // planes, so needs no entropy decoding.
+    //
+    QualityMetrics measure(const cv::Mat &image, bool rgb, size_t compressedBytes);
+};
@@ -0,0 +1,381 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+#include "pre_computed.hpp"
+#include "dct.hpp"
+#include "shared.hpp"
+#include "sampling.hpp"
+#include "jpeg.hpp"
+#include "jpeg_encoder.hpp"
+#include "jpeg_decoder.hpp"
+#include "row_reader.hpp"
+#include "profile.hpp"
+
+////////////////////////////////////////
+// Run
+////////////////////////////////////////
+
+struct CliArgs {
+    std::string imagePath;      
+
+    // quantisation matrix to use - default 3 (best performing so far)
+    int qmi = 3;           
+
+    // quality to scale the standard quantisation tables to, when writing JPEGs -
+    // 0 means the --qmi matrix is used instead
+    int quality = 0;
+
+    // file size (bytes) or PSNR (dB) to search the quality for, when writing JPEGs -
+    // 0 means no target
+    size_t targetBytes = 0;
+    double targetPsnr = 0;
+
+    // SIMD level of the DCT kernels - default is the best the host supports
+    CpuUtils::SimdLevel simd = CpuUtils::detectSimdLevel();
+
+    // DCT implementation - integer methods give bit-exact output on every platform
+    DctMethod dctMethod = DCT_FLOAT;
+
+    // chroma subsampling mode
+    Subsampling subsampling = SUBSAMPLING_444;
+
+    // Huffman tables of written JPEGs
+    HuffmanMode huffman = HUFFMAN_STANDARD;
+
+    // write progressive JPEGs rather than baseline ones
+    bool progressive = false;
+
+    // MCUs per restart interval of written JPEGs - 0 for none
+    int restartInterval = 0;
+
+    // entropy coder - rANS writes files of the internal format rather than JPEGs
+    EntropyCoder entropy = ENTROPY_HUFFMAN;
+
+    // number of threads to process blocks with - 0 means one per hardware thread
+    int threads = 1;
+
+    // JPEG file to write - if empty, the compressed image is displayed instead.
+    // When decoding, the image file to write the decoded image to.
+    std::string outPath;
+
+    // decode the given JPEG file, rather than compressing an image
+    bool decode = false;
+
+    // encode every image of the given directory or list file into the --out
+    // directory, rather than a single image
+    bool batch = false;
+
+    // encode a PPM/PGM image (or raw pixels) a strip at a time, from a file or
+    // stdin ("-"), to the --out file or stdout ("-")
+    bool stream = false;
+
+    // format of raw BGR input files - no size means inputs are image files
+    PixelFormat rawFormat;
+
+    // report the time and counts of each pipeline stage at the end, as a table
+    // or as JSON
+    bool profile = false;
+    bool profileJson = false;
+
+    // report the PSNR, SSIM and bits/pixel of the result, as text or as JSON.
+    // Unless given, on for --batch and when displaying, and off otherwise.
+    MetricsMode metrics = METRICS_OFF;
+    bool metricsGiven = false;
+};
+
+std::string usage() {
+    std::ostringstream oss;
+    oss << "Usage: myjpeg {image_file_path} [--qmi=N] [--simd=LEVEL] [--dct=METHOD] [--subsampling=S] [--threads=T] [--out=FILE [--huffman=H | --progressive | --entropy=E] [--restart=R] [--quality=Q | --target-size=B | --target-psnr=DB] [--raw=WxH]] [--metrics[=M]] [--profile[=json]]" << "\n";
+    oss << "       myjpeg {jpeg_file_path} --decode [--dct=METHOD] [--threads=T] [--out=FILE]" << "\n";
+    oss << "       myjpeg {ppm_pgm_file|-} --stream --out=FILE|- [--raw=WxH] [--qmi=N | --quality=Q] [--dct=METHOD] [--subsampling=S] [--threads=T] [--restart=R]" << "\n";
+    oss << "       myjpeg {image_dir_or_list_file} --batch --out=DIR [--qmi=N | --quality=Q | --target-size=B | --target-psnr=DB] [--dct=METHOD] [--subsampling=S] [--threads=T] [--huffman=H | --progressive | --entropy=E] [--restart=R] [--raw=WxH] [--metrics[=M]]" << "\n\n";
+    oss << "Note - valid N values: {0,1,2,3} (increasing orders of quantisation)" << "\n";
+    oss << "     - valid LEVEL values: {auto,scalar,sse2,avx2} (kernels to use)" << "\n";
+    oss << "     - valid METHOD values: {float,islow,ifast} (islow/ifast are bit-exact integer DCTs)" << "\n";
+    oss << "     - valid S values: {444,422,420} (chroma subsampling)" << "\n";
+    oss << "     - valid T values: >= 0 (0 uses one thread per hardware thread)" << "\n";
+    oss << "     - --out writes a JPEG to FILE, instead of displaying the result" << "\n";
+    oss << "       (with --decode, writes the decoded image to FILE, in a format given by its extension)" << "\n";
+    oss << "     - --batch encodes every image of a directory, or of a list file (one path per line), into" << "\n";
+    oss << "       DIR without any GUI, T files at a time, and prints a throughput summary" << "\n";
+    oss << "     - --stream encodes a binary PPM/PGM (or raw pixels) one strip of 8/16 rows at a time," << "\n";
+    oss << "       so memory grows with image width only; - is stdin/stdout" << "\n";
+    oss << "     - --raw reads input files as raw BGR pixels of size WxH; PPM/PGM and raw files are" << "\n";
+    oss << "       memory-mapped and encoded in place, without being decoded or copied" << "\n";
+    oss << "     - valid H values: {standard,optimized} (optimized: per-image Huffman tables, smaller but slower)" << "\n";
+    oss << "     - --progressive writes progressive JPEGs (a coarse image first, refined by later scans)," << "\n";
+    oss << "       always with optimized Huffman tables" << "\n";
+    oss << "     - --restart writes a restart marker every R MCUs (1-65535, not with --progressive); restart" << "\n";
+    oss << "       intervals are entropy coded, and decoded, in parallel on T threads" << "\n";
+    oss << "     - valid E values: {huffman,rans}; rans writes a file of an internal format (not a JPEG, but" << "\n";
+    oss << "       --decode reads it) whose symbols are rANS coded in contexts, a few percent smaller than" << "\n";
+    oss << "       with optimized Huffman tables; not with --restart, --stream or --target-size" << "\n";
+    oss << "     - valid Q values: 1-100 (scales the standard quantisation tables, replacing --qmi)" << "\n";
+    oss << "     - --target-size writes the highest quality whose file is at most B bytes (B may end in K or M);" << "\n";
+    oss << "       --target-psnr the lowest quality whose PSNR is at least DB. The image is transformed once," << "\n";
+    oss << "       and qualities searched by estimated size/PSNR, then the chosen one is checked" << "\n";
+    oss << "     - --metrics reports PSNR (overall and per R/G/B channel), luma SSIM and bits/pixel of the" << "\n";
+    oss << "       result; valid M values: {text,json,off}. On by default when displaying, and with --batch" << "\n";
+    oss << "       (the mean over the images, and with json, each image's too)" << "\n";
+    oss << "     - --profile (any mode) reports time, blocks and bytes in/out of each pipeline stage, as a" << "\n";
+    oss << "       table, or with --profile=json, as JSON" << "\n";
+    return oss.str();
+}
+
+//
+// Parses a file size in bytes, optionally in KiB or MiB (e.g. "200K").
+// Returns false on malformed or non-positive sizes.
+//
+bool parseByteSize(const std::string &size, size_t &bytes) {
+    const char *s = size.c_str();
+    char *end;
+    long long n = strtoll(s, &end, 10);
+    if (end == s || n <= 0) {
+        return false;
+    }
+    if (*end == 'K' || *end == 'k') {
+        n *= 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        n *= 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    bytes = static_cast<size_t>(n);
+    return true;
+}
+
+CliArgs parseCliArgs(int argc, char* argv[]) {
+    CliArgs args;
+
+    if (argc < 2) {
+        std::cout << usage();
+        std::exit(1);
+    }
+
+    args.imagePath = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--qmi=", 0) == 0) {
+            int qmi = std::stoi(arg.substr(6));
+            if (qmi < 0 || qmi >= NUM_QUANT_MATRICES) {
+                std::cout << usage();
+                std::exit(1);
+            }
+            args.qmi = qmi;
+        } else if (arg.rfind("--quality=", 0) == 0) {
+            int quality = std::stoi(arg.substr(10));
+            if (quality < MIN_QUALITY || quality > MAX_QUALITY) {
+                std::cout << usage();
+                std::exit(1);
+            }
+            args.quality = quality;
+        } else if (arg.rfind("--target-size=", 0) == 0) {
+            if (!parseByteSize(arg.substr(14), args.targetBytes)) {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg.rfind("--target-psnr=", 0) == 0) {
+            double psnr = std::atof(arg.substr(14).c_str());
+            if (psnr <= 0 || psnr > MAX_PSNR) {
+                std::cout << usage();
+                std::exit(1);
+            }
+            args.targetPsnr = psnr;
+        } else if (arg.rfind("--dct=", 0) == 0) {
+            std::string method = arg.substr(6);
+            if (method == "float") {
+                args.dctMethod = DCT_FLOAT;
+            } else if (method == "islow") {
+                args.dctMethod = DCT_ISLOW;
+            } else if (method == "ifast") {
+                args.dctMethod = DCT_IFAST;
+            } else {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg.rfind("--subsampling=", 0) == 0) {
+            if (!Sampling::parseSubsampling(arg.substr(14), args.subsampling)) {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            int threads = std::stoi(arg.substr(10));
+            if (threads < 0) {
+                std::cout << usage();
+                std::exit(1);
+            }
+            args.threads = threads;
+        } else if (arg.rfind("--huffman=", 0) == 0) {
+            std::string mode = arg.substr(10);
+            if (mode == "standard") {
+                args.huffman = HUFFMAN_STANDARD;
+            } else if (mode == "optimized") {
+                args.huffman = HUFFMAN_OPTIMIZED;
+            } else {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg == "--progressive") {
+            args.progressive = true;
+        } else if (arg.rfind("--restart=", 0) == 0) {
+            int interval = std::stoi(arg.substr(10));
+            if (interval < 1 || interval > MAX_RESTART_INTERVAL) {
+                std::cout << usage();
+                std::exit(1);
+            }
+            args.restartInterval = interval;
+        } else if (arg.rfind("--entropy=", 0) == 0) {
+            std::string coder = arg.substr(10);
+            if (coder == "huffman") {
+                args.entropy = ENTROPY_HUFFMAN;
+            } else if (coder == "rans") {
+                args.entropy = ENTROPY_RANS;
+            } else {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg == "--profile") {
+            args.profile = true;
+        } else if (arg == "--profile=json") {
+            args.profile = true;
+            args.profileJson = true;
+        } else if (arg == "--metrics" || arg == "--metrics=text") {
+            args.metrics = METRICS_TEXT;
+            args.metricsGiven = true;
+        } else if (arg == "--metrics=json") {
+            args.metrics = METRICS_JSON;
+            args.metricsGiven = true;
+        } else if (arg == "--metrics=off") {
+            args.metrics = METRICS_OFF;
+            args.metricsGiven = true;
+        } else if (arg == "--decode") {
+            args.decode = true;
+        } else if (arg == "--batch") {
+            args.batch = true;
+        } else if (arg == "--stream") {
+            args.stream = true;
+        } else if (arg.rfind("--raw=", 0) == 0) {
+            if (!parseImageSize(arg.substr(6), args.rawFormat.width, args.rawFormat.height)) {
+                std::cout << usage();
+                std::exit(1);
+            }
+            args.rawFormat.channels = 3;
+        } else if (arg.rfind("--out=", 0) == 0) {
+            args.outPath = arg.substr(6);
+            if (args.outPath.empty()) {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else if (arg.rfind("--simd=", 0) == 0) {
+            if (!CpuUtils::parseSimdLevel(arg.substr(7), args.simd)) {
+                std::cout << usage();
+                std::exit(1);
+            }
+        } else {
+            std::cout << usage();
+            std::exit(1);
+        }
+    }
+
+    if (args.batch && (args.decode || args.outPath.empty())) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    if (args.stream && (args.decode || args.batch || args.outPath.empty() || args.huffman == HUFFMAN_OPTIMIZED
+                        || args.progressive)) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    if (args.progressive && (args.decode || args.outPath.empty() || args.restartInterval > 0)) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    if (args.restartInterval > 0 && (args.decode || args.outPath.empty())) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    if (args.entropy == ENTROPY_RANS && (args.decode || args.outPath.empty() || args.stream || args.progressive
+                                         || args.huffman == HUFFMAN_OPTIMIZED || args.restartInterval > 0
+                                         || args.targetBytes > 0)) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    if (args.rawFormat.width > 0 && (args.decode || args.outPath.empty())) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    if (args.quality > 0 && (args.decode || args.outPath.empty())) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    bool target = args.targetBytes > 0 || args.targetPsnr > 0;
+    if (target && ((args.targetBytes > 0 && args.targetPsnr > 0) || args.quality > 0 || args.outPath.empty()
+                   || args.decode || args.stream)) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    if (args.metrics != METRICS_OFF && (args.decode || args.stream)) {
+        std::cout << usage();
+        std::exit(1);
+    }
+    if (!args.metricsGiven && !args.decode && (args.batch || args.outPath.empty())) {
+        args.metrics = METRICS_TEXT;
+    }
+
+    return args;
+}
+
+//
+// Runs the mode selected by the given arguments
+//
+int run(const CliArgs &args) {
+    if (args.decode) {
+        DecoderOptions options;
+        options.dctMethod = args.dctMethod;
+        options.threads = args.threads;
+        return jpegDecode(args.imagePath, args.outPath, options);
+    }
+    if (!args.outPath.empty()) {
+        EncoderOptions options;
+        options.quantMatrixIndex = args.qmi;
+        options.quality = args.quality;
+        options.targetBytes = args.targetBytes;
+        options.targetPsnr = args.targetPsnr;
+        options.dctMethod = args.dctMethod;
+        options.subsampling = args.subsampling;
+        options.huffman = args.huffman;
+        options.progressive = args.progressive;
+        options.entropy = args.entropy;
+        options.restartInterval = args.restartInterval;
+        options.threads = args.threads;
+        if (args.batch) {
+            return jpegEncodeBatch(args.imagePath, args.outPath, options, args.rawFormat, args.threads, args.metrics);
+        }
+        if (args.stream) {
+            return jpegEncodeStream(args.imagePath, args.outPath, options, args.rawFormat);
+        }
+        return jpegEncode(args.imagePath, args.outPath, options, args.rawFormat, args.metrics);
+    }
+    return jpegForwardReverse(args.imagePath, args.qmi, args.dctMethod, args.subsampling, args.threads, args.metrics);
+}
+
+int main(int argc, char* argv[]) {
+    CliArgs args = parseCliArgs(argc, argv);
+    if (!CpuUtils::setSimdLevel(args.simd)) {
+        std::cout << "SIMD level not supported by this CPU: " << CpuUtils::simdLevelName(args.simd) << "\n";
+        return 1;
+    }
+    Profile::setEnabled(args.profile);
+
+    int status = run(args);
+    if (args.profile) {
+        // reports go to stderr when a JPEG is streamed to stdout
+        Profile::report(args.outPath == "-" ? std::cerr : std::cout, args.profileJson);
+    }
+    return status;
+}
@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+#include "metrics.hpp"
+#include "color.hpp"
+#include "shared.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Metrics {
+
+    //
+    // SSIM stabilising constants (Wang et al.), scaled for sums over the 64 samples
+    // of a window, as in x264
+    //
+    static const double SSIM_C1 = 0.01 * 0.01 * 255 * 255 * 64;
+    static const double SSIM_C2 = 0.03 * 0.03 * 255 * 255 * 64 * 63;
+
+    static uint64_t sumSquaredDiffScalar(const uchar *a, const uchar *b, int n) {
+        uint64_t sum = 0;
+        for (int i = 0; i < n; i++) {
+            int d = a[i] - b[i];
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    static void channelSquaredDiffsScalar(const uchar *a, const uchar *b, int n, uint64_t *sums) {
+        for (int i = 0; i < n; i++) {
+            for (int c = 0; c < 3; c++) {
+                int d = a[3*i + c] - b[3*i + c];
+                sums[c] += d * d;
+            }
+        }
+    }
+
+    static void blockSums4x4Scalar(const uchar *a, size_t strideA, const uchar *b, size_t strideB,
+                                   int numBlocks, int32_t *sums) {
+        for (int block = 0; block < numBlocks; block++) {
+            int32_t s1 = 0, s2 = 0, ss = 0, s12 = 0;
+            for (int r = 0; r < 4; r++) {
+                const uchar *rowA = a + r * strideA + block * 4, *rowB = b + r * strideB + block * 4;
+                for (int c = 0; c < 4; c++) {
+                    int x = rowA[c], y = rowB[c];
+                    s1 += x;
+                    s2 += y;
+                    ss += x * x + y * y;
+                    s12 += x * y;
+                }
+            }
+            sums[4*block] = s1;
+            sums[4*block + 1] = s2;
+            sums[4*block + 2] = ss;
+            sums[4*block + 3] = s12;
+        }
+    }
+
+#if defined(__x86_64__)
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+    static AVX2_TARGET uint64_t sumSquaredDiffAvx2(const uchar *a, const uchar *b, int n) {
+        // 32-bit lanes take 4 squared differences (at most 4 * 255^2) per 32 samples,
+        // so cannot overflow within a row of up to ~500k samples
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i acc = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+            __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+            __m256i dLo = _mm256_sub_epi16(_mm256_unpacklo_epi8(va, zero), _mm256_unpacklo_epi8(vb, zero));
+            __m256i dHi = _mm256_sub_epi16(_mm256_unpackhi_epi8(va, zero), _mm256_unpackhi_epi8(vb, zero));
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(dLo, dLo), _mm256_madd_epi16(dHi, dHi)));
+        }
+
+        alignas(32) uint32_t lanes[8];
+        _mm256_store_si256((__m256i*) lanes, acc);
+        uint64_t sum = 0;
+        for (int k = 0; k < 8; k++) {
+            sum += lanes[k];
+        }
+        return sum + sumSquaredDiffScalar(a + i, b + i, n - i);
+    }
+
+    static AVX2_TARGET void channelSquaredDiffsAvx2(const uchar *a, const uchar *b, int n, uint64_t *sums) {
+        // 16 pixels (48 bytes) at a time, so each of the 48 32-bit lanes always sums
+        // the same byte of a pixel, of a known channel: one squared difference (at
+        // most 255^2) per 16 pixels cannot overflow within a row of up to ~1M pixels
+        __m256i acc[6];
+        for (int k = 0; k < 6; k++) {
+            acc[k] = _mm256_setzero_si256();
+        }
+        int i = 0;
+        for (; i + 16 <= n; i += 16) {
+            for (int k = 0; k < 3; k++) {
+                __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (a + 3*i + 16*k)));
+                __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (b + 3*i + 16*k)));
+                __m256i d = _mm256_sub_epi16(va, vb);
+                __m256i squares = _mm256_mullo_epi16(d, d);
+                acc[2*k] = _mm256_add_epi32(acc[2*k], _mm256_cvtepu16_epi32(_mm256_castsi256_si128(squares)));
+                acc[2*k + 1] = _mm256_add_epi32(acc[2*k + 1], _mm256_cvtepu16_epi32(_mm256_extracti128_si256(squares, 1)));
+            }
+        }
+
+        alignas(32) uint32_t lanes[48];
+        for (int k = 0; k < 6; k++) {
+            _mm256_store_si256((__m256i*) (lanes + 8*k), acc[k]);
+        }
+        for (int k = 0; k < 48; k++) {
+            sums[k % 3] += lanes[k];
+        }
+        channelSquaredDiffsScalar(a + 3*i, b + 3*i, n - i, sums);
+    }
+
+    static AVX2_TARGET void blockSums4x4Avx2(const uchar *a, size_t strideA, const uchar *b, size_t strideB,
+                                             int numBlocks, int32_t *sums) {
+        const __m256i one = _mm256_set1_epi16(1);
+        int block = 0;
+
+        // 4 blocks (16 samples per row) at a time: madd sums adjacent sample pairs, so
+        // after 4 rows each 32-bit lane holds half a block's sum
+        for (; block + 4 <= numBlocks; block += 4) {
+            __m256i s1 = _mm256_setzero_si256(), s2 = s1, ss = s1, s12 = s1;
+            for (int r = 0; r < 4; r++) {
+                __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (a + r * strideA + block * 4)));
+                __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (b + r * strideB + block * 4)));
+                s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(va, one));
+                s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(vb, one));
+                ss = _mm256_add_epi32(ss, _mm256_add_epi32(_mm256_madd_epi16(va, va), _mm256_madd_epi16(vb, vb)));
+                s12 = _mm256_add_epi32(s12, _mm256_madd_epi16(va, vb));
+            }
+
+            // per 128-bit lane (blocks 0-1 | 2-3): [s1 s1 s2 s2], [ss ss s12 s12] per block,
+            // then transposed to [s1 s2 ss s12] per block
+            __m256i x = _mm256_hadd_epi32(s1, s2);
+            __m256i y = _mm256_hadd_epi32(ss, s12);
+            __m256i lo = _mm256_unpacklo_epi32(x, y);
+            __m256i hi = _mm256_unpackhi_epi32(x, y);
+            __m256i even = _mm256_unpacklo_epi32(lo, hi);
+            __m256i odd = _mm256_unpackhi_epi32(lo, hi);
+            _mm256_storeu_si256((__m256i*) (sums + 4*block), _mm256_permute2x128_si256(even, odd, 0x20));
+            _mm256_storeu_si256((__m256i*) (sums + 4*block + 8), _mm256_permute2x128_si256(even, odd, 0x31));
+        }
+
+        blockSums4x4Scalar(a + block * 4, strideA, b + block * 4, strideB, numBlocks - block, sums + 4*block);
+    }
+
+#undef AVX2_TARGET
+
+#endif
+
+    //
+    // Sum of squared differences of `n` samples
+    //
+    uint64_t sumSquaredDiff(const uchar *a, const uchar *b, int n) {
+#if defined(__x86_64__)
+        if (CpuUtils::getSimdLevel() >= CpuUtils::SIMD_AVX2) {
+            return sumSquaredDiffAvx2(a, b, n);
+        }
+#endif
+        return sumSquaredDiffScalar(a, b, n);
+    }
+
+    //
+    // Sums of squared differences of each channel of `n` 3-channel pixels, into
+    // `sums` (3, in channel order)
+    //
+    void channelSquaredDiffs(const uchar *a, const uchar *b, int n, uint64_t *sums) {
+        sums[0] = sums[1] = sums[2] = 0;
+#if defined(__x86_64__)
+        if (CpuUtils::getSimdLevel() >= CpuUtils::SIMD_AVX2) {
+            channelSquaredDiffsAvx2(a, b, n, sums);
+            return;
+        }
+#endif
+        channelSquaredDiffsScalar(a, b, n, sums);
+    }
+
+    //
+    // Sums of a, b, a^2 + b^2 and a * b over each of `numBlocks` consecutive 4x4
+    // blocks of the given 4 rows of samples, into `sums` (4 per block, in that order)
+    //
+    void blockSums4x4(const uchar *a, size_t strideA, const uchar *b, size_t strideB,
+                      int numBlocks, int32_t *sums) {
+#if defined(__x86_64__)
+        if (CpuUtils::getSimdLevel() >= CpuUtils::SIMD_AVX2) {
+            blockSums4x4Avx2(a, strideA, b, strideB, numBlocks, sums);
+            return;
+        }
+#endif
+        blockSums4x4Scalar(a, strideA, b, strideB, numBlocks, sums);
+    }
+
+    //
+    // Mean squared error of two planes of the given size
+    //
+    double meanSquaredError(const uchar *a, size_t strideA, const uchar *b, size_t strideB,
+                            int width, int height, ThreadPool &pool) {
+        std::vector<uint64_t> rowSums(height);
+        pool.parallelFor(height, [&](int r) {
+            rowSums[r] = sumSquaredDiff(a + r * strideA, b + r * strideB, width);
+        });
+
+        uint64_t sum = 0;
+        for (uint64_t rowSum : rowSums) {
+            sum += rowSum;
+        }
+        return static_cast<double>(sum) / (static_cast<double>(width) * height);
+    }
+
+    //
+    // SSIM of a window, from the sums of its 64 samples
+    //
+    static inline double windowSsim(double s1, double s2, double ss, double s12) {
+        double variances = ss * 64 - s1 * s1 - s2 * s2;
+        double covariance = s12 * 64 - s1 * s2;
+        return (2 * s1 * s2 + SSIM_C1) * (2 * covariance + SSIM_C2)
+               / ((s1 * s1 + s2 * s2 + SSIM_C1) * (variances + SSIM_C2));
+    }
+
+    //
+    // Mean SSIM of two planes of the given size. Images smaller than a window
+    // (8x8) count as identical.
+    //
+    double ssim(const uchar *a, size_t strideA, const uchar *b, size_t strideB,
+                int width, int height, ThreadPool &pool) {
+        int blocksWide = width / 4, blocksHigh = height / 4;
+        if (blocksWide < 2 || blocksHigh < 2) {
+            return 1.0;
+        }
+
+        // statistics of every 4x4 block
+        std::vector<int32_t> sums(static_cast<size_t>(blocksWide) * blocksHigh * 4);
+        pool.parallelFor(blocksHigh, [&](int by) {
+            blockSums4x4(a + 4 * by * strideA, strideA, b + 4 * by * strideB, strideB, blocksWide,
+                         &sums[static_cast<size_t>(by) * blocksWide * 4]);
+        });
+
+        // every 8x8 window (2x2 blocks)
+        std::vector<double> rowSums(blocksHigh - 1);
+        pool.parallelFor(blocksHigh - 1, [&](int by) {
+            const int32_t *top = &sums[static_cast<size_t>(by) * blocksWide * 4];
+            const int32_t *bottom = top + blocksWide * 4;
+            double rowSum = 0;
+            for (int bx = 0; bx + 1 < blocksWide; bx++) {
+                double s[4];
+                for (int k = 0; k < 4; k++) {
+                    s[k] = top[4*bx + k] + top[4*bx + 4 + k] + bottom[4*bx + k] + bottom[4*bx + 4 + k];
+                }
+                rowSum += windowSsim(s[0], s[1], s[2], s[3]);
+            }
+            rowSums[by] = rowSum;
+        });
+
+        double sum = 0;
+        for (double rowSum : rowSums) {
+            sum += rowSum;
+        }
+        return sum / (static_cast<double>(blocksWide - 1) * (blocksHigh - 1));
+    }
+
+    //
+    // PSNR (dB) of the given mean squared error, for 8-bit samples (MAX_PSNR if 0)
+    //
+    double psnr(double mse) {
+        if (mse <= 0) {
+            return MAX_PSNR;
+        }
+        return std::min(MAX_PSNR, 10 * std::log10(255.0 * 255.0 / mse));
+    }
+
+    //
+    // Compares the given original image (BGR, or RGB if `originalRgb`, or grayscale)
+    // with its reconstruction (BGR or grayscale, of the same size), compressed
+    // into `compressedBytes` bytes
+    //
+    QualityMetrics compare(const cv::Mat &original, bool originalRgb, const cv::Mat &reconstruction,
+                           size_t compressedBytes, ThreadPool &pool) {
+        int width = original.cols, height = original.rows;
+        QualityMetrics metrics;
+        metrics.bitsPerPixel = 8.0 * compressedBytes / (static_cast<double>(width) * height);
+
+        if (original.channels() == 1) {
+            double mse = meanSquaredError(original.ptr<uchar>(0), original.step, reconstruction.ptr<uchar>(0),
+                                          reconstruction.step, width, height, pool);
+            metrics.psnrR = metrics.psnrG = metrics.psnrB = metrics.psnr = psnr(mse);
+            metrics.ssim = ssim(original.ptr<uchar>(0), original.step, reconstruction.ptr<uchar>(0),
+                                reconstruction.step, width, height, pool);
+            return metrics;
+        }
+
+        // squared differences of each channel, and the luma of both images, per row
+        // (RGB rows are swapped to BGR first)
+        std::vector<uint64_t> rowSums(3 * static_cast<size_t>(height));
+        Plane<uchar> originalLuma(width, height), reconstructedLuma(width, height);
+        pool.parallelFor(height, [&](int r) {
+            const uchar *row = original.ptr<uchar>(r);
+            std::vector<uchar> bgrRow, cr(width), cb(width);
+            if (originalRgb) {
+                bgrRow.resize(3 * static_cast<size_t>(width));
+                for (int i = 0; i < width; i++) {
+                    bgrRow[3*i] = row[3*i + 2];
+                    bgrRow[3*i + 1] = row[3*i + 1];
+                    bgrRow[3*i + 2] = row[3*i];
+                }
+                row = bgrRow.data();
+            }
+            const uchar *reconstructedRow = reconstruction.ptr<uchar>(r);
+            channelSquaredDiffs(row, reconstructedRow, width, &rowSums[3 * static_cast<size_t>(r)]);
+            Color::bgrRowToYcbcr(row, width, originalLuma.row(r), cr.data(), cb.data());
+            Color::bgrRowToYcbcr(reconstructedRow, width, reconstructedLuma.row(r), cr.data(), cb.data());
+        });
+
+        uint64_t sums[3] = {0, 0, 0};
+        for (int r = 0; r < height; r++) {
+            for (int c = 0; c < 3; c++) {
+                sums[c] += rowSums[3 * static_cast<size_t>(r) + c];
+            }
+        }
+        double pixels = static_cast<double>(width) * height;
+        metrics.psnrB = psnr(sums[0] / pixels);
+        metrics.psnrG = psnr(sums[1] / pixels);
+        metrics.psnrR = psnr(sums[2] / pixels);
+        metrics.psnr = psnr((sums[0] + sums[1] + sums[2]) / (3 * pixels));
+        metrics.ssim = ssim(originalLuma.row(0), originalLuma.stride, reconstructedLuma.row(0), reconstructedLuma.stride,
+                            width, height, pool);
+        return metrics;
+    }
+
+    //
+    // Prints the given metrics as a line of text, or as a JSON object (with any
+    // `label` as its "image")
+    //
+    void print(std::ostream &out, const QualityMetrics &metrics, bool json, const std::string &label) {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(4);
+        if (json) {
+            out << "{";
+            if (!label.empty()) {
+                out << "\"image\":\"" << label << "\",";
+            }
+            out << "\"psnr\":" << metrics.psnr << ",\"psnr_r\":" << metrics.psnrR << ",\"psnr_g\":" << metrics.psnrG
+                << ",\"psnr_b\":" << metrics.psnrB << ",\"ssim\":" << metrics.ssim
+                << ",\"bits_per_pixel\":" << metrics.bitsPerPixel << "}" << "\n";
+        } else {
+            if (!label.empty()) {
+                out << label << ": ";
+            }
+            out << "PSNR " << std::setprecision(2) << metrics.psnr << " dB (R " << metrics.psnrR << ", G "
+                << metrics.psnrG << ", B " << metrics.psnrB << "), SSIM " << std::setprecision(4) << metrics.ssim << ", " << std::setprecision(3)
+                << metrics.bitsPerPixel << " bits/pixel" << "\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "thread_pool.hpp"
+
+// PSNR reported for identical images (whose MSE is 0)
+#define MAX_PSNR 100.0
+
+//
+// Whether and how quality metrics are reported
+//
+enum MetricsMode {
+    METRICS_OFF = 0,
+    METRICS_TEXT,
+    METRICS_JSON
+};
+
+//
+// Quality of a compressed image, relative to its original
+//
+struct QualityMetrics {
+    // PSNR (dB) of each colour channel (R, G, B), and of all channels together
+    // (i.e. of their mean squared error). Grayscale images have a single channel,
+    // whose PSNR all four hold.
+    double psnrR = 0;
+    double psnrG = 0;
+    double psnrB = 0;
+    double psnr = 0;
+
+    // mean SSIM of luma
+    double ssim = 0;
+
+    // compressed size, in bits per pixel
+    double bitsPerPixel = 0;
+};
+
+//
+// Objective quality metrics between an original image and its reconstruction.
+//
+// Images are compared as they are displayed: the input image against the decoded
+// one, as 8-bit BGR (or grayscale) pixels, giving a PSNR per colour channel and
+// overall. Every lossy step counts, colour conversion and its rounding included.
+// SSIM is taken of luma (the Y of both images, see color.hpp), as is usual for
+// codecs, over 8x8 windows at a step of 4 pixels (as in x264 and libjpeg-turbo's
+// tjbench): each window's statistics are summed from the windows' four 4x4
+// sub-blocks, so every pixel is only read once.
+//
+// The sum-of-squared-differences and 4x4 block statistics kernels have AVX2 and
+// scalar versions (computing identical integer sums), picked by the process-wide
+// SIMD level; images are processed in parallel over rows.
+//
+namespace Metrics {
+
+    //
+    // Sum of squared differences of `n` samples
+    //
+    uint64_t sumSquaredDiff(const uchar *a, const uchar *b, int n);
+
+    //
+    // Sums of squared differences of each channel of `n` 3-channel pixels, into
+    // `sums` (3, in channel order)
+    //
+    void channelSquaredDiffs(const uchar *a, const uchar *b, int n, uint64_t *sums);
+
+    //
+    // Sums of a, b, a^2 + b^2 and a * b over each of `numBlocks` consecutive 4x4
+    // blocks of the given 4 rows of samples, into `sums` (4 per block, in that order)
+    //
+    void blockSums4x4(const uchar *a, size_t strideA, const uchar *b, size_t strideB,
+                      int numBlocks, int32_t *sums);
+
+    //
+    // Mean squared error of two planes of the given size
+    //
+    double meanSquaredError(const uchar *a, size_t strideA, const uchar *b, size_t strideB,
+                            int width, int height, ThreadPool &pool);
+
+    //
+    // Mean SSIM of two planes of the given size. Images smaller than a window
+    // (8x8) count as identical.
+    //
+    double ssim(const uchar *a, size_t strideA, const uchar *b, size_t strideB,
+                int width, int height, ThreadPool &pool);
+
+    //
+    // PSNR (dB) of the given mean squared error, for 8-bit samples (MAX_PSNR if 0)
+    //
+    double psnr(double mse);
+
+    //
+    // Compares the given original image (BGR, or RGB if `originalRgb`, or grayscale)
+    // with its reconstruction (BGR or grayscale, of the same size), compressed
+    // into `compressedBytes` bytes
+    //
+    QualityMetrics compare(const cv::Mat &original, bool originalRgb, const cv::Mat &reconstruction,
+                           size_t compressedBytes, ThreadPool &pool);
+
+    //
+    // Prints the given metrics as a line of text, or as a JSON object (with any
+    // `label` as its "image")
+    //
+    void print(std::ostream &out, const QualityMetrics &metrics, bool json, const std::string &label = "");
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#define PLANE_ALIGNMENT 32
+
+//
+// A single image channel (e.g. Y, Cb or Cr) as a flat 2D buffer.
+//
+// The buffer is aligned to PLANE_ALIGNMENT bytes (enough for AVX2), and every row
+// starts on an aligned boundary, `stride` elements after the previous one.
+// Allocation happens only in `create`, so planes can be set up once per image and
+// then reused without touching the heap.
+//
+template <typename T>
+class Plane {
+private:
+    T *buffer;
+
+    void release() {
+        free(buffer);
+        buffer = nullptr;
+    }
+
+public:
+    int width;
+    int height;
+    int stride; // in elements
+
+    Plane() : buffer(nullptr), width(0), height(0), stride(0) {}
+
+    Plane(int width, int height) : Plane() {
+        create(width, height);
+    }
+
+    ~Plane() {
+        release();
+    }
+
+    Plane(const Plane&) = delete;
+    Plane& operator=(const Plane&) = delete;
+
+    Plane(Plane &&other) : buffer(other.buffer), width(other.width), height(other.height), stride(other.stride) {
+        other.buffer = nullptr;
+        other.width = other.height = other.stride = 0;
+    }
+
+    Plane& operator=(Plane &&other) {
+        if (this != &other) {
+            release();
+            buffer = other.buffer;
+            width = other.width;
+            height = other.height;
+            stride = other.stride;
+            other.buffer = nullptr;
+            other.width = other.height = other.stride = 0;
+        }
+        return *this;
+    }
+
+    //
+    // (Re-)allocates the plane for the given dimensions. Contents are undefined.
+    // Does nothing if the plane already has these dimensions.
+    //
+    void create(int width, int height) {
+        if (buffer && this->width == width && this->height == height) {
+            return;
+        }
+        release();
+
+        const int rowAlign = PLANE_ALIGNMENT / sizeof(T);
+        this->width = width;
+        this->height = height;
+        this->stride = (width + rowAlign - 1) / rowAlign * rowAlign;
+
+        size_t bytes = sizeof(T) * stride * height;
+        void *p = nullptr;
+        if (bytes > 0 && posix_memalign(&p, PLANE_ALIGNMENT, bytes) != 0) {
+            throw std::bad_alloc();
+        }
+        buffer = static_cast<T*>(p);
+    }
+
+    bool empty() const {
+        return buffer == nullptr;
+    }
+
+    T *data() {
+        return buffer;
+    }
+
+    const T *data() const {
+        return buffer;
+    }
+
+    T *row(int r) {
+        return buffer + (size_t) r * stride;
+    }
+
+    const T *row(int r) const {
+        return buffer + (size_t) r * stride;
+    }
+};
+
+//
+// Quantised DCT coefficients of all blocks of a plane: 64 coefficients per block,
+// in zig-zag order, with blocks laid out in rows like the plane's pixels.
+//
+class CoefPlane {
+public:
+    int blocksWide;
+    int blocksHigh;
+    Plane<int16_t> coefs;
+
+    CoefPlane() : blocksWide(0), blocksHigh(0) {}
+
+    //
+    // (Re-)allocates the plane for the given number of blocks. Contents are undefined.
+    //
+    void create(int blocksWide, int blocksHigh) {
+        this->blocksWide = blocksWide;
+        this->blocksHigh = blocksHigh;
+        coefs.create(blocksWide * 64, blocksHigh);
+    }
+
+    int16_t *block(int bx, int by) {
+        return coefs.row(by) + bx * 64;
+    }
+
+    const int16_t *block(int bx, int by) const {
+        return coefs.row(by) + bx * 64;
+    }
+};
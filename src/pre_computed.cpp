@@ -1,9 +1,13 @@
 #include "pre_computed.hpp"
+#include "shared.hpp"
 
 JpegElements::JpegElements() {
     populateDctCoefsMatrix();
     populateDctCosinesMatrix();
+    populateAanScaleMatrices();
+    populateIntDctTables();
     populateZigZagIndices();
+    populateQuantTables();
 }
 
 //
@@ -46,6 +50,159 @@ void JpegElements::populateDctCoefsMatrix() {
     }
 }
 
+//
+// Populates the pre-computed AAN scale factors (requires DCT cosines)
+//
+void JpegElements::populateAanScaleMatrices() {
+    aan_scale_factors[0] = 1;
+    for (int k = 1; k < BLOCK_SIZE; k++) {
+        aan_scale_factors[k] = sqrt(2) * dct_cosines[0][k];
+    }
+
+    double scale;
+    for (int u = 0; u < BLOCK_SIZE; u++) {
+        for (int v = 0; v < BLOCK_SIZE; v++) {
+            scale = (double) aan_scale_factors[u] * aan_scale_factors[v];
+            aan_fdct_scales[u][v] = 1 / (8 * scale);
+            aan_idct_scales[u][v] = scale / 8;
+        }
+    }
+}
+
+//
+// Populates the pre-computed integer DCT divisors and multipliers.
+//
+// islow outputs are scaled by 8, so divisors are 8q. ifast outputs are additionally
+// scaled by the AAN factors, which (like the IJG library) are folded in with 14-bit
+// precision. The ifast inverse takes its multipliers with 2 fractional bits.
+//
+void JpegElements::populateIntDctTables() {
+    int32_t q, scale;
+    for (int i = 0; i < NUM_QUANT_MATRICES; i++) {
+        for (int r = 0; r < BLOCK_SIZE; r++) {
+            for (int c = 0; c < BLOCK_SIZE; c++) {
+                q = static_cast<int32_t>(QUANTISATION_MATRIX[i][r][c]);
+                scale = IFAST_AAN_SCALES[r][c];
+                int_quant_divisors[DCT_ISLOW - 1][i][r][c] = q << 3;
+                int_quant_divisors[DCT_IFAST - 1][i][r][c] = (q * scale + (1 << 10)) >> 11;
+            }
+        }
+    }
+
+    for (int r = 0; r < BLOCK_SIZE; r++) {
+        for (int c = 0; c < BLOCK_SIZE; c++) {
+            int_idct_multipliers[DCT_ISLOW - 1][r][c] = 1;
+            int_idct_multipliers[DCT_IFAST - 1][r][c] = (IFAST_AAN_SCALES[r][c] + (1 << 11)) >> 12;
+        }
+    }
+}
+
+//
+// Returns the integer quantisation divisors of the given DCT method and
+// quantisation matrix
+//
+const int32_t *JpegElements::getIntQuantDivisors(DctMethod method, int i) const {
+    return &int_quant_divisors[method - 1][i][0][0];
+}
+
+//
+// Returns the integer inverse DCT multipliers of the given DCT method, for
+// unit (i.e. no) dequantisation
+//
+const int32_t *JpegElements::getIntIdctMultipliers(DctMethod method) const {
+    return &int_idct_multipliers[method - 1][0][0];
+}
+
+//
+// Computes the inverse DCT multipliers of the given DCT method that dequantise
+// with the given (natural order) quantisation table. Float multipliers are the
+// table itself.
+//
+void JpegElements::computeIdctMultipliers(DctMethod method, const uint16_t *quantTable, int32_t *multipliers) const {
+    const int32_t *scales = &IFAST_AAN_SCALES[0][0];
+    for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+        if (method == DCT_IFAST) {
+            multipliers[i] = static_cast<int32_t>((static_cast<int64_t>(quantTable[i]) * scales[i] + (1 << 11)) >> 12);
+        } else {
+            multipliers[i] = quantTable[i];
+        }
+    }
+}
+
+//
+// Builds the quantisation table of the given (natural order) values
+// (requires zig-zag indices).
+//
+// Integer reciprocals are ceil(2^31 / divisor). Quantising n = |coef| + bias as
+// (n * reciprocal) >> 31 then gives exactly n / divisor whenever n * divisor < 2^31,
+// which holds with room to spare: the integer DCTs' outputs are below 2^15 in
+// magnitude, and their divisors below 2^13.
+//
+void JpegElements::buildQuantTable(const uint16_t *values, QuantTable &table) const {
+    const int32_t *scales = &IFAST_AAN_SCALES[0][0];
+    int32_t divisors[2];
+    for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        int i = zig_zag_order[k];
+        int32_t q = values[i];
+        table.values[k] = values[i];
+        table.reciprocals[k] = 1.0f / q;
+
+        divisors[DCT_ISLOW - 1] = q << 3;
+        divisors[DCT_IFAST - 1] = (q * scales[i] + (1 << 10)) >> 11;
+        for (int m = 0; m < 2; m++) {
+            uint64_t reciprocal = ((1ull << 31) + divisors[m] - 1) / divisors[m];
+            table.intReciprocals[m][k] = static_cast<uint32_t>(reciprocal);
+            table.intBiases[m][k] = divisors[m] / 2;
+        }
+    }
+}
+
+//
+// Populates the pre-computed quantisation tables (requires zig-zag indices)
+//
+void JpegElements::populateQuantTables() {
+    uint16_t values[BLOCK_SIZE*BLOCK_SIZE];
+    for (int i = 0; i < NUM_QUANT_MATRICES; i++) {
+        const float *matrix = &QUANTISATION_MATRIX[i][0][0];
+        for (int j = 0; j < BLOCK_SIZE*BLOCK_SIZE; j++) {
+            values[j] = static_cast<uint16_t>(matrix[j]);
+        }
+        buildQuantTable(values, quant_tables[i]);
+    }
+}
+
+//
+// Returns the quantisation tables of the given quality (MIN_QUALITY to
+// MAX_QUALITY): the standard luma and chroma tables, in that order, scaled as
+// libjpeg does. Built on first use, then cached. Thread-safe.
+//
+// Qualities below 50 scale the tables by 50 / quality, and those above by
+// (100 - quality) / 50, so quality 50 gives the standard tables themselves.
+// Values are clamped to 1-255, as baseline JPEG stores them in 8 bits.
+//
+const QuantTable *JpegElements::getQualityTables(int quality) {
+    quality = MathUtils::clamp(quality, MIN_QUALITY, MAX_QUALITY);
+
+    std::lock_guard<std::mutex> lock(quality_tables_mutex);
+    std::unique_ptr<QuantTable[]> &tables = quality_tables[quality];
+    if (tables) {
+        return tables.get();
+    }
+
+    int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    const uint16_t *bases[2] = {&STD_LUMINANCE_QUANT[0][0], &STD_CHROMINANCE_QUANT[0][0]};
+    uint16_t values[BLOCK_SIZE*BLOCK_SIZE];
+
+    tables.reset(new QuantTable[2]);
+    for (int t = 0; t < 2; t++) {
+        for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i++) {
+            values[i] = static_cast<uint16_t>(MathUtils::clamp((bases[t][i] * scale + 50) / 100, 1, 255));
+        }
+        buildQuantTable(values, tables[t]);
+    }
+    return tables.get();
+}
+
 //
 // Populates the pre-computed zig-zag indices
 //
@@ -111,4 +268,8 @@ void JpegElements::populateZigZagIndices() {
         zig_zag_indices.push_back(std::make_pair(r, c));
         cnt++;
     }
+
+    for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+        zig_zag_order[k] = zig_zag_indices[k].first * BLOCK_SIZE + zig_zag_indices[k].second;
+    }
 }
\ No newline at end of file
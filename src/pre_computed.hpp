@@ -1,16 +1,56 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 
 #define BLOCK_SIZE 8
 #define NUM_QUANT_MATRICES 5
+#define MIN_QUALITY 1
+#define MAX_QUALITY 100
+
+//
+// DCT implementations:
+//      - float: AAN float transform (see dct.hpp)
+//      - islow: accurate fixed-point transform, bit-exact on every platform
+//      - ifast: fast, less accurate fixed-point transform, bit-exact on every platform
+//
+enum DctMethod {
+    DCT_FLOAT = 0,
+    DCT_ISLOW = 1,
+    DCT_IFAST = 2
+};
+
+//
+// A quantisation table, with what the fused quantiser (see jpeg.hpp) needs to
+// quantise by multiplication rather than division. Entries are in zig-zag order.
+//
+struct QuantTable {
+    // table values, as written to DQT segments
+    uint16_t values[BLOCK_SIZE*BLOCK_SIZE];
+
+    // float DCT: reciprocals of the values
+    float reciprocals[BLOCK_SIZE*BLOCK_SIZE];
+
+    // integer DCTs, indexed as [dct method - 1]: reciprocals of the integer divisors
+    // (values with the DCT's output scaling folded in) in 31-bit fixed point, rounded
+    // up, and the rounding biases (half the divisors)
+    uint32_t intReciprocals[2][BLOCK_SIZE*BLOCK_SIZE];
+    int32_t intBiases[2][BLOCK_SIZE*BLOCK_SIZE];
+};
 
 //
 // Holds pre-computed elements of JPEG compression, namely:
 //      - quantisation matrix
 //      - dct cosines
 //      - dct coefficients
+//      - AAN (fast DCT) scale factors
+//      - integer DCT quantisation divisors and dequantisation multipliers
+//      - quantisation tables with reciprocals, for the fused quantiser
+//      - standard (JPEG Annex K.1) quantisation tables, scaled per quality
 //      - zig-zag ordering of indices
+//      - standard (JPEG Annex K) Huffman tables
 //
 class JpegElements {
 public:
@@ -83,6 +123,76 @@ public:
     float dct_cosines[BLOCK_SIZE][BLOCK_SIZE];
     float dct_coefs[BLOCK_SIZE][BLOCK_SIZE];
 
+    //
+    // Pre-computed scale factors of the AAN (Arai-Agui-Nakajima) fast DCT,
+    // derived from the DCT cosines. The AAN butterflies produce outputs scaled by
+    // 8 * s[u] * s[v], where s[0] = 1 and s[k] = sqrt(2) * cos(k*pi/16), so:
+    //      - aan_fdct_scales undoes that scaling after the forward transform
+    //      - aan_idct_scales applies it (and the final divide by 8) before the inverse
+    //
+    float aan_scale_factors[BLOCK_SIZE];
+    float aan_fdct_scales[BLOCK_SIZE][BLOCK_SIZE];
+    float aan_idct_scales[BLOCK_SIZE][BLOCK_SIZE];
+
+    //
+    // AAN scale factors s[u] * s[v] in 14-bit fixed point, for the ifast integer DCT.
+    // Hard-coded (rather than derived from the float cosines) so that integer
+    // outputs never depend on the platform's libm.
+    //
+    int32_t IFAST_AAN_SCALES[BLOCK_SIZE][BLOCK_SIZE] = {
+        {16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520},
+        {22725, 31521, 29692, 26722, 22725, 17855, 12299,  6270},
+        {21407, 29692, 27969, 25172, 21407, 16819, 11585,  5906},
+        {19266, 26722, 25172, 22654, 19266, 15137, 10426,  5315},
+        {16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520},
+        {12873, 17855, 16819, 15137, 12873, 10114,  6967,  3552},
+        { 8867, 12299, 11585, 10426,  8867,  6967,  4799,  2446},
+        { 4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247}
+    };
+
+    //
+    // Pre-computed integer quantisation divisors, i.e. each quantisation matrix with
+    // the output scaling of the integer forward DCT folded in.
+    // Indexed as [dct method - 1][quantisation matrix].
+    //
+    int32_t int_quant_divisors[2][NUM_QUANT_MATRICES][BLOCK_SIZE][BLOCK_SIZE];
+
+    //
+    // Pre-computed integer inverse DCT multipliers for unit (i.e. no) dequantisation.
+    // Indexed as [dct method - 1].
+    //
+    int32_t int_idct_multipliers[2][BLOCK_SIZE][BLOCK_SIZE];
+
+    //
+    // Pre-computed quantisation tables of the quantisation matrices
+    //
+    QuantTable quant_tables[NUM_QUANT_MATRICES];
+
+    //
+    // Standard quantisation tables (JPEG Annex K.1), which --quality scales
+    //
+    uint16_t STD_LUMINANCE_QUANT[BLOCK_SIZE][BLOCK_SIZE] = {
+        {16, 11, 10, 16, 24, 40, 51, 61},
+        {12, 12, 14, 19, 26, 58, 60, 55},
+        {14, 13, 16, 24, 40, 57, 69, 56},
+        {14, 17, 22, 29, 51, 87, 80, 62},
+        {18, 22, 37, 56, 68, 109, 103, 77},
+        {24, 35, 55, 64, 81, 104, 113, 92},
+        {49, 64, 78, 87, 103, 121, 120, 101},
+        {72, 92, 95, 98, 112, 100, 103, 99}
+    };
+
+    uint16_t STD_CHROMINANCE_QUANT[BLOCK_SIZE][BLOCK_SIZE] = {
+        {17, 18, 24, 47, 99, 99, 99, 99},
+        {18, 21, 26, 66, 99, 99, 99, 99},
+        {24, 26, 56, 99, 99, 99, 99, 99},
+        {47, 66, 99, 99, 99, 99, 99, 99},
+        {99, 99, 99, 99, 99, 99, 99, 99},
+        {99, 99, 99, 99, 99, 99, 99, 99},
+        {99, 99, 99, 99, 99, 99, 99, 99},
+        {99, 99, 99, 99, 99, 99, 99, 99}
+    };
+
     JpegElements();
     ~JpegElements() = default;
 
@@ -91,6 +201,53 @@ public:
     //
     std::vector<std::pair<int, int>> zig_zag_indices;
 
+    //
+    // Zig-zag ordering as flat (row-major) block indices, i.e. the kth coefficient
+    // in zig-zag order is block[zig_zag_order[k]]
+    //
+    int zig_zag_order[BLOCK_SIZE*BLOCK_SIZE];
+
+    //
+    // Standard Huffman tables (JPEG Annex K.3), as given in DHT segments:
+    //      - bits: number of codes of each length 1-16
+    //      - vals: symbols, in order of increasing code length
+    //
+    uchar STD_DC_LUMINANCE_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+    uchar STD_DC_LUMINANCE_VALS[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+    uchar STD_DC_CHROMINANCE_BITS[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+    uchar STD_DC_CHROMINANCE_VALS[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+    uchar STD_AC_LUMINANCE_BITS[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+    uchar STD_AC_LUMINANCE_VALS[162] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+        0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa
+    };
+
+    uchar STD_AC_CHROMINANCE_BITS[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+    uchar STD_AC_CHROMINANCE_VALS[162] = {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+        0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa
+    };
+
     //
     // Returns the ith quantisation matrix (see pre_computed.hpp)
     // as a cv::Mat object
@@ -107,8 +264,62 @@ public:
     //
     void populateDctCoefsMatrix();
 
+    //
+    // Populates the pre-computed AAN scale factors (requires DCT cosines)
+    //
+    void populateAanScaleMatrices();
+
+    //
+    // Populates the pre-computed integer DCT divisors and multipliers
+    //
+    void populateIntDctTables();
+
+    //
+    // Returns the integer quantisation divisors of the given DCT method and
+    // quantisation matrix
+    //
+    const int32_t *getIntQuantDivisors(DctMethod method, int i) const;
+
+    //
+    // Returns the integer inverse DCT multipliers of the given DCT method, for
+    // unit (i.e. no) dequantisation
+    //
+    const int32_t *getIntIdctMultipliers(DctMethod method) const;
+
+    //
+    // Computes the inverse DCT multipliers of the given DCT method that dequantise
+    // with the given (natural order) quantisation table. Float multipliers are the
+    // table itself.
+    //
+    void computeIdctMultipliers(DctMethod method, const uint16_t *quantTable, int32_t *multipliers) const;
+
+    //
+    // Builds the quantisation table of the given (natural order) values
+    // (requires zig-zag indices)
+    //
+    void buildQuantTable(const uint16_t *values, QuantTable &table) const;
+
+    //
+    // Populates the pre-computed quantisation tables (requires zig-zag indices)
+    //
+    void populateQuantTables();
+
+    //
+    // Returns the quantisation tables of the given quality (MIN_QUALITY to
+    // MAX_QUALITY): the standard luma and chroma tables, in that order, scaled as
+    // libjpeg does. Built on first use, then cached. Thread-safe.
+    //
+    const QuantTable *getQualityTables(int quality);
+
     //
     // Populates the pre-computed zig-zag indices
     //
     void populateZigZagIndices();
+
+private:
+    //
+    // Cached quantisation tables of each quality (see getQualityTables)
+    //
+    std::unique_ptr<QuantTable[]> quality_tables[MAX_QUALITY + 1];
+    std::mutex quality_tables_mutex;
 };
\ No newline at end of file
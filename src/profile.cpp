@@ -0,0 +1,157 @@
+#include <atomic>
+#include <iomanip>
+
+#include "profile.hpp"
+
+namespace Profile {
+
+    //
+    // Totals of a stage, added to from any thread
+    //
+    struct AtomicTotals {
+        std::atomic<uint64_t> nanoseconds;
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> blocks;
+        std::atomic<uint64_t> bytesIn;
+        std::atomic<uint64_t> bytesOut;
+    };
+
+    static bool enabled = false;
+    static AtomicTotals stageTotals[NUM_STAGES];
+
+    //
+    // Turns profiling on or off. Must be called before any worker threads start.
+    //
+    void setEnabled(bool enable) {
+        enabled = enable;
+    }
+
+    bool isEnabled() {
+        return enabled;
+    }
+
+    //
+    // Adds a timed call of the given stage, with its counts, to the stage's totals
+    //
+    void add(Stage stage, uint64_t nanoseconds, uint64_t blocks, uint64_t bytesIn, uint64_t bytesOut) {
+        AtomicTotals &t = stageTotals[stage];
+        t.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        t.calls.fetch_add(1, std::memory_order_relaxed);
+        t.blocks.fetch_add(blocks, std::memory_order_relaxed);
+        t.bytesIn.fetch_add(bytesIn, std::memory_order_relaxed);
+        t.bytesOut.fetch_add(bytesOut, std::memory_order_relaxed);
+    }
+
+    //
+    // Returns the totals of the given stage so far
+    //
+    StageTotals totals(Stage stage) {
+        const AtomicTotals &t = stageTotals[stage];
+        StageTotals totals;
+        totals.nanoseconds = t.nanoseconds.load(std::memory_order_relaxed);
+        totals.calls = t.calls.load(std::memory_order_relaxed);
+        totals.blocks = t.blocks.load(std::memory_order_relaxed);
+        totals.bytesIn = t.bytesIn.load(std::memory_order_relaxed);
+        totals.bytesOut = t.bytesOut.load(std::memory_order_relaxed);
+        return totals;
+    }
+
+    //
+    // Clears the totals of every stage
+    //
+    void reset() {
+        for (AtomicTotals &t : stageTotals) {
+            t.nanoseconds = 0;
+            t.calls = 0;
+            t.blocks = 0;
+            t.bytesIn = 0;
+            t.bytesOut = 0;
+        }
+    }
+
+    //
+    // Returns the name of the given stage (e.g. "transform")
+    //
+    std::string stageName(Stage stage) {
+        static const char *names[NUM_STAGES] = {
+            "read", "color", "sampling", "transform", "statistics", "entropy", "write"
+        };
+        return names[stage];
+    }
+
+    //
+    // Prints the totals of every stage that ran, as a table (with each stage's share
+    // of the total time, and its throughput in MB/s of input), or as a JSON object
+    //
+    void report(std::ostream &out, bool json) {
+        uint64_t totalNanoseconds = 0;
+        for (int s = 0; s < NUM_STAGES; s++) {
+            totalNanoseconds += totals(static_cast<Stage>(s)).nanoseconds;
+        }
+
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(3);
+        if (json) {
+            out << "{\"total_ms\":" << totalNanoseconds / 1e6 << ",\"stages\":[";
+        } else {
+            out << "profile:" << "\n";
+            out << std::left << std::setw(12) << "  stage" << std::right << std::setw(12) << "ms" << std::setw(8) << "%"
+                << std::setw(8) << "calls" << std::setw(10) << "blocks" << std::setw(12) << "MB in"
+                << std::setw(12) << "MB out" << std::setw(12) << "MB/s" << "\n";
+        }
+
+        bool first = true;
+        for (int s = 0; s < NUM_STAGES; s++) {
+            StageTotals t = totals(static_cast<Stage>(s));
+            if (t.calls == 0) {
+                continue;
+            }
+            double ms = t.nanoseconds / 1e6;
+            double share = totalNanoseconds ? 100.0 * t.nanoseconds / totalNanoseconds : 0;
+            double mbPerSecond = t.nanoseconds ? t.bytesIn / 1e6 / (t.nanoseconds / 1e9) : 0;
+            if (json) {
+                out << (first ? "" : ",") << "{\"stage\":\"" << stageName(static_cast<Stage>(s)) << "\",\"ms\":" << ms
+                    << ",\"calls\":" << t.calls << ",\"blocks\":" << t.blocks << ",\"bytes_in\":" << t.bytesIn
+                    << ",\"bytes_out\":" << t.bytesOut << ",\"mb_per_s\":" << mbPerSecond << "}";
+            } else {
+                out << "  " << std::left << std::setw(10) << stageName(static_cast<Stage>(s)) << std::right
+                    << std::setw(12) << ms << std::setw(8) << std::setprecision(1) << share
+                    << std::setprecision(3) << std::setw(8) << t.calls << std::setw(10) << t.blocks
+                    << std::setw(12) << t.bytesIn / 1e6 << std::setw(12) << t.bytesOut / 1e6
+                    << std::setw(12) << mbPerSecond << "\n";
+            }
+            first = false;
+        }
+
+        if (json) {
+            out << "]}" << "\n";
+        } else {
+            out << "  " << std::left << std::setw(10) << "total" << std::right << std::setw(12)
+                << totalNanoseconds / 1e6 << "\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    ScopedTimer::ScopedTimer(Stage stage)
+        : stage(stage), active(enabled), blocks(0), bytesIn(0), bytesOut(0) {
+        if (active) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ScopedTimer::~ScopedTimer() {
+        if (active) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            add(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                blocks, bytesIn, bytesOut);
+        }
+    }
+
+    void ScopedTimer::setCounts(uint64_t blocks, uint64_t bytesIn, uint64_t bytesOut) {
+        this->blocks = blocks;
+        this->bytesIn = bytesIn;
+        this->bytesOut = bytesOut;
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+//
+// Per-stage timers and counters of the encode and decode pipelines (see --profile).
+//
+// Stages are timed by scoped timers around whole steps (a plane, a scan, a strip),
+// never single blocks, so an image takes a few dozen clock reads. Each timed step
+// adds one call, its time, and its counts (blocks processed, bytes in and out) to
+// the stage's totals. Totals are atomics, so workers encoding files concurrently
+// (--batch) add up safely - their times are then summed over the workers.
+//
+// Profiling is off by default; a timer then costs a single test of a flag.
+//
+namespace Profile {
+
+    //
+    // Pipeline stages. Encoding runs them top to bottom, decoding (mostly) in reverse.
+    //
+    enum Stage {
+        STAGE_READ = 0,     // loading or reading the input
+        STAGE_COLOR,        // colour conversion
+        STAGE_SAMPLING,     // chroma down/upsampling
+        STAGE_TRANSFORM,    // (inverse) DCT and (de)quantisation, fused per block
+        STAGE_STATISTICS,   // symbol statistics and table building for optimized Huffman (or rANS) tables
+        STAGE_ENTROPY,      // headers, run/size symbolization and Huffman (or rANS) (de)coding
+        STAGE_WRITE,        // writing the output
+        NUM_STAGES
+    };
+
+    //
+    // Totals of a stage
+    //
+    struct StageTotals {
+        uint64_t nanoseconds = 0;
+        uint64_t calls = 0;
+        uint64_t blocks = 0;
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+    };
+
+    //
+    // Turns profiling on or off. Must be called before any worker threads start.
+    //
+    void setEnabled(bool enabled);
+    bool isEnabled();
+
+    //
+    // Adds a timed call of the given stage, with its counts, to the stage's totals
+    //
+    void add(Stage stage, uint64_t nanoseconds, uint64_t blocks, uint64_t bytesIn, uint64_t bytesOut);
+
+    //
+    // Returns the totals of the given stage so far
+    //
+    StageTotals totals(Stage stage);
+
+    //
+    // Clears the totals of every stage
+    //
+    void reset();
+
+    //
+    // Returns the name of the given stage (e.g. "transform")
+    //
+    std::string stageName(Stage stage);
+
+    //
+    // Prints the totals of every stage that ran, as a table (with each stage's share
+    // of the total time, and its throughput in MB/s of input), or as a JSON object
+    //
+    void report(std::ostream &out, bool json);
+
+    //
+    // Times its scope as a call of the given stage, if profiling is on. Counts are
+    // set while the step runs, and added when the timer goes out of scope.
+    //
+    class ScopedTimer {
+    private:
+        Stage stage;
+        bool active;
+        std::chrono::steady_clock::time_point start;
+        uint64_t blocks, bytesIn, bytesOut;
+
+    public:
+        explicit ScopedTimer(Stage stage);
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+        void setCounts(uint64_t blocks, uint64_t bytesIn, uint64_t bytesOut);
+    };
+}
@@ -0,0 +1,53 @@
+#include "progressive.hpp"
+
+namespace Progressive {
+
+    //
+    // Adds a scan of the given band and bit positions of the given component
+    // (or, for DC scans, of all `numComponents` components) to `scans`
+    //
+    static void addScan(ScanSpec *scans, int &numScans, int component, int numComponents,
+                        int ss, int se, int ah, int al) {
+        ScanSpec &scan = scans[numScans++];
+        scan.numComponents = numComponents;
+        for (int i = 0; i < numComponents; i++) {
+            scan.components[i] = component + i;
+        }
+        scan.ss = ss;
+        scan.se = se;
+        scan.ah = ah;
+        scan.al = al;
+    }
+
+    //
+    // Fills in libjpeg's default progression (jpeg_simple_progression) for images
+    // of the given number of components (1 or 3) - DC first, a coarse luma band,
+    // then the rest, with the low bit(s) of everything refined last. Returns the
+    // number of scans.
+    //
+    int simpleProgression(int numComponents, ScanSpec *scans) {
+        int n = 0;
+        if (numComponents == 1) {
+            addScan(scans, n, 0, 1, 0, 0, 0, 1);
+            addScan(scans, n, 0, 1, 1, 5, 0, 2);
+            addScan(scans, n, 0, 1, 6, 63, 0, 2);
+            addScan(scans, n, 0, 1, 1, 63, 2, 1);
+            addScan(scans, n, 0, 1, 0, 0, 1, 0);
+            addScan(scans, n, 0, 1, 1, 63, 1, 0);
+            return n;
+        }
+
+        // Y, Cb, Cr: chroma is sent early, whole (it is small), and refined late
+        addScan(scans, n, 0, numComponents, 0, 0, 0, 1);
+        addScan(scans, n, 0, 1, 1, 5, 0, 2);
+        addScan(scans, n, 2, 1, 1, 63, 0, 1);
+        addScan(scans, n, 1, 1, 1, 63, 0, 1);
+        addScan(scans, n, 0, 1, 6, 63, 0, 2);
+        addScan(scans, n, 0, 1, 1, 63, 2, 1);
+        addScan(scans, n, 0, numComponents, 0, 0, 1, 0);
+        addScan(scans, n, 2, 1, 1, 63, 1, 0);
+        addScan(scans, n, 1, 1, 1, 63, 1, 0);
+        addScan(scans, n, 0, 1, 1, 63, 1, 0);
+        return n;
+    }
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+
+#include "shared.hpp"
+#include "rle.hpp"
+
+// most components a scan may code (JPEG B.2.3)
+#define MAX_SCAN_COMPONENTS 4
+
+// most scans of a progression (see simpleProgression)
+#define MAX_PROGRESSIVE_SCANS 10
+
+// correction bits an AC refinement scan may buffer: its EOB run is forced out
+// once a block's worth more might not fit (as libjpeg)
+#define MAX_CORRECTION_BITS 1000
+
+//
+// Progressive JPEG coding (JPEG G.1.2): the quantised coefficients of the whole
+// image are sent in a series of scans, each coding a band of zig-zag positions
+// [ss, se] (spectral selection) of some components, at a reduced precision:
+// the low `al` bits of each coefficient are dropped in its first scan, and sent
+// one bit per scan by later refinement scans (successive approximation, `ah` is
+// the previous scan's `al`).
+//
+//      - DC first scans code the DPCM differences of the shifted DCs, as baseline
+//        does; DC refinement scans the next bit of each DC, uncoded
+//      - AC first scans code run/size symbols of the shifted coefficients, as
+//        baseline does, but runs of blocks with no (more) nonzero coefficients in
+//        the band are coded as a single EOBn symbol, `n << 4`, followed by the
+//        run length's low n bits (EOB runs, up to 32767 blocks)
+//      - AC refinement scans code the coefficients that become nonzero as 1-bit
+//        run/size symbols (with their sign), and append to each symbol the next
+//        bit of the already-nonzero coefficients passed on the way (correction
+//        bits). Correction bits of blocks ending in an EOB run are buffered until
+//        the run is coded.
+//
+// As Rle::runSizeEncode, blocks are symbolized straight from their zig-zag
+// ordered coefficients, handing symbols to `sink.put(table, symbol, value, size)`
+// and uncoded bits to `sink.putBits(bits, length)`.
+//
+namespace Progressive {
+
+    //
+    // A scan of a progression: its components (indices into the frame's
+    // components), band and successive approximation bit positions
+    //
+    struct ScanSpec {
+        int numComponents;
+        int components[MAX_SCAN_COMPONENTS];
+        int ss, se;
+        int ah, al;
+    };
+
+    //
+    // Fills in libjpeg's default progression for images of the given number of
+    // components (1 or 3) - DC first, a coarse luma band, then the rest, with the
+    // low bit(s) of everything refined last. Returns the number of scans.
+    //
+    int simpleProgression(int numComponents, ScanSpec *scans);
+
+    //
+    // EOB run and buffered correction bits of an AC scan, carried between blocks
+    //
+    struct AcState {
+        int eobRun;
+        int numCorrectionBits;
+        uchar correctionBits[MAX_CORRECTION_BITS];
+    };
+
+    //
+    // Codes the pending EOB run (if any) with the given AC table, then the buffered
+    // correction bits
+    //
+    template <typename Sink, typename Table>
+    inline void flushEobRun(AcState &state, Sink &sink, Table *acTable) {
+        if (state.eobRun > 0) {
+            int n = MathUtils::bitLength(state.eobRun) - 1;
+            sink.put(acTable, n << 4, state.eobRun, n);
+            state.eobRun = 0;
+        }
+        for (int i = 0; i < state.numCorrectionBits; i++) {
+            sink.putBits(state.correctionBits[i], 1);
+        }
+        state.numCorrectionBits = 0;
+    }
+
+    //
+    // DC first scan: codes the difference of the block's DC (shifted right by `al`)
+    // from `prevDc`, which is updated to it
+    //
+    template <typename Sink, typename Table>
+    inline void codeDcFirst(const int16_t *zigZag, int al, int &prevDc, Sink &sink, Table *dcTable) {
+        int dc = zigZag[0] >> al; // arithmetic shift, as JPEG G.1.2.1 requires
+        int diff = dc - prevDc;
+        int size = MathUtils::bitLength(diff);
+        prevDc = dc;
+        sink.put(dcTable, size, diff, size);
+    }
+
+    //
+    // DC refinement scan: appends bit `al` of the block's DC
+    //
+    template <typename Sink>
+    inline void codeDcRefine(const int16_t *zigZag, int al, Sink &sink) {
+        sink.putBits((zigZag[0] >> al) & 1, 1);
+    }
+
+    //
+    // AC first scan: codes the block's coefficients in [ss, se], with magnitudes
+    // shifted right by `al`
+    //
+    template <typename Sink, typename Table>
+    inline void codeAcFirst(const int16_t *zigZag, int ss, int se, int al, AcState &state, Sink &sink,
+                            Table *acTable) {
+        int run = 0;
+        for (int k = ss; k <= se; k++) {
+            int coef = zigZag[k];
+            int magnitude = (coef < 0 ? -coef : coef) >> al;
+            if (magnitude == 0) {
+                run++;
+                continue;
+            }
+            flushEobRun(state, sink, acTable);
+            while (run > 15) {
+                sink.put(acTable, Rle::SYMBOL_ZRL, 0, 0);
+                run -= 16;
+            }
+            int size = MathUtils::bitLength(magnitude);
+            sink.put(acTable, (run << 4) | size, coef < 0 ? -magnitude : magnitude, size);
+            run = 0;
+        }
+        if (run > 0 && ++state.eobRun == 0x7FFF) {
+            flushEobRun(state, sink, acTable);
+        }
+    }
+
+    //
+    // AC refinement scan: codes bit `al` of the block's coefficients in [ss, se],
+    // whose higher bits were sent by earlier scans
+    //
+    template <typename Sink, typename Table>
+    inline void codeAcRefine(const int16_t *zigZag, int ss, int se, int al, AcState &state, Sink &sink,
+                             Table *acTable) {
+        // magnitudes at this scan's precision, and the last that becomes nonzero
+        int magnitudes[64];
+        int end = 0;
+        for (int k = ss; k <= se; k++) {
+            int coef = zigZag[k];
+            magnitudes[k] = (coef < 0 ? -coef : coef) >> al;
+            end = magnitudes[k] == 1 ? k : end;
+        }
+
+        // correction bits of this block, which follow any buffered ones
+        uchar *corrections = state.correctionBits + state.numCorrectionBits;
+        int numCorrections = 0;
+        int run = 0;
+        for (int k = ss; k <= se; k++) {
+            int magnitude = magnitudes[k];
+            if (magnitude == 0) {
+                run++;
+                continue;
+            }
+            // ZRLs, unless the run can be left to an EOB
+            while (run > 15 && k <= end) {
+                flushEobRun(state, sink, acTable);
+                sink.put(acTable, Rle::SYMBOL_ZRL, 0, 0);
+                run -= 16;
+                for (int i = 0; i < numCorrections; i++) {
+                    sink.putBits(corrections[i], 1);
+                }
+                corrections = state.correctionBits;
+                numCorrections = 0;
+            }
+            if (magnitude > 1) {
+                corrections[numCorrections++] = magnitude & 1;
+                continue;
+            }
+            flushEobRun(state, sink, acTable);
+            sink.put(acTable, (run << 4) | 1, zigZag[k] < 0 ? -1 : 1, 1);
+            for (int i = 0; i < numCorrections; i++) {
+                sink.putBits(corrections[i], 1);
+            }
+            corrections = state.correctionBits;
+            numCorrections = 0;
+            run = 0;
+        }
+
+        // trailing zeros or correction bits: the block joins the EOB run, and its
+        // correction bits (already in place after the buffered ones) wait for it
+        if (run > 0 || numCorrections > 0) {
+            state.numCorrectionBits += numCorrections;
+            if (++state.eobRun == 0x7FFF || state.numCorrectionBits > MAX_CORRECTION_BITS - 64 + 1) {
+                flushEobRun(state, sink, acTable);
+            }
+        }
+    }
+}
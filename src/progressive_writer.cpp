@@ -0,0 +1,136 @@
+#include <cstring>
+
+#include "progressive_writer.hpp"
+#include "profile.hpp"
+
+ProgressiveWriter::ProgressiveWriter() : numScans(0) {
+}
+
+//
+// Codes the blocks of the given scan of the frame into the given sink, with the
+// given tables (indexed by table id). Scans of several components code whole
+// MCUs, as CoefFrame::codeScan; scans of one code just the blocks covering its
+// samples, row by row (JPEG A.2.2), which leaves out the padding blocks of a
+// subsampled image.
+//
+template <typename Sink, typename Table>
+void ProgressiveWriter::codeScan(const CoefFrame &frame, const Progressive::ScanSpec &scan, Sink &sink,
+                                 Table *tables) {
+    const JfifComponent *components = frame.components;
+    Progressive::AcState state;
+    state.eobRun = 0;
+    state.numCorrectionBits = 0;
+    int prevDc[MAX_SCAN_COMPONENTS] = {0};
+
+    auto codeBlock = [&](int i, const int16_t *zigZag) {
+        const JfifComponent &component = components[scan.components[i]];
+        if (scan.ss == 0 && scan.ah == 0) {
+            Progressive::codeDcFirst(zigZag, scan.al, prevDc[i], sink, &tables[component.dcTable]);
+        } else if (scan.ss == 0) {
+            Progressive::codeDcRefine(zigZag, scan.al, sink);
+        } else if (scan.ah == 0) {
+            Progressive::codeAcFirst(zigZag, scan.ss, scan.se, scan.al, state, sink, &tables[component.acTable]);
+        } else {
+            Progressive::codeAcRefine(zigZag, scan.ss, scan.se, scan.al, state, sink, &tables[component.acTable]);
+        }
+    };
+
+    int hMax = components[0].h, vMax = components[0].v;
+    if (scan.numComponents > 1) {
+        int mcusWide = frame.coefPlanes[0].blocksWide / hMax, mcusHigh = frame.coefPlanes[0].blocksHigh / vMax;
+        for (int my = 0; my < mcusHigh; my++) {
+            for (int mx = 0; mx < mcusWide; mx++) {
+                for (int i = 0; i < scan.numComponents; i++) {
+                    const JfifComponent &component = components[scan.components[i]];
+                    const CoefPlane &coefPlane = frame.coefPlanes[CoefFrame::COMPONENT_PLANES[scan.components[i]]];
+                    for (int by = 0; by < component.v; by++) {
+                        for (int bx = 0; bx < component.h; bx++) {
+                            codeBlock(i, coefPlane.block(mx * component.h + bx, my * component.v + by));
+                        }
+                    }
+                }
+            }
+        }
+    } else {
+        const JfifComponent &component = components[scan.components[0]];
+        const CoefPlane &coefPlane = frame.coefPlanes[CoefFrame::COMPONENT_PLANES[scan.components[0]]];
+        int componentWidth = (frame.width * component.h + hMax - 1) / hMax;
+        int componentHeight = (frame.height * component.v + vMax - 1) / vMax;
+        int blocksWide = (componentWidth + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        int blocksHigh = (componentHeight + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        for (int y = 0; y < blocksHigh; y++) {
+            for (int x = 0; x < blocksWide; x++) {
+                codeBlock(0, coefPlane.block(x, y));
+            }
+        }
+    }
+
+    if (scan.ss > 0) {
+        Progressive::flushEobRun(state, sink, &tables[components[scan.components[0]].acTable]);
+    }
+}
+
+//
+// Whether the given scan of the frame codes with the given table id (DC refinement
+// scans code without any)
+//
+bool ProgressiveWriter::scanUsesTable(const CoefFrame &frame, const Progressive::ScanSpec &scan, int id) {
+    if (scan.ss == 0 && scan.ah > 0) {
+        return false;
+    }
+    for (int i = 0; i < scan.numComponents; i++) {
+        const JfifComponent &component = frame.components[scan.components[i]];
+        if ((scan.ss == 0 ? component.dcTable : component.acTable) == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//
+// Builds optimal Huffman tables for each scan of the progression (JPEG Annex K.2),
+// from the symbol frequencies of a statistics pass over the scan
+//
+void ProgressiveWriter::optimizeTables(const CoefFrame &frame) {
+    Profile::ScopedTimer timer(Profile::STAGE_STATISTICS);
+    numScans = Progressive::simpleProgression(frame.numComponents, scans);
+    uint64_t blocks = frame.numBlocks();
+    timer.setCounts(blocks, numScans * blocks * 64 * sizeof(int16_t), 0);
+
+    for (int s = 0; s < numScans; s++) {
+        SymbolCounts counts[2];
+        memset(counts, 0, sizeof(counts));
+        SymbolCounter counter;
+        codeScan(frame, scans[s], counter, counts);
+        for (int id = 0; id < frame.numTableIds(); id++) {
+            if (scanUsesTable(frame, scans[s], id)) {
+                huffmanEncoder.buildTable(counts[id].freqs, scanTables[s][id]);
+            }
+        }
+    }
+}
+
+//
+// Entropy codes the coefficient planes of the given frame as the scans of the
+// progression, each preceded by its tables
+//
+void ProgressiveWriter::writeScans(BitWriter &writer, const CoefFrame &frame) {
+    SymbolWriter symbolWriter = {writer};
+    for (int s = 0; s < numScans; s++) {
+        const Progressive::ScanSpec &scan = scans[s];
+        for (int id = 0; id < frame.numTableIds(); id++) {
+            if (scanUsesTable(frame, scan, id)) {
+                Jfif::writeDht(writer, scan.ss == 0 ? 0 : 1, id, scanTables[s][id]);
+            }
+        }
+
+        JfifComponent scanComponents[MAX_SCAN_COMPONENTS];
+        for (int i = 0; i < scan.numComponents; i++) {
+            scanComponents[i] = frame.components[scan.components[i]];
+        }
+        Jfif::writeSos(writer, scanComponents, scan.numComponents, scan.ss, scan.se, scan.ah, scan.al);
+        const HuffmanTable *tables = scanTables[s];
+        codeScan(frame, scan, symbolWriter, tables);
+        writer.alignToByte();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "coef_frame.hpp"
+#include "huffman.hpp"
+#include "bit_writer.hpp"
+#include "progressive.hpp"
+
+//
+// Writer of the scans of progressive JPEGs, from the coefficient planes of a
+// frame: for each scan of the progression (see Progressive), Huffman tables
+// optimized for that scan, then the scan itself. The tables of all scans are
+// built first, by a statistics pass over each. The frame headers (up to the SOF2
+// segment) are left to the encoder.
+//
+class ProgressiveWriter {
+private:
+    // scans of the progression, and the Huffman tables of each, indexed by table
+    // id (DC tables for DC scans, AC tables otherwise)
+    Progressive::ScanSpec scans[MAX_PROGRESSIVE_SCANS];
+    int numScans;
+    HuffmanTable scanTables[MAX_PROGRESSIVE_SCANS][2];
+
+    // builder of optimized tables
+    HuffmanEncoder huffmanEncoder;
+
+    //
+    // Codes the blocks of the given scan of the frame into the given symbol sink,
+    // with the given tables (indexed by table id)
+    //
+    template <typename Sink, typename Table>
+    static void codeScan(const CoefFrame &frame, const Progressive::ScanSpec &scan, Sink &sink, Table *tables);
+
+    //
+    // Whether the given scan of the frame codes with the given table id
+    //
+    static bool scanUsesTable(const CoefFrame &frame, const Progressive::ScanSpec &scan, int id);
+
+public:
+    ProgressiveWriter();
+
+    //
+    // Builds optimal Huffman tables for each scan of the progression of the
+    // given frame
+    //
+    void optimizeTables(const CoefFrame &frame);
+
+    //
+    // Entropy codes the coefficient planes of the given frame as the scans of the
+    // progression, each preceded by its tables (as built by optimizeTables)
+    //
+    void writeScans(BitWriter &writer, const CoefFrame &frame);
+};
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cstring>
+
+#include "rans.hpp"
+
+namespace Rans {
+
+    //
+    // Quantises the given symbol counts to frequencies summing to RANS_PROB_SCALE:
+    // each is scaled down (to at least 1 if the symbol occurs), and the rounding
+    // difference taken from (or given to) the most frequent symbols. Contexts with
+    // fewer than two symbols get a dummy second one, so that no frequency takes
+    // the whole scale (which the decoding table could not hold).
+    //
+    void FrequencyTable::build(const uint32_t *counts) {
+        uint64_t total = 0;
+        int numSymbols = 0;
+        for (int s = 0; s < RANS_SYMBOLS; s++) {
+            total += counts[s];
+            numSymbols += counts[s] > 0;
+        }
+
+        memset(freqs, 0, sizeof(freqs));
+        if (numSymbols < 2) {
+            int symbol = 0;
+            while (symbol < RANS_SYMBOLS - 1 && counts[symbol] == 0) {
+                symbol++;
+            }
+            freqs[symbol] = RANS_PROB_SCALE - 1;
+            freqs[symbol == 0 ? 1 : 0] = 1;
+            finish();
+            return;
+        }
+
+        int sum = 0;
+        for (int s = 0; s < RANS_SYMBOLS; s++) {
+            if (counts[s]) {
+                freqs[s] = static_cast<uint16_t>(std::max<uint64_t>(1, static_cast<uint64_t>(counts[s]) * RANS_PROB_SCALE / total));
+                sum += freqs[s];
+            }
+        }
+        while (sum != RANS_PROB_SCALE) {
+            // (every symbol at 1 would sum to at most RANS_SYMBOLS, below the scale)
+            int largest = static_cast<int>(std::max_element(freqs, freqs + RANS_SYMBOLS) - freqs);
+            int change = sum < RANS_PROB_SCALE ? RANS_PROB_SCALE - sum
+                                               : -std::min(sum - RANS_PROB_SCALE, freqs[largest] - 1);
+            freqs[largest] = static_cast<uint16_t>(freqs[largest] + change);
+            sum += change;
+        }
+        finish();
+    }
+
+    //
+    // Computes the cumulative frequencies of `freqs`. Returns false unless they
+    // sum to RANS_PROB_SCALE, with no single symbol taking all of it.
+    //
+    bool FrequencyTable::finish() {
+        int start = 0;
+        for (int s = 0; s < RANS_SYMBOLS; s++) {
+            if (freqs[s] >= RANS_PROB_SCALE) {
+                return false;
+            }
+            starts[s] = static_cast<uint16_t>(std::min(start, RANS_PROB_SCALE));
+            start += freqs[s];
+        }
+        return start == RANS_PROB_SCALE;
+    }
+
+    //
+    // Sets up each symbol's encoding parameters (ryg_rans' RansEncSymbolInit, for
+    // 16-bit renormalization): states below 2^31 let the reciprocal be exact
+    //
+    void EncodeTable::build(const FrequencyTable &table) {
+        for (int s = 0; s < RANS_SYMBOLS; s++) {
+            uint32_t freq = table.freqs[s], start = table.starts[s];
+            EncodeSymbol &symbol = symbols[s];
+            symbol.xMax = ((RANS_STATE_LOW >> RANS_PROB_BITS) << 16) * freq;
+            symbol.cmplFreq = static_cast<uint16_t>(RANS_PROB_SCALE - freq);
+            if (freq < 2) {
+                // x / 1 is x: the reciprocal of "almost 1" gives x - 1, which the
+                // bias makes up for
+                symbol.rcpFreq = ~0u;
+                symbol.rcpShift = 0;
+                symbol.bias = start + RANS_PROB_SCALE - 1;
+            } else {
+                uint32_t shift = 0;
+                while (freq > (1u << shift)) {
+                    shift++;
+                }
+                symbol.rcpFreq = static_cast<uint32_t>(((1ull << (shift + 31)) + freq - 1) / freq);
+                symbol.rcpShift = static_cast<uint16_t>(shift - 1);
+                symbol.bias = start;
+            }
+        }
+    }
+
+    //
+    // Fills in the slots of each symbol
+    //
+    void DecodeTable::build(const FrequencyTable &table) {
+        memcpy(freqs, table.freqs, sizeof(freqs));
+        memcpy(starts, table.starts, sizeof(starts));
+        for (int s = 0; s < RANS_SYMBOLS; s++) {
+            memset(symbols + table.starts[s], s, table.freqs[s]);
+        }
+    }
+
+    //
+    // Codes the given symbols into `stream` (see rans.hpp). Symbols are coded last
+    // first, each by the state of its lane, and the words emitted on the way are
+    // stacked from the end of a buffer down, so they come out in decoding order.
+    // The final states go in front of them.
+    //
+    void encode(const uint16_t *symbols, size_t n, const EncodeTable *tables, std::vector<uchar> &stream) {
+        // at most one word per symbol, plus the final states
+        std::vector<uint16_t> words(n + 2 * RANS_LANES);
+        uint16_t *ptr = words.data() + words.size();
+
+        uint32_t states[RANS_LANES];
+        for (int lane = 0; lane < RANS_LANES; lane++) {
+            states[lane] = RANS_STATE_LOW;
+        }
+        for (size_t i = n; i-- > 0;) {
+            uint32_t &x = states[i & (RANS_LANES - 1)];
+            const EncodeSymbol &symbol = tables[symbols[i] >> 8].symbols[symbols[i] & 0xFF];
+            if (x >= symbol.xMax) {
+                *--ptr = static_cast<uint16_t>(x);
+                x >>= 16;
+            }
+            uint32_t q = static_cast<uint32_t>((static_cast<uint64_t>(x) * symbol.rcpFreq) >> 32) >> symbol.rcpShift;
+            x += symbol.bias + q * symbol.cmplFreq;
+        }
+        for (int lane = RANS_LANES - 1; lane >= 0; lane--) {
+            *--ptr = static_cast<uint16_t>(states[lane]);
+            *--ptr = static_cast<uint16_t>(states[lane] >> 16);
+        }
+
+        size_t numWords = words.data() + words.size() - ptr;
+        stream.resize(2 * numWords);
+        for (size_t w = 0; w < numWords; w++) {
+            stream[2 * w] = static_cast<uchar>(ptr[w]);
+            stream[2 * w + 1] = static_cast<uchar>(ptr[w] >> 8);
+        }
+    }
+
+    //
+    // Writes the given tables to the container: per table, a 256-bit map of the
+    // symbols with frequencies, then their frequencies (big-endian 16-bit words)
+    //
+    void writeTables(BitWriter &writer, const FrequencyTable *tables) {
+        for (int t = 0; t < RANS_CONTEXTS; t++) {
+            const FrequencyTable &table = tables[t];
+            for (int s = 0; s < RANS_SYMBOLS; s += 8) {
+                uchar map = 0;
+                for (int b = 0; b < 8; b++) {
+                    map |= (table.freqs[s + b] ? 1 : 0) << (7 - b);
+                }
+                writer.writeByte(map);
+            }
+            for (int s = 0; s < RANS_SYMBOLS; s++) {
+                if (table.freqs[s]) {
+                    writer.writeWord(table.freqs[s]);
+                }
+            }
+        }
+    }
+
+    //
+    // Reads the tables written by writeTables, starting at `pos`, which is
+    // advanced past them. Returns false if they are truncated or invalid.
+    //
+    bool readTables(const uchar *data, size_t size, size_t &pos, FrequencyTable *tables) {
+        for (int t = 0; t < RANS_CONTEXTS; t++) {
+            FrequencyTable &table = tables[t];
+            if (size - pos < RANS_SYMBOLS / 8) {
+                return false;
+            }
+            const uchar *map = data + pos;
+            pos += RANS_SYMBOLS / 8;
+            for (int s = 0; s < RANS_SYMBOLS; s++) {
+                table.freqs[s] = 0;
+                if (map[s / 8] & (0x80 >> (s % 8))) {
+                    if (size - pos < 2) {
+                        return false;
+                    }
+                    table.freqs[s] = static_cast<uint16_t>((data[pos] << 8) | data[pos + 1]);
+                    pos += 2;
+                    if (table.freqs[s] == 0) {
+                        return false;
+                    }
+                }
+            }
+            if (!table.finish()) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "bit_writer.hpp"
+
+// symbol probabilities are quantised to multiples of 1 / 2^RANS_PROB_BITS
+#define RANS_PROB_BITS 12
+#define RANS_PROB_SCALE (1 << RANS_PROB_BITS)
+
+// number of interleaved coder states (a power of 2)
+#define RANS_LANES 4
+
+// lower bound of a normalized state: states stay in [2^15, 2^31), and are
+// renormalized 16 bits at a time
+#define RANS_STATE_LOW (1u << 15)
+
+// symbols of each context (JPEG run/size symbols)
+#define RANS_SYMBOLS 256
+
+// bands of zig-zag positions of the AC symbols' contexts (see AC_BAND_ENDS)
+#define RANS_AC_BANDS 3
+
+// contexts of a block class (luma or chroma): DC symbols, then AC symbols of
+// each band
+#define RANS_CLASS_CONTEXTS (1 + RANS_AC_BANDS)
+#define RANS_CONTEXTS (2 * RANS_CLASS_CONTEXTS)
+
+// container magic, and version
+#define RANS_MAGIC "RANS"
+#define RANS_MAGIC_SIZE 4
+#define RANS_VERSION 1
+
+//
+// rANS (range asymmetric numeral systems) entropy coding of JPEG run/size symbols,
+// for an internal format that need not be JPEG compatible (written by
+// JpegEncoder, read by JpegDecoder).
+//
+// Coefficients are symbolized as for Huffman coding (see Rle), but the symbols
+// are coded with static per-image frequencies, in contexts: DC symbols, and AC
+// symbols by band of zig-zag positions (the run/size statistics of low and high
+// frequencies differ widely), of luma and of chroma.
+// Magnitude bits go to a separate, uncoded bit stream.
+//
+// The coder follows ryg_rans: 32-bit states emitting 16-bit words, and encoding
+// by reciprocal multiplication rather than division. RANS_LANES states are
+// interleaved (symbol i goes to state i % RANS_LANES) over a single word stream,
+// so the decoder's state updates form independent dependency chains, which a
+// superscalar core overlaps. Encoding runs backwards over the symbols, so the
+// decoder can run forwards.
+//
+// The container holds, in order:
+//      - RANS_MAGIC, and the RANS_VERSION byte
+//      - the DQT segments and the SOF0 segment of the frame, as in a JFIF file
+//      - the frequency tables of the contexts (see writeTables)
+//      - the sizes of the rANS stream and of the magnitude bit stream, as
+//        big-endian 32-bit words
+//      - the rANS stream (see encode), then the magnitude bits (most significant
+//        bit first, unstuffed, padded with 1 bits)
+// The blocks are coded in the order of a single interleaved baseline scan.
+//
+namespace Rans {
+
+    //
+    // Quantised frequencies of the symbols of a context, summing to RANS_PROB_SCALE,
+    // and their cumulative frequencies
+    //
+    struct FrequencyTable {
+        uint16_t freqs[RANS_SYMBOLS];
+        uint16_t starts[RANS_SYMBOLS];
+
+        //
+        // Quantises the given symbol counts: every symbol that occurs gets a
+        // frequency of at least 1, and none the whole scale (so at least two
+        // symbols have frequencies)
+        //
+        void build(const uint32_t *counts);
+
+        //
+        // Computes the cumulative frequencies of `freqs`. Returns false unless
+        // they sum to RANS_PROB_SCALE, with no single symbol taking all of it.
+        //
+        bool finish();
+    };
+
+    //
+    // Encoding parameters of a symbol (see ryg_rans' RansEncSymbol)
+    //
+    struct EncodeSymbol {
+        uint32_t xMax;      // states at or above this are renormalized first
+        uint32_t rcpFreq;   // fixed point reciprocal of the frequency
+        uint32_t bias;
+        uint16_t cmplFreq;  // RANS_PROB_SCALE - frequency
+        uint16_t rcpShift;
+    };
+
+    struct EncodeTable {
+        EncodeSymbol symbols[RANS_SYMBOLS];
+
+        void build(const FrequencyTable &table);
+    };
+
+    //
+    // Decoding table of a context: the symbol of each slot of the scale, and the
+    // frequency and start of each symbol. Each table takes 5 KiB, so the 4 of a
+    // block class (20 KiB) fit in a 32 KiB L1 data cache, but all RANS_CONTEXTS
+    // of them (40 KiB) do not.
+    //
+    struct DecodeTable {
+        uint8_t symbols[RANS_PROB_SCALE];
+        uint16_t freqs[RANS_SYMBOLS];
+        uint16_t starts[RANS_SYMBOLS];
+
+        void build(const FrequencyTable &table);
+    };
+
+    // last zig-zag position of each band of AC symbols: an AC symbol's band is
+    // that of the first position its zero run may start at
+    const int AC_BAND_ENDS[RANS_AC_BANDS] = {2, 9, 63};
+
+    //
+    // Context of the DC symbols, or of the AC symbols at zig-zag position `k`, of
+    // blocks of the given class (0: luma, 1: chroma)
+    //
+    inline int dcContext(int blockClass) {
+        return RANS_CLASS_CONTEXTS * blockClass;
+    }
+
+    inline int acContext(int blockClass, int k) {
+        return RANS_CLASS_CONTEXTS * blockClass + 1 + (k > AC_BAND_ENDS[0]) + (k > AC_BAND_ENDS[1]);
+    }
+
+    //
+    // Codes the given symbols, each `context << 8 | symbol`, with the given tables
+    // (indexed by context), into `stream`: the coder's final states, then the
+    // words it emitted, in the order the decoder reads them (16-bit little-endian)
+    //
+    void encode(const uint16_t *symbols, size_t n, const EncodeTable *tables, std::vector<uchar> &stream);
+
+    //
+    // Writes the given tables (RANS_CONTEXTS of them) to the container: per
+    // table, a 256-bit map of the symbols with frequencies, then their frequencies
+    //
+    void writeTables(BitWriter &writer, const FrequencyTable *tables);
+
+    //
+    // Reads RANS_CONTEXTS tables written by writeTables, starting at `pos`, which
+    // is advanced past them. Returns false if they are truncated or invalid.
+    //
+    bool readTables(const uchar *data, size_t size, size_t &pos, FrequencyTable *tables);
+
+    //
+    // Decoder of a stream written by `encode`
+    //
+    class Decoder {
+    private:
+        uint32_t states[RANS_LANES];
+        const uchar *ptr;
+        const uchar *end;
+        size_t count;
+
+        // next word of the stream (0 past its end, so corrupt streams stay in bounds)
+        inline uint32_t readWord() {
+            if (end - ptr < 2) {
+                return 0;
+            }
+            uint32_t word = ptr[0] | (ptr[1] << 8);
+            ptr += 2;
+            return word;
+        }
+
+    public:
+        //
+        // Starts decoding the given stream. Returns false if it is too short.
+        //
+        bool init(const uchar *stream, size_t size) {
+            ptr = stream;
+            end = stream + size;
+            count = 0;
+            if (size < 4 * RANS_LANES) {
+                return false;
+            }
+            for (int lane = 0; lane < RANS_LANES; lane++) {
+                states[lane] = readWord() << 16;
+                states[lane] |= readWord();
+            }
+            return true;
+        }
+
+        //
+        // Decodes the next symbol, with the given table
+        //
+        inline int decode(const DecodeTable &table) {
+            uint32_t &x = states[count++ & (RANS_LANES - 1)];
+            uint32_t slot = x & (RANS_PROB_SCALE - 1);
+            int symbol = table.symbols[slot];
+            x = table.freqs[symbol] * (x >> RANS_PROB_BITS) + slot - table.starts[symbol];
+            if (x < RANS_STATE_LOW) {
+                x = (x << 16) | readWord();
+            }
+            return symbol;
+        }
+    };
+}
@@ -0,0 +1,96 @@
+#include "rans_writer.hpp"
+#include "rans.hpp"
+#include "profile.hpp"
+
+//
+// "Table" of the rANS coder's symbols of a block class (0: luma, 1: chroma, as the
+// table ids), whose context depends on whether they are DC or AC symbols (and of
+// the latter, on their zig-zag position)
+//
+struct RansTable {
+    int blockClass;
+    bool ac;
+};
+
+//
+// Collects the symbols of the rANS coder, each tagged with its context (see
+// Rans), and writes the coefficients' magnitude bits to a stream of their own.
+// Follows the zig-zag position of each block's AC symbols, from the runs they code.
+//
+struct RansSymbolWriter {
+    std::vector<uint16_t> &symbols;
+    BitWriter &magnitudeBits;
+    int k; // zig-zag position of the next AC symbol's run
+
+    inline void put(const RansTable *table, int symbol, int coef, int size) {
+        int context;
+        if (table->ac) {
+            context = Rans::acContext(table->blockClass, k);
+            k += symbol == Rle::SYMBOL_EOB ? BLOCK_SIZE*BLOCK_SIZE : (symbol >> 4) + 1;
+        } else {
+            context = Rans::dcContext(table->blockClass);
+            k = 1;
+        }
+        symbols.push_back(static_cast<uint16_t>((context << 8) | symbol));
+        if (size) {
+            magnitudeBits.writeBits(Rle::magnitudeBits(coef, size), size);
+        }
+    }
+
+    inline void restart(int) {}
+};
+
+//
+// Writes the coefficient planes of the given frame as a rANS coded file (see
+// rans.hpp): a statistics pass symbolizes the scan (which has no restart
+// intervals), collecting its symbols and magnitude bits, and builds each
+// context's frequencies from its symbol counts; the symbols are then rANS coded,
+// and the container written out. Returns the number of bytes written.
+//
+size_t RansWriter::write(std::ostream &out, const CoefFrame &frame) {
+    uint64_t blocks = frame.numBlocks();
+    Rans::FrequencyTable freqTables[RANS_CONTEXTS];
+    std::vector<Rans::EncodeTable> encodeTables(RANS_CONTEXTS);
+    BitWriter magnitudeBits(nullptr, false);
+    {
+        Profile::ScopedTimer timer(Profile::STAGE_STATISTICS);
+        timer.setCounts(blocks, blocks * 64 * sizeof(int16_t), 0);
+
+        symbols.clear();
+        RansSymbolWriter symbolWriter = {symbols, magnitudeBits, 0};
+        const RansTable dc[2] = {{0, false}, {1, false}}, ac[2] = {{0, true}, {1, true}};
+        int prevDc[NUM_COMPONENTS] = {0};
+        frame.codeScan(symbolWriter, dc, ac, prevDc);
+        magnitudeBits.alignToByte();
+
+        std::vector<uint32_t> counts(RANS_CONTEXTS * RANS_SYMBOLS);
+        for (uint16_t symbol : symbols) {
+            counts[symbol]++;
+        }
+        for (int context = 0; context < RANS_CONTEXTS; context++) {
+            freqTables[context].build(&counts[context * RANS_SYMBOLS]);
+            encodeTables[context].build(freqTables[context]);
+        }
+    }
+
+    Profile::ScopedTimer timer(Profile::STAGE_ENTROPY);
+    Rans::encode(symbols.data(), symbols.size(), encodeTables.data(), stream);
+
+    BitWriter writer(&out);
+    for (int i = 0; i < RANS_MAGIC_SIZE; i++) {
+        writer.writeByte(RANS_MAGIC[i]);
+    }
+    writer.writeByte(RANS_VERSION);
+    frame.writeQuantTables(writer);
+    Jfif::writeSof0(writer, frame.width, frame.height, frame.components, frame.numComponents);
+    Rans::writeTables(writer, freqTables);
+    for (uint32_t bytes : {static_cast<uint32_t>(stream.size()), static_cast<uint32_t>(magnitudeBits.size())}) {
+        writer.writeWord(static_cast<uint16_t>(bytes >> 16));
+        writer.writeWord(static_cast<uint16_t>(bytes));
+    }
+    writer.writeBytes(stream.data(), stream.size());
+    writer.writeBytes(magnitudeBits.data(), magnitudeBits.size());
+    writer.flush();
+    timer.setCounts(blocks, blocks * 64 * sizeof(int16_t), writer.size());
+    return writer.size();
+}
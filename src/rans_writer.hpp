@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "coef_frame.hpp"
+
+//
+// Writer of rANS coded files of the internal format (see rans.hpp), from the
+// coefficient planes of a frame. The scan is symbolized as for Huffman coding,
+// into a buffer of context-tagged symbols and a stream of magnitude bits; the
+// symbol counts give static per-image frequency tables, and the symbols are then
+// rANS coded (see Rans) and written, with the frame header, into the container.
+// Only JpegDecoder reads these files.
+//
+// Buffers are kept between calls, so writing images of the same size does not
+// allocate.
+//
+class RansWriter {
+private:
+    // symbols of the scan (each `context << 8 | symbol`), and their coded stream
+    std::vector<uint16_t> symbols;
+    std::vector<uchar> stream;
+
+public:
+    //
+    // Writes the coefficient planes of the given frame as a rANS coded file.
+    // Returns the number of bytes written.
+    //
+    size_t write(std::ostream &out, const CoefFrame &frame);
+};
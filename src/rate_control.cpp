@@ -0,0 +1,277 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rate_control.hpp"
+#include "jpeg_encoder.hpp"
+#include "jpeg.hpp"
+#include "profile.hpp"
+
+RateController::RateController() : quantErrors{0, 0, 0}, samplingErrors{0, 0, 0} {
+}
+
+//
+// Outcome of the last encode
+//
+const RateResult &RateController::result() const {
+    return rate;
+}
+
+//
+// Transforms the encoder's sample planes into unquantised coefficient planes
+// (float or integer, by DCT method), in parallel over block rows. Coefficients are
+// stored in zig-zag order, so that each quantisation pass reads them without a
+// gather.
+//
+void RateController::transformCoefs(JpegEncoder &encoder) {
+    Profile::ScopedTimer timer(Profile::STAGE_TRANSFORM);
+    CoefFrame &frame = encoder.frame;
+    DctMethod dctMethod = encoder.options.dctMethod;
+    bool floatDct = dctMethod == DCT_FLOAT;
+
+    // block rows of each channel, laid out one channel after the other
+    int blockRowOffsets[NUM_COMPONENTS + 1] = {0};
+    for (int channel = 0; channel < frame.numComponents; channel++) {
+        const Plane<uchar> &plane = encoder.planes[channel];
+        int blocksWide = plane.width / BLOCK_SIZE, blocksHigh = plane.height / BLOCK_SIZE;
+        frame.coefPlanes[channel].create(blocksWide, blocksHigh);
+        frame.blockEnds[channel].create(blocksWide, blocksHigh);
+        if (floatDct) {
+            dctPlanes[channel].create(blocksWide * 64, blocksHigh);
+        } else {
+            intDctPlanes[channel].create(blocksWide * 64, blocksHigh);
+        }
+        blockRowOffsets[channel + 1] = blockRowOffsets[channel] + blocksHigh;
+    }
+
+    encoder.pool.parallelFor(blockRowOffsets[frame.numComponents], [&](int task) {
+        int channel = 0;
+        while (task >= blockRowOffsets[channel + 1]) {
+            channel++;
+        }
+        int by = task - blockRowOffsets[channel];
+        const Plane<uchar> &plane = encoder.planes[channel];
+        const int *order = encoder.jpegElements.zig_zag_order;
+        BlockScratch scratch;
+        for (int bx = 0; bx < frame.coefPlanes[channel].blocksWide; bx++) {
+            jpegBlockDct(plane.row(by * BLOCK_SIZE) + bx * BLOCK_SIZE, plane.stride, scratch.coefs, scratch.intCoefs,
+                         dctMethod, encoder.jpegElements, scratch);
+            if (floatDct) {
+                float *coefs = dctPlanes[channel].row(by) + bx * 64;
+                for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+                    coefs[k] = scratch.coefs[order[k]];
+                }
+            } else {
+                int32_t *coefs = intDctPlanes[channel].row(by) + bx * 64;
+                for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+                    coefs[k] = scratch.intCoefs[order[k]];
+                }
+            }
+        }
+    });
+    uint64_t blocks = frame.numBlocks();
+    timer.setCounts(blocks, blocks * 64, blocks * 64 * sizeof(float));
+}
+
+//
+// Quantises the unquantised coefficient planes into the encoder's coefficient
+// planes (with its current tables), in parallel over block rows. If
+// `measureError`, sums the squared difference of each plane's coefficients and
+// their dequantised values: the DCT is orthonormal, so that is the squared error
+// the quantisation adds to the plane's samples.
+//
+void RateController::quantiseCoefs(JpegEncoder &encoder, bool measureError) {
+    Profile::ScopedTimer timer(Profile::STAGE_TRANSFORM);
+    CoefFrame &frame = encoder.frame;
+    DctMethod dctMethod = encoder.options.dctMethod;
+    bool floatDct = dctMethod == DCT_FLOAT;
+
+    int blockRowOffsets[NUM_COMPONENTS + 1] = {0};
+    for (int channel = 0; channel < frame.numComponents; channel++) {
+        blockRowOffsets[channel + 1] = blockRowOffsets[channel] + frame.coefPlanes[channel].blocksHigh;
+    }
+    std::vector<double> rowErrors(blockRowOffsets[frame.numComponents], 0);
+
+    encoder.pool.parallelFor(blockRowOffsets[frame.numComponents], [&](int task) {
+        int channel = 0;
+        while (task >= blockRowOffsets[channel + 1]) {
+            channel++;
+        }
+        int by = task - blockRowOffsets[channel];
+        CoefPlane &coefPlane = frame.coefPlanes[channel];
+        const QuantTable &quantTable = *frame.quantTables[channel == 0 ? 0 : 1];
+        uchar *ends = frame.blockEnds[channel].row(by);
+
+        // integer DCT outputs are scaled up by their divisor over the table value,
+        // i.e. down by that value times the reciprocal
+        float scales[BLOCK_SIZE*BLOCK_SIZE];
+        for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+            scales[k] = floatDct ? 1.0f
+                : static_cast<float>(quantTable.values[k] * (quantTable.intReciprocals[dctMethod - 1][k] / 2147483648.0));
+        }
+
+        double error = 0;
+        for (int bx = 0; bx < coefPlane.blocksWide; bx++) {
+            int16_t *zigZag = coefPlane.block(bx, by);
+            if (floatDct) {
+                const float *coefs = dctPlanes[channel].row(by) + bx * 64;
+                ends[bx] = quantiseReordered(coefs, quantTable, zigZag);
+                if (measureError) {
+                    for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+                        float e = coefs[k] - zigZag[k] * quantTable.values[k];
+                        error += e * e;
+                    }
+                }
+            } else {
+                const int32_t *coefs = intDctPlanes[channel].row(by) + bx * 64;
+                ends[bx] = quantiseReorderedInt(coefs, quantTable, dctMethod, zigZag);
+                if (measureError) {
+                    for (int k = 0; k < BLOCK_SIZE*BLOCK_SIZE; k++) {
+                        float e = coefs[k] * scales[k] - zigZag[k] * quantTable.values[k];
+                        error += e * e;
+                    }
+                }
+            }
+        }
+        rowErrors[task] = error;
+    });
+
+    for (int channel = 0; channel < frame.numComponents; channel++) {
+        quantErrors[channel] = 0;
+        for (int task = blockRowOffsets[channel]; task < blockRowOffsets[channel + 1]; task++) {
+            quantErrors[channel] += rowErrors[task];
+        }
+    }
+    uint64_t blocks = frame.numBlocks();
+    timer.setCounts(blocks, blocks * 64 * sizeof(float), blocks * 64 * sizeof(int16_t));
+}
+
+//
+// Weight of the (independent) error of each Y, Cr and Cb sample in the mean
+// squared error of the R, G and B it decodes to: the mean of the squares of
+// its coefficients in the inverse colour conversion (see color.cpp)
+//
+static const double RGB_ERROR_WEIGHTS[NUM_COMPONENTS] = {
+    1.0, (1.402 * 1.402 + 0.714136 * 0.714136) / 3, (1.772 * 1.772 + 0.344136 * 0.344136) / 3
+};
+
+//
+// Estimates the PSNR of the given frame's coefficient planes (as
+// QualityMetrics::psnr), from the quantisation error of each plane, the error of
+// chroma subsampling, and the rounding of the decoded pixels
+//
+double RateController::estimatePsnr(const CoefFrame &frame) const {
+    // decoded pixels are rounded to integers: uniform error, of variance 1/12.
+    // Colour planes are rounded too (converted, then decoded), but a round trip
+    // through Y, Cb and Cr nearly preserves R, G and B, so that barely adds any.
+    const double roundingError = 1.0 / 12;
+
+    double mse = roundingError;
+    for (int channel = 0; channel < frame.numComponents; channel++) {
+        double samples = 64.0 * frame.coefPlanes[channel].blocksWide * frame.coefPlanes[channel].blocksHigh;
+        mse += RGB_ERROR_WEIGHTS[channel] * (quantErrors[channel] / samples + samplingErrors[channel]);
+    }
+    return Metrics::psnr(mse);
+}
+
+//
+// Encodes the given image with the given encoder, at the quality that meets its
+// options' target: the highest quality whose file is at most `targetBytes`, or
+// the lowest whose PSNR is at least `targetPsnr`. Returns the number of bytes
+// written.
+//
+// The image is transformed once, and qualities are binary searched by estimate
+// (see rate_control.hpp). The chosen quality is then encoded (to memory) and
+// checked: while it misses the target, the next quality down (size) or up (PSNR)
+// is encoded instead, and if it meets it, the next quality the other way is tried
+// too. If no quality meets the target, the nearest (1 or 100) is written.
+//
+size_t RateController::encode(JpegEncoder &encoder, const cv::Mat &image, std::ostream &out, bool rgb) {
+    const EncoderOptions &options = encoder.options;
+    CoefFrame &frame = encoder.frame;
+    bool sizeTarget = options.targetBytes > 0;
+    rate = RateResult();
+    encoder.setComponents(image.channels());
+
+    int mcuWidth = BLOCK_SIZE * frame.components[0].h, mcuHeight = BLOCK_SIZE * frame.components[0].v;
+    int M = (image.rows + mcuHeight - 1) / mcuHeight * mcuHeight;
+    int N = (image.cols + mcuWidth - 1) / mcuWidth * mcuWidth;
+    encoder.convertPlanes(image, rgb, N, M);
+    transformCoefs(encoder);
+
+    // subsampling error of each chroma plane, which is the same at any quality
+    int h = frame.components[0].h, v = frame.components[0].v;
+    for (int channel = 0; channel < frame.numComponents; channel++) {
+        samplingErrors[channel] = 0;
+        if (!sizeTarget && channel > 0 && (h > 1 || v > 1)) {
+            const Plane<uchar> &full = encoder.fullPlanes[channel];
+            Plane<uchar> &upsampled = encoder.reconstructedFullPlanes[channel];
+            Sampling::upsample(encoder.planes[channel], upsampled, h, v, encoder.pool);
+            samplingErrors[channel] = Metrics::meanSquaredError(full.row(0), full.stride, upsampled.row(0),
+                                                                upsampled.stride, frame.width, frame.height,
+                                                                encoder.pool);
+        }
+    }
+
+    // quality to encode: the best that meets the target by estimate
+    int quality = sizeTarget ? MIN_QUALITY : MAX_QUALITY;
+    int low = MIN_QUALITY, high = MAX_QUALITY;
+    while (low <= high) {
+        int candidate = (low + high) / 2;
+        encoder.setQuality(candidate);
+        quantiseCoefs(encoder, !sizeTarget);
+        rate.candidates++;
+        bool meets = sizeTarget ? encoder.estimateSize() <= options.targetBytes
+                                : estimatePsnr(frame) >= options.targetPsnr;
+        if (meets == sizeTarget) {
+            // size: meets, so try higher - PSNR: misses, so must go higher
+            quality = meets ? candidate : quality;
+            low = candidate + 1;
+        } else {
+            quality = meets ? candidate : quality;
+            high = candidate - 1;
+        }
+    }
+
+    // encode the chosen quality, stepping towards the target while it misses,
+    // or past it while the next quality meets it too (estimates are close, but
+    // not exact - see rate_control.hpp)
+    int safer = sizeTarget ? -1 : 1, bound = sizeTarget ? MIN_QUALITY : MAX_QUALITY;
+    std::string data;
+    size_t bytes = 0;
+    int step = 0;
+    while (true) {
+        encoder.setQuality(quality);
+        quantiseCoefs(encoder, false);
+        std::ostringstream file;
+        size_t fileBytes = encoder.writeFile(file);
+        rate.encodes++;
+        bool meets = sizeTarget ? fileBytes <= options.targetBytes
+                                : encoder.measure(image, rgb, fileBytes).psnr >= options.targetPsnr;
+        if (step == 0) {
+            step = meets ? -safer : safer;
+        }
+        if (meets || step == safer) {
+            // first encode, a better quality that meets the target, or a safer one
+            rate.met = meets;
+            rate.quality = quality;
+            data = file.str();
+            bytes = fileBytes;
+        }
+        if ((step == safer && (meets || quality == bound)) || (step != safer && !meets)
+            || quality + step < MIN_QUALITY || quality + step > MAX_QUALITY) {
+            break;
+        }
+        quality += step;
+    }
+
+    // the last quality tried may be a rejected neighbour: requantise at the one
+    // written, so that the coefficient planes (and `measure`) match the file
+    if (quality != rate.quality) {
+        encoder.setQuality(rate.quality);
+        quantiseCoefs(encoder, false);
+    }
+
+    out.write(data.data(), data.size());
+    return bytes;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <ostream>
+
+#include "coef_frame.hpp"
+#include "plane.hpp"
+
+class JpegEncoder;
+
+//
+// Outcome of a rate-controlled encode
+//
+struct RateResult {
+    int quality = 0;     // quality the image was encoded at
+    int candidates = 0;  // qualities whose size or PSNR was estimated
+    int encodes = 0;     // qualities that were encoded in full, to check the target
+    bool met = false;    // whether the target was met (if not, the quality is 1 or 100)
+};
+
+//
+// Rate control of JpegEncoder: encodes an image at the quality that meets a target
+// file size or PSNR (see EncoderOptions).
+//
+// The DCT runs once, into unquantised coefficient planes. Candidate qualities are
+// then binary searched, each costing only a quantisation pass and an estimate (in
+// parallel over rows, without writing any output): of the entropy coded size from
+// symbol counts and code lengths (see JpegEncoder::estimateSize), or of the PSNR
+// from the quantisation error of the (orthonormal) DCT coefficients, weighted by
+// how much each plane's error weighs in the decoded R, G and B. Sizes come within
+// a fraction of a percent; the PSNR estimate ignores the clamping of decoded
+// pixels, so it errs low, by up to a dB at most qualities. The chosen quality is
+// encoded, checked against the target, and its neighbours encoded until the best
+// quality that meets it is found.
+//
+// Planes are kept between calls, so encoding images of the same size does not
+// allocate.
+//
+class RateController {
+private:
+    // unquantised DCT coefficients of each plane, 64 per block (in zig-zag order,
+    // float or integer by DCT method), the squared quantisation error of each
+    // plane in DCT units, and the mean squared error that chroma subsampling adds
+    // to each plane
+    Plane<float> dctPlanes[NUM_COMPONENTS];
+    Plane<int32_t> intDctPlanes[NUM_COMPONENTS];
+    double quantErrors[NUM_COMPONENTS];
+    double samplingErrors[NUM_COMPONENTS];
+    RateResult rate;
+
+    //
+    // Transforms the encoder's sample planes into unquantised coefficient planes
+    //
+    void transformCoefs(JpegEncoder &encoder);
+
+    //
+    // Quantises the unquantised coefficient planes into the encoder's coefficient
+    // planes, summing the quantisation error of each plane if `measureError`
+    //
+    void quantiseCoefs(JpegEncoder &encoder, bool measureError);
+
+    //
+    // Estimates the PSNR of the given frame's coefficient planes, from their
+    // quantisation errors
+    //
+    double estimatePsnr(const CoefFrame &frame) const;
+
+public:
+    RateController();
+
+    //
+    // Encodes the given image (RGB if `rgb`) with the given encoder, at the quality
+    // that meets its options' target (see rate_control.cpp). Returns the number of
+    // bytes written.
+    //
+    size_t encode(JpegEncoder &encoder, const cv::Mat &image, std::ostream &out, bool rgb);
+
+    //
+    // Outcome of the last encode
+    //
+    const RateResult &result() const;
+};
@@ -1,4 +1,8 @@
-#include <vector>
+#include "rle.hpp"
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
 
 //
 // Collection of run-length encoding/decoding algs
@@ -6,23 +10,26 @@
 namespace Rle {
 
     //
-    // Run-length encode given byte array
+    // Returns a mask of the nonzero coefficients of a zig-zag ordered block
+    // (bit k set if coefficient k is nonzero)
     //
-    std::vector<int> rleEncode(std::vector<int> arr) {
-        std::vector<int> rle_array;
-
-        int n = arr.size();
-        int i = 0, j = 0;
-        while (i < n) {
-            j = i+1;
-            while (arr[j] == arr[i]) {
-                j++;
-            }
-            rle_array.push_back((j - i)); // count
-            rle_array.push_back((arr[i])); // number
-            i = j;
+    uint64_t nonZeroMask(const int16_t *zigZag) {
+#if defined(__x86_64__)
+        // compare 8 coefficients at a time, and gather the byte-packed results
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t zeros = 0;
+        for (int i = 0; i < 64; i += 16) {
+            __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(zigZag + i)), zero);
+            __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(zigZag + i + 8)), zero);
+            zeros |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_packs_epi16(a, b))) << i;
         }
-
-        return rle_array;
+        return ~zeros;
+#else
+        uint64_t mask = 0;
+        for (int k = 0; k < 64; k++) {
+            mask |= static_cast<uint64_t>(zigZag[k] != 0) << k;
+        }
+        return mask;
+#endif
     }
-}
\ No newline at end of file
+}
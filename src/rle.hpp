@@ -1,14 +1,84 @@
 #pragma once
 
-#include <vector>
+#include <cstdint>
 
+#include "shared.hpp"
+
+//
+// Run-length coding of quantised DCT coefficients, as JPEG symbolizes them
+// (JPEG F.1.2) before Huffman coding:
+//      - DC: the difference from the previous block's DC (DPCM), as a size symbol
+//        (its magnitude category) followed by `size` magnitude bits
+//      - AC: each nonzero coefficient as a (zero run, size) symbol, `run << 4 | size`,
+//        followed by `size` magnitude bits. Runs over 15 zeros are split off with ZRL
+//        (0xF0) symbols, and EOB (0x00) ends a block once only zeros remain.
 //
-// Run-length encoding/decoding algorithms
+// Blocks are symbolized in place, straight from the zig-zag ordered coefficients:
+// symbols are handed to a sink as they are found.
 //
 namespace Rle {
 
+    // end of block / run of 16 zeros symbols
+    const int SYMBOL_EOB = 0x00;
+    const int SYMBOL_ZRL = 0xF0;
+
+    //
+    // Returns a mask of the nonzero coefficients of a zig-zag ordered block
+    // (bit k set if coefficient k is nonzero)
+    //
+    uint64_t nonZeroMask(const int16_t *zigZag);
+
+    //
+    // Magnitude bits of a coefficient of the given size: the value itself if
+    // positive, its one's complement if negative (JPEG F.1.2.1)
+    //
+    inline uint32_t magnitudeBits(int coef, int size) {
+        return static_cast<uint32_t>(coef < 0 ? coef - 1 : coef) & ((1u << size) - 1);
+    }
+
     //
-    // Run-length encode given byte array
+    // Inverse of magnitudeBits, i.e. the coefficient of the given magnitude bits
+    // and size (JPEG F.2.2.1)
+    //
+    inline int extendMagnitude(int bits, int size) {
+        return bits < (1 << (size - 1)) ? bits - (1 << size) + 1 : bits;
+    }
+
     //
-    std::vector<int> rleEncode(std::vector<int> arr);
-}
\ No newline at end of file
+    // Symbolizes a block of zig-zag ordered coefficients, handing each symbol to
+    // `sink.put(table, symbol, coefficient, size)`, with the given DC or AC table.
+    // `last` is the index of the block's last nonzero AC coefficient (0 if none), as
+    // reported by the quantiser. `prevDc` is the DC prediction, updated to this
+    // block's DC.
+    //
+    // AC coefficients are visited via their nonzero mask, so zero runs cost nothing,
+    // and blocks without any (the common case at high compression) skip the mask.
+    //
+    template <typename Sink, typename Table>
+    inline void runSizeEncode(const int16_t *zigZag, int last, int &prevDc, Sink &sink,
+                              Table *dcTable, Table *acTable) {
+        int diff = zigZag[0] - prevDc;
+        int size = MathUtils::bitLength(diff);
+        prevDc = zigZag[0];
+        sink.put(dcTable, size, diff, size);
+
+        uint64_t mask = last ? nonZeroMask(zigZag) & ~1ull : 0;
+        int k = 0; // last coefficient coded
+        while (mask) {
+            int next = __builtin_ctzll(mask);
+            int run = next - k - 1;
+            while (run > 15) {
+                sink.put(acTable, SYMBOL_ZRL, 0, 0);
+                run -= 16;
+            }
+            int coef = zigZag[next];
+            size = MathUtils::bitLength(coef);
+            sink.put(acTable, (run << 4) | size, coef, size);
+            k = next;
+            mask &= mask - 1;
+        }
+        if (last < 63) {
+            sink.put(acTable, SYMBOL_EOB, 0, 0);
+        }
+    }
+}
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+#include "row_reader.hpp"
+
+namespace Pnm {
+
+    //
+    // Reads the next header token (skipping whitespace and comments) into `value`,
+    // from `next`, a function returning the next byte or -1 at the end. Consumes
+    // the single whitespace byte after the token.
+    //
+    template <typename Next>
+    static bool readHeaderNumber(Next &next, int &value) {
+        int c = next();
+        while (c == '#' || isspace(c)) {
+            if (c == '#') {
+                while (c != '\n' && c != -1) {
+                    c = next();
+                }
+            }
+            c = next();
+        }
+        if (!isdigit(c)) {
+            return false;
+        }
+        long v = 0;
+        while (isdigit(c)) {
+            v = v * 10 + (c - '0');
+            if (v > (1 << 30)) {
+                return false;
+            }
+            c = next();
+        }
+        value = static_cast<int>(v);
+        return c != -1 && isspace(c);
+    }
+
+    //
+    // Parses the fields of a header from `next` (see readHeaderNumber)
+    //
+    template <typename Next>
+    static bool parseHeaderFields(Next &next, PixelFormat &format) {
+        if (next() != 'P') {
+            return false;
+        }
+        int magic = next();
+        if (magic != '5' && magic != '6') {
+            return false;
+        }
+
+        int maxval;
+        if (!readHeaderNumber(next, format.width) || !readHeaderNumber(next, format.height) ||
+            !readHeaderNumber(next, maxval)) {
+            return false;
+        }
+        format.channels = magic == '6' ? 3 : 1;
+        format.rgb = magic == '6';
+        return format.width > 0 && format.height > 0 && maxval == 255;
+    }
+
+    //
+    // Reads a PGM/PPM header from the stream, leaving it at the first pixel.
+    // Returns false if the stream does not start with a supported header.
+    //
+    bool readHeader(std::istream &in, PixelFormat &format) {
+        auto next = [&]() {
+            return in.get();
+        };
+        return parseHeaderFields(next, format);
+    }
+
+    //
+    // Parses a PGM/PPM header at the start of the given buffer, giving the offset
+    // of the first pixel. Returns false if the buffer does not start with a
+    // supported header.
+    //
+    bool parseHeader(const uchar *data, size_t size, PixelFormat &format, size_t &dataOffset) {
+        size_t pos = 0;
+        auto next = [&]() {
+            return pos < size ? static_cast<int>(data[pos++]) : -1;
+        };
+        if (!parseHeaderFields(next, format)) {
+            return false;
+        }
+        dataOffset = pos;
+        return true;
+    }
+}
+
+//
+// Parses a raw image size of the form "WxH" (e.g. "1920x1080").
+// Returns false on malformed or non-positive sizes.
+//
+bool parseImageSize(const std::string &size, int &width, int &height) {
+    const char *s = size.c_str();
+    char *end;
+    long w = strtol(s, &end, 10);
+    if (end == s || *end != 'x') {
+        return false;
+    }
+    s = end + 1;
+    long h = strtol(s, &end, 10);
+    if (end == s || *end != '\0') {
+        return false;
+    }
+    if (w <= 0 || h <= 0 || w > (1 << 30) || h > (1 << 30)) {
+        return false;
+    }
+    width = static_cast<int>(w);
+    height = static_cast<int>(h);
+    return true;
+}
+
+RowReader::RowReader(std::istream &in, const PixelFormat &format)
+    : in(in), pixelFormat(format), rowsRead(0) {}
+
+const PixelFormat &RowReader::format() const {
+    return pixelFormat;
+}
+
+//
+// Reads the next `numRows` rows (or those left, if fewer) into `dst`, with rows
+// `stride` bytes apart. Returns the number of rows read, or -1 if the stream
+// ends early.
+//
+int RowReader::read(uchar *dst, size_t stride, int numRows) {
+    numRows = std::min(numRows, pixelFormat.height - rowsRead);
+    size_t rowBytes = pixelFormat.rowBytes();
+    for (int r = 0; r < numRows; r++) {
+        uchar *row = dst + r * stride;
+        if (!in.read(reinterpret_cast<char*>(row), rowBytes)) {
+            return -1;
+        }
+    }
+    rowsRead += numRows;
+    return numRows;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <istream>
+#include <string>
+
+//
+// Layout of uncompressed 8-bit pixel data: `channels` interleaved samples per
+// pixel (1: gray, 3: colour, in RGB order if `rgb`, else BGR), rows packed one
+// after the other
+//
+struct PixelFormat {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    bool rgb = false;
+
+    size_t rowBytes() const {
+        return static_cast<size_t>(width) * channels;
+    }
+};
+
+//
+// Binary PGM (P5) and PPM (P6) images with 8-bit samples (maxval 255)
+//
+namespace Pnm {
+
+    //
+    // Reads a PGM/PPM header from the stream, leaving it at the first pixel.
+    // Returns false if the stream does not start with a supported header.
+    //
+    bool readHeader(std::istream &in, PixelFormat &format);
+
+    //
+    // Parses a PGM/PPM header at the start of the given buffer, giving the offset
+    // of the first pixel. Returns false if the buffer does not start with a
+    // supported header.
+    //
+    bool parseHeader(const uchar *data, size_t size, PixelFormat &format, size_t &dataOffset);
+}
+
+//
+// Parses a raw image size of the form "WxH" (e.g. "1920x1080").
+// Returns false on malformed or non-positive sizes.
+//
+bool parseImageSize(const std::string &size, int &width, int &height);
+
+//
+// Reads the rows of an uncompressed image from a stream, a strip at a time, so
+// that only a strip is ever held in memory. Pixels are returned as stored, so
+// colour pixels are in RGB order if the format says so.
+//
+class RowReader {
+private:
+    std::istream &in;
+    PixelFormat pixelFormat;
+    int rowsRead;
+
+public:
+    RowReader(std::istream &in, const PixelFormat &format);
+
+    const PixelFormat &format() const;
+
+    //
+    // Reads the next `numRows` rows (or those left, if fewer) into `dst`, with rows
+    // `stride` bytes apart. Returns the number of rows read, or -1 if the stream
+    // ends early.
+    //
+    int read(uchar *dst, size_t stride, int numRows);
+};
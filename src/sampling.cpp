@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cstring>
+
+#include "sampling.hpp"
+
+namespace Sampling {
+
+    //
+    // Luma horizontal/vertical sampling factors of the given mode
+    //
+    int lumaH(Subsampling mode) {
+        return mode == SUBSAMPLING_444 ? 1 : 2;
+    }
+
+    int lumaV(Subsampling mode) {
+        return mode == SUBSAMPLING_420 ? 2 : 1;
+    }
+
+    //
+    // MCU dimensions (in pixels) of the given mode
+    //
+    int mcuWidth(Subsampling mode) {
+        return 8 * lumaH(mode);
+    }
+
+    int mcuHeight(Subsampling mode) {
+        return 8 * lumaV(mode);
+    }
+
+    //
+    // Parses a mode name ("444", "422" or "420"). Returns false on unknown names.
+    //
+    bool parseSubsampling(const std::string& name, Subsampling& mode) {
+        if (name == "444") {
+            mode = SUBSAMPLING_444;
+        } else if (name == "422") {
+            mode = SUBSAMPLING_422;
+        } else if (name == "420") {
+            mode = SUBSAMPLING_420;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    //
+    // Returns the name of the given mode (e.g. "4:2:0")
+    //
+    std::string subsamplingName(Subsampling mode) {
+        switch (mode) {
+            case SUBSAMPLING_422: return "4:2:2";
+            case SUBSAMPLING_420: return "4:2:0";
+            default:              return "4:4:4";
+        }
+    }
+
+    //
+    // Downsamples the given full-resolution plane by factors (h, v), each 1 or 2,
+    // into `out` (created). Averages each h x v box, with alternating rounding bias
+    // so that no direction of rounding accumulates across the image.
+    //
+    void downsample(const Plane<uchar> &in, Plane<uchar> &out, int h, int v, ThreadPool &pool) {
+        out.create(in.width / h, in.height / v);
+
+        int n = h * v;
+        int shift = n == 4 ? 2 : (n == 2 ? 1 : 0);
+        int biases[2] = {n == 4 ? 1 : 0, n == 4 ? 2 : (n == 2 ? 1 : 0)};
+
+        pool.parallelFor(out.height, [&](int r) {
+            const uchar *top = in.row(r * v);
+            const uchar *bottom = in.row(r * v + v - 1);
+            uchar *dst = out.row(r);
+            if (n == 1) {
+                memcpy(dst, top, out.width);
+                return;
+            }
+            int sum;
+            for (int i = 0; i < out.width; i++) {
+                if (h == 2) {
+                    sum = top[2*i] + top[2*i + 1];
+                    if (v == 2) {
+                        sum += bottom[2*i] + bottom[2*i + 1];
+                    }
+                } else {
+                    sum = top[i] + bottom[i];
+                }
+                dst[i] = (sum + biases[i & 1]) >> shift;
+            }
+        });
+    }
+
+    //
+    // Upsamples the given plane by factors (h, v), each 1 or 2, into `out` (created)
+    // using a triangle filter, i.e. linear interpolation between the neighbouring
+    // input samples, centred as in JPEG/JFIF (co-sited with the box downsampling).
+    //
+    // Each output sample is 3/4 of its nearest input sample plus 1/4 of the next
+    // nearest, in each upsampled direction. Samples at the edges repeat.
+    //
+    void upsample(const Plane<uchar> &in, Plane<uchar> &out, int h, int v, ThreadPool &pool) {
+        out.create(in.width * h, in.height * v);
+
+        pool.parallelFor(in.height, [&](int r) {
+            const uchar *cur = in.row(r);
+            int last = in.width - 1;
+
+            for (int k = 0; k < v; k++) {
+                uchar *dst = out.row(r * v + k);
+                if (h == 1 && v == 1) {
+                    memcpy(dst, cur, in.width);
+                    continue;
+                }
+
+                // vertically filtered column values (scaled by 4), using the row
+                // above for the upper output row, and the row below for the lower
+                const uchar *near = cur;
+                if (v == 2) {
+                    near = in.row(k == 0 ? std::max(r - 1, 0) : std::min(r + 1, in.height - 1));
+                }
+                auto col = [&](int i) {
+                    return 3 * cur[i] + near[i];
+                };
+
+                if (h == 1) {
+                    int bias = k == 0 ? 1 : 2;
+                    for (int i = 0; i <= last; i++) {
+                        dst[i] = (col(i) + bias) >> 2;
+                    }
+                    continue;
+                }
+
+                int prevCol = col(0), thisCol = col(0), nextCol;
+                for (int i = 0; i <= last; i++) {
+                    nextCol = col(std::min(i + 1, last));
+                    dst[2*i] = (3 * thisCol + prevCol + 8) >> 4;
+                    dst[2*i + 1] = (3 * thisCol + nextCol + 7) >> 4;
+                    prevCol = thisCol;
+                    thisCol = nextCol;
+                }
+            }
+        });
+    }
+}
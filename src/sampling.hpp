@@ -0,0 +1,67 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+#include "plane.hpp"
+#include "thread_pool.hpp"
+
+//
+// Chroma subsampling modes, i.e. the resolution of the chroma planes relative to luma:
+//      - 4:4:4: full resolution
+//      - 4:2:2: half horizontal resolution
+//      - 4:2:0: half horizontal and vertical resolution
+//
+enum Subsampling {
+    SUBSAMPLING_444 = 0,
+    SUBSAMPLING_422 = 1,
+    SUBSAMPLING_420 = 2
+};
+
+//
+// Chroma subsampling: MCU layouts, and the filters that convert chroma planes
+// between full and subsampled resolution.
+//
+// In JPEG terms, luma has sampling factors (h, v) and chroma (1, 1). An MCU
+// (minimum coded unit) then covers 8h x 8v pixels: h x v luma blocks plus one
+// block of each chroma plane. Images are padded to a multiple of the MCU size, so
+// every plane is a whole number of blocks.
+//
+namespace Sampling {
+
+    //
+    // Luma horizontal/vertical sampling factors of the given mode
+    //
+    int lumaH(Subsampling mode);
+    int lumaV(Subsampling mode);
+
+    //
+    // MCU dimensions (in pixels) of the given mode
+    //
+    int mcuWidth(Subsampling mode);
+    int mcuHeight(Subsampling mode);
+
+    //
+    // Parses a mode name ("444", "422" or "420"). Returns false on unknown names.
+    //
+    bool parseSubsampling(const std::string& name, Subsampling& mode);
+
+    //
+    // Returns the name of the given mode (e.g. "4:2:0")
+    //
+    std::string subsamplingName(Subsampling mode);
+
+    //
+    // Downsamples the given full-resolution plane by factors (h, v), each 1 or 2,
+    // into `out` (created). Averages each h x v box, with alternating rounding bias
+    // so that no direction of rounding accumulates across the image.
+    //
+    void downsample(const Plane<uchar> &in, Plane<uchar> &out, int h, int v, ThreadPool &pool);
+
+    //
+    // Upsamples the given plane by factors (h, v), each 1 or 2, into `out` (created)
+    // using a triangle filter, i.e. linear interpolation between the neighbouring
+    // input samples, centred as in JPEG/JFIF (co-sited with the box downsampling).
+    //
+    void upsample(const Plane<uchar> &in, Plane<uchar> &out, int h, int v, ThreadPool &pool);
+}
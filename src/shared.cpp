@@ -65,3 +65,74 @@ namespace MathUtils {
         return std::max(min, std::min(value, max));
     }
 }
+
+namespace CpuUtils {
+
+    //
+    // Returns the best SIMD level supported by the host CPU (via CPUID)
+    //
+    SimdLevel detectSimdLevel() {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return SIMD_AVX2;
+        }
+        return SIMD_SSE2; // always present on x86-64
+#else
+        return SIMD_SCALAR;
+#endif
+    }
+
+    static SimdLevel activeLevel = detectSimdLevel();
+
+    //
+    // Returns the process-wide SIMD level that kernels should use.
+    // Defaults to the detected level.
+    //
+    SimdLevel getSimdLevel() {
+        return activeLevel;
+    }
+
+    //
+    // Sets the process-wide SIMD level. Must be called before any worker threads
+    // start. Returns false (leaving the level unchanged) if the host CPU does not
+    // support the given level.
+    //
+    bool setSimdLevel(SimdLevel level) {
+        if (level > detectSimdLevel()) {
+            return false;
+        }
+        activeLevel = level;
+        return true;
+    }
+
+    //
+    // Returns a human-readable name for the given SIMD level
+    //
+    std::string simdLevelName(SimdLevel level) {
+        switch (level) {
+            case SIMD_AVX2: return "avx2";
+            case SIMD_SSE2: return "sse2";
+            default:        return "scalar";
+        }
+    }
+
+    //
+    // Parses a SIMD level name ("auto", "scalar", "sse2" or "avx2").
+    // "auto" yields the detected level. Returns false on unknown names.
+    //
+    bool parseSimdLevel(const std::string& name, SimdLevel& level) {
+        if (name == "auto") {
+            level = detectSimdLevel();
+        } else if (name == "scalar") {
+            level = SIMD_SCALAR;
+        } else if (name == "sse2") {
+            level = SIMD_SSE2;
+        } else if (name == "avx2") {
+            level = SIMD_AVX2;
+        } else {
+            return false;
+        }
+        return true;
+    }
+}
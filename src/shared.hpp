@@ -75,4 +75,57 @@ namespace MathUtils {
     // Clamp 'value' into range ['min', 'max']
     //
     int clamp(int value, int min, int max);
+
+    //
+    // Number of bits needed to represent |value|, i.e. its JPEG magnitude category
+    //
+    inline int bitLength(int value) {
+        unsigned magnitude = value < 0 ? -value : value;
+        return magnitude ? 32 - __builtin_clz(magnitude) : 0;
+    }
+}
+
+//
+// Collection of CPU feature detection utility functions
+//
+namespace CpuUtils {
+
+    //
+    // Instruction set levels that hand-vectorised kernels are available for,
+    // in increasing order of capability.
+    //
+    enum SimdLevel {
+        SIMD_SCALAR = 0,
+        SIMD_SSE2 = 1,
+        SIMD_AVX2 = 2
+    };
+
+    //
+    // Returns the best SIMD level supported by the host CPU (via CPUID)
+    //
+    SimdLevel detectSimdLevel();
+
+    //
+    // Returns the process-wide SIMD level that kernels should use.
+    // Defaults to the detected level.
+    //
+    SimdLevel getSimdLevel();
+
+    //
+    // Sets the process-wide SIMD level. Must be called before any worker threads
+    // start. Returns false (leaving the level unchanged) if the host CPU does not
+    // support the given level.
+    //
+    bool setSimdLevel(SimdLevel level);
+
+    //
+    // Returns a human-readable name for the given SIMD level
+    //
+    std::string simdLevelName(SimdLevel level);
+
+    //
+    // Parses a SIMD level name ("auto", "scalar", "sse2" or "avx2").
+    // "auto" yields the detected level. Returns false on unknown names.
+    //
+    bool parseSimdLevel(const std::string& name, SimdLevel& level);
 }
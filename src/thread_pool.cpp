@@ -0,0 +1,113 @@
+#include "thread_pool.hpp"
+
+//
+// Creates a pool of `numThreads` threads (including the caller).
+// 0 means one per hardware thread.
+//
+ThreadPool::ThreadPool(int numThreads)
+    : job(nullptr), jobSize(0), nextIndex(0), activeWorkers(0), generation(0), stopping(false) {
+    int n = resolveThreadCount(numThreads);
+    for (int i = 1; i < n; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+//
+// Worker thread main loop
+//
+void ThreadPool::workerLoop() {
+    unsigned long seen = 0;
+    while (true) {
+        const std::function<void(int)> *fn;
+        int n;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobReady.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            if (!job) {
+                continue; // woke after the job had already finished
+            }
+            fn = job;
+            n = jobSize;
+            activeWorkers++;
+        }
+
+        runJob(*fn, n);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            activeWorkers--;
+        }
+        jobDone.notify_all();
+    }
+}
+
+//
+// Runs indices of the current job until none are left
+//
+void ThreadPool::runJob(const std::function<void(int)> &fn, int n) {
+    int i;
+    while ((i = nextIndex.fetch_add(1)) < n) {
+        fn(i);
+    }
+}
+
+//
+// Runs fn(i) for every i in [0, n), returning once all calls have finished
+//
+void ThreadPool::parallelFor(int n, const std::function<void(int)> &fn) {
+    if (workers.empty() || n <= 1) {
+        for (int i = 0; i < n; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobSize = n;
+        nextIndex = 0;
+        generation++;
+    }
+    jobReady.notify_all();
+
+    runJob(fn, n);
+
+    // wait for workers still finishing their last index
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [&] { return activeWorkers == 0; });
+    job = nullptr;
+}
+
+//
+// Number of threads (including the caller)
+//
+int ThreadPool::size() const {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+//
+// Resolves a thread count option, where 0 means one per hardware thread
+//
+int ThreadPool::resolveThreadCount(int numThreads) {
+    if (numThreads > 0) {
+        return numThreads;
+    }
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    return hw > 0 ? hw : 1;
+}
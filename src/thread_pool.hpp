@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Fixed-size pool of worker threads, for data-parallel loops.
+//
+// `parallelFor` hands out loop indices dynamically (one at a time, from a shared
+// counter), so uneven work balances itself. The calling thread works too, so a pool
+// of N threads has N-1 workers, and a pool of 1 thread runs everything inline.
+//
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+
+    // current job
+    const std::function<void(int)> *job;
+    int jobSize;
+    std::atomic<int> nextIndex;
+    int activeWorkers;
+    unsigned long generation;
+    bool stopping;
+
+    //
+    // Worker thread main loop
+    //
+    void workerLoop();
+
+    //
+    // Runs indices of the current job until none are left
+    //
+    void runJob(const std::function<void(int)> &fn, int n);
+
+public:
+    //
+    // Creates a pool of `numThreads` threads (including the caller).
+    // 0 means one per hardware thread.
+    //
+    ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //
+    // Runs fn(i) for every i in [0, n), returning once all calls have finished.
+    // Calls may run concurrently and in any order, so fn must only write state
+    // owned by index i.
+    //
+    void parallelFor(int n, const std::function<void(int)> &fn);
+
+    //
+    // Number of threads (including the caller)
+    //
+    int size() const;
+
+    //
+    // Resolves a thread count option, where 0 means one per hardware thread
+    //
+    static int resolveThreadCount(int numThreads);
+};
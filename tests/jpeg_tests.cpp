@@ -0,0 +1,711 @@
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pre_computed.hpp"
+#include "dct.hpp"
+#include "huffman.hpp"
+#include "shared.hpp"
+#include "color.hpp"
+#include "rans.hpp"
+#include "jpeg_encoder.hpp"
+#include "jpeg_decoder.hpp"
+#include "row_reader.hpp"
+#include "metrics.hpp"
+
+//
+// Unit tests of the codec: the accuracy and bit-exactness its kernels document,
+// SIMD kernels against the scalar ones (at every level the host supports), Huffman table construction, and encode
+// -> decode round trips of every file type the encoder writes.
+//
+// Inputs are generated by a fixed linear congruential generator, so they (and the
+// expected hashes of the integer DCTs) are the same on every platform. Each test
+// prints its failed checks and PASS or FAIL; the process exits non-zero if any
+// test fails. Run by ctest, or directly, optionally with a filter on test names.
+//
+
+static int checkFailures;
+
+#define CHECK(condition) checkTrue((condition), #condition, __FILE__, __LINE__)
+
+static bool checkTrue(bool condition, const char *text, const char *file, int line) {
+    if (!condition) {
+        std::cout << "    " << file << ":" << line << ": check failed: " << text << "\n";
+        checkFailures++;
+    }
+    return condition;
+}
+
+struct Test {
+    std::string name;
+    std::function<void()> run;
+};
+
+//
+// Linear congruential generator (Knuth's MMIX constants), of values in [low, high]
+//
+struct Lcg {
+    uint64_t state;
+
+    explicit Lcg(uint64_t seed) : state(seed) {}
+
+    int next(int low, int high) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return low + static_cast<int>((state >> 33) % static_cast<uint64_t>(high - low + 1));
+    }
+};
+
+//
+// FNV-1a hash of the given values
+//
+static uint64_t hashValues(const int32_t *values, size_t n, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t value = static_cast<uint32_t>(values[i]);
+        for (int b = 0; b < 4; b++) {
+            hash = (hash ^ ((value >> (8 * b)) & 0xFF)) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+//
+// Level-shifted 8-bit sample blocks: random ones, then the extremes (flat black,
+// flat white, and a black and white checkerboard)
+//
+static std::vector<int32_t> sampleBlocks(int numRandom) {
+    const int n = BLOCK_SIZE*BLOCK_SIZE;
+    std::vector<int32_t> blocks;
+    Lcg rng(1);
+    for (int i = 0; i < numRandom * n; i++) {
+        blocks.push_back(rng.next(-128, 127));
+    }
+    for (int i = 0; i < n; i++) {
+        blocks.push_back(-128);
+    }
+    for (int i = 0; i < n; i++) {
+        blocks.push_back(127);
+    }
+    for (int i = 0; i < n; i++) {
+        blocks.push_back(((i / BLOCK_SIZE + i % BLOCK_SIZE) % 2) ? 127 : -128);
+    }
+    return blocks;
+}
+
+//
+// Orthonormal 2D DCT of the given block (the direct O(N^4) form), in double
+//
+static void referenceDct(const float *in, double *out) {
+    for (int u = 0; u < BLOCK_SIZE; u++) {
+        for (int v = 0; v < BLOCK_SIZE; v++) {
+            double sum = 0;
+            for (int i = 0; i < BLOCK_SIZE; i++) {
+                for (int j = 0; j < BLOCK_SIZE; j++) {
+                    sum += in[i*BLOCK_SIZE + j] * std::cos((2*i + 1) * u * M_PI / 16) * std::cos((2*j + 1) * v * M_PI / 16);
+                }
+            }
+            double cu = u ? 1 : std::sqrt(0.5), cv = v ? 1 : std::sqrt(0.5);
+            out[u*BLOCK_SIZE + v] = 0.25 * cu * cv * sum;
+        }
+    }
+}
+
+//
+// Inverse of referenceDct
+//
+static void referenceInverseDct(const float *in, double *out) {
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            double sum = 0;
+            for (int u = 0; u < BLOCK_SIZE; u++) {
+                for (int v = 0; v < BLOCK_SIZE; v++) {
+                    double cu = u ? 1 : std::sqrt(0.5), cv = v ? 1 : std::sqrt(0.5);
+                    sum += cu * cv * in[u*BLOCK_SIZE + v] * std::cos((2*i + 1) * u * M_PI / 16) * std::cos((2*j + 1) * v * M_PI / 16);
+                }
+            }
+            out[i*BLOCK_SIZE + j] = 0.25 * sum;
+        }
+    }
+}
+
+//
+// Float DCT kernels of each SIMD level the host supports
+//
+struct FloatKernels {
+    CpuUtils::SimdLevel level;
+    Dct::DctKernel forward, inverse;
+};
+
+static std::vector<FloatKernels> floatKernels() {
+    std::vector<FloatKernels> kernels;
+    kernels.push_back({CpuUtils::SIMD_SCALAR, Dct::forwardDctScalar, Dct::inverseDctScalar});
+#if defined(__x86_64__)
+    if (CpuUtils::detectSimdLevel() >= CpuUtils::SIMD_SSE2) {
+        kernels.push_back({CpuUtils::SIMD_SSE2, Dct::forwardDctSse2, Dct::inverseDctSse2});
+    }
+    if (CpuUtils::detectSimdLevel() >= CpuUtils::SIMD_AVX2) {
+        kernels.push_back({CpuUtils::SIMD_AVX2, Dct::forwardDctAvx2, Dct::inverseDctAvx2});
+    }
+#endif
+    return kernels;
+}
+
+//
+// The AAN float transforms agree with the direct form to within 1e-3 (dct.hpp),
+// at every SIMD level
+//
+static void testFloatDctAccuracy(JpegElements &jpegElements) {
+    const int n = BLOCK_SIZE*BLOCK_SIZE;
+    std::vector<int32_t> blocks = sampleBlocks(500);
+    float in[n], out[n];
+    double expected[n];
+    for (const FloatKernels &kernels : floatKernels()) {
+        double forwardError = 0, inverseError = 0;
+        for (size_t b = 0; b < blocks.size(); b += n) {
+            for (int i = 0; i < n; i++) {
+                in[i] = static_cast<float>(blocks[b + i]);
+            }
+            referenceDct(in, expected);
+            kernels.forward(in, out, jpegElements);
+            for (int i = 0; i < n; i++) {
+                forwardError = std::max(forwardError, std::fabs(out[i] - expected[i]));
+            }
+
+            // the inverse of the exact coefficients (as floats) is the block again
+            for (int i = 0; i < n; i++) {
+                in[i] = static_cast<float>(expected[i]);
+            }
+            referenceInverseDct(in, expected);
+            kernels.inverse(in, out, jpegElements);
+            for (int i = 0; i < n; i++) {
+                inverseError = std::max(inverseError, std::fabs(out[i] - expected[i]));
+            }
+        }
+        std::cout << "    " << CpuUtils::simdLevelName(kernels.level) << ": max error " << forwardError
+                  << " (forward), " << inverseError << " (inverse)\n";
+        CHECK(forwardError < 1e-3);
+        CHECK(inverseError < 1e-3);
+    }
+}
+
+//
+// The SIMD float kernels give the same coefficients and samples as the scalar
+// ones, up to float rounding
+//
+static void testFloatDctSimd(JpegElements &jpegElements) {
+    const int n = BLOCK_SIZE*BLOCK_SIZE;
+    std::vector<int32_t> blocks = sampleBlocks(500);
+    std::vector<FloatKernels> kernels = floatKernels();
+    float in[n], expected[n], out[n];
+    for (size_t k = 1; k < kernels.size(); k++) {
+        double forwardError = 0, inverseError = 0;
+        for (size_t b = 0; b < blocks.size(); b += n) {
+            for (int i = 0; i < n; i++) {
+                in[i] = static_cast<float>(blocks[b + i]);
+            }
+            kernels[0].forward(in, expected, jpegElements);
+            kernels[k].forward(in, out, jpegElements);
+            for (int i = 0; i < n; i++) {
+                forwardError = std::max(forwardError, static_cast<double>(std::fabs(out[i] - expected[i])));
+            }
+
+            kernels[0].inverse(expected, in, jpegElements);
+            kernels[k].inverse(expected, out, jpegElements);
+            for (int i = 0; i < n; i++) {
+                inverseError = std::max(inverseError, static_cast<double>(std::fabs(out[i] - in[i])));
+            }
+        }
+        std::cout << "    " << CpuUtils::simdLevelName(kernels[k].level) << " vs scalar: max difference "
+                  << forwardError << " (forward), " << inverseError << " (inverse)\n";
+        CHECK(forwardError < 1e-4);
+        CHECK(inverseError < 1e-4);
+    }
+}
+
+//
+// The AVX2 colour conversion rows give the same bytes as the scalar ones (as
+// color.hpp documents), in the vector body and in the scalar tail alike, for
+// the corners of the RGB cube (whose chroma saturates) and random pixels. Pure
+// colours survive a round trip through YCbCr.
+//
+static void testColorSimd() {
+    const int width = 40;
+    const int corners[8][3] = {{0, 0, 0}, {255, 0, 0}, {0, 255, 0}, {0, 0, 255},
+                               {255, 255, 0}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}};
+    std::vector<uchar> bgr(3 * width);
+    Lcg rng(4);
+    for (int i = 0; i < width; i++) {
+        for (int c = 0; c < 3; c++) {
+            // corners in the first vector of 16 pixels and in the tail
+            bool corner = i < 8 || i >= 32;
+            bgr[3*i + c] = static_cast<uchar>(corner ? corners[i % 8][c] : rng.next(0, 255));
+        }
+    }
+
+    CpuUtils::SimdLevel previous = CpuUtils::getSimdLevel();
+    std::vector<uchar> planes[2][3], round[2];
+    for (int simd = 0; simd < 2; simd++) {
+        if (!CpuUtils::setSimdLevel(simd ? CpuUtils::SIMD_AVX2 : CpuUtils::SIMD_SCALAR)) {
+            std::cout << "    avx2 not supported, scalar kernels only\n";
+            break;
+        }
+        for (int p = 0; p < 3; p++) {
+            planes[simd][p].resize(width);
+        }
+        Color::bgrRowToYcbcr(bgr.data(), width, planes[simd][0].data(), planes[simd][1].data(), planes[simd][2].data());
+        round[simd].resize(3 * width);
+        Color::ycbcrRowToBgr(planes[simd][0].data(), planes[simd][1].data(), planes[simd][2].data(), width,
+                             round[simd].data());
+
+        // RGB input converts as its BGR equivalent
+        std::vector<uchar> rgb(bgr), y(width), cr(width), cb(width);
+        for (int i = 0; i < width; i++) {
+            std::swap(rgb[3*i], rgb[3*i + 2]);
+        }
+        Color::rgbRowToYcbcr(rgb.data(), width, y.data(), cr.data(), cb.data());
+        CHECK(y == planes[simd][0] && cr == planes[simd][1] && cb == planes[simd][2]);
+
+        int maxError = 0;
+        for (int i = 0; i < 3 * width; i++) {
+            if (i < 3 * 8 || i >= 3 * 32) {
+                maxError = std::max(maxError, std::abs(round[simd][i] - bgr[i]));
+            }
+        }
+        CHECK(maxError <= 2);
+    }
+    CpuUtils::setSimdLevel(previous);
+
+    if (!planes[1][0].empty()) {
+        for (int p = 0; p < 3; p++) {
+            CHECK(planes[1][p] == planes[0][p]);
+        }
+        CHECK(round[1] == round[0]);
+    }
+}
+
+//
+// The integer DCTs are bit-exact: their outputs hash to fixed values on every
+// platform. islow is also accurate to within a unit of its scaled-up output.
+//
+static void testIntDctExact(JpegElements &jpegElements) {
+    const int n = BLOCK_SIZE*BLOCK_SIZE;
+    std::vector<int32_t> blocks = sampleBlocks(500);
+    int32_t coefs[n], samples[n];
+    float in[n];
+    double expected[n];
+
+    uint64_t islowHash = hashValues(nullptr, 0), ifastHash = islowHash;
+    uint64_t islowInverseHash = islowHash, ifastInverseHash = islowHash;
+    int islowError = 0;
+    for (size_t b = 0; b < blocks.size(); b += n) {
+        const int32_t *block = &blocks[b];
+        Dct::forwardDctIslow(block, coefs);
+        islowHash = hashValues(coefs, n, islowHash);
+
+        for (int i = 0; i < n; i++) {
+            in[i] = static_cast<float>(block[i]);
+        }
+        referenceDct(in, expected);
+        for (int i = 0; i < n; i++) {
+            islowError = std::max(islowError, std::abs(coefs[i] - static_cast<int>(std::lround(8 * expected[i]))));
+        }
+
+        // (islow coefficients, descaled, are in range of the inverse DCTs)
+        for (int i = 0; i < n; i++) {
+            coefs[i] = (coefs[i] + 4) >> 3;
+        }
+        Dct::inverseDctIslow(coefs, samples, jpegElements.getIntIdctMultipliers(DCT_ISLOW));
+        islowInverseHash = hashValues(samples, n, islowInverseHash);
+        Dct::inverseDctIfast(coefs, samples, jpegElements.getIntIdctMultipliers(DCT_IFAST));
+        ifastInverseHash = hashValues(samples, n, ifastInverseHash);
+
+        Dct::forwardDctIfast(block, coefs);
+        ifastHash = hashValues(coefs, n, ifastHash);
+    }
+
+    std::cout << std::hex << "    hashes: islow " << islowHash << ", ifast " << ifastHash << ", islow inverse "
+              << islowInverseHash << ", ifast inverse " << ifastInverseHash << std::dec
+              << "; islow max error " << islowError << "\n";
+    CHECK(islowHash == 0xc4a01e62ee7513afull);
+    CHECK(ifastHash == 0xa37b4d5bab0680bcull);
+    CHECK(islowInverseHash == 0x57cd12f5f984d1ebull);
+    CHECK(ifastInverseHash == 0x77313b8ec4bdf42full);
+    CHECK(islowError <= 1);
+}
+
+//
+// Optimized Huffman tables have codes of at most 16 bits, even for frequencies
+// whose optimal codes are longer, and are canonical, complete but for the
+// all-ones code, and prefix-free
+//
+static void testHuffmanLengthLimit() {
+    HuffmanEncoder encoder;
+    HuffmanTable table;
+
+    // Fibonacci frequencies give a maximally deep tree: 40 symbols would need codes
+    // of up to 39 bits
+    uint32_t freqs[HUFFMAN_SYMBOLS] = {0};
+    uint32_t a = 1, b = 1;
+    for (int s = 0; s < 40; s++) {
+        freqs[s * 5] = a;
+        uint32_t next = a + b;
+        a = b;
+        b = next;
+    }
+    encoder.buildTable(freqs, table);
+
+    int maxLength = 0;
+    double kraftSum = 0;
+    for (int s = 0; s < HUFFMAN_SYMBOLS; s++) {
+        CHECK((table.lengths[s] > 0) == (freqs[s] > 0));
+        maxLength = std::max(maxLength, static_cast<int>(table.lengths[s]));
+        if (table.lengths[s]) {
+            kraftSum += std::ldexp(1.0, -table.lengths[s]);
+        }
+    }
+    CHECK(maxLength == HUFFMAN_MAX_CODE_LENGTH);
+    CHECK(kraftSum == 1 - std::ldexp(1.0, -HUFFMAN_MAX_CODE_LENGTH));
+
+    // more frequent symbols never get longer codes
+    for (int s = 0; s < HUFFMAN_SYMBOLS; s++) {
+        for (int t = 0; t < HUFFMAN_SYMBOLS; t++) {
+            if (freqs[s] && freqs[t] && freqs[s] > freqs[t]) {
+                CHECK(table.lengths[s] <= table.lengths[t]);
+            }
+        }
+    }
+
+    // no code is a prefix of another, nor all ones
+    for (int s = 0; s < HUFFMAN_SYMBOLS; s++) {
+        if (!table.lengths[s]) {
+            continue;
+        }
+        CHECK(table.codes[s] != (1u << table.lengths[s]) - 1);
+        for (int t = 0; t < HUFFMAN_SYMBOLS; t++) {
+            if (t != s && table.lengths[t] && table.lengths[t] >= table.lengths[s]) {
+                CHECK((table.codes[t] >> (table.lengths[t] - table.lengths[s])) != table.codes[s]);
+            }
+        }
+    }
+
+    // the table's DHT fields give the same codes back
+    HuffmanTable rebuilt;
+    rebuilt.build(table.bits, table.vals);
+    CHECK(memcmp(rebuilt.codes, table.codes, sizeof(table.codes)) == 0);
+    CHECK(memcmp(rebuilt.lengths, table.lengths, sizeof(table.lengths)) == 0);
+}
+
+//
+// rANS coding of symbols in several contexts decodes back to the same symbols,
+// including contexts of a single symbol and of very skewed frequencies
+//
+static void testRansRoundTrip() {
+    const int numSymbols = 100000;
+    Lcg rng(2);
+    std::vector<uint16_t> symbols(numSymbols);
+    std::vector<uint32_t> counts(RANS_CONTEXTS * RANS_SYMBOLS, 0);
+    for (int i = 0; i < numSymbols; i++) {
+        int context = rng.next(0, RANS_CONTEXTS - 1);
+        int symbol;
+        if (context == 0) {
+            symbol = 7;
+        } else if (context == 1) {
+            symbol = rng.next(0, 999) ? 0 : rng.next(1, 255);
+        } else {
+            symbol = rng.next(0, 15) * rng.next(0, 15);
+        }
+        symbols[i] = static_cast<uint16_t>(context << 8 | symbol);
+        counts[context * RANS_SYMBOLS + symbol]++;
+    }
+
+    std::vector<Rans::FrequencyTable> frequencies(RANS_CONTEXTS);
+    std::vector<Rans::EncodeTable> encodeTables(RANS_CONTEXTS);
+    std::vector<Rans::DecodeTable> decodeTables(RANS_CONTEXTS);
+    for (int t = 0; t < RANS_CONTEXTS; t++) {
+        frequencies[t].build(&counts[t * RANS_SYMBOLS]);
+        encodeTables[t].build(frequencies[t]);
+        decodeTables[t].build(frequencies[t]);
+    }
+
+    std::vector<uchar> stream;
+    Rans::encode(symbols.data(), symbols.size(), encodeTables.data(), stream);
+
+    Rans::Decoder decoder;
+    CHECK(decoder.init(stream.data(), stream.size()));
+    int mismatches = 0;
+    for (int i = 0; i < numSymbols; i++) {
+        mismatches += decoder.decode(decodeTables[symbols[i] >> 8]) != (symbols[i] & 0xFF);
+    }
+    CHECK(mismatches == 0);
+}
+
+//
+// Smooth synthetic BGR (or grayscale) image, like a photo, with a little noise
+//
+static cv::Mat syntheticImage(int width, int height, int channels) {
+    cv::Mat image(height, width, channels == 3 ? CV_8UC3 : CV_8UC1);
+    Lcg rng(3);
+    for (int y = 0; y < height; y++) {
+        uchar *row = image.ptr<uchar>(y);
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+                double fx = static_cast<double>(x) / width, fy = static_cast<double>(y) / height;
+                int v = static_cast<int>(128 + 60 * std::sin(6.0 * fx + 2.0 * c) * std::cos(4.0 * fy - c)
+                                         + 40 * (fx - fy)) + rng.next(-4, 4);
+                row[x * channels + c] = static_cast<uchar>(MathUtils::clamp(v, 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+//
+// Encodes the given image with the given options, then decodes it
+//
+static bool encodeDecode(const cv::Mat &image, const EncoderOptions &options, cv::Mat &decoded) {
+    JpegEncoder encoder(options);
+    std::ostringstream out;
+    size_t bytes = encoder.encode(image, out);
+    std::string data = out.str();
+    if (!CHECK(bytes > 0 && bytes == data.size())) {
+        return false;
+    }
+
+    JpegDecoder decoder(DecoderOptions{});
+    if (!decoder.decode(reinterpret_cast<const uchar*>(data.data()), data.size(), decoded)) {
+        std::cout << "    decode failed: " << decoder.error() << "\n";
+        checkFailures++;
+        return false;
+    }
+    return true;
+}
+
+static bool sameImage(const cv::Mat &a, const cv::Mat &b) {
+    if (a.rows != b.rows || a.cols != b.cols || a.channels() != b.channels()) {
+        return false;
+    }
+    for (int r = 0; r < a.rows; r++) {
+        if (memcmp(a.ptr<uchar>(r), b.ptr<uchar>(r), a.cols * a.channels()) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//
+// Baseline files of every subsampling (and grayscale ones), at sizes that are
+// not whole MCUs, decode to images close to the original. Files with optimized
+// tables, restart intervals, progressive scans or rANS coding hold the same
+// coefficients, so decode to exactly the same pixels.
+//
+static void testDecoderRoundTrip() {
+    ThreadPool pool(1);
+    const Subsampling subsamplings[] = {SUBSAMPLING_444, SUBSAMPLING_422, SUBSAMPLING_420};
+    const int sizes[][2] = {{61, 37}, {8, 8}, {1, 1}, {130, 17}};
+    for (int channels : {3, 1}) {
+        for (const int *size : sizes) {
+            cv::Mat image = syntheticImage(size[0], size[1], channels);
+            for (Subsampling subsampling : subsamplings) {
+                if (channels == 1 && subsampling != SUBSAMPLING_444) {
+                    continue;
+                }
+                EncoderOptions options;
+                options.quality = 90;
+                options.subsampling = subsampling;
+
+                cv::Mat baseline;
+                if (!encodeDecode(image, options, baseline)) {
+                    continue;
+                }
+                CHECK(baseline.rows == image.rows && baseline.cols == image.cols);
+                CHECK(baseline.channels() == image.channels());
+                double mse = Metrics::meanSquaredError(image.ptr<uchar>(0), image.step, baseline.ptr<uchar>(0),
+                                                       baseline.step, image.cols * image.channels(), image.rows, pool);
+                CHECK(Metrics::psnr(mse) > 25);
+
+                EncoderOptions variants[4] = {options, options, options, options};
+                variants[0].huffman = HUFFMAN_OPTIMIZED;
+                variants[1].restartInterval = 2;
+                variants[1].threads = 3;
+                variants[2].progressive = true;
+                variants[3].entropy = ENTROPY_RANS;
+                for (const EncoderOptions &variant : variants) {
+                    cv::Mat decoded;
+                    if (encodeDecode(image, variant, decoded)) {
+                        CHECK(sameImage(decoded, baseline));
+                    }
+                }
+            }
+        }
+    }
+}
+
+//
+// Images too large for the SOF segment's 16-bit dimensions are rejected, whole or
+// streamed, before anything is written
+//
+static void testMaxDimensions() {
+    JpegEncoder encoder{EncoderOptions{}};
+    for (int width : {MAX_IMAGE_DIMENSION, MAX_IMAGE_DIMENSION + 1}) {
+        bool fits = width <= MAX_IMAGE_DIMENSION;
+        cv::Mat image(1, width, CV_8UC3, cv::Scalar(40, 80, 120));
+        std::ostringstream out;
+        size_t bytes = encoder.encode(image, out);
+        CHECK((bytes > 0) == fits);
+        CHECK(out.str().size() == bytes);
+        CHECK(encoder.error().empty() == fits);
+
+        PixelFormat format;
+        format.width = 1;
+        format.height = width;
+        format.channels = 1;
+        std::istringstream in(std::string(width, '\x80'));
+        RowReader reader(in, format);
+        std::ostringstream streamed;
+        bytes = 0;
+        CHECK(encoder.encodeStream(reader, streamed, bytes) == fits);
+        CHECK(streamed.str().size() == bytes);
+    }
+}
+
+//
+// Metrics compare the input image with the decoded one: an encoder measures what
+// its file decodes to, RGB inputs measure as their BGR equivalents, and errors
+// land in their own colour channel (with the SIMD and scalar kernels agreeing)
+//
+static void testMetricsDomain() {
+    ThreadPool pool(1);
+    for (int channels : {3, 1}) {
+        cv::Mat image = syntheticImage(61, 37, channels);
+        EncoderOptions options;
+        options.quality = 75;
+        options.subsampling = SUBSAMPLING_420;
+        JpegEncoder encoder(options);
+        std::ostringstream out;
+        size_t bytes = encoder.encode(image, out);
+        QualityMetrics measured = encoder.measure(image, false, bytes);
+
+        std::string data = out.str();
+        JpegDecoder decoder(DecoderOptions{});
+        cv::Mat decoded;
+        if (!CHECK(decoder.decode(reinterpret_cast<const uchar*>(data.data()), data.size(), decoded))) {
+            continue;
+        }
+        QualityMetrics compared = Metrics::compare(image, false, decoded, bytes, pool);
+        CHECK(measured.psnr == compared.psnr && measured.ssim == compared.ssim);
+        CHECK(measured.psnrR == compared.psnrR && measured.psnrG == compared.psnrG && measured.psnrB == compared.psnrB);
+        CHECK(measured.psnr > 30 && measured.psnr < MAX_PSNR);
+
+        if (channels == 3) {
+            cv::Mat rgb = image.clone();
+            for (int r = 0; r < rgb.rows; r++) {
+                uchar *row = rgb.ptr<uchar>(r);
+                for (int i = 0; i < rgb.cols; i++) {
+                    std::swap(row[3*i], row[3*i + 2]);
+                }
+            }
+            std::ostringstream rgbOut;
+            size_t rgbBytes = encoder.encode(rgb, rgbOut, true);
+            CHECK(rgbOut.str() == data);
+            QualityMetrics rgbMeasured = encoder.measure(rgb, true, rgbBytes);
+            CHECK(rgbMeasured.psnr == measured.psnr && rgbMeasured.psnrR == measured.psnrR);
+        }
+    }
+
+    // an error of 10 in every red sample only
+    cv::Mat image = syntheticImage(37, 9, 3), shifted = image.clone();
+    for (int r = 0; r < shifted.rows; r++) {
+        uchar *row = shifted.ptr<uchar>(r);
+        for (int i = 0; i < shifted.cols; i++) {
+            row[3*i + 2] = static_cast<uchar>(row[3*i + 2] < 128 ? row[3*i + 2] + 10 : row[3*i + 2] - 10);
+        }
+    }
+    CpuUtils::SimdLevel previous = CpuUtils::getSimdLevel();
+    for (CpuUtils::SimdLevel simd : {CpuUtils::SIMD_SCALAR, CpuUtils::SIMD_AVX2}) {
+        if (!CpuUtils::setSimdLevel(simd)) {
+            continue;
+        }
+        QualityMetrics metrics = Metrics::compare(image, false, shifted, 0, pool);
+        CHECK(std::fabs(metrics.psnrR - Metrics::psnr(100)) < 1e-9);
+        CHECK(metrics.psnrG == MAX_PSNR && metrics.psnrB == MAX_PSNR);
+        CHECK(std::fabs(metrics.psnr - Metrics::psnr(100.0 / 3)) < 1e-9);
+    }
+    CpuUtils::setSimdLevel(previous);
+}
+
+//
+// Rate control writes the best quality that meets a size or PSNR target, and
+// leaves the encoder measuring the file it wrote
+//
+static void testRateControl() {
+    cv::Mat image = syntheticImage(160, 120, 3);
+    for (double target : {30.0, 35.0, 38.0, 40.0, 42.0, 45.0}) {
+        EncoderOptions options;
+        options.targetPsnr = target;
+        JpegEncoder encoder(options);
+        std::ostringstream out;
+        size_t bytes = encoder.encode(image, out);
+        const RateResult &rate = encoder.rateResult();
+        CHECK(rate.met);
+        CHECK(encoder.measure(image, false, bytes).psnr >= target);
+
+        // the quality below misses the target
+        if (rate.quality > MIN_QUALITY) {
+            EncoderOptions lower;
+            lower.quality = rate.quality - 1;
+            JpegEncoder lowerEncoder(lower);
+            std::ostringstream lowerOut;
+            size_t lowerBytes = lowerEncoder.encode(image, lowerOut);
+            CHECK(lowerEncoder.measure(image, false, lowerBytes).psnr < target);
+        }
+    }
+
+    for (size_t target : {2000, 5000, 10000}) {
+        EncoderOptions options;
+        options.targetBytes = target;
+        JpegEncoder encoder(options);
+        std::ostringstream out;
+        size_t bytes = encoder.encode(image, out);
+        CHECK(encoder.rateResult().met);
+        CHECK(bytes <= target && out.str().size() == bytes);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string filter = argc > 1 ? argv[1] : "";
+    JpegElements jpegElements;
+
+    std::vector<Test> tests = {
+        {"dct/float-accuracy", [&] { testFloatDctAccuracy(jpegElements); }},
+        {"dct/float-simd", [&] { testFloatDctSimd(jpegElements); }},
+        {"dct/int-exact", [&] { testIntDctExact(jpegElements); }},
+        {"color/simd", testColorSimd},
+        {"huffman/length-limit", testHuffmanLengthLimit},
+        {"rans/round-trip", testRansRoundTrip},
+        {"decoder/round-trip", testDecoderRoundTrip},
+        {"encoder/max-dimensions", testMaxDimensions},
+        {"encoder/rate-control", testRateControl},
+        {"metrics/input-domain", testMetricsDomain},
+    };
+
+    int failed = 0, run = 0;
+    for (const Test &test : tests) {
+        if (test.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        std::cout << test.name << "\n";
+        int failuresBefore = checkFailures;
+        test.run();
+        bool passed = checkFailures == failuresBefore;
+        std::cout << (passed ? "PASS " : "FAIL ") << test.name << "\n";
+        failed += !passed;
+        run++;
+    }
+    std::cout << run - failed << "/" << run << " tests passed" << "\n";
+    return failed ? 1 : 0;
+}